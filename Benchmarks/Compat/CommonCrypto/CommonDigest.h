@@ -0,0 +1,33 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ CommonCrypto stand-in for the benchmark build on non-Apple systems, backed
+ by OpenSSL (link with -lcrypto).
+*/
+
+#include <openssl/sha.h>
+
+#define CC_SHA1_DIGEST_LENGTH	SHA_DIGEST_LENGTH
+#define CC_SHA1_CTX				SHA_CTX
+#define CC_SHA1_Init			SHA1_Init
+#define CC_SHA1_Update			SHA1_Update
+#define CC_SHA1_Final			SHA1_Final
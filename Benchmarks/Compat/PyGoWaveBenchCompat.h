@@ -0,0 +1,42 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ Included ahead of every source when building the benchmarks with GNUstep,
+ which lacks the CoreFoundation calls the library uses on Apple systems.
+*/
+
+#import <Foundation/Foundation.h>
+
+#ifdef GNUSTEP
+
+typedef const struct __CFString * CFStringRef;
+typedef NSUInteger CFStringEncoding;
+
+#define kCFStringEncodingUTF8 0x08000100
+
+// No direct access to the internal buffer; callers fall back to copying the bytes
+static inline const char * CFStringGetCStringPtr(CFStringRef aString, CFStringEncoding aEncoding)
+{
+	return NULL;
+}
+
+#endif
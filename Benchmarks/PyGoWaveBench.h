@@ -0,0 +1,120 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ Headless benchmark harness. Every benchmark feeds per-operation latencies
+ into a recorder; each result is written to stdout as one JSON object per
+ line:
+	{"benchmark":..., "params":{...}, "ops":..., "seconds":...,
+	 "opsPerSecond":..., "allocations":..., "allocationsPerOp":...,
+	 "latencyNs":{"mean":..., "p50":..., "p90":..., "p99":..., "p999":..., "max":...}}
+ allocations counts Objective-C objects and is null where the runtime
+ cannot count them (it can on GNUstep).
+*/
+
+@class PyGoWaveBundleWriter;
+
+
+uint64_t PyGoWaveBenchNow(void);
+// CPU time in nanoseconds, user and system, of the whole process or the calling thread
+uint64_t PyGoWaveBenchProcessCPUTime(void);
+uint64_t PyGoWaveBenchThreadCPUTime(void);
+// Resident memory of the process in bytes, now and at its highest so far
+uint64_t PyGoWaveBenchResidentBytes(void);
+uint64_t PyGoWaveBenchPeakResidentBytes(void);
+long long PyGoWaveBenchAllocations(void);
+// Heap blocks allocated by any thread since PyGoWaveBenchCountHeapAllocations, which
+// installs the counter once (Mac OS X only); -1 where they are not counted
+BOOL PyGoWaveBenchCountHeapAllocations(void);
+long long PyGoWaveBenchHeapAllocations(void);
+void PyGoWaveBenchDrainRunLoop(void);
+
+// Deterministic generator, so runs with the same seed use the same workload
+uint32_t PyGoWaveBenchRandom(uint32_t * aState);
+NSString * PyGoWaveBenchText(NSUInteger aLength, uint32_t * aState);
+
+@interface PyGoWaveBenchRecorder : NSObject
+{
+	NSString * m_name;
+	NSDictionary * m_params;
+	uint64_t * m_samples;
+	NSUInteger m_count;
+	NSUInteger m_capacity;
+	uint64_t m_started;
+	uint64_t m_elapsed;
+	long long m_allocations; // -1 if not counted
+	long long m_allocationsAtStart;
+}
+@property (readonly) NSString * name;
+@property (readonly) NSUInteger count;
+
+- (id)initWithName:(NSString*)aName params:(NSDictionary*)sParams;
+- (void)dealloc;
+
+// Wall clock and allocations are only counted between start and stop
+- (void)start;
+- (void)stop;
+- (void)addSample:(uint64_t)aNanoseconds;
+// For work that was timed elsewhere, e.g. on another thread
+- (void)addElapsed:(uint64_t)aNanoseconds;
+
+- (NSDictionary*)result;
+- (void)writeResultWithWriter:(PyGoWaveBundleWriter*)aWriter;
+
+@end
+
+#pragma mark -
+
+/*
+ Settings shared by all benchmarks. The quick mode shrinks every workload
+ so the whole suite runs in seconds, e.g. as a smoke test.
+*/
+@interface PyGoWaveBenchSuite : NSObject
+{
+	NSString * m_filter;
+	BOOL m_quick;
+	uint32_t m_seed;
+	NSString * m_scratchDirectory;
+	PyGoWaveBundleWriter * m_writer;
+	NSUInteger m_failures;
+}
+@property (copy) NSString * filter;
+@property BOOL quick;
+@property uint32_t seed;
+@property (copy) NSString * scratchDirectory;
+// Checks that failed during the run; the suite then exits with status 1
+@property (readonly) NSUInteger failures;
+
+- (id)init;
+- (void)dealloc;
+
+- (BOOL)shouldRun:(NSString*)aName;
+- (NSUInteger)scaled:(NSUInteger)aCount;
+- (PyGoWaveBenchRecorder*)recorderWithName:(NSString*)aName params:(NSDictionary*)sParams;
+- (void)report:(PyGoWaveBenchRecorder*)aRecorder;
+// Logs aMessage to stderr and counts a failure
+- (void)fail:(NSString*)aMessage;
+
+@end
+
+// Benchmark groups, see PyGoWaveBenchOT.m and PyGoWaveBenchClient.m
+void PyGoWaveBenchRunOT(PyGoWaveBenchSuite * aSuite);
+void PyGoWaveBenchRunClient(PyGoWaveBenchSuite * aSuite);
@@ -0,0 +1,400 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#import "PyGoWaveBench.h"
+#import "PyGoWaveBundleWriter.h"
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/vm_map.h>
+#include <malloc/malloc.h>
+#include <libkern/OSAtomic.h>
+#endif
+#ifdef GNUSTEP
+#import <Foundation/NSDebug.h>
+#endif
+
+#pragma mark Timing and allocation counting
+
+uint64_t PyGoWaveBenchNow(void)
+{
+#ifdef __APPLE__
+	static mach_timebase_info_data_t timebase;
+	if (timebase.denom == 0)
+		mach_timebase_info(&timebase);
+	return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+uint64_t PyGoWaveBenchProcessCPUTime(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return ((uint64_t) usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ULL
+		+ ((uint64_t) usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ULL;
+}
+
+uint64_t PyGoWaveBenchThreadCPUTime(void)
+{
+#ifdef __APPLE__
+	thread_basic_info_data_t info;
+	mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+	mach_port_t thread = mach_thread_self();
+	kern_return_t result = thread_info(thread, THREAD_BASIC_INFO, (thread_info_t) &info, &count);
+	mach_port_deallocate(mach_task_self(), thread);
+	if (result != KERN_SUCCESS)
+		return 0;
+	return ((uint64_t) info.user_time.seconds + info.system_time.seconds) * 1000000000ULL
+		+ ((uint64_t) info.user_time.microseconds + info.system_time.microseconds) * 1000ULL;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+uint64_t PyGoWaveBenchResidentBytes(void)
+{
+#ifdef __APPLE__
+	struct task_basic_info info;
+	mach_msg_type_number_t count = TASK_BASIC_INFO_COUNT;
+	if (task_info(mach_task_self(), TASK_BASIC_INFO, (task_info_t) &info, &count) != KERN_SUCCESS)
+		return 0;
+	return info.resident_size;
+#else
+	unsigned long size = 0, resident = 0;
+	FILE * statm = fopen("/proc/self/statm", "r");
+	if (statm == NULL)
+		return 0;
+	if (fscanf(statm, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+	fclose(statm);
+	return (uint64_t) resident * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+uint64_t PyGoWaveBenchPeakResidentBytes(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss; // Bytes here, kilobytes elsewhere
+#else
+	return (uint64_t) usage.ru_maxrss * 1024;
+#endif
+}
+
+long long PyGoWaveBenchAllocations(void)
+{
+#ifdef GNUSTEP
+	long long total = 0;
+	Class * classes = GSDebugAllocationClassList();
+	for (Class * c = classes; c != NULL && *c != Nil; c++)
+		total += GSDebugAllocationTotal(*c);
+	return total;
+#else
+	return -1;
+#endif
+}
+
+#ifdef __APPLE__
+static volatile int64_t s_heapAllocations = -1;
+static void * (*s_zoneMalloc)(struct _malloc_zone_t * aZone, size_t aSize);
+static void * (*s_zoneCalloc)(struct _malloc_zone_t * aZone, size_t aCount, size_t aSize);
+
+static void * countingMalloc(struct _malloc_zone_t * aZone, size_t aSize)
+{
+	OSAtomicIncrement64(&s_heapAllocations);
+	return s_zoneMalloc(aZone, aSize);
+}
+
+static void * countingCalloc(struct _malloc_zone_t * aZone, size_t aCount, size_t aSize)
+{
+	OSAtomicIncrement64(&s_heapAllocations);
+	return s_zoneCalloc(aZone, aCount, aSize);
+}
+#endif
+
+// Wraps the allocation functions of the default zone, which objects are allocated from too
+BOOL PyGoWaveBenchCountHeapAllocations(void)
+{
+#ifdef __APPLE__
+	if (s_heapAllocations >= 0)
+		return YES;
+	vm_address_t * zones = NULL;
+	unsigned int count = 0;
+	if (malloc_get_all_zones(mach_task_self(), NULL, &zones, &count) != KERN_SUCCESS || count == 0)
+		return NO;
+	malloc_zone_t * zone = (malloc_zone_t *) zones[0];
+	// The zone is write-protected once it is set up
+	if (vm_protect(mach_task_self(), (vm_address_t) zone, sizeof(malloc_zone_t), 0, VM_PROT_READ | VM_PROT_WRITE) != KERN_SUCCESS)
+		return NO;
+	s_zoneMalloc = zone->malloc;
+	s_zoneCalloc = zone->calloc;
+	s_heapAllocations = 0;
+	zone->malloc = countingMalloc;
+	zone->calloc = countingCalloc;
+	vm_protect(mach_task_self(), (vm_address_t) zone, sizeof(malloc_zone_t), 0, VM_PROT_READ);
+	return YES;
+#else
+	return NO;
+#endif
+}
+
+long long PyGoWaveBenchHeapAllocations(void)
+{
+#ifdef __APPLE__
+	return s_heapAllocations;
+#else
+	return -1;
+#endif
+}
+
+// Delivers queued notifications, which would otherwise pile up without a running event loop
+// Delivers queued notifications and expired performSelector calls without waiting for new ones
+void PyGoWaveBenchDrainRunLoop(void)
+{
+	static NSTimer * keepAlive = nil;
+	NSRunLoop * runLoop = [NSRunLoop currentRunLoop];
+	if (keepAlive == nil) {
+		// Without an input source the run loop returns at once instead of firing timers
+		keepAlive = [[NSTimer alloc] initWithFireDate:[NSDate distantFuture] interval:0 target:runLoop selector:@selector(description) userInfo:nil repeats:NO];
+		[runLoop addTimer:keepAlive forMode:NSDefaultRunLoopMode];
+	}
+	for (NSUInteger pass = 0; pass < 16; pass++)
+		[runLoop runMode:NSDefaultRunLoopMode beforeDate:[NSDate date]];
+}
+
+uint32_t PyGoWaveBenchRandom(uint32_t * aState)
+{
+	// xorshift32
+	uint32_t x = *aState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*aState = x;
+	return x;
+}
+
+NSString * PyGoWaveBenchText(NSUInteger aLength, uint32_t * aState)
+{
+	static const char letters[] = "abcdefghijklmnopqrstuvwxyz      \n";
+	char * buf = malloc(aLength + 1);
+	for (NSUInteger i = 0; i < aLength; i++)
+		buf[i] = letters[PyGoWaveBenchRandom(aState) % (sizeof(letters) - 1)];
+	buf[aLength] = '\0';
+	NSString * text = [[[NSString alloc] initWithBytes:buf length:aLength encoding:NSUTF8StringEncoding] autorelease];
+	free(buf);
+	return text;
+}
+
+static int compareSamples(const void * a, const void * b)
+{
+	uint64_t v1 = *(const uint64_t*) a;
+	uint64_t v2 = *(const uint64_t*) b;
+	return v1 < v2 ? -1 : (v1 > v2 ? 1 : 0);
+}
+
+#pragma mark -
+
+@implementation PyGoWaveBenchRecorder
+
+@synthesize name = m_name, count = m_count;
+
+#pragma mark Initialization and Deallocation
+
+- (id)initWithName:(NSString*)aName params:(NSDictionary*)sParams
+{
+	if (self = [super init]) {
+		m_name = [aName copy];
+		m_params = [sParams copy];
+		m_capacity = 1024;
+		m_samples = malloc(m_capacity * sizeof(uint64_t));
+		m_count = 0;
+		m_started = 0;
+		m_elapsed = 0;
+		m_allocations = PyGoWaveBenchAllocations() < 0 ? -1 : 0;
+		m_allocationsAtStart = 0;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	free(m_samples);
+	[m_name release];
+	[m_params release];
+	[super dealloc];
+}
+
+#pragma mark Public methods
+
+- (void)start
+{
+	if (m_allocations >= 0)
+		m_allocationsAtStart = PyGoWaveBenchAllocations();
+	m_started = PyGoWaveBenchNow();
+}
+
+- (void)stop
+{
+	m_elapsed += PyGoWaveBenchNow() - m_started;
+	if (m_allocations >= 0)
+		m_allocations += PyGoWaveBenchAllocations() - m_allocationsAtStart;
+}
+
+- (void)addSample:(uint64_t)aNanoseconds
+{
+	if (m_count == m_capacity) {
+		m_capacity *= 2;
+		m_samples = realloc(m_samples, m_capacity * sizeof(uint64_t));
+	}
+	m_samples[m_count++] = aNanoseconds;
+}
+
+- (void)addElapsed:(uint64_t)aNanoseconds
+{
+	m_elapsed += aNanoseconds;
+}
+
+// Nearest-rank percentile of the sorted samples
+- (NSNumber*)percentile:(double)aFraction
+{
+	NSUInteger rank = (NSUInteger) ceil(aFraction * m_count);
+	if (rank > 0)
+		rank--;
+	return [NSNumber numberWithUnsignedLongLong:m_samples[MIN(rank, m_count - 1)]];
+}
+
+- (NSDictionary*)result
+{
+	double seconds = m_elapsed / 1e9;
+	NSMutableDictionary * result = [NSMutableDictionary dictionary];
+	[result setObject:m_name forKey:@"benchmark"];
+	[result setObject:m_params != nil ? m_params : [NSDictionary dictionary] forKey:@"params"];
+	[result setObject:[NSNumber numberWithUnsignedInteger:m_count] forKey:@"ops"];
+	[result setObject:[NSNumber numberWithDouble:seconds] forKey:@"seconds"];
+	[result setObject:[NSNumber numberWithDouble:seconds > 0.0 ? m_count / seconds : 0.0] forKey:@"opsPerSecond"];
+	if (m_allocations >= 0) {
+		[result setObject:[NSNumber numberWithLongLong:m_allocations] forKey:@"allocations"];
+		[result setObject:[NSNumber numberWithDouble:m_count > 0 ? (double) m_allocations / m_count : 0.0] forKey:@"allocationsPerOp"];
+	}
+	else {
+		[result setObject:[NSNull null] forKey:@"allocations"];
+		[result setObject:[NSNull null] forKey:@"allocationsPerOp"];
+	}
+	
+	if (m_count > 0) {
+		qsort(m_samples, m_count, sizeof(uint64_t), compareSamples);
+		uint64_t sum = 0;
+		for (NSUInteger i = 0; i < m_count; i++)
+			sum += m_samples[i];
+		[result setObject:[NSDictionary dictionaryWithObjectsAndKeys:
+						   [NSNumber numberWithDouble:(double) sum / m_count], @"mean",
+						   [self percentile:0.5], @"p50",
+						   [self percentile:0.9], @"p90",
+						   [self percentile:0.99], @"p99",
+						   [self percentile:0.999], @"p999",
+						   [NSNumber numberWithUnsignedLongLong:m_samples[m_count - 1]], @"max",
+						   nil]
+				   forKey:@"latencyNs"];
+	}
+	return result;
+}
+
+- (void)writeResultWithWriter:(PyGoWaveBundleWriter*)aWriter
+{
+	[aWriter reset];
+	[aWriter appendValue:[self result]];
+	[aWriter appendBytes:"\n" length:1];
+	fwrite([[aWriter data] bytes], 1, [[aWriter data] length], stdout);
+	fflush(stdout);
+}
+
+@end
+
+#pragma mark -
+
+@implementation PyGoWaveBenchSuite
+
+@synthesize filter = m_filter, quick = m_quick, seed = m_seed, scratchDirectory = m_scratchDirectory, failures = m_failures;
+
+#pragma mark Initialization and Deallocation
+
+- (id)init
+{
+	if (self = [super init]) {
+		m_filter = nil;
+		m_quick = NO;
+		m_seed = 0x5eed1234;
+		m_scratchDirectory = [[NSTemporaryDirectory() stringByAppendingPathComponent:@"PyGoWaveBench"] copy];
+		m_writer = [PyGoWaveBundleWriter new];
+		m_failures = 0;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_filter release];
+	[m_scratchDirectory release];
+	[m_writer release];
+	[super dealloc];
+}
+
+#pragma mark Public methods
+
+- (BOOL)shouldRun:(NSString*)aName
+{
+	return m_filter == nil || [aName rangeOfString:m_filter].location != NSNotFound;
+}
+
+- (NSUInteger)scaled:(NSUInteger)aCount
+{
+	return m_quick ? MAX(aCount / 20, 1) : aCount;
+}
+
+- (PyGoWaveBenchRecorder*)recorderWithName:(NSString*)aName params:(NSDictionary*)sParams
+{
+	return [[[PyGoWaveBenchRecorder alloc] initWithName:aName params:sParams] autorelease];
+}
+
+- (void)report:(PyGoWaveBenchRecorder*)aRecorder
+{
+	[aRecorder writeResultWithWriter:m_writer];
+}
+
+- (void)fail:(NSString*)aMessage
+{
+	fprintf(stderr, "FAIL: %s\n", [aMessage UTF8String]);
+	m_failures++;
+}
+
+@end
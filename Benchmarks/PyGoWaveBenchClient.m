@@ -0,0 +1,566 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#import "PyGoWaveBench.h"
+#import "PyGoWaveOperations.h"
+#import "PyGoWaveModel.h"
+#import "PyGoWaveBundleWriter.h"
+#import "PyGoWaveSnapshotStore.h"
+#import "JSON.h"
+#include <math.h>
+
+#define BENCH_WAVE_ID		@"bench.example.org!w+bench"
+#define BENCH_WAVELET_ID	@"bench.example.org!conv+root"
+#define BENCH_BLIP_ID		@"b+bench"
+#define BENCH_LOCAL_ID		@"local@bench.example.org"
+#define BENCH_REMOTE_ID		@"remote@bench.example.org"
+
+/*
+ Client-side paths around the OT engine: event dispatch, the work an
+ incoming bundle costs the owner thread, and the time until an opened
+ wavelet can be shown.
+*/
+
+@interface PyGoWaveBenchParticipants : NSObject <PyGoWaveParticipantProvider>
+{
+	NSMutableDictionary * m_participants;
+}
+@end
+
+@implementation PyGoWaveBenchParticipants
+
+- (id)init
+{
+	if (self = [super init])
+		m_participants = [NSMutableDictionary new];
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_participants release];
+	[super dealloc];
+}
+
+- (PyGoWaveParticipant *)participantById:(NSString *)aParticipantId
+{
+	PyGoWaveParticipant * p = [m_participants objectForKey:aParticipantId];
+	if (p == nil) {
+		p = [[PyGoWaveParticipant alloc] initWithParticipantId:aParticipantId];
+		[m_participants setObject:p forKey:aParticipantId];
+		[p release];
+	}
+	return p;
+}
+
+@end
+
+#pragma mark -
+
+@interface PyGoWaveBenchObserver : NSObject
+{
+@public
+	NSUInteger count;
+}
+- (void)object:(id)aSender event:(const PyGoWaveEventInfo *)aInfo;
+- (void)notification:(NSNotification *)aNotification;
+@end
+
+@implementation PyGoWaveBenchObserver
+
+- (void)object:(id)aSender event:(const PyGoWaveEventInfo *)aInfo
+{
+	count++;
+}
+
+- (void)notification:(NSNotification *)aNotification
+{
+	count++;
+}
+
+@end
+
+static void countEvent(id aSender, PyGoWaveEventType aEvent, const PyGoWaveEventInfo * aInfo, void * aContext)
+{
+	(*(NSUInteger *) aContext)++;
+}
+
+#pragma mark Event dispatch
+
+enum {
+	BenchDispatch_None = 0,
+	BenchDispatch_Selector,
+	BenchDispatch_Callback,
+	BenchDispatch_Notification
+};
+
+static void benchDispatch(PyGoWaveBenchSuite * aSuite, NSInteger aKind)
+{
+	static NSString * const kinds[] = {@"none", @"selector", @"callback", @"notification"};
+	NSUInteger count = [aSuite scaled:1000000];
+	PyGoWaveBenchRecorder * rec = [aSuite recorderWithName:@"events.dispatch"
+													params:[NSDictionary dictionaryWithObject:kinds[aKind] forKey:@"observer"]];
+	PyGoWaveObject * sender = [PyGoWaveObject new];
+	PyGoWaveBenchObserver * observer = [PyGoWaveBenchObserver new];
+	NSUInteger called = 0;
+	if (aKind == BenchDispatch_Selector)
+		[sender addEventObserver:observer selector:@selector(object:event:) forEvent:PyGoWaveEvent_InsertedText];
+	else if (aKind == BenchDispatch_Callback)
+		[sender addEventCallback:countEvent context:&called forEvent:PyGoWaveEvent_InsertedText];
+	else if (aKind == BenchDispatch_Notification)
+		[sender addObserver:observer selector:@selector(notification:) name:@"insertedText"];
+	
+	PyGoWaveEventInfo info = {0, 1, 0, 0, @"a", NULL, 0};
+	NSAutoreleasePool * pool = [NSAutoreleasePool new];
+	for (NSUInteger k = 0; k < count; k++) {
+		info.index = k;
+		[rec start];
+		uint64_t t = PyGoWaveBenchNow();
+		[sender postEvent:PyGoWaveEvent_InsertedText info:&info];
+		[rec addSample:PyGoWaveBenchNow() - t];
+		[rec stop];
+		if (k % 1000 == 999) {
+			PyGoWaveBenchDrainRunLoop(); // Delivery of queued notifications is not counted
+			[pool release];
+			pool = [NSAutoreleasePool new];
+		}
+	}
+	PyGoWaveBenchDrainRunLoop();
+	[pool release];
+	
+	if (aKind == BenchDispatch_Selector)
+		[sender removeEventObserver:observer forEvent:PyGoWaveEvent_InsertedText];
+	else if (aKind == BenchDispatch_Callback)
+		[sender removeEventCallback:countEvent context:&called forEvent:PyGoWaveEvent_InsertedText];
+	else if (aKind == BenchDispatch_Notification)
+		[sender removeObserver:observer name:@"insertedText"];
+	[observer release];
+	[sender release];
+	[aSuite report:rec];
+}
+
+#pragma mark Inbound bundles
+
+/*
+ Per incoming bundle, the inline mode decodes, transforms and applies on the
+ owner thread; the pipelined mode leaves only the apply step there. Both are
+ measured on the same bundles, against a queue of unacknowledged local
+ operations behind the remote edits.
+*/
+static void benchInbound(PyGoWaveBenchSuite * aSuite, NSUInteger aQueueLength)
+{
+	uint32_t state = aSuite.seed;
+	NSUInteger count = [aSuite scaled:5000];
+	NSUInteger opsPerBundle = 4;
+	
+	PyGoWaveBenchParticipants * pp = [PyGoWaveBenchParticipants new];
+	PyGoWaveWaveModel * wave = [[PyGoWaveWaveModel alloc] initWithWaveId:BENCH_WAVE_ID viewerId:BENCH_LOCAL_ID participantProvider:pp];
+	PyGoWaveWavelet * wavelet = [wave createWaveletWithId:BENCH_WAVELET_ID creator:[pp participantById:BENCH_LOCAL_ID] title:@"Bench" isRoot:YES created:nil lastModified:nil version:0];
+	[wavelet appendBlipWithId:BENCH_BLIP_ID
+					  content:PyGoWaveBenchText(4000, &state)
+					 elements:nil
+					  creator:[pp participantById:BENCH_LOCAL_ID]
+				 contributors:nil
+					   isRoot:YES
+				 lastModified:nil
+					  version:0
+					submitted:YES];
+	
+	// Local edits sit behind the remote typing, so the remote indices stay valid for the blip
+	PyGoWaveOpManager * mcached = [[PyGoWaveOpManager alloc] initWithWaveId:BENCH_WAVE_ID waveletId:BENCH_WAVELET_ID contributorId:BENCH_LOCAL_ID];
+	for (NSUInteger k = 0; k < aQueueLength; k++)
+		[mcached documentInsert:@"x" atIndex:2000 + (aQueueLength - k) * 4 inBlipWithId:BENCH_BLIP_ID];
+	
+	PyGoWaveBundleWriter * writer = [PyGoWaveBundleWriter new];
+	NSMutableArray * messages = [[NSMutableArray alloc] initWithCapacity:count];
+	for (NSUInteger k = 0; k < count; k++) {
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		NSMutableArray * ops = [NSMutableArray arrayWithCapacity:opsPerBundle];
+		NSUInteger start = (k * opsPerBundle) % 1500;
+		for (NSUInteger o = 0; o < opsPerBundle; o++) {
+			PyGoWaveOperation * op = [[PyGoWaveOperation alloc] initWithType:PyGoWaveOperation_DOCUMENT_INSERT waveId:BENCH_WAVE_ID waveletId:BENCH_WAVELET_ID blipId:BENCH_BLIP_ID index:start + o property:@"r"];
+			[ops addObject:op];
+			[op release];
+		}
+		NSData * data = [writer bundleWithVersion:k + 1 operations:ops];
+		NSString * message = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+		[messages addObject:message];
+		[message release];
+		[pool release];
+	}
+	[writer release];
+	
+	NSDictionary * params = [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedInteger:aQueueLength] forKey:@"queueLength"];
+	PyGoWaveBenchRecorder * inline_ = [aSuite recorderWithName:@"inbound.ownerThreadStall.inline" params:params];
+	PyGoWaveBenchRecorder * pipelined = [aSuite recorderWithName:@"inbound.ownerThreadStall.pipelined" params:params];
+	SBJsonParser * parser = [SBJsonParser new];
+	NSDate * timestamp = [NSDate date];
+	
+	for (NSUInteger k = 0; k < count; k++) {
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		[inline_ start];
+		uint64_t t0 = PyGoWaveBenchNow();
+		NSDictionary * msg = [parser objectWithString:[messages objectAtIndex:k]];
+		PyGoWaveOpManager * delta = [[PyGoWaveOpManager alloc] initWithWaveId:BENCH_WAVE_ID waveletId:BENCH_WAVELET_ID contributorId:BENCH_REMOTE_ID];
+		[delta addSerializedOperations:[[msg objectForKey:@"property"] objectForKey:@"operations"]];
+		NSMutableArray * ops = [NSMutableArray arrayWithCapacity:opsPerBundle];
+		for (PyGoWaveOperation * incoming in [delta operations])
+			[ops addObjectsFromArray:[mcached transformInputOperation:incoming]];
+		[delta release];
+		[pipelined start];
+		uint64_t t1 = PyGoWaveBenchNow();
+		[wavelet applyOperations:ops timestamp:timestamp contributorId:BENCH_REMOTE_ID];
+		uint64_t t2 = PyGoWaveBenchNow();
+		[pipelined stop];
+		[inline_ stop];
+		[inline_ addSample:t2 - t0];
+		[pipelined addSample:t2 - t1];
+		[pool release];
+		if (k % 100 == 99)
+			PyGoWaveBenchDrainRunLoop();
+	}
+	
+	[parser release];
+	[messages release];
+	[mcached release];
+	[wave release];
+	[pp release];
+	[aSuite report:inline_];
+	[aSuite report:pipelined];
+}
+
+#pragma mark Cold start
+
+static NSString * snapshotJson(NSUInteger aBlipCount, uint32_t * aState)
+{
+	NSMutableDictionary * blips = [NSMutableDictionary dictionaryWithCapacity:aBlipCount];
+	unsigned long long created = 1270000000000ULL;
+	for (NSUInteger b = 0; b < aBlipCount; b++) {
+		NSString * blipId = [NSString stringWithFormat:@"b+%lu", (unsigned long) b];
+		NSString * author = (b % 3 == 0) ? BENCH_LOCAL_ID : BENCH_REMOTE_ID;
+		NSMutableArray * elements = [NSMutableArray array];
+		if (b % 10 == 0)
+			[elements addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								 [NSNumber numberWithUnsignedInteger:b], @"id",
+								 [NSNumber numberWithInt:0], @"index",
+								 [NSNumber numberWithInt:PyGoWaveElementType_GADGET], @"type",
+								 [NSDictionary dictionaryWithObjectsAndKeys:
+								  @"http://gadgets.example.org/poll.xml", @"url",
+								  [NSDictionary dictionaryWithObject:@"3" forKey:@"votes"], @"fields",
+								  nil], @"properties",
+								 nil]];
+		[blips setObject:[NSDictionary dictionaryWithObjectsAndKeys:
+						  blipId, @"blipId",
+						  PyGoWaveBenchText(200 + PyGoWaveBenchRandom(aState) % 600, aState), @"content",
+						  elements, @"elements",
+						  author, @"creator",
+						  [NSArray arrayWithObject:author], @"contributors",
+						  [NSNumber numberWithUnsignedLongLong:created + b * 1000], @"creationTime",
+						  [NSNumber numberWithUnsignedLongLong:created + b * 1000 + 500], @"lastModifiedTime",
+						  [NSNumber numberWithUnsignedInteger:b + 1], @"version",
+						  [NSNumber numberWithBool:YES], @"submitted",
+						  nil]
+				  forKey:blipId];
+	}
+	NSDictionary * property = [NSDictionary dictionaryWithObjectsAndKeys:
+							   blips, @"blips",
+							   [NSDictionary dictionaryWithObjectsAndKeys:@"b+0", @"rootBlipId", [NSNumber numberWithInt:100], @"version", nil], @"wavelet",
+							   nil];
+	PyGoWaveBundleWriter * writer = [PyGoWaveBundleWriter new];
+	NSData * data = [writer messageWithType:@"WAVELET_OPEN" property:property];
+	NSString * json = [[[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding] autorelease];
+	[writer release];
+	return json;
+}
+
+/*
+ Time from having the wavelet's data at hand to a fully populated model:
+ parsing and loading the server's WAVELET_OPEN snapshot, against opening
+ and loading the snapshot cache file.
+*/
+static void benchColdStart(PyGoWaveBenchSuite * aSuite, NSUInteger aBlipCount)
+{
+	uint32_t state = aSuite.seed;
+	NSUInteger count = MAX([aSuite scaled:20000] / aBlipCount, 5);
+	NSString * json = [snapshotJson(aBlipCount, &state) retain];
+	NSDictionary * params = [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedInteger:aBlipCount] forKey:@"blips"];
+	PyGoWaveBenchRecorder * server = [aSuite recorderWithName:@"coldStart.serverSnapshot" params:params];
+	PyGoWaveBenchRecorder * cached = [aSuite recorderWithName:@"coldStart.snapshotCache" params:params];
+	PyGoWaveBenchParticipants * pp = [PyGoWaveBenchParticipants new];
+	SBJsonParser * parser = [SBJsonParser new];
+	
+	NSString * directory = [aSuite.scratchDirectory stringByAppendingPathComponent:@"snapshots"];
+	[[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:NULL];
+	PyGoWaveSnapshotStore * store = [[PyGoWaveSnapshotStore alloc] initWithDirectory:directory];
+	BOOL saved = NO;
+	
+	for (NSUInteger k = 0; k < count; k++) {
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		[server start];
+		uint64_t t = PyGoWaveBenchNow();
+		NSDictionary * property = [[parser objectWithString:json] objectForKey:@"property"];
+		PyGoWaveWaveModel * wave = [[PyGoWaveWaveModel alloc] initWithWaveId:BENCH_WAVE_ID viewerId:BENCH_LOCAL_ID participantProvider:pp];
+		PyGoWaveWavelet * wavelet = [wave createWaveletWithId:BENCH_WAVELET_ID];
+		[wavelet loadBlipsFromSnapshot:[property objectForKey:@"blips"] rootBlipId:[[property objectForKey:@"wavelet"] objectForKey:@"rootBlipId"]];
+		wavelet.version = [[[property objectForKey:@"wavelet"] objectForKey:@"version"] intValue];
+		[server addSample:PyGoWaveBenchNow() - t];
+		[server stop];
+		if (!saved)
+			saved = [store saveWavelet:wavelet];
+		[wave release];
+		PyGoWaveBenchDrainRunLoop();
+		[pool release];
+	}
+	
+	for (NSUInteger k = 0; k < count && saved; k++) {
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		[cached start];
+		uint64_t t = PyGoWaveBenchNow();
+		PyGoWaveSnapshot * snapshot = [store snapshotForWaveletWithId:BENCH_WAVELET_ID];
+		PyGoWaveWaveModel * wave = [[PyGoWaveWaveModel alloc] initWithWaveId:BENCH_WAVE_ID viewerId:BENCH_LOCAL_ID participantProvider:pp];
+		PyGoWaveWavelet * wavelet = [wave createWaveletWithId:BENCH_WAVELET_ID];
+		[snapshot loadIntoWavelet:wavelet];
+		[cached addSample:PyGoWaveBenchNow() - t];
+		[cached stop];
+		[wave release];
+		PyGoWaveBenchDrainRunLoop();
+		[pool release];
+	}
+	
+	[store removeSnapshotForWaveletWithId:BENCH_WAVELET_ID];
+	[store release];
+	[parser release];
+	[pp release];
+	[json release];
+	[aSuite report:server];
+	if (saved)
+		[aSuite report:cached];
+	else
+		NSLog(@"Bench: Could not write a snapshot to '%@', skipping coldStart.snapshotCache", directory);
+}
+
+/*
+ A newer snapshot of an open wavelet in which one blip gained a sentence:
+ reloading every blip from it, against reconciling the wavelet with it.
+*/
+static void benchSnapshotUpdate(PyGoWaveBenchSuite * aSuite, NSUInteger aBlipCount, BOOL bReconcile)
+{
+	uint32_t state = aSuite.seed;
+	NSUInteger count = MAX([aSuite scaled:20000] / aBlipCount, 5);
+	NSString * json = snapshotJson(aBlipCount, &state);
+	NSMutableDictionary * params = [NSMutableDictionary dictionaryWithObject:[NSNumber numberWithUnsignedInteger:aBlipCount] forKey:@"blips"];
+	[params setObject:(bReconcile ? @"reconcile" : @"reload") forKey:@"mode"];
+	PyGoWaveBenchRecorder * rec = [aSuite recorderWithName:@"snapshot.update" params:params];
+	PyGoWaveBenchParticipants * pp = [PyGoWaveBenchParticipants new];
+	SBJsonParser * parser = [SBJsonParser new];
+	
+	NSDictionary * property = [[parser objectWithString:json] objectForKey:@"property"];
+	NSDictionary * blips = [property objectForKey:@"blips"];
+	NSString * rootBlipId = [[property objectForKey:@"wavelet"] objectForKey:@"rootBlipId"];
+	NSString * changedId = [NSString stringWithFormat:@"b+%lu", (unsigned long) (aBlipCount / 2)];
+	NSMutableDictionary * changedBlip = [NSMutableDictionary dictionaryWithDictionary:[blips objectForKey:changedId]];
+	[changedBlip setObject:[[changedBlip objectForKey:@"content"] stringByAppendingString:@" One more sentence."] forKey:@"content"];
+	[changedBlip setObject:[NSNumber numberWithInt:[[changedBlip objectForKey:@"version"] intValue] + 1] forKey:@"version"];
+	NSMutableDictionary * newerBlips = [NSMutableDictionary dictionaryWithDictionary:blips];
+	[newerBlips setObject:changedBlip forKey:changedId];
+	
+	for (NSUInteger k = 0; k < count; k++) {
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		PyGoWaveWaveModel * wave = [[PyGoWaveWaveModel alloc] initWithWaveId:BENCH_WAVE_ID viewerId:BENCH_LOCAL_ID participantProvider:pp];
+		PyGoWaveWavelet * wavelet = [wave createWaveletWithId:BENCH_WAVELET_ID];
+		[wavelet loadBlipsFromSnapshot:blips rootBlipId:rootBlipId];
+		[rec start];
+		uint64_t t = PyGoWaveBenchNow();
+		if (bReconcile)
+			[wavelet reconcileBlipsWithSnapshot:newerBlips rootBlipId:rootBlipId];
+		else
+			[wavelet loadBlipsFromSnapshot:newerBlips rootBlipId:rootBlipId];
+		[rec addSample:PyGoWaveBenchNow() - t];
+		[rec stop];
+		[wave release];
+		PyGoWaveBenchDrainRunLoop();
+		[pool release];
+	}
+	
+	[parser release];
+	[pp release];
+	[aSuite report:rec];
+}
+
+#pragma mark Serialization
+
+static NSArray * serializeWorkload(NSUInteger aCount, uint32_t * aState)
+{
+	static NSString * const blipIds[] = {@"b+bench", @"b+reply1", @"b+reply2", @""};
+	NSMutableArray * ops = [NSMutableArray arrayWithCapacity:aCount];
+	for (NSUInteger k = 0; k < aCount; k++) {
+		PyGoWaveOperationType type;
+		id property;
+		NSString * blipId = blipIds[PyGoWaveBenchRandom(aState) % 3];
+		switch (PyGoWaveBenchRandom(aState) % 5) {
+			case 0:
+				type = PyGoWaveOperation_DOCUMENT_DELETE;
+				property = [NSNumber numberWithUnsignedInt:1 + PyGoWaveBenchRandom(aState) % 20];
+				break;
+			case 1:
+				type = PyGoWaveOperation_DOCUMENT_ELEMENT_DELTA;
+				property = [NSDictionary dictionaryWithObjectsAndKeys:
+							[NSNumber numberWithInt:(int) k], @"id",
+							[NSDictionary dictionaryWithObject:@"3" forKey:@"votes"], @"delta",
+							nil];
+				break;
+			case 2:
+				type = PyGoWaveOperation_WAVELET_ADD_PARTICIPANT;
+				property = BENCH_REMOTE_ID;
+				blipId = blipIds[3];
+				break;
+			default:
+				type = PyGoWaveOperation_DOCUMENT_INSERT;
+				property = [NSString stringWithFormat:@"%@\"%C\t", PyGoWaveBenchText(1 + PyGoWaveBenchRandom(aState) % 40, aState), (unichar) 0xe9];
+				break;
+		}
+		PyGoWaveOperation * op = [[PyGoWaveOperation alloc] initWithType:type waveId:BENCH_WAVE_ID waveletId:BENCH_WAVELET_ID blipId:blipId index:PyGoWaveBenchRandom(aState) % 2000 property:property];
+		[ops addObject:op];
+		[op release];
+	}
+	return ops;
+}
+
+// The writer must produce what SBJsonWriter produces for the same message, and valid JSON for values SBJsonWriter gets wrong
+static void checkSerialize(PyGoWaveBenchSuite * aSuite, NSArray * aBundles)
+{
+	PyGoWaveBundleWriter * writer = [PyGoWaveBundleWriter new];
+	SBJsonWriter * sbWriter = [SBJsonWriter new];
+	SBJsonParser * parser = [SBJsonParser new];
+	NSUInteger version = 0;
+	for (NSArray * ops in aBundles) {
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		NSString * ours = [[[NSString alloc] initWithData:[writer bundleWithVersion:++version operations:ops] encoding:NSUTF8StringEncoding] autorelease];
+		NSString * theirs = [sbWriter stringWithObject:[NSDictionary dictionaryWithObjectsAndKeys:
+														@"OPERATION_MESSAGE_BUNDLE", @"type",
+														[NSDictionary dictionaryWithObjectsAndKeys:
+														 [NSNumber numberWithUnsignedInteger:version], @"version",
+														 [ops valueForKey:@"serialize"], @"operations",
+														 nil], @"property",
+														nil]];
+		if (![[parser objectWithString:ours] isEqual:[parser objectWithString:theirs]])
+			[aSuite fail:[NSString stringWithFormat:@"serialize.bundle version %lu: %@ differs from %@", (unsigned long) version, ours, theirs]];
+		[pool release];
+	}
+	
+	unichar nul[] = {'a', 0, 'b'};
+	NSDictionary * edges = [NSDictionary dictionaryWithObjectsAndKeys:
+							[NSNumber numberWithBool:YES], @"bool",
+							[NSNumber numberWithChar:1], @"char",
+							[NSNumber numberWithDouble:NAN], @"nan",
+							[NSNumber numberWithDouble:-INFINITY], @"inf",
+							[NSNumber numberWithUnsignedLongLong:ULLONG_MAX], @"big",
+							[NSString stringWithCharacters:nul length:3], @"nul",
+							nil];
+	NSString * json = [[[NSString alloc] initWithData:[writer messageWithType:@"EDGES" property:edges] encoding:NSUTF8StringEncoding] autorelease];
+	static NSString * const expected[] = {@"\"bool\":true", @"\"char\":1", @"\"nan\":null", @"\"inf\":null", @"\"big\":18446744073709551615", @"\"nul\":\"a\\u0000b\""};
+	for (NSUInteger i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+		if ([json rangeOfString:expected[i]].location == NSNotFound)
+			[aSuite fail:[NSString stringWithFormat:@"serialize.edges: %@ lacks %@", json, expected[i]]];
+	}
+	if ([parser objectWithString:json] == nil)
+		[aSuite fail:[NSString stringWithFormat:@"serialize.edges: %@ is not valid JSON", json]];
+	
+	[parser release];
+	[sbWriter release];
+	[writer release];
+}
+
+/*
+ Outgoing bundles written directly into the reusable buffer, against
+ building the dictionaries and running them through SBJsonWriter.
+*/
+static void benchSerialize(PyGoWaveBenchSuite * aSuite, NSArray * aBundles, BOOL bSBJson)
+{
+	PyGoWaveBenchRecorder * rec = [aSuite recorderWithName:@"serialize.bundle"
+													params:[NSDictionary dictionaryWithObject:(bSBJson ? @"sbjson" : @"bundleWriter") forKey:@"writer"]];
+	PyGoWaveBundleWriter * writer = [PyGoWaveBundleWriter new];
+	SBJsonWriter * sbWriter = [SBJsonWriter new];
+	NSUInteger version = 0;
+	NSAutoreleasePool * pool = [NSAutoreleasePool new];
+	for (NSArray * ops in aBundles) {
+		[rec start];
+		uint64_t t = PyGoWaveBenchNow();
+		if (bSBJson) {
+			NSDictionary * message = [NSDictionary dictionaryWithObjectsAndKeys:
+									  @"OPERATION_MESSAGE_BUNDLE", @"type",
+									  [NSDictionary dictionaryWithObjectsAndKeys:
+									   [NSNumber numberWithUnsignedInteger:++version], @"version",
+									   [ops valueForKey:@"serialize"], @"operations",
+									   nil], @"property",
+									  nil];
+			[[sbWriter stringWithObject:message] dataUsingEncoding:NSUTF8StringEncoding];
+		}
+		else
+			[writer bundleWithVersion:++version operations:ops];
+		[rec addSample:PyGoWaveBenchNow() - t];
+		[rec stop];
+		if (version % 100 == 0) {
+			[pool release];
+			pool = [NSAutoreleasePool new];
+		}
+	}
+	[pool release];
+	[sbWriter release];
+	[writer release];
+	[aSuite report:rec];
+}
+
+void PyGoWaveBenchRunClient(PyGoWaveBenchSuite * aSuite)
+{
+	if ([aSuite shouldRun:@"events.dispatch"]) {
+		for (NSInteger kind = BenchDispatch_None; kind <= BenchDispatch_Notification; kind++)
+			benchDispatch(aSuite, kind);
+	}
+	if ([aSuite shouldRun:@"inbound.ownerThreadStall"]) {
+		static const NSUInteger queueLengths[] = {0, 10, 100};
+		for (NSUInteger q = 0; q < 3; q++)
+			benchInbound(aSuite, queueLengths[q]);
+	}
+	if ([aSuite shouldRun:@"coldStart"]) {
+		static const NSUInteger blipCounts[] = {20, 200, 1000};
+		for (NSUInteger b = 0; b < 3; b++)
+			benchColdStart(aSuite, blipCounts[b]);
+	}
+	if ([aSuite shouldRun:@"snapshot.update"]) {
+		static const NSUInteger blipCounts[] = {20, 200, 1000};
+		for (NSUInteger b = 0; b < 3; b++) {
+			benchSnapshotUpdate(aSuite, blipCounts[b], NO);
+			benchSnapshotUpdate(aSuite, blipCounts[b], YES);
+		}
+	}
+	if ([aSuite shouldRun:@"serialize"]) {
+		uint32_t state = aSuite.seed;
+		NSUInteger count = [aSuite scaled:5000];
+		NSMutableArray * bundles = [[NSMutableArray alloc] initWithCapacity:count];
+		for (NSUInteger k = 0; k < count; k++)
+			[bundles addObject:serializeWorkload(8, &state)];
+		checkSerialize(aSuite, bundles);
+		benchSerialize(aSuite, bundles, NO);
+		benchSerialize(aSuite, bundles, YES);
+		[bundles release];
+	}
+}
@@ -0,0 +1,70 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#import "PyGoWaveBench.h"
+#ifdef GNUSTEP
+#import <Foundation/NSDebug.h>
+#endif
+
+static void usage(const char * aName)
+{
+	fprintf(stderr,
+			"usage: %s [--filter SUBSTRING] [--quick] [--seed N] [--scratch DIR]\n"
+			"Runs the PyGoWave client benchmarks and prints one JSON result per line.\n"
+			"Exits with status 1 if a check, such as transform.differential, failed.\n",
+			aName);
+}
+
+int main(int argc, const char * argv[])
+{
+#ifdef GNUSTEP
+	GSDebugAllocationActive(YES);
+#endif
+	NSAutoreleasePool * pool = [NSAutoreleasePool new];
+	PyGoWaveBenchSuite * suite = [PyGoWaveBenchSuite new];
+	
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+			suite.filter = [NSString stringWithUTF8String:argv[++i]];
+		else if (strcmp(argv[i], "--quick") == 0)
+			suite.quick = YES;
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+			suite.seed = (uint32_t) strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--scratch") == 0 && i + 1 < argc)
+			suite.scratchDirectory = [NSString stringWithUTF8String:argv[++i]];
+		else {
+			usage(argv[0]);
+			[suite release];
+			[pool release];
+			return 2;
+		}
+	}
+	if (suite.seed == 0)
+		suite.seed = 1; // xorshift never leaves 0
+	
+	PyGoWaveBenchRunOT(suite);
+	PyGoWaveBenchRunClient(suite);
+	
+	int status = suite.failures == 0 ? 0 : 1;
+	[suite release];
+	[pool release];
+	return status;
+}
@@ -0,0 +1,586 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#import "PyGoWaveBench.h"
+#import "PyGoWaveBenchReference.h"
+#import "PyGoWaveOperations.h"
+#import "PyGoWaveModel.h"
+
+#define BENCH_WAVE_ID		@"bench.example.org!w+bench"
+#define BENCH_WAVELET_ID	@"bench.example.org!conv+root"
+#define BENCH_BLIP_ID		@"b+bench"
+#define BENCH_DOCUMENT		4000	// Characters the workloads edit in
+#define BENCH_ELEMENTS		16		// Gadgets the element workloads address
+#define BENCH_BLIPS			4		// Blips the workloads spread over
+
+/*
+ Queues and remote traffic spread over several blips and include
+ wavelet-level operations, as in a busy conversation; the transformation
+ steps over every pair of operations that do not touch the same blip.
+*/
+
+static NSString * const kBlipIds[BENCH_BLIPS] = {BENCH_BLIP_ID, @"b+bench2", @"b+bench3", @"b+bench4"};
+
+static NSString * randomBlipId(uint32_t * aState)
+{
+	return kBlipIds[PyGoWaveBenchRandom(aState) % BENCH_BLIPS];
+}
+
+// A participant joining or leaving; these have no blip
+static void addParticipantChange(PyGoWaveOpManager * aManager, uint32_t * aState)
+{
+	NSString * participantId = [NSString stringWithFormat:@"user%u@bench.example.org", PyGoWaveBenchRandom(aState) % 4];
+	if (PyGoWaveBenchRandom(aState) % 2 == 0)
+		[aManager waveletAddParticipantWithId:participantId];
+	else
+		[aManager waveletRemoveParticipantWithId:participantId];
+}
+
+static PyGoWaveOpManager * newManager(void)
+{
+	return [[PyGoWaveOpManager alloc] initWithWaveId:BENCH_WAVE_ID waveletId:BENCH_WAVELET_ID contributorId:@"local@bench.example.org"];
+}
+
+static PyGoWaveOperation * newOperationInBlip(NSString * aBlipId, PyGoWaveOperationType aType, NSInteger aIndex, id aProperty)
+{
+	return [[PyGoWaveOperation alloc] initWithType:aType waveId:BENCH_WAVE_ID waveletId:BENCH_WAVELET_ID blipId:aBlipId index:aIndex property:aProperty];
+}
+
+static PyGoWaveOperation * newRemoteOperation(PyGoWaveOperationType aType, NSInteger aIndex, id aProperty)
+{
+	return newOperationInBlip(BENCH_BLIP_ID, aType, aIndex, aProperty);
+}
+
+static NSDictionary * gadgetDelta(NSInteger aElementId, uint32_t * aState)
+{
+	NSString * key = [NSString stringWithFormat:@"field%u", PyGoWaveBenchRandom(aState) % 8];
+	NSString * value = [NSString stringWithFormat:@"%u", PyGoWaveBenchRandom(aState) % 1000];
+	return [NSDictionary dictionaryWithObjectsAndKeys:
+			[NSNumber numberWithInteger:aElementId], @"id",
+			[NSDictionary dictionaryWithObject:value forKey:key], @"delta",
+			nil];
+}
+
+// Element positions are spread over the document: element e sits at e * BENCH_DOCUMENT / BENCH_ELEMENTS
+static NSInteger elementPosition(NSInteger aElementId)
+{
+	return aElementId * (BENCH_DOCUMENT / BENCH_ELEMENTS);
+}
+
+#pragma mark Local queues
+
+// Single-character inserts, taking turns over the blips, far enough apart that they do not merge
+static void fillTyping(PyGoWaveOpManager * aManager, NSUInteger aLength)
+{
+	for (NSUInteger k = 0; k < aLength; k++)
+		[aManager documentInsert:@"x" atIndex:BENCH_DOCUMENT / 2 + (aLength - k) * 4 inBlipWithId:kBlipIds[k % BENCH_BLIPS]];
+}
+
+// Random inserts and deletes, and now and then a participant change, until the queue holds aLength operations
+static void fillRandom(PyGoWaveOpManager * aManager, NSUInteger aLength, uint32_t * aState)
+{
+	for (NSUInteger attempts = 0; [[aManager operations] count] < aLength && attempts < aLength * 4; attempts++) {
+		NSInteger index = PyGoWaveBenchRandom(aState) % BENCH_DOCUMENT;
+		uint32_t kind = PyGoWaveBenchRandom(aState) % 16;
+		NSString * blipId = randomBlipId(aState);
+		if (kind == 0)
+			addParticipantChange(aManager, aState);
+		else if (kind % 3 == 0)
+			[aManager documentDeleteFromStart:index toEnd:index + 1 + PyGoWaveBenchRandom(aState) % 4 inBlipWithId:blipId];
+		else
+			[aManager documentInsert:PyGoWaveBenchText(1 + PyGoWaveBenchRandom(aState) % 8, aState) atIndex:index inBlipWithId:blipId];
+	}
+}
+
+// Element deltas, element inserts and text, as busy gadget blips produce them
+static void fillGadget(PyGoWaveOpManager * aManager, NSUInteger aLength, uint32_t * aState)
+{
+	for (NSUInteger attempts = 0; [[aManager operations] count] < aLength && attempts < aLength * 4; attempts++) {
+		uint32_t kind = PyGoWaveBenchRandom(aState) % 20;
+		NSInteger element = PyGoWaveBenchRandom(aState) % BENCH_ELEMENTS;
+		NSString * blipId = randomBlipId(aState);
+		if (kind < 12)
+			[aManager documentElementApplyDelta:gadgetDelta(element, aState) atIndex:elementPosition(element) inBlipWithId:blipId];
+		else if (kind < 14)
+			[aManager documentElementInsertAtIndex:PyGoWaveBenchRandom(aState) % BENCH_DOCUMENT
+											  type:PyGoWaveElementType_GADGET
+										properties:[NSDictionary dictionaryWithObject:@"http://gadgets.example.org/poll.xml" forKey:@"url"]
+									  inBlipWithId:blipId];
+		else if (kind < 19)
+			[aManager documentInsert:@"y" atIndex:PyGoWaveBenchRandom(aState) % BENCH_DOCUMENT inBlipWithId:blipId];
+		else
+			addParticipantChange(aManager, aState);
+	}
+}
+
+#pragma mark Mixed operation types
+
+// An operation of any type in one of the blips, or with no blip at all,
+// so every rule of the transformation and pairs of unrelated operations get their turn
+static PyGoWaveOperation * newMixedOperation(uint32_t * aState)
+{
+	uint32_t blip = PyGoWaveBenchRandom(aState) % (BENCH_BLIPS + 1);
+	NSString * blipId = blip < BENCH_BLIPS ? kBlipIds[blip] : @"";
+	PyGoWaveOperationType type;
+	NSInteger index = PyGoWaveBenchRandom(aState) % BENCH_DOCUMENT;
+	id property = nil;
+	uint32_t kind = PyGoWaveBenchRandom(aState) % 64;
+	if (kind == 0)
+		type = PyGoWaveOperation_BLIP_DELETE; // Clears the queue, so it stays rare
+	else
+		type = kind % PyGoWaveOperation_BLIP_DELETE;
+	switch (type) {
+		case PyGoWaveOperation_DOCUMENT_INSERT:
+			property = PyGoWaveBenchText(1 + PyGoWaveBenchRandom(aState) % 8, aState);
+			break;
+		case PyGoWaveOperation_DOCUMENT_DELETE:
+			property = [NSNumber numberWithInt:1 + PyGoWaveBenchRandom(aState) % 6];
+			break;
+		case PyGoWaveOperation_DOCUMENT_ELEMENT_INSERT:
+			property = [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:PyGoWaveElementType_GADGET], @"type", [NSDictionary dictionary], @"properties", nil];
+			break;
+		case PyGoWaveOperation_DOCUMENT_ELEMENT_DELTA: {
+			NSInteger element = PyGoWaveBenchRandom(aState) % BENCH_ELEMENTS;
+			index = elementPosition(element);
+			property = gadgetDelta(element, aState);
+			break;
+		}
+		case PyGoWaveOperation_DOCUMENT_ELEMENT_SETPREF:
+			property = [NSDictionary dictionaryWithObjectsAndKeys:@"color", @"key", [NSString stringWithFormat:@"%u", PyGoWaveBenchRandom(aState) % 8], @"value", nil];
+			break;
+		case PyGoWaveOperation_WAVELET_ADD_PARTICIPANT:
+		case PyGoWaveOperation_WAVELET_REMOVE_PARTICIPANT:
+			blipId = @"";
+			index = -1;
+			property = [NSString stringWithFormat:@"user%u@bench.example.org", PyGoWaveBenchRandom(aState) % 4];
+			break;
+		case PyGoWaveOperation_WAVELET_APPEND_BLIP:
+			blipId = @"";
+			// Fall through
+		case PyGoWaveOperation_BLIP_CREATE_CHILD:
+			index = -1;
+			property = [NSDictionary dictionaryWithObjectsAndKeys:BENCH_WAVE_ID, @"waveId", BENCH_WAVELET_ID, @"waveletId",
+						[NSString stringWithFormat:@"TBD_%u", PyGoWaveBenchRandom(aState) % 4], @"blipId", nil];
+			break;
+	}
+	return newOperationInBlip(blipId, type, index, property);
+}
+
+// Queued as they come, without merging them
+static void fillMixed(PyGoWaveOpManager * aManager, NSUInteger aLength, uint32_t * aState)
+{
+	NSMutableArray * ops = [NSMutableArray arrayWithCapacity:aLength];
+	for (NSUInteger k = 0; k < aLength; k++) {
+		PyGoWaveOperation * op = newMixedOperation(aState);
+		[ops addObject:op];
+		[op release];
+	}
+	[aManager putOperations:ops];
+}
+
+static NSArray * serializeAll(NSArray * aOperations)
+{
+	NSMutableArray * serialized = [NSMutableArray arrayWithCapacity:[aOperations count]];
+	for (PyGoWaveOperation * op in aOperations)
+		[serialized addObject:[op serialize]];
+	return serialized;
+}
+
+#pragma mark Benchmarks
+
+static NSDictionary * queueParams(NSUInteger aQueueLength)
+{
+	return [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedInteger:aQueueLength] forKey:@"queueLength"];
+}
+
+// Fewer operations for long queues, so every queue length takes about as long
+static NSUInteger opsForQueueLength(PyGoWaveBenchSuite * aSuite, NSUInteger aQueueLength)
+{
+	return MIN(MAX([aSuite scaled:400000] / MAX(aQueueLength, 1), 20), [aSuite scaled:20000]);
+}
+
+static void benchMergeTyping(PyGoWaveBenchSuite * aSuite)
+{
+	NSUInteger count = [aSuite scaled:200000];
+	PyGoWaveBenchRecorder * rec = [aSuite recorderWithName:@"merge.sequentialTyping"
+													params:[NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedInteger:count] forKey:@"characters"]];
+	PyGoWaveOpManager * mgr = newManager();
+	NSAutoreleasePool * pool = [NSAutoreleasePool new];
+	[rec start];
+	for (NSUInteger k = 0; k < count; k++) {
+		uint64_t t = PyGoWaveBenchNow();
+		[mgr documentInsert:@"a" atIndex:k inBlipWithId:BENCH_BLIP_ID];
+		[rec addSample:PyGoWaveBenchNow() - t];
+		if (k % 1000 == 999) {
+			[pool release];
+			pool = [NSAutoreleasePool new];
+		}
+	}
+	[rec stop];
+	[pool release];
+	[mgr release];
+	[aSuite report:rec];
+}
+
+static void benchMergeLargePaste(PyGoWaveBenchSuite * aSuite)
+{
+	uint32_t state = aSuite.seed;
+	NSUInteger count = [aSuite scaled:2000];
+	NSString * paste = PyGoWaveBenchText(16384, &state);
+	PyGoWaveBenchRecorder * rec = [aSuite recorderWithName:@"merge.largePaste"
+													params:[NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedInteger:[paste length]] forKey:@"pasteLength"]];
+	[rec start];
+	for (NSUInteger k = 0; k < count; k++) {
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		PyGoWaveOpManager * mgr = newManager();
+		[mgr documentInsert:@"typed before the paste" atIndex:0 inBlipWithId:BENCH_BLIP_ID];
+		uint64_t t = PyGoWaveBenchNow();
+		[mgr documentInsert:paste atIndex:10 inBlipWithId:BENCH_BLIP_ID]; // Merges into the typed text
+		[rec addSample:PyGoWaveBenchNow() - t];
+		[mgr release];
+		[pool release];
+	}
+	[rec stop];
+	[aSuite report:rec];
+}
+
+static void benchMergeGadgetDeltas(PyGoWaveBenchSuite * aSuite, NSUInteger aQueueLength)
+{
+	uint32_t state = aSuite.seed;
+	NSUInteger count = [aSuite scaled:100000];
+	PyGoWaveBenchRecorder * rec = [aSuite recorderWithName:@"merge.gadgetDeltas" params:queueParams(aQueueLength)];
+	PyGoWaveOpManager * mgr = newManager();
+	fillTyping(mgr, aQueueLength);
+	NSAutoreleasePool * pool = [NSAutoreleasePool new];
+	[rec start];
+	for (NSUInteger k = 0; k < count; k++) {
+		NSInteger element = PyGoWaveBenchRandom(&state) % BENCH_ELEMENTS;
+		NSDictionary * delta = gadgetDelta(element, &state);
+		uint64_t t = PyGoWaveBenchNow();
+		[mgr documentElementApplyDelta:delta atIndex:elementPosition(element) inBlipWithId:BENCH_BLIP_ID];
+		[rec addSample:PyGoWaveBenchNow() - t];
+		if (k % 1000 == 999) {
+			[pool release];
+			pool = [NSAutoreleasePool new];
+		}
+	}
+	[rec stop];
+	[pool release];
+	[mgr release];
+	[aSuite report:rec];
+}
+
+static void benchTransformTyping(PyGoWaveBenchSuite * aSuite, NSUInteger aQueueLength)
+{
+	NSUInteger count = opsForQueueLength(aSuite, aQueueLength);
+	PyGoWaveBenchRecorder * rec = [aSuite recorderWithName:@"transform.sequentialTyping" params:queueParams(aQueueLength)];
+	PyGoWaveOpManager * mgr = newManager();
+	fillTyping(mgr, aQueueLength);
+	NSAutoreleasePool * pool = [NSAutoreleasePool new];
+	[rec start];
+	for (NSUInteger k = 0; k < count; k++) {
+		PyGoWaveOperation * remote = newRemoteOperation(PyGoWaveOperation_DOCUMENT_INSERT, k % (BENCH_DOCUMENT / 2), @"r");
+		uint64_t t = PyGoWaveBenchNow();
+		[mgr transformInputOperation:remote];
+		[rec addSample:PyGoWaveBenchNow() - t];
+		[remote release];
+		if (k % 100 == 99) {
+			[pool release];
+			pool = [NSAutoreleasePool new];
+		}
+	}
+	[rec stop];
+	[pool release];
+	[mgr release];
+	[aSuite report:rec];
+}
+
+static void benchTransformRandom(PyGoWaveBenchSuite * aSuite, NSUInteger aQueueLength)
+{
+	uint32_t state = aSuite.seed;
+	NSUInteger count = opsForQueueLength(aSuite, aQueueLength);
+	PyGoWaveBenchRecorder * rec = [aSuite recorderWithName:@"transform.randomConcurrent" params:queueParams(aQueueLength)];
+	PyGoWaveOpManager * mgr = nil;
+	for (NSUInteger k = 0; k < count; k++) {
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		if (k % 50 == 0) { // Remote deletes eat into the queue, so it is rebuilt now and then
+			[mgr release];
+			mgr = newManager();
+			fillRandom(mgr, aQueueLength, &state);
+		}
+		PyGoWaveOperation * remote;
+		NSInteger index = PyGoWaveBenchRandom(&state) % BENCH_DOCUMENT;
+		uint32_t kind = PyGoWaveBenchRandom(&state) % 16;
+		NSString * blipId = randomBlipId(&state);
+		if (kind == 0)
+			remote = newOperationInBlip(@"", PyGoWaveOperation_WAVELET_ADD_PARTICIPANT, -1,
+										[NSString stringWithFormat:@"user%u@bench.example.org", PyGoWaveBenchRandom(&state) % 4]);
+		else if (kind % 3 == 0)
+			remote = newOperationInBlip(blipId, PyGoWaveOperation_DOCUMENT_DELETE, index, [NSNumber numberWithInt:1 + PyGoWaveBenchRandom(&state) % 4]);
+		else
+			remote = newOperationInBlip(blipId, PyGoWaveOperation_DOCUMENT_INSERT, index, PyGoWaveBenchText(1 + PyGoWaveBenchRandom(&state) % 8, &state));
+		[rec start];
+		uint64_t t = PyGoWaveBenchNow();
+		[mgr transformInputOperation:remote];
+		[rec addSample:PyGoWaveBenchNow() - t];
+		[rec stop];
+		[remote release];
+		[pool release];
+	}
+	[mgr release];
+	[aSuite report:rec];
+}
+
+static void benchTransformLargePaste(PyGoWaveBenchSuite * aSuite, NSUInteger aQueueLength)
+{
+	uint32_t state = aSuite.seed;
+	NSUInteger count = MIN(opsForQueueLength(aSuite, aQueueLength), [aSuite scaled:2000]);
+	NSString * paste = PyGoWaveBenchText(16384, &state);
+	NSMutableDictionary * params = [NSMutableDictionary dictionaryWithDictionary:queueParams(aQueueLength)];
+	[params setObject:[NSNumber numberWithUnsignedInteger:[paste length]] forKey:@"pasteLength"];
+	PyGoWaveBenchRecorder * rec = [aSuite recorderWithName:@"transform.largePaste" params:params];
+	PyGoWaveOpManager * mgr = newManager();
+	fillRandom(mgr, aQueueLength, &state);
+	NSAutoreleasePool * pool = [NSAutoreleasePool new];
+	[rec start];
+	for (NSUInteger k = 0; k < count; k++) {
+		PyGoWaveOperation * remote = newOperationInBlip(randomBlipId(&state), PyGoWaveOperation_DOCUMENT_INSERT, PyGoWaveBenchRandom(&state) % BENCH_DOCUMENT, paste);
+		uint64_t t = PyGoWaveBenchNow();
+		[mgr transformInputOperation:remote];
+		[rec addSample:PyGoWaveBenchNow() - t];
+		[remote release];
+		if (k % 100 == 99) {
+			[pool release];
+			pool = [NSAutoreleasePool new];
+		}
+	}
+	[rec stop];
+	[pool release];
+	[mgr release];
+	[aSuite report:rec];
+}
+
+// One remote delete over the whole document, split by every local insert inside it
+static void benchTransformSpanningDelete(PyGoWaveBenchSuite * aSuite, NSUInteger aQueueLength)
+{
+	NSUInteger count = MIN(opsForQueueLength(aSuite, aQueueLength), [aSuite scaled:5000]);
+	PyGoWaveBenchRecorder * rec = [aSuite recorderWithName:@"transform.spanningDelete" params:queueParams(aQueueLength)];
+	for (NSUInteger k = 0; k < count; k++) {
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		PyGoWaveOpManager * mgr = newManager();
+		fillTyping(mgr, aQueueLength);
+		PyGoWaveOperation * remote = newRemoteOperation(PyGoWaveOperation_DOCUMENT_DELETE, 0, [NSNumber numberWithInt:BENCH_DOCUMENT + aQueueLength * 4]);
+		[rec start];
+		uint64_t t = PyGoWaveBenchNow();
+		[mgr transformInputOperation:remote];
+		[rec addSample:PyGoWaveBenchNow() - t];
+		[rec stop];
+		[remote release];
+		[mgr release];
+		[pool release];
+	}
+	[aSuite report:rec];
+}
+
+static void benchTransformGadget(PyGoWaveBenchSuite * aSuite, NSUInteger aQueueLength)
+{
+	uint32_t state = aSuite.seed;
+	NSUInteger count = opsForQueueLength(aSuite, aQueueLength);
+	PyGoWaveBenchRecorder * rec = [aSuite recorderWithName:@"transform.gadgetTraffic" params:queueParams(aQueueLength)];
+	PyGoWaveOpManager * mgr = nil;
+	for (NSUInteger k = 0; k < count; k++) {
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		if (k % 100 == 0) {
+			[mgr release];
+			mgr = newManager();
+			fillGadget(mgr, aQueueLength, &state);
+		}
+		PyGoWaveOperation * remote;
+		uint32_t kind = PyGoWaveBenchRandom(&state) % 10;
+		NSInteger element = PyGoWaveBenchRandom(&state) % BENCH_ELEMENTS;
+		NSString * blipId = randomBlipId(&state);
+		if (kind < 7)
+			remote = newOperationInBlip(blipId, PyGoWaveOperation_DOCUMENT_ELEMENT_DELTA, elementPosition(element), gadgetDelta(element, &state));
+		else if (kind < 9)
+			remote = newOperationInBlip(blipId, PyGoWaveOperation_DOCUMENT_ELEMENT_INSERT, PyGoWaveBenchRandom(&state) % BENCH_DOCUMENT,
+										[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:PyGoWaveElementType_GADGET], @"type", [NSDictionary dictionary], @"properties", nil]);
+		else
+			remote = newOperationInBlip(blipId, PyGoWaveOperation_DOCUMENT_ELEMENT_DELETE, elementPosition(element), nil);
+		[rec start];
+		uint64_t t = PyGoWaveBenchNow();
+		[mgr transformInputOperation:remote];
+		[rec addSample:PyGoWaveBenchNow() - t];
+		[rec stop];
+		[remote release];
+		[pool release];
+	}
+	[mgr release];
+	[aSuite report:rec];
+}
+
+// Mixed traffic through the rule table, or through the if/else chain it replaced
+static void benchTransformDispatch(PyGoWaveBenchSuite * aSuite, NSUInteger aQueueLength, BOOL bReference)
+{
+	uint32_t state = aSuite.seed;
+	NSUInteger count = opsForQueueLength(aSuite, aQueueLength);
+	NSMutableDictionary * params = [NSMutableDictionary dictionaryWithDictionary:queueParams(aQueueLength)];
+	[params setObject:(bReference ? @"chain" : @"table") forKey:@"rules"];
+	PyGoWaveBenchRecorder * rec = [aSuite recorderWithName:@"transform.dispatch" params:params];
+	NSMutableArray * results = [NSMutableArray new];
+	PyGoWaveOpManager * mgr = nil;
+	for (NSUInteger k = 0; k < count; k++) {
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		if (k % 50 == 0) {
+			[mgr release];
+			mgr = newManager();
+			fillMixed(mgr, aQueueLength, &state);
+		}
+		PyGoWaveOperation * remote = newMixedOperation(&state);
+		[results removeAllObjects];
+		[rec start];
+		uint64_t t = PyGoWaveBenchNow();
+		if (bReference)
+			[mgr referenceTransformInputOperation:remote appendingTo:results];
+		else
+			[mgr transformInputOperation:remote appendingTo:results];
+		[rec addSample:PyGoWaveBenchNow() - t];
+		[rec stop];
+		[remote release];
+		[pool release];
+	}
+	[results release];
+	[mgr release];
+	[aSuite report:rec];
+}
+
+/*
+ Differential check of the rule table against the if/else chain it
+ replaced. Each case fills two queues alike with operations of every type,
+ transforms the same inputs with either and compares the queues and the
+ transformed inputs. Mismatches are failures of the suite; the samples
+ time the table.
+*/
+static void checkTransformDifferential(PyGoWaveBenchSuite * aSuite)
+{
+	uint32_t state = aSuite.seed;
+	NSUInteger cases = [aSuite scaled:20000];
+	PyGoWaveBenchRecorder * rec = [aSuite recorderWithName:@"transform.differential"
+													params:[NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedInteger:cases] forKey:@"cases"]];
+	NSMutableArray * tableResults = [NSMutableArray new];
+	NSMutableArray * chainResults = [NSMutableArray new];
+	NSUInteger mismatches = 0;
+	[rec start];
+	for (NSUInteger k = 0; k < cases; k++) {
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		NSUInteger length = PyGoWaveBenchRandom(&state) % 24;
+		NSUInteger inputs = 1 + PyGoWaveBenchRandom(&state) % 4;
+		uint32_t fillState = state;
+		PyGoWaveOpManager * table = newManager();
+		fillMixed(table, length, &fillState);
+		fillState = state;
+		PyGoWaveOpManager * chain = newManager();
+		fillMixed(chain, length, &fillState);
+		state = fillState;
+		[tableResults removeAllObjects];
+		[chainResults removeAllObjects];
+		for (NSUInteger n = 0; n < inputs; n++) {
+			PyGoWaveOperation * remote = newMixedOperation(&state);
+			uint64_t t = PyGoWaveBenchNow();
+			[table transformInputOperation:remote appendingTo:tableResults];
+			[rec addSample:PyGoWaveBenchNow() - t];
+			[chain referenceTransformInputOperation:remote appendingTo:chainResults];
+			[remote release];
+		}
+		NSArray * tableQueue = [table serializeOperations];
+		NSArray * chainQueue = [chain serializeOperations];
+		NSArray * tableOutput = serializeAll(tableResults);
+		NSArray * chainOutput = serializeAll(chainResults);
+		if (![tableQueue isEqual:chainQueue] || ![tableOutput isEqual:chainOutput]) {
+			if (mismatches == 0) // The first one in full, the others by number
+				[aSuite fail:[NSString stringWithFormat:@"transform.differential case %lu: table queue %@ output %@, chain queue %@ output %@",
+							  (unsigned long) k, tableQueue, tableOutput, chainQueue, chainOutput]];
+			else
+				[aSuite fail:[NSString stringWithFormat:@"transform.differential case %lu differs", (unsigned long) k]];
+			mismatches++;
+		}
+		[table release];
+		[chain release];
+		[pool release];
+	}
+	[rec stop];
+	[tableResults release];
+	[chainResults release];
+	[aSuite report:rec];
+}
+
+static void benchFetch(PyGoWaveBenchSuite * aSuite, NSUInteger aQueueLength)
+{
+	uint32_t state = aSuite.seed;
+	NSUInteger count = MIN(opsForQueueLength(aSuite, aQueueLength), [aSuite scaled:5000]);
+	PyGoWaveBenchRecorder * rec = [aSuite recorderWithName:@"fetch" params:queueParams(aQueueLength)];
+	for (NSUInteger k = 0; k < count; k++) {
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		PyGoWaveOpManager * mgr = newManager();
+		fillRandom(mgr, aQueueLength, &state);
+		[rec start];
+		uint64_t t = PyGoWaveBenchNow();
+		[mgr fetchOperations];
+		[rec addSample:PyGoWaveBenchNow() - t];
+		[rec stop];
+		[mgr release];
+		[pool release];
+	}
+	[aSuite report:rec];
+}
+
+void PyGoWaveBenchRunOT(PyGoWaveBenchSuite * aSuite)
+{
+	static const NSUInteger queueLengths[] = {1, 10, 100, 1000};
+	NSUInteger queueLengthCount = aSuite.quick ? 3 : 4;
+	
+	if ([aSuite shouldRun:@"merge.sequentialTyping"])
+		benchMergeTyping(aSuite);
+	if ([aSuite shouldRun:@"merge.largePaste"])
+		benchMergeLargePaste(aSuite);
+	if ([aSuite shouldRun:@"transform.differential"])
+		checkTransformDifferential(aSuite);
+	for (NSUInteger q = 0; q < queueLengthCount; q++) {
+		NSUInteger length = queueLengths[q];
+		if ([aSuite shouldRun:@"merge.gadgetDeltas"])
+			benchMergeGadgetDeltas(aSuite, length);
+		if ([aSuite shouldRun:@"transform.sequentialTyping"])
+			benchTransformTyping(aSuite, length);
+		if ([aSuite shouldRun:@"transform.randomConcurrent"])
+			benchTransformRandom(aSuite, length);
+		if ([aSuite shouldRun:@"transform.largePaste"])
+			benchTransformLargePaste(aSuite, length);
+		if ([aSuite shouldRun:@"transform.spanningDelete"])
+			benchTransformSpanningDelete(aSuite, length);
+		if ([aSuite shouldRun:@"transform.gadgetTraffic"])
+			benchTransformGadget(aSuite, length);
+		if ([aSuite shouldRun:@"transform.dispatch"]) {
+			benchTransformDispatch(aSuite, length, NO);
+			benchTransformDispatch(aSuite, length, YES);
+		}
+		if ([aSuite shouldRun:@"fetch"])
+			benchFetch(aSuite, length);
+	}
+}
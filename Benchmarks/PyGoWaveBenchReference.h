@@ -0,0 +1,37 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#import "PyGoWaveOperations.h"
+
+/*
+ The transformation as it was written before the rules moved into a table
+ indexed by operation types: one if/else chain that tests the types of
+ both operations for every pair. It is kept as it was, apart from stepping
+ over operations of other blips, as the reference the transform.differential
+ benchmark compares the table against, and as the baseline for
+ transform.dispatch. Do not change it along with the rules.
+*/
+@interface PyGoWaveOpManager (BenchReference)
+
+- (void)referenceTransformInputOperation:(PyGoWaveOperation*)aInputOperation appendingTo:(NSMutableArray*)op_lst;
+
+@end
@@ -0,0 +1,192 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#import "PyGoWaveBenchReference.h"
+
+@interface PyGoWaveOpManager (BenchReferenceInternal)
+- (void)postOperationChangedWithIndex:(NSInteger)aIndex;
+@end
+
+
+@implementation PyGoWaveOpManager (BenchReference)
+
+- (void)referenceTransformInputOperation:(PyGoWaveOperation*)aInputOperation appendingTo:(NSMutableArray*)op_lst
+{
+	PyGoWaveOperation * new_op = [aInputOperation copy];
+	int first = [op_lst count];
+	[op_lst addObject:new_op];
+	[new_op release];
+	new_op = nil;
+	int i = 0;
+	while (i < [m_operations count]) {
+		PyGoWaveOperation * myop = [m_operations objectAtIndex:i];
+		int j = first;
+		while (j < [op_lst count]) {
+			PyGoWaveOperation * op = [op_lst objectAtIndex:j];
+			if (![op isCompatibleToOperation:myop]) {
+				j++;
+				continue;
+			}
+			int end = 0;
+			if (op.isDelete && myop.isDelete) {
+				if (op.index < myop.index) {
+					end = op.index + op.length;
+					if (end <= myop.index) {
+						myop.index -= op.length;
+						[self postOperationChangedWithIndex:i];
+					}
+					else if (end < (myop.index + myop.length)) {
+						[op resizeToLength:myop.index - op.index];
+						[myop resizeToLength:myop.length - (end - myop.index)];
+						myop.index = op.index;
+						[self postOperationChangedWithIndex:i];
+					}
+					else {
+						[op resizeToLength:op.length - myop.length];
+						myop = nil;
+						[self removeOperationAtIndex:i];
+						i--;
+						break;
+					}
+				}
+				else {
+					end = myop.index + myop.length;
+					if (op.index >= end)
+						op.index -= myop.length;
+					else if (op.index + op.length <= end) {
+						[myop resizeToLength:myop.length - op.length];
+						[op_lst removeObjectAtIndex:j];
+						op = nil;
+						j--;
+						if (myop.isNull) {
+							myop = nil;
+							[self removeOperationAtIndex:i];
+							i--;
+							break;
+						}
+						else
+							[self postOperationChangedWithIndex:i];
+					}
+					else {
+						[myop resizeToLength:myop.length - (end - op.index)];
+						[self postOperationChangedWithIndex:i];
+						[op resizeToLength:op.length - (end - op.index)];
+						op.index = myop.index;
+					}
+				}
+			}
+			else if (op.isDelete && myop.isInsert) {
+				if (op.index < myop.index) {
+					if (op.index + op.length <= myop.index) {
+						myop.index -= op.length;
+						[self postOperationChangedWithIndex:i];
+					}
+					else {
+						new_op = [op copy];
+						[op resizeToLength:myop.index - op.index];
+						[new_op resizeToLength:new_op.length - op.length];
+						[op_lst insertObject:new_op atIndex:j + 1];
+						[new_op release];
+						myop.index -= op.length;
+						[self postOperationChangedWithIndex:i];
+					}
+				}
+				else
+					op.index += myop.length;
+			}
+			else if (op.isInsert && myop.isDelete) {
+				if (op.index <= myop.index) {
+					myop.index += op.length;
+					[self postOperationChangedWithIndex:i];
+				}
+				else if (op.index >= (myop.index + myop.length))
+					op.index -= myop.length;
+				else {
+					new_op = [myop copy];
+					[myop resizeToLength:op.index - myop.index];
+					[self postOperationChangedWithIndex:i];
+					[new_op resizeToLength:new_op.length - myop.length];
+					[self insertOperation:new_op atIndex:i + 1];
+					[new_op release];
+					op.index = myop.index;
+				}
+			}
+			else if (op.isInsert && myop.isInsert) {
+				if (op.index <= myop.index) {
+					myop.index += op.length;
+					[self postOperationChangedWithIndex:i];
+				}
+				else
+					op.index += myop.length;
+			}
+			else if (op.isChange && myop.isDelete) {
+				if (op.index > myop.index) {
+					if (op.index <= (myop.index + myop.length))
+						op.index = myop.index;
+					else
+						op.index -= myop.length;
+				}
+			}
+			else if (op.isChange && myop.isInsert) {
+				if (op.index >= myop.index)
+					op.index += myop.length;
+			}
+			else if (op.isDelete && myop.isChange) {
+				if (op.index < myop.index) {
+					if (myop.index <= (op.index + op.length)) {
+						myop.index = op.index;
+						[self postOperationChangedWithIndex:i];
+					}
+					else {
+						myop.index -= op.length;
+						[self postOperationChangedWithIndex:i];
+					}
+				}
+			}
+			else if (op.isInsert && myop.isChange) {
+				if (op.index <= myop.index) {
+					myop.index += op.length;
+					[self postOperationChangedWithIndex:i];
+				}
+			}
+			else if ((op.type == PyGoWaveOperation_WAVELET_ADD_PARTICIPANT && myop.type == PyGoWaveOperation_WAVELET_ADD_PARTICIPANT)
+					|| (op.type == PyGoWaveOperation_WAVELET_REMOVE_PARTICIPANT && myop.type == PyGoWaveOperation_WAVELET_REMOVE_PARTICIPANT)) {
+				if ([op.property isEqual:myop.property]) {
+					myop = nil;
+					[self removeOperationAtIndex:i];
+					i--;
+					break;
+				}
+			}
+			else if (op.type == PyGoWaveOperation_BLIP_DELETE && [op.blipId length] != 0 && [myop.blipId length] != 0) {
+				myop = nil;
+				[self removeOperationAtIndex:i];
+				i--;
+				break;
+			}
+			j++;
+		}
+		i++;
+	}
+}
+
+@end
@@ -0,0 +1,583 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#import "PyGoWaveBench.h"
+#import "PyGoWaveLoadServer.h"
+#import "PyGoWaveController.h"
+#import "PyGoWaveBundleWriter.h"
+
+/*
+ Concurrent editing load test: N PyGoWaveControllers, each on a thread of
+ its own, log in to the stand-in server, open the same wavelet and type
+ into its blip at the same time. Every client makes the same number of
+ scripted edits, mostly short insertions with some deletions at random
+ places, seeded per client so runs can be repeated.
+ 
+ When all edits are made and the server has been quiet for a moment, the
+ run ends and prints one "load.ack" result in the format of the benchmark
+ suite: latencies are from a bundle being sent until its acknowledgement
+ was handled, and ops per second are acknowledged bundles per second.
+ Added to it are whether every client ended up with the server's text,
+ checksum mismatches the clients saw, edit and server throughput, and CPU
+ time per client, which is the process's CPU time less the server's,
+ divided by the number of clients.
+*/
+
+typedef struct {
+	NSUInteger edits;
+	double rate;				// Edits per second and client; 0 is as fast as possible
+	NSTimeInterval sendWindow;	// maximumSendWindow of the clients; negative keeps the default
+	UInt16 port;
+	uint32_t seed;
+	NSTimeInterval timeout;		// Seconds to wait for the clients to log in, and for convergence
+	NSTimeInterval settle;		// The server is quiet if it commits nothing for this long
+} PyGoWaveLoadOptions;
+
+@class PyGoWaveLoadClient;
+
+// Where bundles are sent and acknowledged; both run on the owner thread
+@interface PyGoWaveController (LoadHooks)
+- (void)sendData:(NSData*)aData to:(NSString*)aDestination;
+- (void)applyAckItem:(id)aItem toWavelet:(PyGoWaveWavelet*)aWavelet;
+@end
+
+@interface PyGoWaveLoadController : PyGoWaveController
+{
+	PyGoWaveLoadClient * m_client; // Not retained, the client owns us
+	uint64_t m_bundleSentAt;
+}
+- (id)initWithClient:(PyGoWaveLoadClient*)aClient;
+@end
+
+@interface PyGoWaveLoadClient : NSObject
+{
+	NSUInteger m_index;
+	PyGoWaveLoadOptions m_options;
+	uint32_t m_random;
+	NSThread * m_thread;
+	PyGoWaveLoadController * m_controller;
+	NSTimer * m_editTimer;
+	NSUInteger m_editsMade;
+	
+	NSLock * m_lock;
+	BOOL m_ready;
+	BOOL m_done;
+	uint64_t * m_ackTimes;
+	NSUInteger m_ackCount;
+	NSUInteger m_ackCapacity;
+	NSInteger m_version;
+	NSString * m_content;
+	NSUInteger m_checkSyncFailures;
+}
+// The following are safe to read from any thread
+@property (readonly) BOOL ready;
+@property (readonly) BOOL done;
+// As of the last sample
+@property (readonly) NSInteger version;
+@property (readonly) NSString * content;
+@property (readonly) NSUInteger checkSyncFailures;
+
+- (id)initWithIndex:(NSUInteger)aIndex options:(PyGoWaveLoadOptions)aOptions;
+- (void)dealloc;
+
+- (void)start;
+- (void)startEditing;
+// Copies the client's state for the properties above; waits for the client thread
+- (void)sample;
+- (void)addAckTimesToRecorder:(PyGoWaveBenchRecorder*)aRecorder;
+// Disconnects and ends the client thread; waits for it
+- (void)stop;
+
+// Called by the controller on the client thread
+- (void)bundleAcknowledgedAfter:(uint64_t)aNanoseconds;
+
+@end
+
+#pragma mark -
+
+@implementation PyGoWaveLoadController
+
+- (id)initWithClient:(PyGoWaveLoadClient*)aClient
+{
+	if (self = [super init]) {
+		m_client = aClient;
+		m_bundleSentAt = 0;
+	}
+	return self;
+}
+
+- (void)sendData:(NSData*)aData to:(NSString*)aDestination
+{
+	static const char prefix[] = "{\"type\":\"OPERATION_MESSAGE_BUNDLE\"";
+	if ([aData length] >= sizeof(prefix) - 1 && memcmp([aData bytes], prefix, sizeof(prefix) - 1) == 0)
+		m_bundleSentAt = PyGoWaveBenchNow();
+	[super sendData:aData to:aDestination];
+}
+
+- (void)applyAckItem:(id)aItem toWavelet:(PyGoWaveWavelet*)aWavelet
+{
+	// Before the next bundle goes out from within the acknowledgement
+	if (m_bundleSentAt != 0)
+		[m_client bundleAcknowledgedAfter:PyGoWaveBenchNow() - m_bundleSentAt];
+	m_bundleSentAt = 0;
+	[super applyAckItem:aItem toWavelet:aWavelet];
+}
+
+@end
+
+#pragma mark -
+
+@implementation PyGoWaveLoadClient
+
+@synthesize ready = m_ready, done = m_done;
+
+#pragma mark Initialization and Deallocation
+
+- (id)initWithIndex:(NSUInteger)aIndex options:(PyGoWaveLoadOptions)aOptions
+{
+	if (self = [super init]) {
+		m_index = aIndex;
+		m_options = aOptions;
+		m_random = aOptions.seed ^ (0x9e3779b9 * (uint32_t) (aIndex + 1));
+		if (m_random == 0)
+			m_random = 1;
+		m_thread = nil;
+		m_controller = nil;
+		m_editTimer = nil;
+		m_editsMade = 0;
+		m_lock = [NSLock new];
+		m_ready = NO;
+		m_done = NO;
+		m_ackCapacity = 256;
+		m_ackTimes = malloc(m_ackCapacity * sizeof(uint64_t));
+		m_ackCount = 0;
+		m_version = -1;
+		m_content = nil;
+		m_checkSyncFailures = 0;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_thread release];
+	[m_lock release];
+	free(m_ackTimes);
+	[m_content release];
+	[super dealloc];
+}
+
+#pragma mark Client thread
+
+- (void)run
+{
+	NSAutoreleasePool * pool = [NSAutoreleasePool new];
+	// Keeps the run loop waiting while the socket is not open yet
+	[[NSRunLoop currentRunLoop] addPort:[NSPort port] forMode:NSDefaultRunLoopMode];
+	m_controller = [[PyGoWaveLoadController alloc] initWithClient:self];
+	m_controller.persistentParticipants = NO;
+	m_controller.collectMetrics = YES;
+	m_controller.directSerialization = YES;
+	if (m_options.sendWindow >= 0.0)
+		m_controller.maximumSendWindow = m_options.sendWindow;
+	[m_controller addWaveListReceivedObserver:self selector:@selector(controller_waveListReceived:)];
+	[m_controller addWaveletOpenedObserver:self selector:@selector(controller_waveletOpened:)];
+	NSString * username = [NSString stringWithFormat:@"load%u", (unsigned) m_index];
+	[m_controller connectToHost:@"localhost" username:username password:@"load" stompPort:m_options.port stompUsername:username stompPassword:@"load"];
+	[pool release];
+	
+	while (![[NSThread currentThread] isCancelled]) {
+		pool = [NSAutoreleasePool new];
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.25]];
+		[pool release];
+	}
+	
+	pool = [NSAutoreleasePool new];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]]; // Let the disconnect finish
+	[m_controller removeWaveListReceivedObserver:self];
+	[m_controller removeWaveletOpenedObserver:self];
+	[m_controller release];
+	m_controller = nil;
+	[pool release];
+}
+
+- (void)controller_waveListReceived:(NSNotification*)notification
+{
+	[m_controller openWaveletWithId:kPyGoWaveLoadWaveletId];
+}
+
+- (void)controller_waveletOpened:(NSNotification*)notification
+{
+	[m_lock lock];
+	m_ready = YES;
+	[m_lock unlock];
+}
+
+- (void)edit
+{
+	PyGoWaveBlip * blip = [[m_controller waveletWithId:kPyGoWaveLoadWaveletId] blipById:kPyGoWaveLoadBlipId];
+	NSInteger length = [blip.content length];
+	uint32_t r = PyGoWaveBenchRandom(&m_random);
+	if (length > 0 && r % 5 == 0) {
+		NSInteger start = (r >> 3) % length;
+		NSInteger end = MIN(start + 1 + (NSInteger) ((r >> 24) % 3), length);
+		[m_controller textDeletedFromStart:start toEnd:end inBlipWithId:kPyGoWaveLoadBlipId ofWaveletWithId:kPyGoWaveLoadWaveletId];
+	}
+	else {
+		NSString * text = PyGoWaveBenchText(1 + (r >> 24) % 3, &m_random);
+		[m_controller textInserted:text atIndex:(r >> 3) % (length + 1) inBlipId:kPyGoWaveLoadBlipId ofWaveletId:kPyGoWaveLoadWaveletId];
+	}
+	
+	if (++m_editsMade < m_options.edits) {
+		if (m_options.rate <= 0.0)
+			[self performSelector:@selector(edit) withObject:nil afterDelay:0.0];
+		return;
+	}
+	[m_editTimer invalidate];
+	[m_editTimer release];
+	m_editTimer = nil;
+	[m_lock lock];
+	m_done = YES;
+	[m_lock unlock];
+}
+
+- (void)editTimer_timeout:(NSTimer*)aTimer
+{
+	[self edit];
+}
+
+- (void)beginEditing
+{
+	if (m_options.edits == 0) {
+		[m_lock lock];
+		m_done = YES;
+		[m_lock unlock];
+	}
+	else if (m_options.rate <= 0.0)
+		[self edit];
+	else {
+		// Clients start at random points of the interval, so they do not type in lockstep
+		NSTimeInterval interval = 1.0 / m_options.rate;
+		NSDate * first = [NSDate dateWithTimeIntervalSinceNow:interval * (PyGoWaveBenchRandom(&m_random) % 1000) / 1000.0];
+		m_editTimer = [[NSTimer alloc] initWithFireDate:first interval:interval target:self selector:@selector(editTimer_timeout:) userInfo:nil repeats:YES];
+		[[NSRunLoop currentRunLoop] addTimer:m_editTimer forMode:NSDefaultRunLoopMode];
+	}
+}
+
+- (void)takeSample
+{
+	PyGoWaveWavelet * wavelet = [m_controller waveletWithId:kPyGoWaveLoadWaveletId];
+	NSNumber * failures = [[[m_controller metricsSnapshot] valueForKey:@"total"] valueForKey:@"checkSyncFailures"];
+	[m_lock lock];
+	m_version = wavelet != nil ? wavelet.version : -1;
+	[m_content release];
+	m_content = [[wavelet blipById:kPyGoWaveLoadBlipId].content copy];
+	m_checkSyncFailures = [failures unsignedIntegerValue];
+	[m_lock unlock];
+}
+
+- (void)disconnect
+{
+	[m_editTimer invalidate];
+	[m_editTimer release];
+	m_editTimer = nil;
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(edit) object:nil];
+	[m_controller disconnectFromHost];
+}
+
+- (void)bundleAcknowledgedAfter:(uint64_t)aNanoseconds
+{
+	[m_lock lock];
+	if (m_ackCount == m_ackCapacity) {
+		m_ackCapacity *= 2;
+		m_ackTimes = realloc(m_ackTimes, m_ackCapacity * sizeof(uint64_t));
+	}
+	m_ackTimes[m_ackCount++] = aNanoseconds;
+	[m_lock unlock];
+}
+
+#pragma mark Public methods
+
+- (BOOL)ready
+{
+	[m_lock lock];
+	BOOL ready = m_ready;
+	[m_lock unlock];
+	return ready;
+}
+
+- (BOOL)done
+{
+	[m_lock lock];
+	BOOL done = m_done;
+	[m_lock unlock];
+	return done;
+}
+
+- (NSInteger)version
+{
+	[m_lock lock];
+	NSInteger version = m_version;
+	[m_lock unlock];
+	return version;
+}
+
+- (NSString*)content
+{
+	[m_lock lock];
+	NSString * content = [[m_content retain] autorelease];
+	[m_lock unlock];
+	return content;
+}
+
+- (NSUInteger)checkSyncFailures
+{
+	[m_lock lock];
+	NSUInteger failures = m_checkSyncFailures;
+	[m_lock unlock];
+	return failures;
+}
+
+- (void)start
+{
+	if (m_thread != nil)
+		return;
+	m_thread = [[NSThread alloc] initWithTarget:self selector:@selector(run) object:nil];
+	[m_thread setName:[NSString stringWithFormat:@"load client %u", (unsigned) m_index]];
+	[m_thread start];
+}
+
+- (void)startEditing
+{
+	[self performSelector:@selector(beginEditing) onThread:m_thread withObject:nil waitUntilDone:NO];
+}
+
+- (void)sample
+{
+	[self performSelector:@selector(takeSample) onThread:m_thread withObject:nil waitUntilDone:YES];
+}
+
+- (void)addAckTimesToRecorder:(PyGoWaveBenchRecorder*)aRecorder
+{
+	[m_lock lock];
+	for (NSUInteger i = 0; i < m_ackCount; i++)
+		[aRecorder addSample:m_ackTimes[i]];
+	[m_lock unlock];
+}
+
+- (void)stop
+{
+	if (m_thread == nil || [m_thread isFinished])
+		return;
+	[self performSelector:@selector(disconnect) onThread:m_thread withObject:nil waitUntilDone:YES];
+	[m_thread cancel];
+	while (![m_thread isFinished])
+		[NSThread sleepForTimeInterval:0.01];
+}
+
+@end
+
+#pragma mark -
+
+// Sleeps until aCondition holds for all clients; returns NO on timeout
+static BOOL waitForClients(NSArray * aClients, SEL aCondition, NSTimeInterval aTimeout)
+{
+	NSTimeInterval deadline = [NSDate timeIntervalSinceReferenceDate] + aTimeout;
+	for (;;) {
+		BOOL all = YES;
+		for (PyGoWaveLoadClient * client in aClients) {
+			if (![client performSelector:aCondition]) {
+				all = NO;
+				break;
+			}
+		}
+		if (all)
+			return YES;
+		if ([NSDate timeIntervalSinceReferenceDate] > deadline)
+			return NO;
+		[NSThread sleepForTimeInterval:0.01];
+	}
+}
+
+static BOOL runLoad(NSUInteger aClientCount, PyGoWaveLoadOptions aOptions, PyGoWaveBundleWriter * aWriter)
+{
+	uint32_t random = aOptions.seed;
+	PyGoWaveLoadServer * server = [[PyGoWaveLoadServer alloc] initWithContent:PyGoWaveBenchText(200, &random)];
+	if (![server startOnPort:aOptions.port]) {
+		[server release];
+		return NO;
+	}
+	
+	NSMutableArray * clients = [NSMutableArray arrayWithCapacity:aClientCount];
+	for (NSUInteger i = 0; i < aClientCount; i++) {
+		PyGoWaveLoadClient * client = [[PyGoWaveLoadClient alloc] initWithIndex:i options:aOptions];
+		[clients addObject:client];
+		[client release];
+		[client start];
+	}
+	if (!waitForClients(clients, @selector(ready), aOptions.timeout)) {
+		NSLog(@"Load: Not all of %u clients opened the wavelet within %.0f seconds", (unsigned) aClientCount, aOptions.timeout);
+		for (PyGoWaveLoadClient * client in clients)
+			[client stop];
+		[server stop];
+		[server release];
+		return NO;
+	}
+	
+	// Editing phase
+	uint64_t started = PyGoWaveBenchNow();
+	uint64_t cpuAtStart = PyGoWaveBenchProcessCPUTime();
+	uint64_t serverCpuAtStart = server.cpuTime;
+	for (PyGoWaveLoadClient * client in clients)
+		[client startEditing];
+	BOOL bTimedOut = !waitForClients(clients, @selector(done), aOptions.timeout + (aOptions.rate > 0.0 ? aOptions.edits / aOptions.rate : 0.0));
+	
+	// Until the server has been quiet for a while and every client is at its version
+	NSTimeInterval deadline = [NSDate timeIntervalSinceReferenceDate] + aOptions.timeout;
+	while (!bTimedOut) {
+		[NSThread sleepForTimeInterval:aOptions.settle / 4];
+		uint64_t lastCommit = server.lastCommit;
+		if (PyGoWaveBenchNow() - MAX(lastCommit, started) < (uint64_t) (aOptions.settle * 1e9))
+			continue;
+		NSInteger version = server.version;
+		BOOL bSynced = YES;
+		for (PyGoWaveLoadClient * client in clients) {
+			[client sample];
+			if (client.version != version)
+				bSynced = NO;
+		}
+		if (bSynced && server.lastCommit == lastCommit)
+			break;
+		if ([NSDate timeIntervalSinceReferenceDate] > deadline)
+			bTimedOut = YES;
+	}
+	uint64_t finished = MAX(server.lastCommit, started);
+	uint64_t serverCpu = server.cpuTime - serverCpuAtStart;
+	uint64_t cpu = PyGoWaveBenchProcessCPUTime() - cpuAtStart;
+	
+	// Results
+	NSString * content = server.content;
+	NSUInteger converged = 0, checkSyncFailures = 0;
+	PyGoWaveBenchRecorder * rec = [[PyGoWaveBenchRecorder alloc] initWithName:@"load.ack" params:
+								   [NSDictionary dictionaryWithObjectsAndKeys:
+									[NSNumber numberWithUnsignedInteger:aClientCount], @"clients",
+									[NSNumber numberWithUnsignedInteger:aOptions.edits], @"editsPerClient",
+									[NSNumber numberWithDouble:aOptions.rate], @"rate",
+									[NSNumber numberWithDouble:aOptions.sendWindow], @"sendWindow",
+									nil]];
+	for (PyGoWaveLoadClient * client in clients) {
+		[client sample];
+		if ([client.content isEqual:content])
+			converged++;
+		checkSyncFailures += client.checkSyncFailures;
+		[client addAckTimesToRecorder:rec];
+	}
+	[rec addElapsed:finished - started];
+	
+	double seconds = (finished - started) / 1e9;
+	double cpuPerClient = aClientCount > 0 && cpu > serverCpu ? (cpu - serverCpu) / 1e9 / aClientCount : 0.0;
+	NSMutableDictionary * result = [NSMutableDictionary dictionaryWithDictionary:[rec result]];
+	[result setObject:[NSNumber numberWithBool:converged == aClientCount && !bTimedOut] forKey:@"converged"];
+	[result setObject:[NSNumber numberWithUnsignedInteger:converged] forKey:@"convergedClients"];
+	[result setObject:[NSNumber numberWithBool:bTimedOut] forKey:@"timedOut"];
+	[result setObject:[NSNumber numberWithUnsignedInteger:checkSyncFailures] forKey:@"checkSyncFailures"];
+	[result setObject:[NSNumber numberWithDouble:seconds > 0.0 ? aClientCount * aOptions.edits / seconds : 0.0] forKey:@"editsPerSecond"];
+	[result setObject:[NSNumber numberWithUnsignedInteger:server.bundles] forKey:@"serverBundles"];
+	[result setObject:[NSNumber numberWithUnsignedInteger:server.operations] forKey:@"serverOperations"];
+	[result setObject:[NSNumber numberWithUnsignedInteger:server.rejected] forKey:@"serverRejected"];
+	[result setObject:[NSNumber numberWithDouble:serverCpu / 1e9] forKey:@"serverCpuSeconds"];
+	[result setObject:[NSNumber numberWithDouble:cpuPerClient] forKey:@"cpuSecondsPerClient"];
+	[result setObject:[NSNumber numberWithDouble:seconds > 0.0 ? 100.0 * cpuPerClient / seconds : 0.0] forKey:@"cpuPercentPerClient"];
+	[rec release];
+	
+	[aWriter reset];
+	[aWriter appendValue:result];
+	[aWriter appendBytes:"\n" length:1];
+	fwrite([[aWriter data] bytes], 1, [[aWriter data] length], stdout);
+	fflush(stdout);
+	
+	for (PyGoWaveLoadClient * client in clients)
+		[client stop];
+	[server stop];
+	[server release];
+	return YES;
+}
+
+static void usage(const char * aName)
+{
+	fprintf(stderr,
+			"usage: %s [--clients N,N,...] [--edits N] [--rate PER_SECOND] [--window SECONDS]\n"
+			"          [--port N] [--seed N] [--timeout SECONDS]\n"
+			"Runs simulated clients editing one wavelet against a stand-in server and prints one\n"
+			"JSON result per client count. --rate 0 edits as fast as possible.\n",
+			aName);
+}
+
+int main(int argc, const char * argv[])
+{
+	NSAutoreleasePool * pool = [NSAutoreleasePool new];
+	NSArray * clientCounts = [NSArray arrayWithObjects:@"1", @"5", @"10", @"25", @"50", nil];
+	PyGoWaveLoadOptions options;
+	options.edits = 200;
+	options.rate = 10.0;
+	options.sendWindow = -1.0;
+	options.port = 61620;
+	options.seed = 0x5eed1234;
+	options.timeout = 30.0;
+	options.settle = 0.5;
+	
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc)
+			clientCounts = [[NSString stringWithUTF8String:argv[++i]] componentsSeparatedByString:@","];
+		else if (strcmp(argv[i], "--edits") == 0 && i + 1 < argc)
+			options.edits = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc)
+			options.rate = strtod(argv[++i], NULL);
+		else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc)
+			options.sendWindow = strtod(argv[++i], NULL);
+		else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+			options.port = (UInt16) strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+			options.seed = (uint32_t) strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)
+			options.timeout = strtod(argv[++i], NULL);
+		else {
+			usage(argv[0]);
+			[pool release];
+			return 2;
+		}
+	}
+	if (options.seed == 0)
+		options.seed = 1; // xorshift never leaves 0
+	
+	PyGoWaveBundleWriter * writer = [PyGoWaveBundleWriter new];
+	int status = 0;
+	for (NSString * count in clientCounts) {
+		NSAutoreleasePool * runPool = [NSAutoreleasePool new];
+		if ([count intValue] <= 0 || !runLoad([count intValue], options, writer))
+			status = 1;
+		options.port++; // The last run's port may still be in TIME_WAIT
+		[runPool release];
+	}
+	[writer release];
+	[pool release];
+	return status;
+}
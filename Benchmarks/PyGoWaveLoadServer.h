@@ -0,0 +1,85 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ Stand-in PyGoWave server for load tests. It accepts any number of clients
+ on the loopback interface and serves one wave with one wavelet and one
+ blip. Logins always succeed; each client sees the same wave list.
+ 
+ Operation bundles are handled like the real server does: a bundle made
+ against an older version is transformed against everything committed
+ since, using the client library's own transformation as the reference.
+ The result is committed as the next version, acknowledged to the sender
+ and broadcast to every other client that opened the wavelet. The server
+ keeps the blip text, so acknowledgements and bundles carry checksums
+ the clients can verify, and the final text can be compared with theirs.
+ Only text insertions and deletions change the text.
+*/
+
+#define kPyGoWaveLoadWaveId		@"w+load"
+#define kPyGoWaveLoadWaveletId	@"w+load!conv+root"
+#define kPyGoWaveLoadBlipId		@"b+load"
+
+@class AsyncSocket;
+
+
+@interface PyGoWaveLoadServer : NSObject
+{
+	NSLock * m_lock;
+	NSThread * m_thread;
+	AsyncSocket * m_listenSocket;
+	NSMutableArray * m_sessions;
+	UInt16 m_port;
+	BOOL m_listening;
+	
+	NSMutableString * m_content;
+	NSMutableArray * m_history; // Operations of each version, transformed
+	NSString * m_blipsum;
+	NSString * m_creatorId;
+	NSUInteger m_bundles;
+	NSUInteger m_operations;
+	NSUInteger m_rejected;
+	uint64_t m_lastCommit;
+	uint64_t m_cpuTime;
+	NSUInteger m_messageId;
+}
+// The following are safe to read from any thread
+@property (readonly) NSInteger version;
+@property (readonly) NSString * content;
+@property (readonly) NSUInteger bundles;
+@property (readonly) NSUInteger operations;
+// Bundles with an unknown base version or operations outside the text
+@property (readonly) NSUInteger rejected;
+// PyGoWaveBenchNow() of the last commit, 0 if there was none
+@property (readonly) uint64_t lastCommit;
+// CPU time the server thread has used so far, in nanoseconds
+@property (readonly) uint64_t cpuTime;
+@property (readonly) UInt16 port;
+
+- (id)initWithContent:(NSString*)aContent;
+- (void)dealloc;
+
+// Listens on the loopback interface, on a thread of its own
+- (BOOL)startOnPort:(UInt16)aPort;
+// Disconnects all clients and ends the thread
+- (void)stop;
+
+@end
@@ -0,0 +1,488 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#import "PyGoWaveLoadServer.h"
+#import "PyGoWaveReplayBroker.h"
+#import "PyGoWaveBench.h"
+#import "PyGoWaveModel.h"
+#import "PyGoWaveOperations.h"
+#import "AsyncSocket.h"
+#import "JSON.h"
+#import <CommonCrypto/CommonDigest.h>
+
+// One connected client; only touched on the server thread
+@interface PyGoWaveLoadSession : NSObject
+{
+@public
+	AsyncSocket * socket;
+	NSString * rxKey;
+	NSString * viewerId;
+	BOOL open; // Has the wavelet's snapshot and gets its bundles
+}
+@end
+
+@implementation PyGoWaveLoadSession
+
+- (void)dealloc
+{
+	[socket release];
+	[rxKey release];
+	[viewerId release];
+	[super dealloc];
+}
+
+@end
+
+static NSString * blipsumOfString(NSString * aString)
+{
+	uint8_t hash[CC_SHA1_DIGEST_LENGTH];
+	const char * data = [aString UTF8String];
+	CC_SHA1(data, (CC_LONG) strlen(data), hash);
+	NSMutableString * sum = [NSMutableString stringWithCapacity:2 * CC_SHA1_DIGEST_LENGTH];
+	for (int i = 0; i < CC_SHA1_DIGEST_LENGTH; i++)
+		[sum appendFormat:@"%02x", hash[i]];
+	return sum;
+}
+
+#pragma mark -
+
+@interface PyGoWaveLoadServer ()
+- (void)shutdown;
+- (void)sampleCPUTime;
+@end
+
+@implementation PyGoWaveLoadServer
+
+@synthesize port = m_port;
+
+#pragma mark Initialization and Deallocation
+
+- (id)initWithContent:(NSString*)aContent
+{
+	if (self = [super init]) {
+		m_lock = [NSLock new];
+		m_sessions = [NSMutableArray new];
+		m_port = 0;
+		m_listening = NO;
+		m_content = [aContent mutableCopy];
+		m_history = [NSMutableArray new];
+		m_blipsum = [blipsumOfString(m_content) copy];
+		m_creatorId = nil;
+		m_bundles = 0;
+		m_operations = 0;
+		m_rejected = 0;
+		m_lastCommit = 0;
+		m_cpuTime = 0;
+		m_messageId = 0;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_lock release];
+	[m_thread release];
+	[m_listenSocket release];
+	[m_sessions release];
+	[m_content release];
+	[m_history release];
+	[m_blipsum release];
+	[m_creatorId release];
+	[super dealloc];
+}
+
+#pragma mark Server thread
+
+- (void)run:(NSConditionLock*)aStarted
+{
+	NSAutoreleasePool * pool = [NSAutoreleasePool new];
+	[aStarted lock];
+	m_listenSocket = [[AsyncSocket alloc] initWithDelegate:self];
+	NSError * error = nil;
+	m_listening = [m_listenSocket acceptOnInterface:@"localhost" port:m_port error:&error];
+	if (!m_listening)
+		NSLog(@"Load: Cannot listen on port %d: %@", m_port, error);
+	[aStarted unlockWithCondition:1];
+	[pool release];
+	
+	while (m_listening && ![[NSThread currentThread] isCancelled]) {
+		pool = [NSAutoreleasePool new];
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate distantFuture]];
+		[pool release];
+	}
+}
+
+- (void)shutdown
+{
+	// Disconnecting calls onSocketDidDisconnect:, which removes the session
+	for (PyGoWaveLoadSession * session in [[m_sessions copy] autorelease])
+		[session->socket disconnect];
+	[m_sessions removeAllObjects];
+	[m_listenSocket disconnect];
+	[self sampleCPUTime];
+	m_listening = NO;
+}
+
+- (void)sampleCPUTime
+{
+	m_cpuTime = PyGoWaveBenchThreadCPUTime();
+}
+
+- (PyGoWaveLoadSession*)sessionForSocket:(AsyncSocket*)aSocket
+{
+	for (PyGoWaveLoadSession * session in m_sessions) {
+		if (session->socket == aSocket)
+			return session;
+	}
+	return nil;
+}
+
+- (void)sendMessages:(NSArray*)sMessages toSession:(PyGoWaveLoadSession*)aSession waveletId:(NSString*)aWaveletId
+{
+	NSString * head = [NSString stringWithFormat:@"MESSAGE\ndestination:%@.%@.waveop\nmessage-id:%u\n\n", aSession->rxKey, aWaveletId, (unsigned) ++m_messageId];
+	NSMutableData * frame = [NSMutableData dataWithData:[head dataUsingEncoding:NSUTF8StringEncoding]];
+	[frame appendData:[[sMessages JSONRepresentation] dataUsingEncoding:NSUTF8StringEncoding]];
+	[frame appendData:[AsyncSocket ZeroData]];
+	[aSession->socket writeData:frame withTimeout:-1 tag:0];
+}
+
+- (void)sendMessageWithType:(NSString*)aType property:(id)aProperty toSession:(PyGoWaveLoadSession*)aSession waveletId:(NSString*)aWaveletId
+{
+	NSDictionary * msg = [NSDictionary dictionaryWithObjectsAndKeys:aType, @"type", aProperty, @"property", nil];
+	[self sendMessages:[NSArray arrayWithObject:msg] toSession:aSession waveletId:aWaveletId];
+}
+
+- (NSDictionary*)waveletDict
+{
+	NSNumber * now = [NSNumber numberWithUnsignedInt:(unsigned) [[NSDate date] timeIntervalSince1970]];
+	return [NSDictionary dictionaryWithObjectsAndKeys:
+			kPyGoWaveLoadWaveletId, @"id",
+			kPyGoWaveLoadWaveId, @"waveId",
+			m_creatorId, @"creator",
+			@"Load test", @"title",
+			[NSNumber numberWithBool:YES], @"isRoot",
+			now, @"creationTime",
+			now, @"lastModifiedTime",
+			[NSNumber numberWithInteger:[m_history count]], @"version",
+			[NSArray arrayWithObject:m_creatorId], @"participants",
+			kPyGoWaveLoadBlipId, @"rootBlipId",
+			nil];
+}
+
+// Applies committed operations to the blip text; returns NO if one does not fit
+- (BOOL)applyOperations:(NSArray*)sOperations toContent:(NSMutableString*)aContent
+{
+	for (PyGoWaveOperation * op in sOperations) {
+		if (op.type == PyGoWaveOperation_DOCUMENT_INSERT) {
+			if (op.index < 0 || op.index > (NSInteger) [aContent length])
+				return NO;
+			[aContent insertString:op.property atIndex:op.index];
+		}
+		else if (op.type == PyGoWaveOperation_DOCUMENT_DELETE) {
+			NSInteger length = [op.property intValue];
+			if (op.index < 0 || length < 0 || op.index + length > (NSInteger) [aContent length])
+				return NO;
+			[aContent deleteCharactersInRange:NSMakeRange(op.index, length)];
+		}
+	}
+	return YES;
+}
+
+- (void)receiveBundle:(NSDictionary*)aProperty fromSession:(PyGoWaveLoadSession*)aSession
+{
+	NSInteger baseVersion = [[aProperty valueForKey:@"version"] intValue];
+	NSInteger version = [m_history count];
+	if (baseVersion < 0 || baseVersion > version) {
+		NSLog(@"Load: Bundle from '%@' is based on unknown version %d", aSession->viewerId, baseVersion);
+		[m_lock lock];
+		m_rejected++;
+		[m_lock unlock];
+		return;
+	}
+	
+	// Bring the bundle up to date; the manager's operations end up transformed
+	PyGoWaveOpManager * incoming = [[PyGoWaveOpManager alloc] initWithWaveId:kPyGoWaveLoadWaveId waveletId:kPyGoWaveLoadWaveletId contributorId:aSession->viewerId];
+	[incoming addSerializedOperations:[aProperty valueForKey:@"operations"]];
+	for (NSInteger v = baseVersion; v < version; v++) {
+		for (PyGoWaveOperation * committed in [m_history objectAtIndex:v])
+			[incoming transformInputOperation:committed];
+	}
+	NSArray * ops = [[incoming operations] copy];
+	NSArray * serialized = [incoming serializeOperations];
+	[incoming release];
+	
+	// A bundle that does not fit is committed empty; its sender will not converge
+	NSMutableString * content = [m_content mutableCopy];
+	BOOL bFits = [self applyOperations:ops toContent:content];
+	if (!bFits) {
+		NSLog(@"Load: Bundle from '%@' does not fit the text at version %d; committed without effect", aSession->viewerId, version);
+		[ops release];
+		ops = [NSArray new];
+		serialized = ops;
+	}
+	[m_lock lock];
+	if (bFits) {
+		[m_content setString:content];
+		[m_blipsum release];
+		m_blipsum = [blipsumOfString(m_content) copy];
+	}
+	else
+		m_rejected++;
+	[m_history addObject:ops];
+	m_bundles++;
+	m_operations += [ops count];
+	m_lastCommit = PyGoWaveBenchNow();
+	[m_lock unlock];
+	[content release];
+	
+	NSDictionary * blipsums = [NSDictionary dictionaryWithObject:m_blipsum forKey:kPyGoWaveLoadBlipId];
+	NSNumber * newVersion = [NSNumber numberWithInteger:version + 1];
+	NSNumber * timestamp = toJsonTimestamp([NSDate date]);
+	[self sendMessageWithType:@"OPERATION_MESSAGE_BUNDLE_ACK"
+					 property:[NSDictionary dictionaryWithObjectsAndKeys:
+							   newVersion, @"version",
+							   blipsums, @"blipsums",
+							   [NSDictionary dictionary], @"newblips",
+							   timestamp, @"timestamp",
+							   nil]
+					toSession:aSession
+					waveletId:kPyGoWaveLoadWaveletId];
+	NSDictionary * bundle = [NSDictionary dictionaryWithObjectsAndKeys:
+							 newVersion, @"version",
+							 serialized, @"operations",
+							 blipsums, @"blipsums",
+							 timestamp, @"timestamp",
+							 aSession->viewerId, @"contributor",
+							 nil];
+	[ops release];
+	for (PyGoWaveLoadSession * session in m_sessions) {
+		if (session != aSession && session->open)
+			[self sendMessageWithType:@"OPERATION_MESSAGE_BUNDLE" property:bundle toSession:session waveletId:kPyGoWaveLoadWaveletId];
+	}
+}
+
+- (void)receiveMessage:(NSDictionary*)aMessage fromSession:(PyGoWaveLoadSession*)aSession waveletId:(NSString*)aWaveletId
+{
+	NSString * type = [aMessage valueForKey:@"type"];
+	id property = [aMessage valueForKey:@"property"];
+	
+	if ([aWaveletId isEqual:@"login"]) {
+		if (![type isEqual:@"LOGIN"])
+			return;
+		[aSession->viewerId release];
+		aSession->viewerId = [[NSString alloc] initWithFormat:@"%@@localhost", [property valueForKey:@"username"]];
+		if (m_creatorId == nil)
+			m_creatorId = [aSession->viewerId copy];
+		[self sendMessageWithType:@"LOGIN"
+						 property:[NSDictionary dictionaryWithObjectsAndKeys:aSession->rxKey, @"rx_key", aSession->rxKey, @"tx_key", aSession->viewerId, @"viewer_id", nil]
+						toSession:aSession
+						waveletId:@"login"];
+	}
+	else if ([aWaveletId isEqual:@"manager"]) {
+		if ([type isEqual:@"WAVE_LIST"]) {
+			NSDictionary * wavelets = [NSDictionary dictionaryWithObject:[self waveletDict] forKey:kPyGoWaveLoadWaveletId];
+			[self sendMessageWithType:@"WAVE_LIST" property:[NSDictionary dictionaryWithObject:wavelets forKey:kPyGoWaveLoadWaveId] toSession:aSession waveletId:@"manager"];
+		}
+		else if ([type isEqual:@"PARTICIPANT_INFO"]) {
+			NSMutableDictionary * infos = [NSMutableDictionary dictionary];
+			for (NSString * aId in property) {
+				[infos setObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								  aId, @"displayName",
+								  @"", @"thumbnailUrl",
+								  @"", @"profileUrl",
+								  [NSNumber numberWithBool:NO], @"isBot",
+								  nil]
+						  forKey:aId];
+			}
+			[self sendMessageWithType:@"PARTICIPANT_INFO" property:infos toSession:aSession waveletId:@"manager"];
+		}
+		else if ([type isEqual:@"PING"])
+			[self sendMessageWithType:@"PONG" property:property toSession:aSession waveletId:@"manager"];
+	}
+	else if ([aWaveletId isEqual:kPyGoWaveLoadWaveletId]) {
+		if ([type isEqual:@"WAVELET_OPEN"]) {
+			NSNumber * now = toJsonTimestamp([NSDate date]);
+			NSDictionary * blip = [NSDictionary dictionaryWithObjectsAndKeys:
+								   [NSString stringWithString:m_content], @"content",
+								   [NSArray array], @"elements",
+								   m_creatorId, @"creator",
+								   [NSArray array], @"contributors",
+								   now, @"creationTime",
+								   now, @"lastModifiedTime",
+								   [NSNumber numberWithInteger:[m_history count]], @"version",
+								   [NSNumber numberWithBool:YES], @"submitted",
+								   nil];
+			[self sendMessageWithType:@"WAVELET_OPEN"
+							 property:[NSDictionary dictionaryWithObjectsAndKeys:
+									   [self waveletDict], @"wavelet",
+									   [NSDictionary dictionaryWithObject:blip forKey:kPyGoWaveLoadBlipId], @"blips",
+									   nil]
+							toSession:aSession
+							waveletId:aWaveletId];
+			aSession->open = YES;
+		}
+		else if ([type isEqual:@"WAVELET_CLOSE"])
+			aSession->open = NO;
+		else if ([type isEqual:@"OPERATION_MESSAGE_BUNDLE"])
+			[self receiveBundle:property fromSession:aSession];
+	}
+}
+
+- (void)receiveFrame:(NSData*)aData fromSession:(PyGoWaveLoadSession*)aSession
+{
+	NSString * command, * body;
+	NSDictionary * headers;
+	if (!PyGoWaveStompParseFrame(aData, &command, &headers, &body))
+		return;
+	
+	if ([command isEqual:@"CONNECT"]) {
+		NSString * frame = [NSString stringWithFormat:@"CONNECTED\nsession:load-%p\n\n", aSession];
+		NSMutableData * data = [NSMutableData dataWithData:[frame dataUsingEncoding:NSUTF8StringEncoding]];
+		[data appendData:[AsyncSocket ZeroData]];
+		[aSession->socket writeData:data withTimeout:-1 tag:0];
+	}
+	else if ([command isEqual:@"SUBSCRIBE"]) {
+		// The first subscription is to "<key>.login.waveop"; the key stays the same after login
+		NSArray * routing_key = [[headers objectForKey:@"destination"] componentsSeparatedByString:@"."];
+		if (aSession->rxKey == nil && [routing_key count] == 3)
+			aSession->rxKey = [[routing_key objectAtIndex:0] copy];
+	}
+	else if ([command isEqual:@"SEND"]) {
+		NSArray * routing_key = [[headers objectForKey:@"destination"] componentsSeparatedByString:@"."];
+		id msg = [body JSONValue];
+		if ([routing_key count] != 3 || aSession->rxKey == nil || ![msg isKindOfClass:[NSDictionary class]]) {
+			NSLog(@"Load: Ignoring malformed message to '%@'", [headers objectForKey:@"destination"]);
+			return;
+		}
+		[self receiveMessage:msg fromSession:aSession waveletId:[routing_key objectAtIndex:1]];
+	}
+}
+
+#pragma mark AsyncSocketDelegate
+
+- (void)onSocket:(AsyncSocket *)sock didAcceptNewSocket:(AsyncSocket *)newSocket
+{
+	PyGoWaveLoadSession * session = [PyGoWaveLoadSession new];
+	session->socket = [newSocket retain];
+	[m_sessions addObject:session];
+	[session release];
+}
+
+- (void)onSocket:(AsyncSocket *)sock didConnectToHost:(NSString *)host port:(UInt16)port
+{
+	[sock readDataToData:[AsyncSocket ZeroData] withTimeout:-1 tag:0];
+}
+
+- (void)onSocket:(AsyncSocket *)sock didReadData:(NSData *)data withTag:(long)tag
+{
+	PyGoWaveLoadSession * session = [self sessionForSocket:sock];
+	if (session != nil)
+		[self receiveFrame:data fromSession:session];
+	[sock readDataToData:[AsyncSocket ZeroData] withTimeout:-1 tag:0];
+}
+
+- (void)onSocketDidDisconnect:(AsyncSocket *)sock
+{
+	PyGoWaveLoadSession * session = [self sessionForSocket:sock];
+	if (session != nil)
+		[m_sessions removeObject:session];
+}
+
+#pragma mark Public methods
+
+- (NSInteger)version
+{
+	[m_lock lock];
+	NSInteger version = [m_history count];
+	[m_lock unlock];
+	return version;
+}
+
+- (NSString*)content
+{
+	[m_lock lock];
+	NSString * content = [NSString stringWithString:m_content];
+	[m_lock unlock];
+	return content;
+}
+
+- (NSUInteger)bundles
+{
+	[m_lock lock];
+	NSUInteger bundles = m_bundles;
+	[m_lock unlock];
+	return bundles;
+}
+
+- (NSUInteger)operations
+{
+	[m_lock lock];
+	NSUInteger operations = m_operations;
+	[m_lock unlock];
+	return operations;
+}
+
+- (NSUInteger)rejected
+{
+	[m_lock lock];
+	NSUInteger rejected = m_rejected;
+	[m_lock unlock];
+	return rejected;
+}
+
+- (uint64_t)lastCommit
+{
+	[m_lock lock];
+	uint64_t lastCommit = m_lastCommit;
+	[m_lock unlock];
+	return lastCommit;
+}
+
+- (uint64_t)cpuTime
+{
+	if (m_thread != nil && m_listening)
+		[self performSelector:@selector(sampleCPUTime) onThread:m_thread withObject:nil waitUntilDone:YES];
+	return m_cpuTime;
+}
+
+- (BOOL)startOnPort:(UInt16)aPort
+{
+	if (m_thread != nil)
+		return NO;
+	m_port = aPort;
+	NSConditionLock * started = [[NSConditionLock alloc] initWithCondition:0];
+	m_thread = [[NSThread alloc] initWithTarget:self selector:@selector(run:) object:started];
+	[m_thread start];
+	[started lockWhenCondition:1];
+	[started unlock];
+	[started release];
+	return m_listening;
+}
+
+- (void)stop
+{
+	if (m_thread == nil || [m_thread isFinished])
+		return;
+	[self performSelector:@selector(shutdown) onThread:m_thread withObject:nil waitUntilDone:YES];
+	[m_thread cancel];
+}
+
+@end
@@ -0,0 +1,278 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#import "PyGoWaveBench.h"
+#import "PyGoWaveReplayBroker.h"
+#import "PyGoWaveController.h"
+#import "PyGoWaveTrace.h"
+#import "PyGoWaveBundleWriter.h"
+#import "SBJsonParser.h"
+
+/*
+ End-to-end replay: a real PyGoWaveController connects to the stand-in broker,
+ which plays back a captured session. Each server message is timed from the
+ broker writing its frame to the controller having applied it, so the time
+ covers the socket, STOMP parsing, JSON decoding, transformation and the
+ model update. Prints "replay.session" and one "replay.endToEnd" result per
+ message type, in the format of the benchmark suite, followed by a
+ "replay.memory" line with the resident size before the controller connected,
+ after the replay and at its peak, in bytes, and a "replay.intern" line with
+ the string intern cache hits and misses of all parsers and the heap
+ allocations of the whole process per applied message. Running once with
+ --no-intern gives the numbers without the cache.
+*/
+
+// Where the controller finishes with a message; all run on its owner thread
+@interface PyGoWaveController (ReplayHooks)
+- (void)processMessageWithWaveletId:(NSString*)aId type:(NSString*)aType property:(id)aProperty;
+- (void)applyRemoteItems:(NSArray*)aItems toWavelet:(PyGoWaveWavelet*)aWavelet;
+- (void)applyAckItem:(id)aItem toWavelet:(PyGoWaveWavelet*)aWavelet;
+- (SBJsonParser*)jsonParserForCurrentThread;
+@end
+
+@interface PyGoWaveReplayController : PyGoWaveController
+{
+	PyGoWaveReplayTracker * m_tracker;
+	NSMutableSet * m_parsers; // Every parser that decoded messages, for their intern counters
+	BOOL m_internStrings;
+}
+- (id)initWithTracker:(PyGoWaveReplayTracker*)aTracker internStrings:(BOOL)bIntern;
+- (NSUInteger)internHits;
+- (NSUInteger)internMisses;
+@end
+
+@implementation PyGoWaveReplayController
+
+- (id)initWithTracker:(PyGoWaveReplayTracker*)aTracker internStrings:(BOOL)bIntern
+{
+	if (self = [super init]) {
+		m_tracker = [aTracker retain];
+		m_internStrings = bIntern;
+		self.jsonParser.internStrings = bIntern;
+		m_parsers = [[NSMutableSet alloc] initWithObjects:self.jsonParser, nil];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_tracker release];
+	[m_parsers release];
+	[super dealloc];
+}
+
+- (SBJsonParser*)jsonParserForCurrentThread
+{
+	SBJsonParser * parser = [super jsonParserForCurrentThread];
+	@synchronized (m_parsers) {
+		if (![m_parsers containsObject:parser]) {
+			parser.internStrings = m_internStrings;
+			[m_parsers addObject:parser];
+		}
+	}
+	return parser;
+}
+
+// Read once the replay is over; the counters are not synchronized
+- (NSUInteger)internHits
+{
+	NSUInteger hits = 0;
+	@synchronized (m_parsers) {
+		for (SBJsonParser * parser in m_parsers)
+			hits += parser.internHits;
+	}
+	return hits;
+}
+
+- (NSUInteger)internMisses
+{
+	NSUInteger misses = 0;
+	@synchronized (m_parsers) {
+		for (SBJsonParser * parser in m_parsers)
+			misses += parser.internMisses;
+	}
+	return misses;
+}
+
+- (void)processMessageWithWaveletId:(NSString*)aId type:(NSString*)aType property:(id)aProperty
+{
+	[super processMessageWithWaveletId:aId type:aType property:aProperty];
+	[m_tracker appliedMessageWithWaveletId:aId type:aType version:-1];
+}
+
+- (void)applyRemoteItems:(NSArray*)aItems toWavelet:(PyGoWaveWavelet*)aWavelet
+{
+	[super applyRemoteItems:aItems toWavelet:aWavelet];
+	for (id item in aItems)
+		[m_tracker appliedMessageWithWaveletId:aWavelet.waveletId type:@"OPERATION_MESSAGE_BUNDLE" version:[item version]];
+}
+
+- (void)applyAckItem:(id)aItem toWavelet:(PyGoWaveWavelet*)aWavelet
+{
+	[super applyAckItem:aItem toWavelet:aWavelet];
+	[m_tracker appliedMessageWithWaveletId:aWavelet.waveletId type:@"OPERATION_MESSAGE_BUNDLE_ACK" version:[aItem version]];
+}
+
+@end
+
+#pragma mark -
+
+static void usage(const char * aName)
+{
+	fprintf(stderr,
+			"usage: %s [--speed recorded|max] [--port N] [--pipelined] [--parallel] [--no-intern] [--timeout SECONDS] [--trace FILE] CAPTURE\n"
+			"Replays a STOMP capture against a PyGoWaveController and prints one JSON result per line.\n"
+			"--no-intern turns off the parsers' string intern cache.\n"
+			"--trace writes the processing spans of the replay as Chrome trace JSON.\n",
+			aName);
+}
+
+int main(int argc, const char * argv[])
+{
+	NSAutoreleasePool * pool = [NSAutoreleasePool new];
+	NSString * capturePath = nil, * tracePath = nil;
+	BOOL bRecordedSpeed = NO, bPipelined = NO, bParallel = NO, bIntern = YES;
+	UInt16 port = 61614;
+	NSTimeInterval idleTimeout = 10.0;
+	
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+			bRecordedSpeed = strcmp(argv[++i], "recorded") == 0;
+		else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+			port = (UInt16) strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--pipelined") == 0)
+			bPipelined = YES;
+		else if (strcmp(argv[i], "--parallel") == 0)
+			bParallel = YES;
+		else if (strcmp(argv[i], "--no-intern") == 0)
+			bIntern = NO;
+		else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)
+			idleTimeout = strtod(argv[++i], NULL);
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+			tracePath = [NSString stringWithUTF8String:argv[++i]];
+		else if (argv[i][0] != '-' && capturePath == nil)
+			capturePath = [NSString stringWithUTF8String:argv[i]];
+		else {
+			capturePath = nil;
+			break;
+		}
+	}
+	if (capturePath == nil) {
+		usage(argv[0]);
+		[pool release];
+		return 2;
+	}
+	
+	NSDictionary * params = [NSDictionary dictionaryWithObjectsAndKeys:
+							 bRecordedSpeed ? @"recorded" : @"max", @"speed",
+							 bParallel ? @"parallel" : (bPipelined ? @"pipelined" : @"inline"), @"mode",
+							 [NSNumber numberWithBool:bIntern], @"intern",
+							 nil];
+	PyGoWaveReplayTracker * tracker = [[PyGoWaveReplayTracker alloc] initWithParams:params];
+	PyGoWaveReplayBroker * broker = [[PyGoWaveReplayBroker alloc] initWithCaptureFile:capturePath tracker:tracker];
+	broker.recordedSpeed = bRecordedSpeed;
+	if (broker == nil || ![broker startOnPort:port]) {
+		[tracker release];
+		[pool release];
+		return 1;
+	}
+	
+	if (tracePath != nil)
+		[PyGoWaveTrace startWithCapacity:65536];
+	
+	uint64_t residentAtStart = PyGoWaveBenchResidentBytes();
+	PyGoWaveBenchCountHeapAllocations();
+	long long heapAtStart = PyGoWaveBenchHeapAllocations();
+	PyGoWaveReplayController * controller = [[PyGoWaveReplayController alloc] initWithTracker:tracker internStrings:bIntern];
+	controller.persistentParticipants = NO;
+	controller.pipelined = bPipelined;
+	controller.parallelWavelets = bParallel;
+	[controller connectToHost:@"localhost" username:@"replay" password:@"replay" stompPort:port stompUsername:@"replay" stompPassword:@"replay"];
+	
+	// Until every timed message is applied, or nothing happens for a while
+	NSUInteger lastApplied = 0;
+	NSTimeInterval lastProgress = [NSDate timeIntervalSinceReferenceDate];
+	while (!(tracker.allSent && tracker.outstanding == 0)) {
+		NSAutoreleasePool * loopPool = [NSAutoreleasePool new];
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+		[loopPool release];
+		NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+		if (tracker.applied != lastApplied) {
+			lastApplied = tracker.applied;
+			lastProgress = now;
+		}
+		else if (now - lastProgress > idleTimeout) {
+			NSLog(@"Replay: No progress for %.0f seconds, %u messages still outstanding", idleTimeout, tracker.outstanding);
+			break;
+		}
+	}
+	long long heapAllocations = heapAtStart < 0 ? -1 : PyGoWaveBenchHeapAllocations() - heapAtStart;
+	if (tracker.unmatched > 0)
+		NSLog(@"Replay: %u applied messages were not in the capture", tracker.unmatched);
+	if (tracePath != nil) {
+		[PyGoWaveTrace stop];
+		if (![PyGoWaveTrace writeToFile:tracePath])
+			NSLog(@"Replay: Could not write trace to %@", tracePath);
+	}
+	
+	PyGoWaveBenchSuite * suite = [PyGoWaveBenchSuite new];
+	for (PyGoWaveBenchRecorder * rec in [tracker recorders])
+		[suite report:rec];
+	[suite release];
+	
+	PyGoWaveBundleWriter * writer = [PyGoWaveBundleWriter new];
+	[writer appendValue:[NSDictionary dictionaryWithObjectsAndKeys:
+						 @"replay.memory", @"benchmark",
+						 params, @"params",
+						 [NSNumber numberWithUnsignedLongLong:residentAtStart], @"residentBytesAtStart",
+						 [NSNumber numberWithUnsignedLongLong:PyGoWaveBenchResidentBytes()], @"residentBytesAtEnd",
+						 [NSNumber numberWithUnsignedLongLong:PyGoWaveBenchPeakResidentBytes()], @"peakResidentBytes",
+						 nil]];
+	[writer appendBytes:"\n" length:1];
+	
+	// Includes the broker writing the frames, which is the same with and without the cache
+	double messages = tracker.applied > 0 ? (double) tracker.applied : 1.0;
+	NSUInteger internHits = [controller internHits], internMisses = [controller internMisses];
+	[writer appendValue:[NSDictionary dictionaryWithObjectsAndKeys:
+						 @"replay.intern", @"benchmark",
+						 params, @"params",
+						 [NSNumber numberWithUnsignedInteger:tracker.applied], @"messages",
+						 [NSNumber numberWithUnsignedInteger:internHits], @"internHits",
+						 [NSNumber numberWithUnsignedInteger:internMisses], @"internMisses",
+						 [NSNumber numberWithDouble:internHits / messages], @"internHitsPerMessage",
+						 [NSNumber numberWithDouble:internMisses / messages], @"internMissesPerMessage",
+						 heapAllocations < 0 ? (id)[NSNull null] : [NSNumber numberWithLongLong:heapAllocations], @"heapAllocations",
+						 heapAllocations < 0 ? (id)[NSNull null] : [NSNumber numberWithDouble:heapAllocations / messages], @"heapAllocationsPerMessage",
+						 nil]];
+	[writer appendBytes:"\n" length:1];
+	fwrite([[writer data] bytes], 1, [[writer data] length], stdout);
+	fflush(stdout);
+	[writer release];
+	
+	[controller disconnectFromHost];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+	[controller release];
+	[broker release];
+	[tracker release];
+	[pool release];
+	return 0;
+}
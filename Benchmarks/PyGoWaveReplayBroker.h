@@ -0,0 +1,107 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ Stand-in STOMP broker for end-to-end replay benchmarks. It accepts one
+ client on the loopback interface and plays back the received frames of a
+ capture made with CRVStompClient's startCaptureToFile:.
+ 
+ The client's own handshake (CONNECT, LOGIN and WAVE_LIST) is awaited
+ before the frames recorded after it are sent; everything the recorded user
+ did by hand is not reproduced, only the server's side of it. Frames go out
+ either at their recorded pace or as fast as the socket takes them.
+*/
+
+@class AsyncSocket;
+@class PyGoWaveBenchRecorder;
+
+// Splits a raw STOMP frame; returns NO if it has no command line
+BOOL PyGoWaveStompParseFrame(NSData * aData, NSString ** aCommand, NSDictionary ** aHeaders, NSString ** aBody);
+
+
+// Matches sent messages to the time the controller finished applying them
+@interface PyGoWaveReplayTracker : NSObject
+{
+	NSLock * m_lock;
+	NSDictionary * m_params;
+	NSMutableDictionary * m_pending;
+	NSMutableDictionary * m_recorders;
+	PyGoWaveBenchRecorder * m_session;
+	NSUInteger m_outstanding;
+	NSUInteger m_applied;
+	NSUInteger m_unmatched;
+	uint64_t m_firstSent;
+	uint64_t m_lastApplied;
+	BOOL m_allSent;
+}
+@property (readonly) NSUInteger outstanding;
+@property (readonly) NSUInteger applied;
+@property (readonly) NSUInteger unmatched;
+@property (readonly) BOOL allSent;
+
++ (NSString*)keyForWaveletId:(NSString*)aWaveletId type:(NSString*)aType version:(NSInteger)aVersion;
+
+- (id)initWithParams:(NSDictionary*)sParams;
+- (void)dealloc;
+
+// Keys of the messages of one frame, see keyForWaveletId:type:version:
+- (void)sentMessagesWithKeys:(NSArray*)sKeys;
+- (void)appliedMessageWithWaveletId:(NSString*)aWaveletId type:(NSString*)aType version:(NSInteger)aVersion;
+- (void)finishSending;
+
+// "replay.session" over all messages, then one recorder per message type; call once
+- (NSArray*)recorders;
+
+@end
+
+#pragma mark -
+
+@interface PyGoWaveReplayBroker : NSObject
+{
+	NSArray * m_records;
+	PyGoWaveReplayTracker * m_tracker;
+	BOOL m_recordedSpeed;
+	UInt16 m_port;
+	
+	NSThread * m_thread;
+	AsyncSocket * m_listenSocket;
+	AsyncSocket * m_clientSocket;
+	NSCountedSet * m_clientFrames;
+	NSUInteger m_cursor;
+	uint64_t m_syncTime;
+	double m_syncOffset;
+	BOOL m_pumpScheduled;
+	BOOL m_listening;
+}
+@property (readonly) NSUInteger frameCount;
+// Send frames at the pace they were recorded in (default NO)
+@property BOOL recordedSpeed;
+@property (readonly) UInt16 port;
+
+// Returns nil if the file is not a readable capture
+- (id)initWithCaptureFile:(NSString*)aPath tracker:(PyGoWaveReplayTracker*)aTracker;
+- (void)dealloc;
+
+// Listens on the loopback interface, on a thread of its own
+- (BOOL)startOnPort:(UInt16)aPort;
+
+@end
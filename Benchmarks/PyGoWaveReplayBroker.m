@@ -0,0 +1,438 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#import "PyGoWaveReplayBroker.h"
+#import "PyGoWaveBench.h"
+#import "CRVStompClient.h"
+#import "AsyncSocket.h"
+#import "JSON.h"
+
+@interface PyGoWaveReplayRecord : NSObject
+{
+@public
+	char direction;
+	double offset;
+	NSData * data;
+	NSString * signature; // Outgoing frames the client sends by itself
+	NSUInteger ordinal;
+	NSArray * keys;
+}
+@end
+
+@implementation PyGoWaveReplayRecord
+
+- (void)dealloc
+{
+	[data release];
+	[signature release];
+	[keys release];
+	[super dealloc];
+}
+
+@end
+
+BOOL PyGoWaveStompParseFrame(NSData * aData, NSString ** aCommand, NSDictionary ** aHeaders, NSString ** aBody)
+{
+	NSString * frame = [[[NSString alloc] initWithData:aData encoding:NSUTF8StringEncoding] autorelease];
+	NSRange terminator = [frame rangeOfString:[NSString stringWithFormat:@"%C", (unichar) 0]];
+	if (terminator.location != NSNotFound)
+		frame = [frame substringToIndex:terminator.location];
+	frame = [frame stringByTrimmingCharactersInSet:[NSCharacterSet newlineCharacterSet]];
+	NSRange split = [frame rangeOfString:@"\n\n"];
+	NSString * head = split.location != NSNotFound ? [frame substringToIndex:split.location] : frame;
+	NSArray * lines = [head componentsSeparatedByString:@"\n"];
+	if ([lines count] == 0 || [[lines objectAtIndex:0] length] == 0)
+		return NO;
+	
+	*aCommand = [lines objectAtIndex:0];
+	NSMutableDictionary * headers = [NSMutableDictionary dictionary];
+	for (NSUInteger i = 1; i < [lines count]; i++) {
+		NSString * line = [lines objectAtIndex:i];
+		NSRange colon = [line rangeOfString:@":"];
+		if (colon.location != NSNotFound)
+			[headers setObject:[line substringFromIndex:colon.location + 1] forKey:[line substringToIndex:colon.location]];
+	}
+	*aHeaders = headers;
+	*aBody = split.location != NSNotFound ? [frame substringFromIndex:split.location + 2] : @"";
+	return YES;
+}
+
+// Wavelet id of a "<key>.<id>.waveop" destination
+static NSString * waveletIdOfDestination(NSString * aDestination)
+{
+	NSArray * routing_key = [aDestination componentsSeparatedByString:@"."];
+	return [routing_key count] == 3 ? [routing_key objectAtIndex:1] : nil;
+}
+
+// Handshake messages the client sends without user interaction
+static NSString * clientFrameSignature(NSString * aCommand, NSString * aBody, SBJsonParser * aParser)
+{
+	if ([aCommand isEqual:@"CONNECT"])
+		return @"CONNECT";
+	if (![aCommand isEqual:@"SEND"])
+		return nil;
+	NSString * type = [[aParser objectWithString:aBody] valueForKey:@"type"];
+	if ([type isEqual:@"LOGIN"] || [type isEqual:@"WAVE_LIST"])
+		return [@"SEND " stringByAppendingString:type];
+	return nil;
+}
+
+#pragma mark -
+
+@implementation PyGoWaveReplayTracker
+
+@synthesize outstanding = m_outstanding, applied = m_applied, unmatched = m_unmatched, allSent = m_allSent;
+
++ (NSString*)keyForWaveletId:(NSString*)aWaveletId type:(NSString*)aType version:(NSInteger)aVersion
+{
+	// Bundles and acknowledgements are told apart by version; the controller may drop stale ones
+	if ([aType isEqual:@"OPERATION_MESSAGE_BUNDLE"] || [aType isEqual:@"OPERATION_MESSAGE_BUNDLE_ACK"])
+		return [NSString stringWithFormat:@"%@ %@ %d", aWaveletId, aType, aVersion];
+	return [NSString stringWithFormat:@"%@ %@", aWaveletId, aType];
+}
+
+#pragma mark Initialization and Deallocation
+
+- (id)initWithParams:(NSDictionary*)sParams
+{
+	if (self = [super init]) {
+		m_lock = [NSLock new];
+		m_params = [sParams copy];
+		m_pending = [NSMutableDictionary new];
+		m_recorders = [NSMutableDictionary new];
+		m_session = [[PyGoWaveBenchRecorder alloc] initWithName:@"replay.session" params:sParams];
+		m_outstanding = 0;
+		m_applied = 0;
+		m_unmatched = 0;
+		m_firstSent = 0;
+		m_lastApplied = 0;
+		m_allSent = NO;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_lock release];
+	[m_params release];
+	[m_pending release];
+	[m_recorders release];
+	[m_session release];
+	[super dealloc];
+}
+
+#pragma mark Public methods
+
+- (void)sentMessagesWithKeys:(NSArray*)sKeys
+{
+	NSNumber * now = [NSNumber numberWithUnsignedLongLong:PyGoWaveBenchNow()];
+	[m_lock lock];
+	if (m_firstSent == 0)
+		m_firstSent = [now unsignedLongLongValue];
+	for (NSString * key in sKeys) {
+		NSMutableArray * times = [m_pending objectForKey:key];
+		if (times == nil) {
+			times = [NSMutableArray new];
+			[m_pending setObject:times forKey:key];
+			[times release];
+		}
+		[times addObject:now];
+		m_outstanding++;
+	}
+	[m_lock unlock];
+}
+
+- (void)appliedMessageWithWaveletId:(NSString*)aWaveletId type:(NSString*)aType version:(NSInteger)aVersion
+{
+	uint64_t now = PyGoWaveBenchNow();
+	NSString * key = [PyGoWaveReplayTracker keyForWaveletId:aWaveletId type:aType version:aVersion];
+	[m_lock lock];
+	NSMutableArray * times = [m_pending objectForKey:key];
+	if ([times count] == 0)
+		m_unmatched++;
+	else {
+		PyGoWaveBenchRecorder * rec = [m_recorders objectForKey:aType];
+		if (rec == nil) {
+			NSMutableDictionary * params = [NSMutableDictionary dictionaryWithDictionary:m_params];
+			[params setObject:aType forKey:@"type"];
+			rec = [[PyGoWaveBenchRecorder alloc] initWithName:@"replay.endToEnd" params:params];
+			[m_recorders setObject:rec forKey:aType];
+			[rec release];
+		}
+		uint64_t latency = now - [[times objectAtIndex:0] unsignedLongLongValue];
+		[rec addSample:latency];
+		[m_session addSample:latency];
+		[times removeObjectAtIndex:0];
+		m_outstanding--;
+		m_applied++;
+		m_lastApplied = now;
+	}
+	[m_lock unlock];
+}
+
+- (void)finishSending
+{
+	[m_lock lock];
+	m_allSent = YES;
+	[m_lock unlock];
+}
+
+- (NSArray*)recorders
+{
+	[m_lock lock];
+	uint64_t elapsed = m_lastApplied > m_firstSent ? m_lastApplied - m_firstSent : 0;
+	[m_session addElapsed:elapsed];
+	NSMutableArray * result = [NSMutableArray arrayWithObject:m_session];
+	for (NSString * type in [[m_recorders allKeys] sortedArrayUsingSelector:@selector(compare:)]) {
+		PyGoWaveBenchRecorder * rec = [m_recorders objectForKey:type];
+		[rec addElapsed:elapsed];
+		[result addObject:rec];
+	}
+	[m_lock unlock];
+	return result;
+}
+
+@end
+
+#pragma mark -
+
+@interface PyGoWaveReplayBroker ()
+- (void)pump;
+@end
+
+@implementation PyGoWaveReplayBroker
+
+@synthesize recordedSpeed = m_recordedSpeed, port = m_port;
+
+#pragma mark Initialization and Deallocation
+
+- (id)initWithCaptureFile:(NSString*)aPath tracker:(PyGoWaveReplayTracker*)aTracker
+{
+	NSData * capture = [NSData dataWithContentsOfFile:aPath options:NSDataReadingMapped error:NULL];
+	if (capture == nil || [capture length] < 8 || memcmp([capture bytes], kCRVStompCaptureMagic, 8) != 0) {
+		NSLog(@"Replay: '%@' is not a STOMP capture", aPath);
+		[self release];
+		return nil;
+	}
+	if (self = [super init]) {
+		NSMutableArray * records = [NSMutableArray array];
+		NSCountedSet * signatures = [NSCountedSet set];
+		SBJsonParser * parser = [SBJsonParser new];
+		const uint8_t * bytes = [capture bytes];
+		NSUInteger length = [capture length], pos = 8;
+		while (pos + 13 <= length) {
+			NSAutoreleasePool * pool = [NSAutoreleasePool new];
+			PyGoWaveReplayRecord * rec = [PyGoWaveReplayRecord new];
+			NSSwappedDouble offset;
+			uint32_t size;
+			rec->direction = (char) bytes[pos];
+			memcpy(&offset, bytes + pos + 1, 8);
+			memcpy(&size, bytes + pos + 9, 4);
+			rec->offset = NSSwapLittleDoubleToHost(offset);
+			size = NSSwapLittleIntToHost(size);
+			pos += 13;
+			if (pos + size > length) {
+				NSLog(@"Replay: Capture '%@' is truncated", aPath);
+				[rec release];
+				[pool release];
+				break;
+			}
+			rec->data = [[NSData alloc] initWithBytes:bytes + pos length:size];
+			pos += size;
+			
+			NSString * command, * body;
+			NSDictionary * headers;
+			if (PyGoWaveStompParseFrame(rec->data, &command, &headers, &body)) {
+				if (rec->direction == '>') {
+					rec->signature = [clientFrameSignature(command, body, parser) copy];
+					if (rec->signature != nil) {
+						[signatures addObject:rec->signature];
+						rec->ordinal = [signatures countForObject:rec->signature];
+					}
+				}
+				else if ([command isEqual:@"MESSAGE"]) {
+					NSString * aWaveletId = waveletIdOfDestination([headers objectForKey:@"destination"]);
+					NSArray * msgs = [parser objectWithString:body];
+					NSMutableArray * keys = [NSMutableArray array];
+					// The login reply is handled before the controller goes online, so it is not timed
+					if (aWaveletId != nil && ![aWaveletId isEqual:@"login"] && [msgs isKindOfClass:[NSArray class]]) {
+						for (NSDictionary * msg in msgs) {
+							NSString * type = [msg valueForKey:@"type"];
+							if (type == nil)
+								continue;
+							NSInteger version = [[[msg valueForKey:@"property"] valueForKey:@"version"] intValue];
+							[keys addObject:[PyGoWaveReplayTracker keyForWaveletId:aWaveletId type:type version:version]];
+						}
+					}
+					rec->keys = [keys copy];
+				}
+			}
+			if (rec->direction == '<' || rec->signature != nil)
+				[records addObject:rec];
+			[rec release];
+			[pool release];
+		}
+		[parser release];
+		
+		m_records = [records copy];
+		m_tracker = [aTracker retain];
+		m_recordedSpeed = NO;
+		m_port = 0;
+		m_clientFrames = [NSCountedSet new];
+		m_cursor = 0;
+		m_syncTime = 0;
+		m_syncOffset = 0.0;
+		m_pumpScheduled = NO;
+		m_listening = NO;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_records release];
+	[m_tracker release];
+	[m_thread release];
+	[m_listenSocket release];
+	[m_clientSocket release];
+	[m_clientFrames release];
+	[super dealloc];
+}
+
+#pragma mark Broker thread
+
+- (void)run:(NSConditionLock*)aStarted
+{
+	NSAutoreleasePool * pool = [NSAutoreleasePool new];
+	[aStarted lock];
+	m_listenSocket = [[AsyncSocket alloc] initWithDelegate:self];
+	NSError * error = nil;
+	m_listening = [m_listenSocket acceptOnInterface:@"localhost" port:m_port error:&error];
+	if (!m_listening)
+		NSLog(@"Replay: Cannot listen on port %d: %@", m_port, error);
+	[aStarted unlockWithCondition:1];
+	[pool release];
+	
+	while (m_listening && ![[NSThread currentThread] isCancelled]) {
+		pool = [NSAutoreleasePool new];
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate distantFuture]];
+		[pool release];
+	}
+}
+
+// Sends recorded frames until the client has to catch up or the next one is not due yet
+- (void)pump
+{
+	m_pumpScheduled = NO;
+	NSUInteger count = [m_records count];
+	while (m_cursor < count) {
+		PyGoWaveReplayRecord * rec = [m_records objectAtIndex:m_cursor];
+		uint64_t now = PyGoWaveBenchNow();
+		if (rec->direction == '>') {
+			if ([m_clientFrames countForObject:rec->signature] < rec->ordinal)
+				return; // Continued when the client's frame arrives
+			m_syncTime = now;
+			m_syncOffset = rec->offset;
+			m_cursor++;
+			continue;
+		}
+		if (m_recordedSpeed && m_syncTime != 0) {
+			uint64_t due = m_syncTime + (uint64_t) (MAX(rec->offset - m_syncOffset, 0.0) * 1e9);
+			if (due > now) {
+				m_pumpScheduled = YES;
+				[self performSelector:@selector(pump) withObject:nil afterDelay:(due - now) / 1e9];
+				return;
+			}
+		}
+		if ([rec->keys count] > 0)
+			[m_tracker sentMessagesWithKeys:rec->keys];
+		[m_clientSocket writeData:rec->data withTimeout:-1 tag:0];
+		m_cursor++;
+	}
+	[m_tracker finishSending];
+}
+
+#pragma mark AsyncSocketDelegate
+
+- (void)onSocket:(AsyncSocket *)sock didAcceptNewSocket:(AsyncSocket *)newSocket
+{
+	if (m_clientSocket != nil) {
+		NSLog(@"Replay: Refusing a second client");
+		[newSocket disconnect];
+		return;
+	}
+	m_clientSocket = [newSocket retain];
+}
+
+- (void)onSocket:(AsyncSocket *)sock didConnectToHost:(NSString *)host port:(UInt16)port
+{
+	[sock readDataToData:[AsyncSocket ZeroData] withTimeout:-1 tag:0];
+}
+
+- (void)onSocket:(AsyncSocket *)sock didReadData:(NSData *)data withTag:(long)tag
+{
+	NSString * command, * body;
+	NSDictionary * headers;
+	if (PyGoWaveStompParseFrame(data, &command, &headers, &body)) {
+		SBJsonParser * parser = [SBJsonParser new];
+		NSString * signature = clientFrameSignature(command, body, parser);
+		[parser release];
+		if (signature != nil) {
+			[m_clientFrames addObject:signature];
+			if (!m_pumpScheduled)
+				[self pump];
+		}
+	}
+	[sock readDataToData:[AsyncSocket ZeroData] withTimeout:-1 tag:0];
+}
+
+- (void)onSocketDidDisconnect:(AsyncSocket *)sock
+{
+	if (sock == m_clientSocket) {
+		[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(pump) object:nil];
+		[m_clientSocket autorelease];
+		m_clientSocket = nil;
+	}
+}
+
+#pragma mark Public methods
+
+- (NSUInteger)frameCount
+{
+	return [m_records count];
+}
+
+- (BOOL)startOnPort:(UInt16)aPort
+{
+	if (m_thread != nil)
+		return NO;
+	m_port = aPort;
+	NSConditionLock * started = [[NSConditionLock alloc] initWithCondition:0];
+	m_thread = [[NSThread alloc] initWithTarget:self selector:@selector(run:) object:started];
+	[m_thread start];
+	[started lockWhenCondition:1];
+	[started unlock];
+	[started release];
+	return m_listening;
+}
+
+@end
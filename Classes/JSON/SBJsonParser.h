@@ -56,27 +56,71 @@
  JSON is mapped to Objective-C types in the following way:
  
  @li Null -> NSNull
- @li String -> NSMutableString
+ @li String -> NSMutableString (NSString if interned, see internStrings)
  @li Array -> NSMutableArray
  @li Object -> NSMutableDictionary
  @li Boolean -> NSNumber (initialised with -initWithBool:)
- @li Number -> NSDecimalNumber
+ @li Number -> NSNumber (NSDecimalNumber if decimalNumbers is set)
  
  Since Objective-C doesn't have a dedicated class for boolean values, these turns into NSNumber
  instances. These are initialised with the -initWithBool: method, and 
  round-trip back to JSON properly. (They won't silently suddenly become 0 or 1; they'll be
  represented as 'true' and 'false' again.)
  
- JSON numbers turn into NSDecimalNumber instances,
- as we can thus avoid any loss of precision. (JSON allows ridiculously large numbers.)
+ Integers of up to 18 digits turn into NSNumber instances holding a long long. Fractional
+ numbers turn into NSNumber instances holding a double when that double is exactly the
+ correctly rounded value; anything else (very long or very large numbers) falls back to
+ NSDecimalNumber, as we can thus avoid any loss of precision. (JSON allows ridiculously
+ large numbers.)
  
  */
 @interface SBJsonParser : SBJsonBase <SBJsonParser> {
     
 @private
     const char *c;
+    struct SBJsonInternEntry *internTable;
+    NSUInteger internHits, internMisses;
+    BOOL decimalNumbers;
 }
 
+/**
+ @brief Whether all numbers are returned as NSDecimalNumber.
+ 
+ If set to YES, every number is parsed with NSDecimalNumber, which keeps exact decimals
+ but is much slower than the native integer and double paths. The default is NO.
+ */
+@property BOOL decimalNumbers;
+
+/**
+ @brief Whether short strings are interned.
+ 
+ If set to YES, the parser keeps a small cache of short strings (object keys, type
+ names, ids) keyed by hash and length. A string that is found in the cache is returned
+ as the shared immutable instance instead of allocating a new NSMutableString.
+ Only strings without escape sequences are interned. The cache lives as long as the
+ parser, so reuse one parser for many messages to benefit. The default is NO.
+ */
+@property BOOL internStrings;
+
+/**
+ @brief Number of strings served from the intern cache.
+ 
+ Each hit is one string allocation saved.
+ */
+@property(readonly) NSUInteger internHits;
+
+/**
+ @brief Number of internable strings that were not found in the cache.
+ 
+ Each miss allocates one string, which then replaces the cache slot.
+ */
+@property(readonly) NSUInteger internMisses;
+
+/**
+ @brief Reset the internHits and internMisses counters.
+ */
+- (void)resetInternStatistics;
+
 @end
 
 // don't use - exists for backwards compatibility with 2.1.x only. Will be removed in 2.3.
@@ -39,6 +39,7 @@
 - (BOOL)scanRestOfFalse:(NSNumber **)o;
 - (BOOL)scanRestOfTrue:(NSNumber **)o;
 - (BOOL)scanRestOfString:(NSMutableString **)o;
+- (NSString *)internedStringWithBytes:(const char *)bytes length:(size_t)len;
 
 // Cannot manage without looking at the first digit
 - (BOOL)scanNumber:(NSNumber **)o;
@@ -53,11 +54,31 @@
 #define skipWhitespace(c) while (isspace(*c)) c++
 #define skipDigits(c) while (isdigit(*c)) c++
 
+#define SBJSON_INTERN_SLOTS 256
+#define SBJSON_INTERN_MAX_LENGTH 48
+
+struct SBJsonInternEntry {
+    NSUInteger hash;
+    NSUInteger length;
+    char bytes[SBJSON_INTERN_MAX_LENGTH];
+    NSString *string;
+};
+
 
 @implementation SBJsonParser
 
+@synthesize internHits;
+@synthesize internMisses;
+@synthesize decimalNumbers;
+
 static char ctrl[0x22];
 
+// Powers of ten that are exactly representable as double
+static const double exactPowersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
 + (void)initialize
 {
     ctrl[0] = '\"';
@@ -67,6 +88,31 @@ static char ctrl[0x22];
     ctrl[0x21] = 0;    
 }
 
+- (void)dealloc {
+    self.internStrings = NO;
+    [super dealloc];
+}
+
+- (BOOL)internStrings {
+    return internTable != NULL;
+}
+
+- (void)setInternStrings:(BOOL)x {
+    if (x && !internTable) {
+        internTable = calloc(SBJSON_INTERN_SLOTS, sizeof(struct SBJsonInternEntry));
+        
+    } else if (!x && internTable) {
+        for (int i = 0; i < SBJSON_INTERN_SLOTS; i++)
+            [internTable[i].string release];
+        free(internTable);
+        internTable = NULL;
+    }
+}
+
+- (void)resetInternStatistics {
+    internHits = internMisses = 0;
+}
+
 /**
  @deprecated This exists in order to provide fragment support in older APIs in one more version.
  It should be removed in the next major version.
@@ -283,13 +329,55 @@ static char ctrl[0x22];
     return NO;
 }
 
+/*
+ Returns the shared instance for a string of the given bytes, creating it on a miss.
+ Returns nil if the bytes are not valid UTF-8.
+ */
+- (NSString *)internedStringWithBytes:(const char *)bytes length:(size_t)len
+{
+    NSUInteger hash = 2166136261U;  // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)bytes[i];
+        hash *= 16777619U;
+    }
+    
+    struct SBJsonInternEntry *e = &internTable[hash % SBJSON_INTERN_SLOTS];
+    if (e->string && e->hash == hash && e->length == len && !memcmp(e->bytes, bytes, len)) {
+        internHits++;
+        return [[e->string retain] autorelease];
+    }
+    
+    NSString *s = [[NSString alloc] initWithBytes:bytes length:len encoding:NSUTF8StringEncoding];
+    if (!s)
+        return nil;
+    
+    internMisses++;
+    [e->string release];
+    e->string = s;
+    e->hash = hash;
+    e->length = len;
+    memcpy(e->bytes, bytes, len);
+    return [[s retain] autorelease];
+}
+
 - (BOOL)scanRestOfString:(NSMutableString **)o 
 {
+    // First see if there's a portion we can grab in one go. 
+    // Doing this caused a massive speedup on the long string.
+    size_t len = strcspn(c, ctrl);
+    
+    // Short strings without escapes may come from the intern cache.
+    if (internTable && len <= SBJSON_INTERN_MAX_LENGTH && c[len] == '"') {
+        NSString *s = [self internedStringWithBytes:c length:len];
+        if (s) {
+            *o = (NSMutableString *)s;
+            c += len + 1;
+            return YES;
+        }
+    }
+    
     *o = [NSMutableString stringWithCapacity:16];
     do {
-        // First see if there's a portion we can grab in one go. 
-        // Doing this caused a massive speedup on the long string.
-        size_t len = strcspn(c, ctrl);
         if (len) {
             // check for 
             id t = [[NSString alloc] initWithBytesNoCopy:(char*)c
@@ -344,6 +432,7 @@ static char ctrl[0x22];
         } else {
             NSLog(@"should not be able to get here");
         }
+        len = strcspn(c, ctrl);
     } while (*c);
     
     [self addErrorWithCode:EEOF description:@"Unexpected EOF while parsing string"];
@@ -407,13 +496,19 @@ static char ctrl[0x22];
 - (BOOL)scanNumber:(NSNumber **)o
 {
     const char *ns = c;
+    BOOL negative = NO, integral = YES, exact = YES;
+    unsigned long long mantissa = 0;
+    int digits = 0, exponent = 0;
     
     // The logic to test for validity of the number formatting is relicensed
     // from JSON::XS with permission from its author Marc Lehmann.
     // (Available at the CPAN: http://search.cpan.org/dist/JSON-XS/ .)
+    //
+    // While validating, up to 18 significant digits are collected into
+    // mantissa; the value is then mantissa * 10^exponent.
     
-    if ('-' == *c)
-        c++;
+    if ('-' == *c && c++)
+        negative = YES;
     
     if ('0' == *c && c++) {        
         if (isdigit(*c)) {
@@ -426,31 +521,75 @@ static char ctrl[0x22];
         return NO;
         
     } else {
-        skipDigits(c);
+        for (; isdigit(*c); c++) {
+            if (digits < 18) {
+                mantissa = mantissa * 10 + (*c - '0');
+                digits++;
+            } else {
+                exact = NO;
+            }
+        }
     }
     
     // Fractional part
     if ('.' == *c && c++) {
+        integral = NO;
         
         if (!isdigit(*c)) {
             [self addErrorWithCode:EPARSENUM description: @"No digits after decimal point"];
             return NO;
         }        
-        skipDigits(c);
+        for (; isdigit(*c); c++) {
+            if (digits < 18) {
+                mantissa = mantissa * 10 + (*c - '0');
+                if (mantissa)
+                    digits++;
+                exponent--;
+            } else if (*c != '0') {
+                exact = NO;
+            }
+        }
     }
     
     // Exponential part
     if ('e' == *c || 'E' == *c) {
+        integral = NO;
         c++;
         
+        BOOL negativeExp = NO;
         if ('-' == *c || '+' == *c)
-            c++;
+            negativeExp = ('-' == *c++);
         
         if (!isdigit(*c)) {
             [self addErrorWithCode:EPARSENUM description: @"No digits after exponent"];
             return NO;
         }
-        skipDigits(c);
+        int e = 0;
+        for (; isdigit(*c); c++) {
+            if (e < 10000)
+                e = e * 10 + (*c - '0');
+        }
+        exponent += negativeExp ? -e : e;
+    }
+    
+    if (!decimalNumbers && exact) {
+        if (integral) {
+            long long v = (long long)mantissa;
+            *o = [NSNumber numberWithLongLong:negative ? -v : v];
+            return YES;
+        }
+        
+        // Clinger's fast path: both mantissa and 10^|exponent| are exact
+        // doubles, so a single multiplication or division rounds correctly.
+        if (mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+            double d = (double)mantissa;
+            if (exponent < 0)
+                d /= exactPowersOfTen[-exponent];
+            else
+                d *= exactPowersOfTen[exponent];
+            *o = [NSNumber numberWithDouble:negative ? -d : d];
+            return YES;
+        }
     }
     
     id str = [[NSString alloc] initWithBytesNoCopy:(char*)ns
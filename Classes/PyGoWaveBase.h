@@ -19,10 +19,76 @@
  * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+enum {
+	PyGoWaveEvent_InsertedText = 0,
+	PyGoWaveEvent_DeletedText,
+	PyGoWaveEvent_InsertedElement,
+	PyGoWaveEvent_DeletedElement,
+	PyGoWaveEvent_OperationChanged,
+	PyGoWaveEvent_BeforeOperationsInserted,
+	PyGoWaveEvent_AfterOperationsInserted,
+	PyGoWaveEvent_BeforeOperationsRemoved,
+	PyGoWaveEvent_AfterOperationsRemoved,
+	PyGoWaveEvent_ContentChanged,
+	PyGoWaveEvent_Count
+};
+typedef NSInteger PyGoWaveEventType;
+
+enum {
+	PyGoWaveChange_InsertedText = 0,
+	PyGoWaveChange_DeletedText,
+	PyGoWaveChange_InsertedElement,
+	PyGoWaveChange_DeletedElement,
+	PyGoWaveChange_ElementDelta,
+	PyGoWaveChange_ElementUserPref
+};
+typedef NSInteger PyGoWaveChangeType;
+
+// One changed range of a blip's content
+typedef struct {
+	PyGoWaveChangeType type;
+	NSInteger index;
+	NSInteger length;
+} PyGoWaveChange;
+
+/*
+ Payload of a typed event. Fields not listed for an event are zero; objects
+ are not retained and only valid during the callback.
+  InsertedText		index, text
+  DeletedText		index, length
+  InsertedElement	index
+  DeletedElement	index
+  OperationChanged	index
+  *Operations*		start, end
+  ContentChanged	changes, count (in the order they were applied)
+*/
+typedef struct {
+	NSInteger index;
+	NSInteger length;
+	NSInteger start;
+	NSInteger end;
+	NSString * text;
+	const PyGoWaveChange * changes;
+	NSInteger count;
+} PyGoWaveEventInfo;
+
+typedef void (*PyGoWaveEventCallback)(id aSender, PyGoWaveEventType aEvent, const PyGoWaveEventInfo * aInfo, void * aContext);
+
+struct PyGoWaveEventObserverList;
+
 @interface PyGoWaveObject : NSObject
 {
+	struct PyGoWaveEventObserverList * m_eventObservers;
+	NSUInteger m_eventNotifications;
 }
 
+- (void)dealloc;
+
+// Notifications are delivered on this thread; nil delivers them on the posting
+// thread (default). Subclasses return the thread of the object owning them
+- (NSThread *)notificationThread;
+
+// Also switches on the named notification of the matching event (all events for a nil name)
 - (void)addObserver:(id)notificationObserver selector:(SEL)notificationSelector name:(NSString *)notificationName;
 - (void)removeObserver:(id)notificationObserver name:(NSString *)notificationName;
 
@@ -30,4 +96,26 @@
 - (void)postNotificationName:(NSString *)notificationName userInfo:(NSDictionary *)userInfo;
 - (void)postNotificationName:(NSString *)notificationName userInfo:(NSDictionary *)userInfo coalescing:(BOOL)doCoalescing;
 
+/*
+ Typed observers are called synchronously on the posting thread, without
+ building a notification. Selectors have the form
+  - (void)blipInsertedText:(id)aSender info:(const PyGoWaveEventInfo *)aInfo;
+ Register before events can be posted from other threads, and do not add or
+ remove observers of an event from within its callback.
+ 
+ The matching named notification is only built and posted after them if it
+ was switched on for the event, which addObserver:selector:name: and the
+ add...Observer helpers do. Observers registering with NSNotificationCenter
+ directly must switch it on themselves, under the same threading rule.
+*/
+- (void)addEventObserver:(id)aObserver selector:(SEL)aSelector forEvent:(PyGoWaveEventType)aEvent;
+- (void)removeEventObserver:(id)aObserver forEvent:(PyGoWaveEventType)aEvent;
+- (void)addEventCallback:(PyGoWaveEventCallback)aCallback context:(void *)aContext forEvent:(PyGoWaveEventType)aEvent;
+- (void)removeEventCallback:(PyGoWaveEventCallback)aCallback context:(void *)aContext forEvent:(PyGoWaveEventType)aEvent;
+
+- (void)setPostsNotification:(BOOL)bPost forEvent:(PyGoWaveEventType)aEvent;
+- (BOOL)postsNotificationForEvent:(PyGoWaveEventType)aEvent;
+
+- (void)postEvent:(PyGoWaveEventType)aEvent info:(const PyGoWaveEventInfo *)aInfo;
+
 @end
@@ -20,12 +20,66 @@
  */
 
 #import "PyGoWaveBase.h"
+#import "PyGoWaveTrace.h"
+
+typedef void (*PyGoWaveEventIMP)(id, SEL, id, const PyGoWaveEventInfo *);
+
+typedef struct {
+	id target;
+	SEL selector;
+	PyGoWaveEventIMP imp;
+	PyGoWaveEventCallback callback;
+	void * context;
+} PyGoWaveEventObserver;
+
+struct PyGoWaveEventObserverList {
+	PyGoWaveEventObserver * entries;
+	NSUInteger count;
+	NSUInteger capacity;
+};
+
+// Notification adapter: name and coalescing of the notification matching each event
+static NSString * const kEventNotificationNames[PyGoWaveEvent_Count] = {
+	@"insertedText",
+	@"deletedText",
+	@"insertedElement",
+	@"deletedElement",
+	@"operationChanged",
+	@"beforeOperationsInserted",
+	@"afterOperationsInserted",
+	@"beforeOperationsRemoved",
+	@"afterOperationsRemoved",
+	@"contentChanged"
+};
+static const BOOL kEventNotificationCoalescing[PyGoWaveEvent_Count] = {
+	NO, NO, NO, NO, YES, NO, NO, NO, NO, NO
+};
 
 @implementation PyGoWaveObject
 
+- (void)dealloc
+{
+	if (m_eventObservers != NULL) {
+		for (NSInteger i = 0; i < PyGoWaveEvent_Count; i++)
+			free(m_eventObservers[i].entries);
+		free(m_eventObservers);
+	}
+	[super dealloc];
+}
+
+- (NSThread *)notificationThread
+{
+	return nil;
+}
+
 - (void)addObserver:(id)notificationObserver selector:(SEL)notificationSelector name:(NSString *)notificationName
 {
 	[[NSNotificationCenter defaultCenter] addObserver:notificationObserver selector:notificationSelector name:notificationName object:self];
+	// Left on when the observer goes away; other observers of the name may remain
+	for (NSInteger i = 0; i < PyGoWaveEvent_Count; i++) {
+		if (notificationName == nil || [notificationName isEqualToString:kEventNotificationNames[i]])
+			[self setPostsNotification:YES forEvent:i];
+	}
 }
 
 - (void)removeObserver:(id)notificationObserver name:(NSString *)notificationName
@@ -43,12 +97,156 @@
 	[self postNotificationName:notificationName userInfo:userInfo coalescing:YES];
 }
 
-- (void)postNotificationName:(NSString *)notificationName userInfo:(NSDictionary *)userInfo coalescing:(BOOL)coalescing
+- (void)enqueueNotification:(NSNotification *)notification coalescing:(BOOL)coalescing
 {
-	[[NSNotificationQueue defaultQueue] enqueueNotification:[NSNotification notificationWithName:notificationName object:self userInfo:userInfo]
+	uint64_t traceStart = PyGoWaveTraceBegin();
+	[[NSNotificationQueue defaultQueue] enqueueNotification:notification
 											   postingStyle:NSPostASAP
 											   coalesceMask:(coalescing ? NSNotificationCoalescingOnName | NSNotificationCoalescingOnSender : NSNotificationNoCoalescing)
 												   forModes:nil];
+	PyGoWaveTraceEnd("notification.enqueue", traceStart, -1);
+}
+
+- (void)enqueueCoalescedNotification:(NSNotification *)notification
+{
+	[self enqueueNotification:notification coalescing:YES];
+}
+
+- (void)enqueueUncoalescedNotification:(NSNotification *)notification
+{
+	[self enqueueNotification:notification coalescing:NO];
+}
+
+- (void)postNotificationName:(NSString *)notificationName userInfo:(NSDictionary *)userInfo coalescing:(BOOL)coalescing
+{
+	NSNotification * notification = [NSNotification notificationWithName:notificationName object:self userInfo:userInfo];
+	NSThread * thread = [self notificationThread];
+	if (thread != nil && thread != [NSThread currentThread])
+		[self performSelector:(coalescing ? @selector(enqueueCoalescedNotification:) : @selector(enqueueUncoalescedNotification:))
+					 onThread:thread
+				   withObject:notification
+				waitUntilDone:NO];
+	else
+		[self enqueueNotification:notification coalescing:coalescing];
+}
+
+#pragma mark Typed events
+
+- (void)addEventObserverEntry:(PyGoWaveEventObserver)aEntry forEvent:(PyGoWaveEventType)aEvent
+{
+	NSAssert(aEvent >= 0 && aEvent < PyGoWaveEvent_Count, @"Unknown event");
+	if (m_eventObservers == NULL)
+		m_eventObservers = calloc(PyGoWaveEvent_Count, sizeof(struct PyGoWaveEventObserverList));
+	struct PyGoWaveEventObserverList * list = &m_eventObservers[aEvent];
+	if (list->count == list->capacity) {
+		list->capacity = list->capacity == 0 ? 2 : list->capacity * 2;
+		list->entries = realloc(list->entries, list->capacity * sizeof(PyGoWaveEventObserver));
+	}
+	list->entries[list->count++] = aEntry;
+}
+
+- (void)removeEventObserverWithTarget:(id)aTarget callback:(PyGoWaveEventCallback)aCallback context:(void *)aContext forEvent:(PyGoWaveEventType)aEvent
+{
+	if (m_eventObservers == NULL)
+		return;
+	struct PyGoWaveEventObserverList * list = &m_eventObservers[aEvent];
+	NSUInteger j = 0;
+	for (NSUInteger i = 0; i < list->count; i++) {
+		PyGoWaveEventObserver * entry = &list->entries[i];
+		if (entry->target == aTarget && entry->callback == aCallback && (aTarget != nil || entry->context == aContext))
+			continue;
+		list->entries[j++] = *entry;
+	}
+	list->count = j;
+}
+
+- (void)addEventObserver:(id)aObserver selector:(SEL)aSelector forEvent:(PyGoWaveEventType)aEvent
+{
+	PyGoWaveEventObserver entry = {aObserver, aSelector, (PyGoWaveEventIMP) [aObserver methodForSelector:aSelector], NULL, NULL};
+	NSAssert(entry.imp != NULL, @"Observer does not respond to selector");
+	[self addEventObserverEntry:entry forEvent:aEvent];
+}
+
+- (void)removeEventObserver:(id)aObserver forEvent:(PyGoWaveEventType)aEvent
+{
+	[self removeEventObserverWithTarget:aObserver callback:NULL context:NULL forEvent:aEvent];
+}
+
+- (void)addEventCallback:(PyGoWaveEventCallback)aCallback context:(void *)aContext forEvent:(PyGoWaveEventType)aEvent
+{
+	PyGoWaveEventObserver entry = {nil, NULL, NULL, aCallback, aContext};
+	[self addEventObserverEntry:entry forEvent:aEvent];
+}
+
+- (void)removeEventCallback:(PyGoWaveEventCallback)aCallback context:(void *)aContext forEvent:(PyGoWaveEventType)aEvent
+{
+	[self removeEventObserverWithTarget:nil callback:aCallback context:aContext forEvent:aEvent];
+}
+
+- (void)setPostsNotification:(BOOL)bPost forEvent:(PyGoWaveEventType)aEvent
+{
+	NSAssert(aEvent >= 0 && aEvent < PyGoWaveEvent_Count, @"Unknown event");
+	if (bPost)
+		m_eventNotifications |= 1 << aEvent;
+	else
+		m_eventNotifications &= ~(1 << aEvent);
+}
+
+- (BOOL)postsNotificationForEvent:(PyGoWaveEventType)aEvent
+{
+	return (m_eventNotifications & (1 << aEvent)) != 0;
+}
+
+- (NSDictionary *)userInfoForEvent:(PyGoWaveEventType)aEvent info:(const PyGoWaveEventInfo *)aInfo
+{
+	switch (aEvent) {
+		case PyGoWaveEvent_InsertedText:
+			return [NSDictionary dictionaryWithObjectsAndKeys:
+					[NSNumber numberWithInt:aInfo->index], @"index",
+					[NSString stringWithString:aInfo->text], @"text",
+					nil];
+		case PyGoWaveEvent_DeletedText:
+			return [NSDictionary dictionaryWithObjectsAndKeys:
+					[NSNumber numberWithInt:aInfo->index], @"index",
+					[NSNumber numberWithInt:aInfo->length], @"length",
+					nil];
+		case PyGoWaveEvent_InsertedElement:
+		case PyGoWaveEvent_DeletedElement:
+		case PyGoWaveEvent_OperationChanged:
+			return [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:aInfo->index], @"index", nil];
+		case PyGoWaveEvent_ContentChanged: {
+			NSMutableArray * changes = [NSMutableArray arrayWithCapacity:aInfo->count];
+			for (NSInteger i = 0; i < aInfo->count; i++) {
+				[changes addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+									[NSNumber numberWithInt:aInfo->changes[i].type], @"type",
+									[NSNumber numberWithInt:aInfo->changes[i].index], @"index",
+									[NSNumber numberWithInt:aInfo->changes[i].length], @"length",
+									nil]];
+			}
+			return [NSDictionary dictionaryWithObjectsAndKeys:changes, @"changes", nil];
+		}
+		default:
+			return [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:aInfo->start], @"start", [NSNumber numberWithInt:aInfo->end], @"end", nil];
+	}
+}
+
+- (void)postEvent:(PyGoWaveEventType)aEvent info:(const PyGoWaveEventInfo *)aInfo
+{
+	uint64_t traceStart = PyGoWaveTraceBegin();
+	if (m_eventObservers != NULL) {
+		struct PyGoWaveEventObserverList * list = &m_eventObservers[aEvent];
+		for (NSUInteger i = 0; i < list->count; i++) {
+			PyGoWaveEventObserver * entry = &list->entries[i];
+			if (entry->callback != NULL)
+				entry->callback(self, aEvent, aInfo, entry->context);
+			else
+				entry->imp(entry->target, entry->selector, self, aInfo);
+		}
+	}
+	
+	if (m_eventNotifications & (1 << aEvent))
+		[self postNotificationName:kEventNotificationNames[aEvent] userInfo:[self userInfoForEvent:aEvent info:aInfo] coalescing:kEventNotificationCoalescing[aEvent]];
+	PyGoWaveTraceEnd("event.dispatch", traceStart, aEvent);
 }
 
 @end
@@ -0,0 +1,52 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+@class PyGoWaveOperation;
+
+/*
+ Writes client messages as UTF-8 JSON directly into a reusable buffer.
+ Operations are serialized from their properties; no intermediate
+ NSDictionary or NSNumber objects are created for them.
+*/
+@interface PyGoWaveBundleWriter : NSObject
+{
+	NSMutableData * m_buffer;
+	NSMutableData * m_scratch;
+}
+@property (readonly) NSData * data;
+
+- (id)init;
+- (void)dealloc;
+
+- (void)reset;
+
+- (NSData*)messageWithType:(NSString*)aMessageType property:(id)aProperty;
+- (NSData*)bundleWithVersion:(NSInteger)aVersion operations:(NSArray*)aOperations;
+
+- (void)appendBytes:(const void*)aBytes length:(NSUInteger)aLength;
+// nil is written as null
+- (void)appendString:(NSString*)aString;
+- (void)appendInteger:(long long)aValue;
+- (void)appendUnsignedInteger:(unsigned long long)aValue;
+- (void)appendValue:(id)aValue;
+- (void)appendOperation:(PyGoWaveOperation*)aOperation;
+
+@end
@@ -0,0 +1,317 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#import "PyGoWaveBundleWriter.h"
+#import "PyGoWaveOperations.h"
+#include <math.h>
+
+#define PGW_ONES	0x0101010101010101ULL
+#define PGW_HIGHS	0x8080808080808080ULL
+
+#define appendLiteral(s) [self appendBytes:s length:sizeof(s)-1]
+
+static const char * const kOperationTypeNames[] = {
+	"DOCUMENT_NOOP",
+	"DOCUMENT_INSERT",
+	"DOCUMENT_DELETE",
+	"DOCUMENT_ELEMENT_INSERT",
+	"DOCUMENT_ELEMENT_DELETE",
+	"DOCUMENT_ELEMENT_DELTA",
+	"DOCUMENT_ELEMENT_SETPREF",
+	"WAVELET_ADD_PARTICIPANT",
+	"WAVELET_REMOVE_PARTICIPANT",
+	"WAVELET_APPEND_BLIP",
+	"BLIP_CREATE_CHILD",
+	"BLIP_DELETE"
+};
+
+static inline BOOL needsEscape(uint8_t ch)
+{
+	return ch < 0x20 || ch == '"' || ch == '\\';
+}
+
+// Returns the offset of the first byte that must be escaped, or aLength.
+// Eight bytes are tested at once; the exact position is then found bytewise.
+static NSUInteger scanForEscape(const uint8_t * aBytes, NSUInteger aLength)
+{
+	NSUInteger i = 0;
+	for (; i + 8 <= aLength; i += 8) {
+		uint64_t w, q, b;
+		memcpy(&w, aBytes + i, 8);
+		q = w ^ (PGW_ONES * '"');
+		b = w ^ (PGW_ONES * '\\');
+		if ((((w - PGW_ONES * 0x20) & ~w) | ((q - PGW_ONES) & ~q) | ((b - PGW_ONES) & ~b)) & PGW_HIGHS)
+			break;
+	}
+	for (; i < aLength; i++) {
+		if (needsEscape(aBytes[i]))
+			return i;
+	}
+	return aLength;
+}
+
+// Booleans are shared instances, unlike numbers made from a char with the same objCType
+static NSNumber * s_true = nil;
+static NSNumber * s_false = nil;
+
+// Writes the decimal digits of aValue so that they end at aEnd; returns their start
+static char * formatDigits(unsigned long long aValue, char * aEnd)
+{
+	do {
+		*--aEnd = '0' + (char)(aValue % 10);
+		aValue /= 10;
+	} while (aValue != 0);
+	return aEnd;
+}
+
+@implementation PyGoWaveBundleWriter
+
+#pragma mark Initialization and Deallocation
+
++ (void)initialize
+{
+	if (self != [PyGoWaveBundleWriter class])
+		return;
+	s_true = [[NSNumber numberWithBool:YES] retain];
+	s_false = [[NSNumber numberWithBool:NO] retain];
+}
+
+- (id)init
+{
+	if (self = [super init]) {
+		m_buffer = [[NSMutableData alloc] initWithCapacity:1024];
+		m_scratch = [[NSMutableData alloc] initWithCapacity:256];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_buffer release];
+	[m_scratch release];
+	[super dealloc];
+}
+
+#pragma mark Public methods
+
+- (NSData*)data
+{
+	return m_buffer;
+}
+
+- (void)reset
+{
+	[m_buffer setLength:0];
+}
+
+- (NSData*)messageWithType:(NSString*)aMessageType property:(id)aProperty
+{
+	[self reset];
+	appendLiteral("{\"type\":");
+	[self appendString:aMessageType];
+	if (aProperty != nil) {
+		appendLiteral(",\"property\":");
+		[self appendValue:aProperty];
+	}
+	appendLiteral("}");
+	return m_buffer;
+}
+
+- (NSData*)bundleWithVersion:(NSInteger)aVersion operations:(NSArray*)aOperations
+{
+	[self reset];
+	appendLiteral("{\"type\":\"OPERATION_MESSAGE_BUNDLE\",\"property\":{\"version\":");
+	[self appendInteger:aVersion];
+	appendLiteral(",\"operations\":[");
+	BOOL addComma = NO;
+	for (PyGoWaveOperation * op in aOperations) {
+		if (addComma)
+			appendLiteral(",");
+		else
+			addComma = YES;
+		[self appendOperation:op];
+	}
+	appendLiteral("]}}");
+	return m_buffer;
+}
+
+- (void)appendBytes:(const void*)aBytes length:(NSUInteger)aLength
+{
+	[m_buffer appendBytes:aBytes length:aLength];
+}
+
+- (void)appendString:(NSString*)aString
+{
+	if (aString == nil) {
+		appendLiteral("null");
+		return;
+	}
+	const uint8_t * bytes = (const uint8_t*) CFStringGetCStringPtr((CFStringRef)aString, kCFStringEncodingUTF8);
+	NSUInteger length = 0;
+	// The pointer is only handed out for ASCII, where bytes and characters match;
+	// a shorter C string means an embedded NUL, which the copy below keeps
+	if (bytes != NULL)
+		length = strlen((const char*)bytes);
+	if (bytes == NULL || length != [aString length]) {
+		NSUInteger maxLength = [aString maximumLengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+		if ([m_scratch length] < maxLength)
+			[m_scratch setLength:maxLength];
+		[aString getBytes:[m_scratch mutableBytes]
+				maxLength:maxLength
+			   usedLength:&length
+				 encoding:NSUTF8StringEncoding
+				  options:0
+					range:NSMakeRange(0, [aString length])
+		   remainingRange:NULL];
+		bytes = [m_scratch bytes];
+	}
+
+	appendLiteral("\"");
+	NSUInteger start = 0;
+	while (start < length) {
+		NSUInteger run = scanForEscape(bytes + start, length - start);
+		if (run > 0) {
+			[m_buffer appendBytes:bytes + start length:run];
+			start += run;
+		}
+		if (start == length)
+			break;
+		uint8_t ch = bytes[start++];
+		switch (ch) {
+			case '"':	appendLiteral("\\\"");	break;
+			case '\\':	appendLiteral("\\\\");	break;
+			case '\t':	appendLiteral("\\t");	break;
+			case '\n':	appendLiteral("\\n");	break;
+			case '\r':	appendLiteral("\\r");	break;
+			case '\b':	appendLiteral("\\b");	break;
+			case '\f':	appendLiteral("\\f");	break;
+			default: {
+				static const char hex[] = "0123456789abcdef";
+				char esc[6] = {'\\', 'u', '0', '0', hex[ch >> 4], hex[ch & 0xf]};
+				[m_buffer appendBytes:esc length:6];
+				break;
+			}
+		}
+	}
+	appendLiteral("\"");
+}
+
+- (void)appendInteger:(long long)aValue
+{
+	char buf[24];
+	char * p = formatDigits(aValue < 0 ? 0ULL - (unsigned long long)aValue : (unsigned long long)aValue, buf + sizeof(buf));
+	if (aValue < 0)
+		*--p = '-';
+	[m_buffer appendBytes:p length:buf + sizeof(buf) - p];
+}
+
+- (void)appendUnsignedInteger:(unsigned long long)aValue
+{
+	char buf[24];
+	char * p = formatDigits(aValue, buf + sizeof(buf));
+	[m_buffer appendBytes:p length:buf + sizeof(buf) - p];
+}
+
+- (void)appendValue:(id)aValue
+{
+	if (aValue == nil || [aValue isKindOfClass:[NSNull class]])
+		appendLiteral("null");
+	else if ([aValue isKindOfClass:[NSString class]])
+		[self appendString:aValue];
+	else if ([aValue isKindOfClass:[NSNumber class]]) {
+		char type = *[aValue objCType];
+		if (aValue == s_true || aValue == s_false || type == 'B') {
+			if ([aValue boolValue])
+				appendLiteral("true");
+			else
+				appendLiteral("false");
+		}
+		else if (type == 'f' || type == 'd') {
+			double d = [aValue doubleValue];
+			if (isnan(d) || isinf(d))
+				appendLiteral("null"); // Not representable in JSON
+			else {
+				const char * str = [[aValue stringValue] UTF8String];
+				[self appendBytes:str length:strlen(str)];
+			}
+		}
+		else if (type == 'Q' || type == 'L' || type == 'I' || type == 'S' || type == 'C')
+			[self appendUnsignedInteger:[aValue unsignedLongLongValue]];
+		else
+			[self appendInteger:[aValue longLongValue]];
+	}
+	else if ([aValue isKindOfClass:[NSDictionary class]]) {
+		appendLiteral("{");
+		BOOL addComma = NO;
+		for (id key in aValue) {
+			NSAssert([key isKindOfClass:[NSString class]], @"JSON object key must be string");
+			if (addComma)
+				appendLiteral(",");
+			else
+				addComma = YES;
+			[self appendString:key];
+			appendLiteral(":");
+			[self appendValue:[aValue objectForKey:key]];
+		}
+		appendLiteral("}");
+	}
+	else if ([aValue isKindOfClass:[NSArray class]]) {
+		appendLiteral("[");
+		BOOL addComma = NO;
+		for (id value in aValue) {
+			if (addComma)
+				appendLiteral(",");
+			else
+				addComma = YES;
+			[self appendValue:value];
+		}
+		appendLiteral("]");
+	}
+	else
+		[self appendValue:[aValue description]];
+}
+
+- (void)appendOperation:(PyGoWaveOperation*)aOperation
+{
+	PyGoWaveOperationType type = aOperation.type;
+	if (type < 0 || type > PyGoWaveOperation_BLIP_DELETE)
+		type = PyGoWaveOperation_DOCUMENT_NOOP;
+	appendLiteral("{\"type\":\"");
+	[self appendBytes:kOperationTypeNames[type] length:strlen(kOperationTypeNames[type])];
+	// The server reads the ids as strings, so missing ones are written empty
+	appendLiteral("\",\"waveId\":");
+	[self appendString:aOperation.waveId != nil ? aOperation.waveId : @""];
+	appendLiteral(",\"waveletId\":");
+	[self appendString:aOperation.waveletId != nil ? aOperation.waveletId : @""];
+	appendLiteral(",\"blipId\":");
+	[self appendString:aOperation.blipId != nil ? aOperation.blipId : @""];
+	appendLiteral(",\"index\":");
+	[self appendInteger:aOperation.index];
+	appendLiteral(",\"property\":");
+	id property = aOperation.property;
+	if (property == nil)
+		appendLiteral("0");
+	else
+		[self appendValue:property];
+	appendLiteral("}");
+}
+
+@end
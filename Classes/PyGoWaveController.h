@@ -22,6 +22,16 @@
 #import "PyGoWaveModel.h"
 #import "STOMP/CRVStompClient.h"
 
+@class PyGoWaveBundleWriter;
+@class PyGoWaveWorkerThread;
+@class PyGoWaveWorkerPool;
+@class PyGoWaveParticipantStore;
+@class PyGoWaveSnapshotStore;
+@class PyGoWaveOperationLog;
+@class PyGoWaveTimerWheel;
+@class PyGoWaveMetrics;
+@class SBJsonParser;
+
 
 enum {
 	PyGoWaveController_ClientDisconnected = 0,
@@ -30,12 +40,18 @@ enum {
 };
 typedef NSInteger PyGoWaveControllerClientState;
 
+enum {
+	PyGoWaveController_DrainImmediately = 0,
+	PyGoWaveController_DrainPerRunLoopTurn,
+	PyGoWaveController_DrainAtFrameRate
+};
+typedef NSInteger PyGoWaveControllerDrainMode;
+
 @interface PyGoWaveController : PyGoWaveObject <CRVStompClientDelegate, PyGoWaveParticipantProvider>
 {
 	CRVStompClient * m_conn;
 	BOOL m_connected;
 	NSTimer * m_pingTimer;
-	NSTimer * m_pendingTimer;
 
 	NSString * m_stompServer;
 	NSInteger m_stompPort;
@@ -53,9 +69,29 @@ typedef NSInteger PyGoWaveControllerClientState;
 
 	NSMutableDictionary * m_allWaves;
 	NSMutableDictionary * m_allWavelets;
-	NSMutableDictionary * m_allParticipants;
+	NSMutableDictionary * m_waveSummaries;
+	NSMutableArray * m_waveSummaryOrder;
+	NSMutableDictionary * m_summaryWaveIds;
+	BOOL m_lazyWaveList;
+	PyGoWaveParticipantStore * m_participants;
 	BOOL m_participantsTodoCollect;
 	NSMutableSet * m_participantsTodo;
+	NSMutableSet * m_participantsStale;
+	BOOL m_persistentParticipants;
+	PyGoWaveSnapshotStore * m_snapshotStore;
+	BOOL m_snapshotCache;
+	BOOL m_reconcileSnapshots;
+	NSMutableDictionary * m_cachedVersions;
+	PyGoWaveOperationLog * m_operationLog;
+	BOOL m_logOperations;
+	NSMutableDictionary * m_sendStates;
+	PyGoWaveTimerWheel * m_ackDeadlines;
+	NSTimeInterval m_maximumSendWindow;
+	NSString * m_captureFile;
+	PyGoWaveMetrics * m_metrics;
+	BOOL m_collectMetrics;
+	NSTimeInterval m_metricsInterval;
+	NSTimer * m_metricsTimer;
 	NSMutableSet * m_openWavelets;
 
 	NSMutableDictionary * m_mcached;
@@ -67,8 +103,91 @@ typedef NSInteger PyGoWaveControllerClientState;
 	NSString * m_createdWaveId;
 
 	NSMutableArray * m_cachedGadgetList;
+
+	PyGoWaveBundleWriter * m_bundleWriter;
+	BOOL m_directSerialization;
+	SBJsonParser * m_jsonParser;
+
+	NSThread * m_ownerThread;
+	PyGoWaveWorkerThread * m_workerThread;
+	BOOL m_pipelined;
+	NSRecursiveLock * m_otLock;
+	NSMutableDictionary * m_waveletLocks;
+	BOOL m_parallelWavelets;
+	PyGoWaveWorkerPool * m_workerPool;
+	NSUInteger m_workerPoolSize;
+	NSMutableDictionary * m_contexts;
+	NSUInteger m_generation;
+
+	NSMutableDictionary * m_inbound;
+	NSMutableDictionary * m_opVersions;
+	NSMutableArray * m_applyQueue;
+	NSMutableSet * m_inboundGaps;
+	PyGoWaveControllerDrainMode m_inboundDrainMode;
+	NSInteger m_inboundFrameRate;
+	NSTimeInterval m_inboundGapTimeout;
+	BOOL m_inboundDrainScheduled;
+	NSTimeInterval m_inboundLastDrain;
+	BOOL m_changeSetEvents;
 }
 @property (readonly) PyGoWaveControllerClientState state;
+// Write outgoing messages straight into a reusable UTF-8 buffer (default YES)
+@property BOOL directSerialization;
+// Parser for incoming messages; interns repeated keys and ids (see internHits/internMisses)
+@property (readonly) SBJsonParser * jsonParser;
+// Parse and transform incoming messages on a background thread; only model changes
+// and notifications happen on the thread that created the controller. Takes effect
+// on the next connect (default NO)
+@property BOOL pipelined;
+// Decode and transform each wavelet's messages in its own serial context on a
+// thread pool, so busy wavelets are processed in parallel. Takes effect on the
+// next connect (default NO)
+@property BOOL parallelWavelets;
+// Number of pool threads for parallelWavelets; 0 means one per processor (default 0)
+@property NSUInteger workerPoolSize;
+// When received messages are applied to the model (default PyGoWaveController_DrainImmediately)
+@property PyGoWaveControllerDrainMode inboundDrainMode;
+// Maximum drains per second in PyGoWaveController_DrainAtFrameRate mode (default 30)
+@property NSInteger inboundFrameRate;
+// Seconds to wait for a missing version before applying out of order (default 5)
+@property NSTimeInterval inboundGapTimeout;
+// Sets changeSetEvents on wavelets created from now on (default NO)
+@property BOOL changeSetEvents;
+// Keep the wave list as PyGoWaveWaveSummary records only; waves are loaded when
+// first accessed through waveWithId:, waveletWithId: or openWaveletWithId: (default NO)
+@property BOOL lazyWaveList;
+// Number of participants kept in memory; 0 means no limit (default 500)
+@property NSUInteger participantCacheSize;
+// Keep fetched participants in a per-host cache file, so they can be shown
+// before the server has been asked again. Takes effect on the next connect (default YES)
+@property BOOL persistentParticipants;
+// Keep a per-host cache of opened wavelets and show them from there right away on
+// the next open. The server's snapshot then only reloads the wavelet if its version
+// differs. A wavelet shown from the cache is read-only until then: local edits are
+// rejected with an errorOccurred notification tagged WAVELET_CACHED, as they could
+// not be transformed against a reload. Takes effect on the next connect (default NO)
+@property BOOL snapshotCache;
+// Update a wavelet that already holds blips, e.g. from the snapshot cache or an
+// earlier open, from the server's snapshot blip by blip. Unchanged blips are kept
+// and post nothing, see -[PyGoWaveWavelet reconcileBlipsWithSnapshot:rootBlipId:] (default NO)
+@property BOOL reconcileSnapshots;
+// Log unacknowledged local operations to disk, so they survive a crash and are sent
+// when the wavelet is next opened at the same version. Takes effect on the next
+// connect (default NO)
+@property BOOL logOperations;
+// Longest time new local operations are held back so a burst goes out as one bundle.
+// The window used is a quarter of the wavelet's round-trip time, up to this value;
+// 0 sends at once (default 0.1)
+@property NSTimeInterval maximumSendWindow;
+// Record the raw STOMP frames of each connection to this file, for replay against
+// a stand-in broker. Takes effect on the next connect (default nil)
+@property (copy) NSString * captureFile;
+// Count traffic and time sending, transforming, applying and parsing per wavelet, see
+// metricsSnapshot. Costs a flag test per message while off (default NO)
+@property (nonatomic) BOOL collectMetrics;
+// Seconds between MetricsUpdated notifications while connected and collecting; 0 means
+// none (default 0)
+@property (nonatomic) NSTimeInterval metricsInterval;
 @property (readonly, nonatomic, copy) NSString * hostName;
 @property (readonly, nonatomic) PyGoWaveParticipant * viewer;
 
@@ -87,6 +206,41 @@ typedef NSInteger PyGoWaveControllerClientState;
 
 - (PyGoWaveWaveModel*)waveWithId:(NSString*)aId;
 - (PyGoWaveWavelet*)waveletWithId:(NSString*)aId;
+- (BOOL)isWaveLoaded:(NSString*)aId;
+// NO while the wavelet is shown from the snapshot cache, see snapshotCache
+- (BOOL)isWaveletEditable:(NSString*)aId;
+
+// The wave list, most recently modified first
+- (NSUInteger)waveSummaryCount;
+- (NSArray*)waveSummariesInRange:(NSRange)aRange;
+- (PyGoWaveWaveSummary*)waveSummaryWithId:(NSString*)aId;
+
+// Estimates from acknowledged bundles; 0 round-trip time if not measured yet
+- (NSTimeInterval)roundTripTimeForWaveletWithId:(NSString*)aId;
+- (NSTimeInterval)sendWindowForWaveletWithId:(NSString*)aId;
+- (NSTimeInterval)acknowledgementTimeoutForWaveletWithId:(NSString*)aId;
+
+// Metrics collected so far in the format described in PyGoWaveMetrics.h; nil if
+// collectMetrics was never set
+- (NSDictionary*)metricsSnapshot;
+- (void)resetMetrics;
+
+/*
+ Approximate bytes kept alive by the loaded waves, their operation queues and
+ the controller's caches. Call on the thread that created the controller.
+ memoryReport walks everything and returns
+	{"total", "waves": {<waveId>: {"total", "wavelets": {<waveletId>: {"total",
+	 "operations", "blips": {<blipId>: {"total", "content", "elements",
+	 "annotations", "contributors"}}}}}}, "participantCache", "gadgetList", "waveList"}
+ topMemoryConsumers: makes the same walk without building the breakdown and
+ returns the largest consumers, largest first, each
+	{"kind", "bytes", "waveId", "waveletId", "blipId"}
+ where kind is one of wave, wavelet, blip, operations (both queues of a
+ wavelet), participantCache, gadgetList or waveList. Waves and wavelets count
+ only their own data here, so the consumers add up to the total.
+*/
+- (NSDictionary*)memoryReport;
+- (NSArray*)topMemoryConsumers:(NSUInteger)aCount;
 
 - (NSInteger)searchForParticipantWithQuery:(NSString*)aQuery;
 
@@ -138,6 +292,9 @@ typedef NSInteger PyGoWaveControllerClientState;
 /* WaveletOpened
  waveletId	NSString
  isRoot		NSNumber/BOOL
+ cached		NSNumber/BOOL; YES if shown from the snapshot cache, in which case a
+			second notification follows once the server's snapshot has arrived and
+			the wavelet can be edited
 */
 - (void)addWaveletOpenedObserver:(id)notificationObserver selector:(SEL)notificationSelector;
 - (void)removeWaveletOpenedObserver:(id)notificationObserver;
@@ -156,6 +313,13 @@ typedef NSInteger PyGoWaveControllerClientState;
 - (void)addParticipantSearchResultsInvalidObserver:(id)notificationObserver selector:(SEL)notificationSelector;
 - (void)removeParticipantSearchResultsInvalidObserver:(id)notificationObserver;
 
+/* WaveListReceived
+ count		NSNumber/unsigned int
+ lazy		NSNumber/BOOL
+*/
+- (void)addWaveListReceivedObserver:(id)notificationObserver selector:(SEL)notificationSelector;
+- (void)removeWaveListReceivedObserver:(id)notificationObserver;
+
 /* WaveAdded
  waveId		NSString
  created	NSNumber/BOOL
@@ -176,4 +340,10 @@ typedef NSInteger PyGoWaveControllerClientState;
 - (void)addUpdateGadgetListObserver:(id)notificationObserver selector:(SEL)notificationSelector;
 - (void)removeUpdateGadgetListObserver:(id)notificationObserver;
 
+/* MetricsUpdated
+ metrics	NSDictionary, see metricsSnapshot
+*/
+- (void)addMetricsUpdatedObserver:(id)notificationObserver selector:(SEL)notificationSelector;
+- (void)removeMetricsUpdatedObserver:(id)notificationObserver;
+
 @end
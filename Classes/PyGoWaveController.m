@@ -21,12 +21,149 @@
 
 #import "PyGoWaveController.h"
 #import "PyGoWaveOperations.h"
+#import "PyGoWaveBundleWriter.h"
+#import "PyGoWaveWorkerThread.h"
+#import "PyGoWaveWorkerPool.h"
+#import "PyGoWaveParticipantStore.h"
+#import "PyGoWaveSnapshotStore.h"
+#import "PyGoWaveOperationLog.h"
+#import "PyGoWaveTimerWheel.h"
+#import "PyGoWaveMetrics.h"
+#import "PyGoWaveTrace.h"
+#import "PyGoWaveMemory.h"
 #import "CoreFoundation/CFUUID.h"
 #import "JSON.h"
 
+enum {
+	PyGoWaveInboundItem_Message = 0,
+	PyGoWaveInboundItem_Bundle,
+	PyGoWaveInboundItem_Ack
+};
+typedef NSInteger PyGoWaveInboundItemKind;
+
+/*
+ A received message on its way from the decoding thread to the model. Bundles
+ and acknowledgements wait in their wavelet's queue until they are next in
+ version order; they are then transformed and moved to the apply queue.
+*/
+@interface PyGoWaveInboundItem : NSObject
+{
+	PyGoWaveInboundItemKind m_kind;
+	NSString * m_waveletId;
+	NSString * m_type;
+	id m_property;
+	NSInteger m_version;
+	NSDictionary * m_blipsums;
+	NSDate * m_timestamp;
+	NSString * m_contributorId;
+	NSMutableArray * m_operations;
+}
+@property (readonly) PyGoWaveInboundItemKind kind;
+@property (readonly) NSString * waveletId;
+@property (readonly) NSString * type;
+@property (readonly) id property;
+@property (readonly) NSInteger version;
+@property (readonly) NSDictionary * blipsums;
+@property (readonly) NSDate * timestamp;
+@property (readonly) NSString * contributorId;
+@property (readonly) NSMutableArray * operations;
+
+- (id)initWithWaveletId:(NSString*)aWaveletId type:(NSString*)aType property:(id)aProperty;
+- (void)dealloc;
+
+@end
+
+@implementation PyGoWaveInboundItem
+
+@synthesize kind = m_kind, waveletId = m_waveletId, type = m_type, property = m_property, version = m_version;
+@synthesize blipsums = m_blipsums, timestamp = m_timestamp, contributorId = m_contributorId, operations = m_operations;
+
+- (id)initWithWaveletId:(NSString*)aWaveletId type:(NSString*)aType property:(id)aProperty
+{
+	if (self = [super init]) {
+		m_waveletId = [aWaveletId copy];
+		m_type = [aType copy];
+		if ([aType isEqual:@"OPERATION_MESSAGE_BUNDLE"])
+			m_kind = PyGoWaveInboundItem_Bundle;
+		else if ([aType isEqual:@"OPERATION_MESSAGE_BUNDLE_ACK"])
+			m_kind = PyGoWaveInboundItem_Ack;
+		else
+			m_kind = PyGoWaveInboundItem_Message;
+		
+		if (m_kind == PyGoWaveInboundItem_Message)
+			m_property = [aProperty retain];
+		else {
+			NSDictionary * propertyDict = aProperty;
+			m_property = [[propertyDict valueForKey:(m_kind == PyGoWaveInboundItem_Ack ? @"newblips" : @"operations")] retain];
+			m_version = [[propertyDict valueForKey:@"version"] intValue];
+			m_blipsums = [[propertyDict valueForKey:@"blipsums"] retain];
+			m_timestamp = [parseJsonTimestamp([propertyDict valueForKey:@"timestamp"]) retain];
+			m_contributorId = [[propertyDict valueForKey:@"contributor"] copy];
+			if (m_kind == PyGoWaveInboundItem_Bundle)
+				m_operations = [NSMutableArray new];
+		}
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_waveletId release];
+	[m_type release];
+	[m_property release];
+	[m_blipsums release];
+	[m_timestamp release];
+	[m_contributorId release];
+	[m_operations release];
+	[super dealloc];
+}
+
+@end
+
+
+/*
+ Round-trip estimate of one wavelet, kept like TCP's retransmission timer
+ (RFC 6298): the smoothed time from sending a bundle to its acknowledgement
+ and the smoothed deviation. Only touched on the owner thread.
+*/
+@interface PyGoWaveSendState : NSObject
+{
+@public
+	NSTimeInterval srtt; // 0 until the first sample
+	NSTimeInterval rttvar;
+	NSTimeInterval sentAt; // 0 while nothing is outstanding
+	NSUInteger timeouts;
+	BOOL flushScheduled;
+}
+@end
+
+@implementation PyGoWaveSendState
+@end
+
+#define PGW_ACK_TIMEOUT_INITIAL	10.0
+#define PGW_ACK_TIMEOUT_MIN		1.0
+#define PGW_ACK_TIMEOUT_MAX		60.0
+// One revolution of the deadline wheel (64s) covers the longest acknowledgement timeout
+#define PGW_ACK_TICK			0.25
+#define PGW_ACK_SLOTS			256
+
+@interface PyGoWaveController ()
+- (void)scheduleApplyInboundItems;
+- (PyGoWaveSerialContext*)serialContextForWaveletWithId:(NSString*)aWaveletId;
+- (NSArray*)generationTaggedObject:(id)aObject;
+- (void)processMessageWithWaveletId:(NSString*)aId type:(NSString*)aType property:(id)aProperty;
+- (void)removeWaveSummaryWithId:(NSString*)aId;
+- (void)saveSnapshotOfWaveletWithId:(NSString*)aId;
+- (void)logOperationsOfWaveletWithId:(NSString*)aWaveletId;
+@end
+
 @implementation PyGoWaveController
 
-@synthesize state = m_state, hostName = m_stompServer;
+@synthesize state = m_state, hostName = m_stompServer, directSerialization = m_directSerialization, jsonParser = m_jsonParser;
+@synthesize pipelined = m_pipelined, parallelWavelets = m_parallelWavelets, workerPoolSize = m_workerPoolSize, inboundDrainMode = m_inboundDrainMode, inboundFrameRate = m_inboundFrameRate, inboundGapTimeout = m_inboundGapTimeout;
+@synthesize changeSetEvents = m_changeSetEvents, lazyWaveList = m_lazyWaveList, persistentParticipants = m_persistentParticipants;
+@synthesize snapshotCache = m_snapshotCache, reconcileSnapshots = m_reconcileSnapshots, logOperations = m_logOperations, maximumSendWindow = m_maximumSendWindow;
+@synthesize captureFile = m_captureFile, collectMetrics = m_collectMetrics, metricsInterval = m_metricsInterval;
 
 #pragma mark Initialization and Deallocation
 
@@ -35,8 +172,28 @@
 	if (self = [super init]) {
 		m_allWaves = [NSMutableDictionary new];
 		m_allWavelets = [NSMutableDictionary new];
-		m_allParticipants = [NSMutableDictionary new];
+		m_waveSummaries = [NSMutableDictionary new];
+		m_waveSummaryOrder = [NSMutableArray new];
+		m_summaryWaveIds = [NSMutableDictionary new];
+		m_lazyWaveList = NO;
+		m_participants = [[PyGoWaveParticipantStore alloc] initWithCapacity:500];
 		m_participantsTodo = [NSMutableSet new];
+		m_participantsStale = [NSMutableSet new];
+		m_persistentParticipants = YES;
+		m_snapshotStore = nil;
+		m_snapshotCache = NO;
+		m_reconcileSnapshots = NO;
+		m_cachedVersions = [NSMutableDictionary new];
+		m_operationLog = nil;
+		m_logOperations = NO;
+		m_sendStates = [NSMutableDictionary new];
+		m_ackDeadlines = [[PyGoWaveTimerWheel alloc] initWithTickInterval:PGW_ACK_TICK slotCount:PGW_ACK_SLOTS target:self selector:@selector(ackTimeout_timeout:)];
+		m_maximumSendWindow = 0.1;
+		m_captureFile = nil;
+		m_metrics = nil;
+		m_collectMetrics = NO;
+		m_metricsInterval = 0.0;
+		m_metricsTimer = nil;
 		m_openWavelets = [NSMutableSet new];
 		m_mcached = [NSMutableDictionary new];
 		m_mpending = [NSMutableDictionary new];
@@ -51,6 +208,30 @@
 		m_state = PyGoWaveController_ClientDisconnected;
 		m_lastSearchId = 0;
 		m_participantsTodoCollect = NO;
+		m_bundleWriter = [PyGoWaveBundleWriter new];
+		m_jsonParser = [SBJsonParser new];
+		m_jsonParser.internStrings = YES;
+		m_directSerialization = YES;
+		m_ownerThread = [[NSThread currentThread] retain];
+		m_workerThread = nil;
+		m_pipelined = NO;
+		m_otLock = [NSRecursiveLock new];
+		m_waveletLocks = [NSMutableDictionary new];
+		m_parallelWavelets = NO;
+		m_workerPool = nil;
+		m_workerPoolSize = 0;
+		m_contexts = [NSMutableDictionary new];
+		m_generation = 0;
+		m_inbound = [NSMutableDictionary new];
+		m_opVersions = [NSMutableDictionary new];
+		m_applyQueue = [NSMutableArray new];
+		m_inboundGaps = [NSMutableSet new];
+		m_inboundDrainMode = PyGoWaveController_DrainImmediately;
+		m_inboundFrameRate = 30;
+		m_inboundGapTimeout = 5.0;
+		m_inboundDrainScheduled = NO;
+		m_inboundLastDrain = 0.0;
+		m_changeSetEvents = NO;
 	}
 	return self;
 }
@@ -61,7 +242,6 @@
 	[m_stompUsername release];
 	[m_stompPassword release];
 	[m_pingTimer release];
-	[m_pendingTimer release];
 	[m_conn release];
 	[m_username release];
 	[m_password release];
@@ -71,14 +251,44 @@
 	[m_createdWaveId release];
 	[m_allWaves release];
 	[m_allWavelets release];
-	[m_allParticipants release];
+	[m_waveSummaries release];
+	[m_waveSummaryOrder release];
+	[m_summaryWaveIds release];
+	[m_participants save];
+	[m_participants release];
 	[m_participantsTodo release];
+	[m_participantsStale release];
+	[m_snapshotStore release];
+	[m_cachedVersions release];
+	[m_operationLog commit];
+	[m_operationLog release];
+	[m_sendStates release];
+	[m_captureFile release];
+	[m_metricsTimer invalidate];
+	[m_metricsTimer release];
+	[m_metrics release];
+	[m_ackDeadlines removeAllDeadlines];
+	[m_ackDeadlines release];
 	[m_openWavelets release];
 	[m_mcached release];
 	[m_mpending release];
 	[m_draftblips release];
 	[m_ispending release];
 	[m_cachedGadgetList release];
+	[m_bundleWriter release];
+	[m_jsonParser release];
+	[m_workerThread stop];
+	[m_workerThread release];
+	[m_ownerThread release];
+	[m_otLock release];
+	[m_waveletLocks release];
+	[m_workerPool stop];
+	[m_workerPool release];
+	[m_contexts release];
+	[m_inbound release];
+	[m_opVersions release];
+	[m_applyQueue release];
+	[m_inboundGaps release];
 	[m_waveAccessKeyRx release];
 	[m_waveAccessKeyTx release];
 	[super dealloc];
@@ -102,42 +312,125 @@
 	m_pingTimer = [[NSTimer scheduledTimerWithTimeInterval:20.0 target:self selector:@selector(pingTimer_timeout:) userInfo:nil repeats:YES] retain];
 }
 
-- (void)killPendingTimer
+- (void)resetMetricsTimer
 {
-	if (m_pendingTimer != nil) {
-		[m_pendingTimer invalidate];
-		[m_pendingTimer release];
+	if (m_metricsTimer != nil) {
+		[m_metricsTimer invalidate];
+		[m_metricsTimer release];
+		m_metricsTimer = nil;
 	}
-	m_pendingTimer = nil;
+	if (m_connected && m_collectMetrics && m_metricsInterval > 0.0)
+		m_metricsTimer = [[NSTimer scheduledTimerWithTimeInterval:m_metricsInterval target:self selector:@selector(metricsTimer_timeout:) userInfo:nil repeats:YES] retain];
 }
 
-- (void)resetPendingTimer
+- (void)metricsTimer_timeout:(NSTimer*)aTimer
 {
-	[self killPendingTimer];
-	m_pendingTimer = [[NSTimer timerWithTimeInterval:10.0 target:self selector:@selector(pendingTimer_timeout:) userInfo:nil repeats:NO] retain];
+	[self postNotificationName:@"metricsUpdated" userInfo:[NSDictionary dictionaryWithObject:[m_metrics snapshot] forKey:@"metrics"] coalescing:NO];
 }
 
-- (void)pendingTimer_timeout:(NSTimer*)aTimer
+- (PyGoWaveSendState*)sendStateForWaveletWithId:(NSString*)aWaveletId
 {
-	//TODO
+	PyGoWaveSendState * state = [m_sendStates objectForKey:aWaveletId];
+	if (state == nil) {
+		state = [PyGoWaveSendState new];
+		[m_sendStates setObject:state forKey:aWaveletId];
+		[state release];
+	}
+	return state;
 }
 
-- (void)addWave:(PyGoWaveWaveModel*)aWave initialMode:(BOOL)bInitialMode
+- (NSTimeInterval)ackTimeoutForState:(PyGoWaveSendState*)aState
+{
+	NSTimeInterval timeout = PGW_ACK_TIMEOUT_INITIAL;
+	if (aState == nil)
+		return timeout;
+	if (aState->srtt > 0.0)
+		timeout = MIN(MAX(aState->srtt + 4.0 * aState->rttvar, PGW_ACK_TIMEOUT_MIN), PGW_ACK_TIMEOUT_MAX);
+	for (NSUInteger i = 0; i < aState->timeouts && timeout < PGW_ACK_TIMEOUT_MAX; i++)
+		timeout *= 2.0; // Back off while the server does not answer
+	return MIN(timeout, PGW_ACK_TIMEOUT_MAX);
+}
+
+// A quarter of the round-trip time, so holding operations back costs little against the wait for the acknowledgement
+- (NSTimeInterval)sendWindowForState:(PyGoWaveSendState*)aState
+{
+	return aState != nil ? MIN(m_maximumSendWindow, aState->srtt / 4.0) : 0.0;
+}
+
+- (void)armAckTimeoutForWaveletWithId:(NSString*)aWaveletId
+{
+	[m_ackDeadlines setDeadlineForKey:aWaveletId afterDelay:[self ackTimeoutForState:[self sendStateForWaveletWithId:aWaveletId]]];
+}
+
+- (void)ackTimeout_timeout:(NSString*)aWaveletId
+{
+	PyGoWaveSendState * state = [m_sendStates objectForKey:aWaveletId];
+	if (state == nil || state->sentAt == 0.0)
+		return;
+	NSLog(@"Controller: No acknowledgement for '%@' after %.1fs", aWaveletId, [NSDate timeIntervalSinceReferenceDate] - state->sentAt);
+	if (state->timeouts++ == 0)
+		[self postErrorOccurredNotification:@"ACK_TIMEOUT" description:@"The server has not acknowledged the last operations yet." waveletId:aWaveletId];
+	[self armAckTimeoutForWaveletWithId:aWaveletId];
+}
+
+- (void)flushOperations_timeout:(NSString*)aWaveletId
+{
+	[self sendStateForWaveletWithId:aWaveletId]->flushScheduled = NO;
+	NSRecursiveLock * lock = [self lockForWaveletWithId:aWaveletId];
+	[lock lock];
+	if ([m_mpending valueForKey:aWaveletId] != nil && ![self waveletHasPendingOperations:aWaveletId])
+		[self transferOperationsForWaveletWithId:aWaveletId];
+	[lock unlock];
+}
+
+- (void)cancelSendTimers
+{
+	[m_ackDeadlines removeAllDeadlines];
+	for (NSString * aWaveletId in m_sendStates)
+		[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(flushOperations_timeout:) object:aWaveletId];
+	[m_sendStates removeAllObjects];
+}
+
+- (void)discardInboundBundlesForWaveletWithId:(NSString*)aWaveletId
+{
+	// A gap timer armed on the other thread cannot be cancelled from here; it finds nothing to do
+	[m_otLock lock];
+	[m_inbound removeObjectForKey:aWaveletId];
+	if ([m_inboundGaps containsObject:aWaveletId]) {
+		[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(inboundGap_timeout:) object:[self generationTaggedObject:aWaveletId]];
+		[m_inboundGaps removeObject:aWaveletId];
+	}
+	[m_otLock unlock];
+}
+
+- (void)registerWave:(PyGoWaveWaveModel*)aWave
 {
 	NSAssert([m_allWaves valueForKey:aWave.waveId] == nil, @"Wave was already present");
 	[m_allWaves setValue:aWave forKey:aWave.waveId];
+	aWave.notificationThread = m_ownerThread;
+	[m_otLock lock];
 	for (PyGoWaveWavelet * wavelet in [aWave allWavelets]) {
 		[m_allWavelets setValue:wavelet forKey:wavelet.waveletId];
 		PyGoWaveOpManager * mcached = [[PyGoWaveOpManager alloc] initWithWaveId:aWave.waveId waveletId:wavelet.waveletId contributorId:m_viewerId];
+		mcached.notificationThread = m_ownerThread;
 		[mcached addBeforeOperationsInsertedObserver:self selector:@selector(mcached_afterOperationsInserted:)];
 		[wavelet addParticipantsChangedObserver:self selector:@selector(wavelet_participantsChanged:)];
 		[m_mcached setValue:mcached forKey:wavelet.waveletId];
 		[mcached release];
 		PyGoWaveOpManager * mpending = [[PyGoWaveOpManager alloc] initWithWaveId:aWave.waveId waveletId:wavelet.waveletId contributorId:m_viewerId];
+		mpending.notificationThread = m_ownerThread;
 		[m_mpending setValue:mpending forKey:wavelet.waveletId];
 		[mpending release];
 		[m_ispending setValue:[NSNumber numberWithBool:NO] forKey:wavelet.waveletId];
+		[m_draftblips setValue:[NSMutableArray array] forKey:wavelet.waveletId];
+		[m_opVersions setValue:[NSNumber numberWithInt:wavelet.version] forKey:wavelet.waveletId];
 	}
+	[m_otLock unlock];
+}
+
+- (void)addWave:(PyGoWaveWaveModel*)aWave initialMode:(BOOL)bInitialMode
+{
+	[self registerWave:aWave];
 	BOOL created = NO;
 	if (m_createdWaveId != nil && [m_createdWaveId isEqual:aWave.waveId]) {
 		[m_createdWaveId release];
@@ -160,9 +453,12 @@
 	[self postNotificationName:@"waveAboutToBeRemoved"
 					  userInfo:[NSDictionary dictionaryWithObjectsAndKeys:aId, @"waveId", nil]
 					coalescing:NO];
-	for (PyGoWaveWavelet * wavelet in [wave allWavelets])
+	for (PyGoWaveWavelet * wavelet in [wave allWavelets]) {
+		[self discardInboundBundlesForWaveletWithId:wavelet.waveletId];
 		[m_allWavelets removeObjectForKey:wavelet.waveletId];
+	}
 	[m_allWaves removeObjectForKey:aId];
+	[self removeWaveSummaryWithId:aId];
 	[wave autorelease];
 }
 
@@ -170,6 +466,78 @@
 {
 	for (NSString * aId in [m_allWaves allKeys])
 		[self removeWaveWithId:aId];
+	[m_waveSummaries removeAllObjects];
+	[m_waveSummaryOrder removeAllObjects];
+	[m_summaryWaveIds removeAllObjects];
+}
+
+- (void)removeWaveSummaryWithId:(NSString*)aId
+{
+	PyGoWaveWaveSummary * summary = [m_waveSummaries valueForKey:aId];
+	if (summary == nil)
+		return;
+	[m_summaryWaveIds removeObjectsForKeys:[summary.wavelets allKeys]];
+	[m_waveSummaryOrder removeObjectIdenticalTo:summary];
+	[m_waveSummaries removeObjectForKey:aId];
+}
+
+// Adds or replaces the summary of a wave; bSorted inserts it at its place in the wave list
+- (void)setWaveSummaryWithId:(NSString*)aId wavelets:(NSDictionary*)sWavelets sorted:(BOOL)bSorted
+{
+	[self removeWaveSummaryWithId:aId];
+	PyGoWaveWaveSummary * summary = [[PyGoWaveWaveSummary alloc] initWithWaveId:aId wavelets:sWavelets];
+	[m_waveSummaries setValue:summary forKey:aId];
+	for (NSString * aWaveletId in sWavelets)
+		[m_summaryWaveIds setValue:aId forKey:aWaveletId];
+	if (bSorted) {
+		NSUInteger low = 0, high = [m_waveSummaryOrder count];
+		while (low < high) {
+			NSUInteger mid = (low + high) / 2;
+			if ([[m_waveSummaryOrder objectAtIndex:mid] compareByLastModified:summary] == NSOrderedAscending)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+		[m_waveSummaryOrder insertObject:summary atIndex:low];
+	}
+	[summary release];
+}
+
+// Creates the model objects and operation managers of a wave from its summary
+- (PyGoWaveWaveModel*)loadWaveWithSummary:(PyGoWaveWaveSummary*)aSummary
+{
+	BOOL collect = !m_participantsTodoCollect;
+	PyGoWaveWaveModel * aWave = [[PyGoWaveWaveModel alloc] initWithWaveId:aSummary.waveId viewerId:m_viewerId participantProvider:self];
+	NSDictionary * sWavelets = aSummary.wavelets;
+	if (collect)
+		[self collectParticipants];
+	for (NSString * aWaveletId in sWavelets)
+		[self newWaveletWithDict:[sWavelets valueForKey:aWaveletId] waveletId:aWaveletId wave:aWave];
+	[self registerWave:aWave];
+	if (collect)
+		[self retrieveParticipants];
+	[aWave release];
+	return aWave;
+}
+
+- (NSDictionary*)headerForDestination:(NSString*)aDestination
+{
+	return [NSDictionary dictionaryWithObjectsAndKeys:
+		[NSString stringWithFormat:@"%@.%@.clientop", m_waveAccessKeyTx, aDestination], @"destination",
+		@"wavelet.topic", @"exchange",
+		@"application/json", @"content-type",
+		nil
+	];
+}
+
+- (void)sendData:(NSData*)aData to:(NSString*)aDestination
+{
+	if (m_waveAccessKeyTx == nil) return;
+	[m_conn sendMessageData:aData customHeader:[self headerForDestination:aDestination]];
+	if (m_collectMetrics)
+		[m_metrics addCount:[aData length] toCounter:PyGoWaveMetric_BytesOut forWaveletWithId:aDestination];
+	if (m_state == PyGoWaveController_ClientOnline)
+		[self resetPingTimer];
 }
 
 - (void)sendJsonTo:(NSString*)aDestination
@@ -177,17 +545,23 @@
 		  property:(NSObject*)aProperty
 {
 	if (m_waveAccessKeyTx == nil) return;
+	uint64_t traceStart = PyGoWaveTraceBegin();
+	if (m_directSerialization) {
+		NSData * message = [m_bundleWriter messageWithType:aMessageType property:aProperty];
+		PyGoWaveTraceEnd("serialize.message", traceStart, [message length]);
+		[self sendData:message to:aDestination];
+		return;
+	}
 	NSMutableDictionary * obj = [NSMutableDictionary new];
 	[obj setValue:aMessageType forKey:@"type"];
 	if (aProperty != nil)
 		[obj setValue:aProperty forKey:@"property"];
-	NSDictionary * header = [NSDictionary dictionaryWithObjectsAndKeys:
-		[NSString stringWithFormat:@"%@.%@.clientop", m_waveAccessKeyTx, aDestination], @"destination",
-		@"wavelet.topic", @"exchange",
-		@"application/json", @"content-type",
-		nil
-	];
-	[m_conn sendMessage:[obj JSONRepresentation] customHeader:header];
+	NSString * json = [obj JSONRepresentation];
+	PyGoWaveTraceEnd("serialize.message", traceStart, [json length]);
+	[m_conn sendMessage:json customHeader:[self headerForDestination:aDestination]];
+	[obj release];
+	if (m_collectMetrics)
+		[m_metrics addCount:[json lengthOfBytesUsingEncoding:NSUTF8StringEncoding] toCounter:PyGoWaveMetric_BytesOut forWaveletWithId:aDestination];
 	if (m_state == PyGoWaveController_ClientOnline)
 		[self resetPingTimer];
 }
@@ -218,11 +592,52 @@
 
 - (void)unsubscribeWaveletWithId:(NSString*)aId close:(BOOL)bClose
 {
+	if ([m_openWavelets containsObject:aId])
+		[self saveSnapshotOfWaveletWithId:aId];
 	if (bClose)
 		[self sendJsonTo:aId messageType:@"WAVELET_CLOSE"];
 	
 	[m_conn unsubscribeFromDestination:[NSString stringWithFormat:@"%@.%@.waveop", m_waveAccessKeyRx, aId]];
 	[m_openWavelets removeObject:aId];
+	[m_cachedVersions removeObjectForKey:aId];
+	[self discardInboundBundlesForWaveletWithId:aId];
+}
+
+// Writes an open wavelet to the snapshot cache, unless it has local changes the server has not acknowledged
+- (void)saveSnapshotOfWaveletWithId:(NSString*)aId
+{
+	PyGoWaveWavelet * aWavelet = [m_allWavelets valueForKey:aId];
+	if (m_snapshotStore == nil || aWavelet == nil)
+		return;
+	NSRecursiveLock * lock = [self lockForWaveletWithId:aId];
+	[lock lock];
+	BOOL clean = ![self waveletHasPendingOperations:aId] && [[m_mcached valueForKey:aId] isEmpty];
+	[lock unlock];
+	if (clean)
+		[m_snapshotStore saveWavelet:aWavelet];
+}
+
+// Shows a wavelet from the snapshot cache while the server's snapshot is on its way
+- (void)loadCachedSnapshotOfWavelet:(PyGoWaveWavelet*)aWavelet
+{
+	NSString * aId = aWavelet.waveletId;
+	if (m_snapshotStore == nil || [m_openWavelets containsObject:aId] || [m_cachedVersions valueForKey:aId] != nil)
+		return;
+	PyGoWaveSnapshot * snapshot = [m_snapshotStore snapshotForWaveletWithId:aId];
+	if (snapshot == nil)
+		return;
+	if (![snapshot loadIntoWavelet:aWavelet]) {
+		[m_snapshotStore removeSnapshotForWaveletWithId:aId];
+		return;
+	}
+	[m_cachedVersions setValue:[NSNumber numberWithInt:snapshot.version] forKey:aId];
+	[self postNotificationName:@"waveletOpened"
+					  userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+								aId, @"waveletId",
+								[NSNumber numberWithBool:aWavelet.isRoot], @"isRoot",
+								[NSNumber numberWithBool:YES], @"cached",
+								nil]
+					coalescing:NO];
 }
 - (void)unsubscribeWaveletWithId:(NSString*)aId
 {
@@ -270,6 +685,7 @@
 	
 	for (NSString * aParticipantId in participants)
 		[aWavelet addParticipant:[self participantById:aParticipantId]];
+	aWavelet.changeSetEvents = m_changeSetEvents;
 	
 	return aWavelet;
 }
@@ -292,6 +708,45 @@
 		[aWavelet removeParticipantById:aParticipantId];
 }
 
+- (BOOL)isOwnerThread
+{
+	return [NSThread currentThread] == m_ownerThread;
+}
+
+// Set on every wave and operation manager of this controller as well
+- (NSThread *)notificationThread
+{
+	return m_ownerThread;
+}
+
+/*
+ Returns the lock that guards the operation managers and draft blips of a
+ wavelet. m_otLock only guards the shared tables and queues and is never held
+ while waiting for a wavelet lock.
+*/
+- (NSRecursiveLock*)lockForWaveletWithId:(NSString*)aWaveletId
+{
+	[m_otLock lock];
+	NSRecursiveLock * lock = [m_waveletLocks valueForKey:aWaveletId];
+	if (lock == nil) {
+		lock = [NSRecursiveLock new];
+		[m_waveletLocks setValue:lock forKey:aWaveletId];
+		[lock release];
+	}
+	[m_otLock unlock];
+	return lock;
+}
+
+// The version the operation managers of a wavelet are relative to
+- (NSInteger)operationVersionForWaveletWithId:(NSString*)aWaveletId
+{
+	[m_otLock lock];
+	NSInteger aVersion = [[m_opVersions valueForKey:aWaveletId] intValue];
+	[m_otLock unlock];
+	return aVersion;
+}
+
+// Call with the wavelet lock held
 - (BOOL)waveletHasPendingOperations:(NSString*)aWaveletId
 {
 	NSNumber * p = [m_ispending valueForKey:aWaveletId];
@@ -301,71 +756,172 @@
 
 - (void)transferOperationsForWaveletWithId:(NSString*)aWaveletId
 {
+	NSRecursiveLock * lock = [self lockForWaveletWithId:aWaveletId];
+	[lock lock];
 	PyGoWaveOpManager * mp = [m_mpending valueForKey:aWaveletId];
 	NSAssert(mp != nil, @"Wavelet not found");
 	PyGoWaveOpManager * mc = [m_mcached valueForKey:aWaveletId];
-	PyGoWaveWavelet * model = [m_allWavelets valueForKey:aWaveletId];
+	// Cached operations are relative to the last version seen by the decoding thread
+	NSInteger aVersion = [self operationVersionForWaveletWithId:aWaveletId];
 	
 	if (mp.isEmpty)
 		[mp putOperations:[mc fetchOperations]];
+	if (m_collectMetrics) {
+		[m_metrics setValue:[[mc operations] count] ofGauge:PyGoWaveMetric_CachedOperations forWaveletWithId:aWaveletId];
+		[m_metrics setValue:[[mp operations] count] ofGauge:PyGoWaveMetric_PendingOperations forWaveletWithId:aWaveletId];
+	}
 	
-	if (mp.isEmpty)
-		return;
+	if (!mp.isEmpty) {
+		[m_ispending setValue:[NSNumber numberWithBool:YES] forKey:aWaveletId];
+		PyGoWaveSendState * state = [self sendStateForWaveletWithId:aWaveletId];
+		if (state->flushScheduled) {
+			[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(flushOperations_timeout:) object:aWaveletId];
+			state->flushScheduled = NO;
+		}
+		state->sentAt = [NSDate timeIntervalSinceReferenceDate];
+		state->timeouts = 0;
+		[self armAckTimeoutForWaveletWithId:aWaveletId];
+		if (m_collectMetrics)
+			[m_metrics addCount:1 toCounter:PyGoWaveMetric_BundlesSent forWaveletWithId:aWaveletId];
+		
+		if (m_directSerialization) {
+			uint64_t traceStart = PyGoWaveTraceBegin();
+			NSData * bundle = [mp writeBundleWithVersion:aVersion toWriter:m_bundleWriter];
+			PyGoWaveTraceEnd("serialize.bundle", traceStart, [bundle length]);
+			[self sendData:bundle to:aWaveletId];
+		}
+		else
+			[self sendJsonTo:aWaveletId messageType:@"OPERATION_MESSAGE_BUNDLE" property:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:aVersion], @"version", [mp serializeOperations], @"operations", nil]];
+	}
+	[lock unlock];
+}
+
+static NSString * const kMemoryWave = @"wave";
+static NSString * const kMemoryWavelet = @"wavelet";
+static NSString * const kMemoryBlip = @"blip";
+static NSString * const kMemoryOperations = @"operations";
+static NSString * const kMemoryParticipantCache = @"participantCache";
+static NSString * const kMemoryGadgetList = @"gadgetList";
+static NSString * const kMemoryWaveList = @"waveList";
+
+/*
+ Walks the loaded waves, operation queues and caches once. Every byte is
+ counted in exactly one consumer added to aRanking; aReport, if given, gets
+ the nested breakdown described in the header. Returns the total.
+*/
+- (NSUInteger)accountMemoryWithReport:(NSMutableDictionary*)aReport ranking:(PyGoWaveMemoryRanking*)aRanking
+{
+	NSUInteger total = 0;
+	NSMutableDictionary * waves = aReport != nil ? [NSMutableDictionary dictionaryWithCapacity:[m_allWaves count]] : nil;
+	for (NSString * aWaveId in m_allWaves) {
+		PyGoWaveWaveModel * wave = [m_allWaves objectForKey:aWaveId];
+		NSUInteger waveBytes = [wave retainedBytes];
+		[aRanking addBytes:waveBytes kind:kMemoryWave waveId:aWaveId waveletId:nil blipId:nil];
+		NSMutableDictionary * wavelets = aReport != nil ? [NSMutableDictionary dictionary] : nil;
+		for (PyGoWaveWavelet * wavelet in [wave allWavelets]) {
+			NSString * aWaveletId = wavelet.waveletId;
+			NSUInteger waveletBytes = [wavelet retainedBytes];
+			[aRanking addBytes:waveletBytes kind:kMemoryWavelet waveId:aWaveId waveletId:aWaveletId blipId:nil];
+			
+			NSRecursiveLock * lock = [self lockForWaveletWithId:aWaveletId];
+			[lock lock];
+			NSUInteger opBytes = [[m_mcached valueForKey:aWaveletId] retainedBytes] + [[m_mpending valueForKey:aWaveletId] retainedBytes];
+			[lock unlock];
+			[aRanking addBytes:opBytes kind:kMemoryOperations waveId:aWaveId waveletId:aWaveletId blipId:nil];
+			waveletBytes += opBytes;
+			
+			NSMutableDictionary * blips = aReport != nil ? [NSMutableDictionary dictionary] : nil;
+			for (PyGoWaveBlip * blip in [wavelet allBlips]) {
+				PyGoWaveBlipMemoryUsage usage;
+				[blip getMemoryUsage:&usage];
+				[aRanking addBytes:usage.total kind:kMemoryBlip waveId:aWaveId waveletId:aWaveletId blipId:blip.blipId];
+				waveletBytes += usage.total;
+				[blips setValue:[NSDictionary dictionaryWithObjectsAndKeys:
+								 [NSNumber numberWithUnsignedInteger:usage.total], @"total",
+								 [NSNumber numberWithUnsignedInteger:usage.content], @"content",
+								 [NSNumber numberWithUnsignedInteger:usage.elements], @"elements",
+								 [NSNumber numberWithUnsignedInteger:usage.annotations], @"annotations",
+								 [NSNumber numberWithUnsignedInteger:usage.contributors], @"contributors",
+								 nil]
+						 forKey:blip.blipId];
+			}
+			waveBytes += waveletBytes;
+			[wavelets setValue:[NSDictionary dictionaryWithObjectsAndKeys:
+								[NSNumber numberWithUnsignedInteger:waveletBytes], @"total",
+								[NSNumber numberWithUnsignedInteger:opBytes], @"operations",
+								blips, @"blips",
+								nil]
+						forKey:aWaveletId];
+		}
+		total += waveBytes;
+		[waves setValue:[NSDictionary dictionaryWithObjectsAndKeys:
+						 [NSNumber numberWithUnsignedInteger:waveBytes], @"total",
+						 wavelets, @"wavelets",
+						 nil]
+				 forKey:aWaveId];
+	}
 	
-	[m_ispending setValue:[NSNumber numberWithBool:YES] forKey:aWaveletId];
-	[self resetPendingTimer];
+	NSUInteger participantBytes = [m_participants retainedBytes];
+	NSUInteger gadgetListBytes = PyGoWaveEstimatedBytes(m_cachedGadgetList);
+	NSUInteger waveListBytes = PyGoWaveCollectionBytes(m_waveSummaries) + PyGoWaveCollectionBytes(m_waveSummaryOrder);
+	for (NSString * aWaveId in m_waveSummaries)
+		waveListBytes += [[m_waveSummaries objectForKey:aWaveId] retainedBytes];
+	[aRanking addBytes:participantBytes kind:kMemoryParticipantCache waveId:nil waveletId:nil blipId:nil];
+	[aRanking addBytes:gadgetListBytes kind:kMemoryGadgetList waveId:nil waveletId:nil blipId:nil];
+	[aRanking addBytes:waveListBytes kind:kMemoryWaveList waveId:nil waveletId:nil blipId:nil];
+	total += participantBytes + gadgetListBytes + waveListBytes;
 	
-	[self sendJsonTo:aWaveletId messageType:@"OPERATION_MESSAGE_BUNDLE" property:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:model.version], @"version", [mp serializeOperations], @"operations", nil]];
+	[aReport setValue:[NSNumber numberWithUnsignedInteger:total] forKey:@"total"];
+	[aReport setValue:waves forKey:@"waves"];
+	[aReport setValue:[NSNumber numberWithUnsignedInteger:participantBytes] forKey:kMemoryParticipantCache];
+	[aReport setValue:[NSNumber numberWithUnsignedInteger:gadgetListBytes] forKey:kMemoryGadgetList];
+	[aReport setValue:[NSNumber numberWithUnsignedInteger:waveListBytes] forKey:kMemoryWaveList];
+	return total;
 }
 
-- (void)processMessageBundleForWavelet:(PyGoWaveWavelet*)aWavelet
-								 isAck:(BOOL)bAck
-				   serialOpsOrNewblips:(id)sOpsOrNewblips
-							   version:(NSInteger)aVersion
-							  blipsums:(NSDictionary*)sBlipsums 
-							 timestamp:(NSDate*)aTimestamp
-						 contributorId:(NSString*)aContributorId
-{
-	PyGoWaveOpManager * mpending = [m_mpending valueForKey:aWavelet.waveletId];
-	PyGoWaveOpManager * mcached = [m_mcached valueForKey:aWavelet.waveletId];
-	
-	if (bAck) {
-		PyGoWaveOpManager * delta = [[PyGoWaveOpManager alloc] initWithWaveId:aWavelet.waveId waveletId:aWavelet.waveletId contributorId:aContributorId];
-		[delta addSerializedOperations:(NSArray*)sOpsOrNewblips];
-		
-		NSMutableArray * ops = [NSMutableArray new];
+#pragma mark Decoding thread
+
+/*
+ Transforms a remote bundle against the local operations, or updates the local
+ operations for an acknowledgement, and moves it to the apply queue.
+ Called on the decoding thread with the wavelet lock held.
+*/
+- (void)transformInboundItem:(PyGoWaveInboundItem*)aItem
+					 mcached:(PyGoWaveOpManager*)mcached
+					mpending:(PyGoWaveOpManager*)mpending
+				  draftblips:(NSMutableArray*)draftblips
+{
+	NSTimeInterval started = m_collectMetrics ? [NSDate timeIntervalSinceReferenceDate] : 0.0;
+	uint64_t traceStart = PyGoWaveTraceBegin();
+	if (aItem.kind == PyGoWaveInboundItem_Bundle) {
+		// One operation object and one result array serve the whole bundle; the
+		// transforms copy what they keep
+		PyGoWaveOperation * incoming = [PyGoWaveOperation new];
+		NSMutableArray * transformed = [NSMutableArray new];
 		
 		// Iterate over all operations
-		for (PyGoWaveOperation * incoming in [delta operations]) {
+		for (NSDictionary * sOp in aItem.property) {
+			[incoming loadSerialized:sOp];
 			// Transform pending operations, iterate over results
-			for (PyGoWaveOperation * tr in [mpending transformInputOperation:incoming]) {
+			[transformed removeAllObjects];
+			[mpending transformInputOperation:incoming appendingTo:transformed];
+			for (PyGoWaveOperation * tr in transformed) {
 				// Transform cached operations, save results
-				[ops addObject:[mcached transformInputOperation:tr]];
+				[mcached transformInputOperation:tr appendingTo:aItem.operations];
 			}
 		}
-		
-		// Apply operations
-		[self collectParticipants];
-		[aWavelet applyOperations:ops timestamp:aTimestamp contributorId:aContributorId];
-		[self retrieveParticipants];
-		
-		// Set version and checkup
-		aWavelet.version = aVersion;
-		if (![self waveletHasPendingOperations:aWavelet.waveletId] && mcached.isEmpty)
-			[aWavelet checkSync:sBlipsums];
-		[ops release];
-	}
-	else { // ACK message
-		[self killPendingTimer];
-		aWavelet.version = aVersion;
+		[transformed release];
+		[incoming release];
+	}
+	else {
 		[mpending fetchOperations];
+		if (m_collectMetrics)
+			[m_metrics setValue:0 ofGauge:PyGoWaveMetric_PendingOperations forWaveletWithId:aItem.waveletId];
 		
 		// Update Blip IDs
-		NSMutableArray * draftblips = [m_draftblips valueForKey:aWavelet.waveletId];
-		NSDictionary * idDict = sOpsOrNewblips;
+		NSDictionary * idDict = aItem.property;
 		for (NSString * aTempId in idDict) {
 			NSString * aBlipId = [idDict valueForKey:aTempId];
-			[aWavelet updateBlipId:aTempId toBlipId:aBlipId];
 			[mcached unlockBlipOpsWithId:aTempId];
 			[mcached updateBlipId:aTempId toBlipId:aBlipId];
 			if ([draftblips containsObject:aTempId]) {
@@ -374,31 +930,530 @@
 				[mcached lockBlipOpsWithId:aBlipId];
 			}
 		}
+	}
+	PyGoWaveTraceEnd("ot.transform", traceStart, [aItem.operations count]);
+	if (m_collectMetrics)
+		[m_metrics addTime:[NSDate timeIntervalSinceReferenceDate] - started toTiming:PyGoWaveMetric_TransformTime forWaveletWithId:aItem.waveletId];
+	[m_otLock lock];
+	[m_opVersions setValue:[NSNumber numberWithInt:aItem.version] forKey:aItem.waveletId];
+	[m_applyQueue addObject:aItem];
+	[m_otLock unlock];
+}
+
+/*
+ Work handed to the pool or to a timer carries the connection generation it
+ was created in. The pool keeps running across reconnects and timers armed on
+ the owner thread cannot be cancelled from a decoding thread, so stale work
+ checks the generation first and returns.
+*/
+- (NSArray*)generationTaggedObject:(id)aObject
+{
+	[m_otLock lock];
+	NSNumber * generation = [NSNumber numberWithUnsignedInteger:m_generation];
+	[m_otLock unlock];
+	return [NSArray arrayWithObjects:generation, aObject, nil];
+}
+
+- (BOOL)isCurrentGeneration:(NSArray*)aTagged
+{
+	[m_otLock lock];
+	BOOL bCurrent = [[aTagged objectAtIndex:0] unsignedIntegerValue] == m_generation;
+	[m_otLock unlock];
+	return bCurrent;
+}
+
+- (void)armInboundGapTimer:(NSArray*)aTaggedWaveletId
+{
+	if (![self isCurrentGeneration:aTaggedWaveletId])
+		return;
+	[self performSelector:@selector(inboundGap_timeout:) withObject:aTaggedWaveletId afterDelay:m_inboundGapTimeout];
+}
+
+/*
+ Transforms queued bundles in version order until the queue is empty or a
+ version is missing. If bForce is set, missing versions are skipped.
+ Called on the decoding thread of the wavelet.
+*/
+- (void)drainInboundBundlesForWaveletWithId:(NSString*)aWaveletId force:(BOOL)bForce
+{
+	NSRecursiveLock * lock = [self lockForWaveletWithId:aWaveletId];
+	[lock lock];
+	[m_otLock lock];
+	NSMutableArray * queue = [[m_inbound valueForKey:aWaveletId] retain];
+	NSNumber * opVersion = [[m_opVersions valueForKey:aWaveletId] retain];
+	PyGoWaveOpManager * mcached = [[m_mcached valueForKey:aWaveletId] retain];
+	PyGoWaveOpManager * mpending = [[m_mpending valueForKey:aWaveletId] retain];
+	NSMutableArray * draftblips = [[m_draftblips valueForKey:aWaveletId] retain];
+	[m_otLock unlock];
+	
+	if (queue != nil && (opVersion == nil || mcached == nil))
+		[self discardInboundBundlesForWaveletWithId:aWaveletId];
+	else if (queue != nil) {
+		NSInteger nextVersion = [opVersion intValue] + 1;
+		while ([queue count] > 0) {
+			PyGoWaveInboundItem * item = [queue objectAtIndex:0];
+			if (item.version < nextVersion) {
+				NSLog(@"Controller: Dropping stale bundle with version %ld for wavelet '%@'", (long)item.version, aWaveletId);
+				[queue removeObjectAtIndex:0];
+				continue;
+			}
+			if (item.version > nextVersion && !bForce)
+				break;
+			
+			nextVersion = item.version + 1;
+			[self transformInboundItem:item mcached:mcached mpending:mpending draftblips:draftblips];
+			[queue removeObjectAtIndex:0];
+		}
 		
-		if (!mcached.isEmpty) {
-			if (mcached.canFetch)
-				[self transferOperationsForWaveletWithId:aWavelet.waveletId];
+		if ([queue count] == 0)
+			[self discardInboundBundlesForWaveletWithId:aWaveletId];
+		else {
+			[m_otLock lock];
+			BOOL bArm = ![m_inboundGaps containsObject:aWaveletId];
+			if (bArm)
+				[m_inboundGaps addObject:aWaveletId];
+			[m_otLock unlock];
+			// Wait for the missing version(s) for a while; pool threads have no run loop for the timer
+			if (bArm && m_workerPool != nil)
+				[self performSelector:@selector(armInboundGapTimer:) onThread:m_ownerThread withObject:[self generationTaggedObject:aWaveletId] waitUntilDone:NO];
+			else if (bArm)
+				[self armInboundGapTimer:[self generationTaggedObject:aWaveletId]];
+		}
+	}
+	[queue release];
+	[opVersion release];
+	[mcached release];
+	[mpending release];
+	[draftblips release];
+	[lock unlock];
+}
+
+- (void)closeInboundGapOfWaveletWithId:(NSString*)aWaveletId
+{
+	[m_otLock lock];
+	BOOL bGap = [m_inboundGaps containsObject:aWaveletId];
+	[m_inboundGaps removeObject:aWaveletId];
+	[m_otLock unlock];
+	if (!bGap)
+		return;
+	
+	[self postErrorOccurredNotification:@"VERSION_GAP"
+							description:[NSString stringWithFormat:@"Missing operations after version %d; applying later bundles anyway", [self operationVersionForWaveletWithId:aWaveletId]]
+							  waveletId:aWaveletId];
+	[self drainInboundBundlesForWaveletWithId:aWaveletId force:YES];
+	[self scheduleApplyInboundItems];
+}
+
+- (void)closeInboundGap:(NSArray*)aTaggedWaveletId
+{
+	if ([self isCurrentGeneration:aTaggedWaveletId])
+		[self closeInboundGapOfWaveletWithId:[aTaggedWaveletId objectAtIndex:1]];
+}
+
+- (void)inboundGap_timeout:(NSArray*)aTaggedWaveletId
+{
+	if (![self isCurrentGeneration:aTaggedWaveletId])
+		return;
+	NSString * aWaveletId = [aTaggedWaveletId objectAtIndex:1];
+	if (m_workerPool != nil)
+		[[self serialContextForWaveletWithId:aWaveletId] performSelector:@selector(closeInboundGap:) target:self withObject:aTaggedWaveletId];
+	else
+		[self closeInboundGapOfWaveletWithId:aWaveletId];
+}
+
+- (void)queueInboundBundle:(PyGoWaveInboundItem*)aItem
+{
+	NSString * aWaveletId = aItem.waveletId;
+	[m_otLock lock];
+	NSMutableArray * queue = [m_inbound valueForKey:aWaveletId];
+	if (queue == nil) {
+		queue = [NSMutableArray new];
+		[m_inbound setValue:queue forKey:aWaveletId];
+		[queue release];
+	}
+	
+	// Keep ordered by version; bundles usually arrive in order
+	NSInteger i = [queue count];
+	while (i > 0 && ((PyGoWaveInboundItem*)[queue objectAtIndex:i-1]).version > aItem.version)
+		i--;
+	[queue insertObject:aItem atIndex:i];
+	[m_otLock unlock];
+	
+	[self drainInboundBundlesForWaveletWithId:aWaveletId force:NO];
+}
+
+/*
+ Entry point for decoded messages. Runs on the worker thread in pipelined
+ mode and in the wavelet's serial context in parallel mode; everything that
+ touches the model is left to applyInboundItems.
+*/
+- (void)receiveMessages:(NSArray*)aMessages forWaveletWithId:(NSString*)aWaveletId
+{
+	for (NSDictionary * msg in aMessages) {
+		NSString * msgType = [msg valueForKey:@"type"];
+		if (msgType == nil) {
+			NSLog(@"Controller: Message lacks 'type' field!"); break;
 		}
+		PyGoWaveInboundItem * item = [[PyGoWaveInboundItem alloc] initWithWaveletId:aWaveletId type:msgType property:[msg valueForKey:@"property"]];
+		if (item.kind != PyGoWaveInboundItem_Message)
+			[self queueInboundBundle:item];
 		else {
-			// All done, we can do a check-up
-			[aWavelet checkSync:sBlipsums];
-			[m_ispending setValue:[NSNumber numberWithBool:NO] forKey:aWavelet.waveletId];
+			[m_otLock lock];
+			[m_applyQueue addObject:item];
+			BOOL bOpen = [msgType isEqual:@"WAVELET_OPEN"] && [m_mcached valueForKey:aWaveletId] != nil;
+			if (bOpen) {
+				// The snapshot is the new base; bundles older than it are dropped
+				NSInteger aVersion = [[[item.property valueForKey:@"wavelet"] valueForKey:@"version"] intValue];
+				[m_opVersions setValue:[NSNumber numberWithInt:aVersion] forKey:aWaveletId];
+			}
+			[m_otLock unlock];
+			if (bOpen)
+				[self drainInboundBundlesForWaveletWithId:aWaveletId force:NO];
 		}
+		[item release];
 	}
+	[self scheduleApplyInboundItems];
 }
 
-- (void)queueMessageBundleForWavelet:(PyGoWaveWavelet*)aWavelet
-							   isAck:(BOOL)bAck
-				 serialOpsOrNewblips:(NSObject*)sOpsOrNewblips
-							 version:(NSInteger)aVersion
-							blipsums:(NSDictionary*)sBlipsums
-						   timestamp:(NSDate*)aTimestamp
-					   contributorId:(NSString*)aContributorId
+// SBJsonParser is not thread-safe, so every decoding thread gets its own
+- (SBJsonParser*)jsonParserForCurrentThread
 {
-	//TODO
-	[self processMessageBundleForWavelet:aWavelet isAck:bAck serialOpsOrNewblips:sOpsOrNewblips version:aVersion blipsums:sBlipsums timestamp:aTimestamp contributorId:aContributorId];
+	if ([self isOwnerThread])
+		return m_jsonParser;
+	NSMutableDictionary * threadDict = [[NSThread currentThread] threadDictionary];
+	SBJsonParser * parser = [threadDict objectForKey:@"PyGoWaveJsonParser"];
+	if (parser == nil) {
+		parser = [SBJsonParser new];
+		parser.internStrings = YES;
+		[threadDict setObject:parser forKey:@"PyGoWaveJsonParser"];
+		[parser release];
+	}
+	return parser;
 }
+
+- (void)decodeMessageBody:(NSString*)aBody forWaveletWithId:(NSString*)aWaveletId
+{
+	// The parse tree and the transform temporaries go away with the message, not
+	// with the next drain of the run loop's pool
+	NSAutoreleasePool * pool = [NSAutoreleasePool new];
+	NSTimeInterval started = m_collectMetrics ? [NSDate timeIntervalSinceReferenceDate] : 0.0;
+	uint64_t traceStart = PyGoWaveTraceBegin();
+	NSArray * msgs = [[self jsonParserForCurrentThread] objectWithString:aBody];
+	PyGoWaveTraceEnd("json.parse", traceStart, [aBody length]);
+	if (m_collectMetrics) {
+		[m_metrics addTime:[NSDate timeIntervalSinceReferenceDate] - started toTiming:PyGoWaveMetric_ParseTime forWaveletWithId:aWaveletId];
+		[m_metrics addCount:[aBody lengthOfBytesUsingEncoding:NSUTF8StringEncoding] toCounter:PyGoWaveMetric_BytesIn forWaveletWithId:aWaveletId];
+	}
+	if (msgs == nil)
+		NSLog(@"Controller: Error in parsing received JSON data!");
+	else
+		[self receiveMessages:msgs forWaveletWithId:aWaveletId];
+	[pool release];
+}
+
+- (void)decodeMessage:(NSArray*)aTaggedWaveletIdAndBody
+{
+	if (![self isCurrentGeneration:aTaggedWaveletIdAndBody])
+		return;
+	NSArray * aWaveletIdAndBody = [aTaggedWaveletIdAndBody objectAtIndex:1];
+	[self decodeMessageBody:[aWaveletIdAndBody objectAtIndex:1] forWaveletWithId:[aWaveletIdAndBody objectAtIndex:0]];
+}
+
+- (PyGoWaveSerialContext*)serialContextForWaveletWithId:(NSString*)aWaveletId
+{
+	[m_otLock lock];
+	PyGoWaveSerialContext * context = [m_contexts valueForKey:aWaveletId];
+	if (context == nil) {
+		context = [[PyGoWaveSerialContext alloc] initWithPool:m_workerPool];
+		[m_contexts setValue:context forKey:aWaveletId];
+		[context release];
+	}
+	[[context retain] autorelease];
+	[m_otLock unlock];
+	return context;
+}
+
+#pragma mark Owner thread
+
+- (void)applyRemoteItems:(NSArray*)aItems toWavelet:(PyGoWaveWavelet*)aWavelet
+{
+	NSMutableArray * ops = [NSMutableArray new];
+	NSString * aContributorId = nil;
+	NSDate * aTimestamp = nil;
+	NSTimeInterval started = m_collectMetrics ? [NSDate timeIntervalSinceReferenceDate] : 0.0;
+	
+	[self collectParticipants];
+	for (PyGoWaveInboundItem * item in aItems) {
+		// Consecutive bundles of one contributor are applied together
+		if (aContributorId != nil && ![aContributorId isEqual:item.contributorId]) {
+			[aWavelet applyOperations:ops timestamp:aTimestamp contributorId:aContributorId];
+			[ops removeAllObjects];
+		}
+		[ops addObjectsFromArray:item.operations];
+		aContributorId = item.contributorId;
+		aTimestamp = item.timestamp;
+		aWavelet.version = item.version;
+	}
+	
+	// Apply operations
+	if (aContributorId != nil)
+		[aWavelet applyOperations:ops timestamp:aTimestamp contributorId:aContributorId];
+	[self retrieveParticipants];
+	[ops release];
+	if (m_collectMetrics) {
+		[m_metrics addTime:[NSDate timeIntervalSinceReferenceDate] - started toTiming:PyGoWaveMetric_ApplyTime forWaveletWithId:aWavelet.waveletId];
+		[m_metrics addCount:[aItems count] toCounter:PyGoWaveMetric_BundlesReceived forWaveletWithId:aWavelet.waveletId];
+	}
+	
+	// Checkup against the latest state
+	NSRecursiveLock * lock = [self lockForWaveletWithId:aWavelet.waveletId];
+	[lock lock];
+	BOOL bSynced = ![self waveletHasPendingOperations:aWavelet.waveletId] && [[m_mcached valueForKey:aWavelet.waveletId] isEmpty];
+	[lock unlock];
+	if (bSynced) {
+		[aWavelet checkSync:[[aItems lastObject] blipsums]];
+		if (m_collectMetrics && [aWavelet.status isEqual:@"invalid"])
+			[m_metrics addCount:1 toCounter:PyGoWaveMetric_CheckSyncFailures forWaveletWithId:aWavelet.waveletId];
+	}
+	else
+		[self logOperationsOfWaveletWithId:aWavelet.waveletId]; // Transformed and rebased
+}
+
+- (void)applyAckItem:(PyGoWaveInboundItem*)aItem toWavelet:(PyGoWaveWavelet*)aWavelet
+{
+	PyGoWaveSendState * state = [self sendStateForWaveletWithId:aWavelet.waveletId];
+	[m_ackDeadlines removeDeadlineForKey:aWavelet.waveletId];
+	if (state->sentAt > 0.0) {
+		NSTimeInterval rtt = [NSDate timeIntervalSinceReferenceDate] - state->sentAt;
+		if (state->srtt == 0.0) {
+			state->srtt = rtt;
+			state->rttvar = rtt / 2.0;
+		}
+		else {
+			state->rttvar = 0.75 * state->rttvar + 0.25 * fabs(state->srtt - rtt);
+			state->srtt = 0.875 * state->srtt + 0.125 * rtt;
+		}
+		state->sentAt = 0.0;
+		if (m_collectMetrics)
+			[m_metrics addTime:rtt toTiming:PyGoWaveMetric_AckTime forWaveletWithId:aWavelet.waveletId];
+	}
+	if (m_collectMetrics)
+		[m_metrics addCount:1 toCounter:PyGoWaveMetric_AcksReceived forWaveletWithId:aWavelet.waveletId];
+	aWavelet.version = aItem.version;
+	
+	NSDictionary * idDict = aItem.property;
+	for (NSString * aTempId in idDict)
+		[aWavelet updateBlipId:aTempId toBlipId:[idDict valueForKey:aTempId]];
+	
+	NSRecursiveLock * lock = [self lockForWaveletWithId:aWavelet.waveletId];
+	[lock lock];
+	PyGoWaveOpManager * mcached = [m_mcached valueForKey:aWavelet.waveletId];
+	if (!mcached.isEmpty) {
+		if (mcached.canFetch)
+			[self transferOperationsForWaveletWithId:aWavelet.waveletId];
+	}
+	else {
+		// All done, we can do a check-up
+		[aWavelet checkSync:aItem.blipsums];
+		if (m_collectMetrics && [aWavelet.status isEqual:@"invalid"])
+			[m_metrics addCount:1 toCounter:PyGoWaveMetric_CheckSyncFailures forWaveletWithId:aWavelet.waveletId];
+		[m_ispending setValue:[NSNumber numberWithBool:NO] forKey:aWavelet.waveletId];
+	}
+	[self logOperationsOfWaveletWithId:aWavelet.waveletId];
+	[lock unlock];
+}
+
+/*
+ Applies everything the decoding thread has finished, in arrival order. Runs of
+ remote bundles for one wavelet go through a single apply pass.
+*/
+- (void)applyInboundItems
+{
+	m_inboundDrainScheduled = NO;
+	m_inboundLastDrain = [NSDate timeIntervalSinceReferenceDate];
+	
+	[m_otLock lock];
+	NSArray * items = [m_applyQueue copy];
+	[m_applyQueue removeAllObjects];
+	[m_otLock unlock];
+	
+	NSUInteger i = 0, count = [items count];
+	while (i < count) {
+		// Model changes and notifications leave temporaries of their own; one pool per message or run of bundles
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		PyGoWaveInboundItem * item = [items objectAtIndex:i];
+		if (item.kind == PyGoWaveInboundItem_Message) {
+			uint64_t traceStart = PyGoWaveTraceBegin();
+			[self processMessageWithWaveletId:item.waveletId type:item.type property:item.property];
+			PyGoWaveTraceEnd("controller.processMessage", traceStart, -1);
+			i++;
+			[pool release];
+			continue;
+		}
+		
+		NSUInteger j = i + 1;
+		if (item.kind == PyGoWaveInboundItem_Bundle) {
+			while (j < count && ((PyGoWaveInboundItem*)[items objectAtIndex:j]).kind == PyGoWaveInboundItem_Bundle
+				   && [((PyGoWaveInboundItem*)[items objectAtIndex:j]).waveletId isEqual:item.waveletId])
+				j++;
+		}
+		PyGoWaveWavelet * aWavelet = [m_allWavelets valueForKey:item.waveletId];
+		if (aWavelet != nil) {
+			if (item.kind == PyGoWaveInboundItem_Bundle)
+				[self applyRemoteItems:[items subarrayWithRange:NSMakeRange(i, j - i)] toWavelet:aWavelet];
+			else
+				[self applyAckItem:item toWavelet:aWavelet];
+		}
+		i = j;
+		[pool release];
+	}
+	[items release];
+}
+
+- (void)scheduleApplyInboundItems
+{
+	if (![self isOwnerThread]) {
+		[self performSelector:@selector(scheduleApplyInboundItems) onThread:m_ownerThread withObject:nil waitUntilDone:NO];
+		return;
+	}
+	if (m_inboundDrainScheduled)
+		return;
+	if (m_inboundDrainMode == PyGoWaveController_DrainImmediately) {
+		[self applyInboundItems];
+		return;
+	}
+	
+	NSTimeInterval delay = 0.0;
+	if (m_inboundDrainMode == PyGoWaveController_DrainAtFrameRate && m_inboundFrameRate > 0) {
+		delay = m_inboundLastDrain + 1.0 / m_inboundFrameRate - [NSDate timeIntervalSinceReferenceDate];
+		if (delay < 0.0)
+			delay = 0.0;
+	}
+	m_inboundDrainScheduled = YES;
+	[self performSelector:@selector(applyInboundItems) withObject:nil afterDelay:delay];
+}
+
+/*
+ Local edits are made on the model, which does not contain the operations in
+ the apply queue yet. While there are any for the wavelet, the edit is recorded
+ in a scratch manager and transformed against them in endLocalEdit:.
+ The wavelet lock is held from begin to end.
+*/
+- (PyGoWaveOpManager*)beginLocalEditOfWaveletWithId:(NSString*)aWaveletId
+{
+	[[self lockForWaveletWithId:aWaveletId] lock];
+	PyGoWaveOpManager * mcached = [m_mcached valueForKey:aWaveletId];
+	BOOL bQueued = NO;
+	[m_otLock lock];
+	for (PyGoWaveInboundItem * item in m_applyQueue) {
+		if (item.kind != PyGoWaveInboundItem_Message && [item.waveletId isEqual:aWaveletId]) {
+			bQueued = YES;
+			break;
+		}
+	}
+	[m_otLock unlock];
+	if (bQueued) {
+		PyGoWaveOpManager * delta = [[PyGoWaveOpManager alloc] initWithWaveId:mcached.waveId waveletId:aWaveletId contributorId:m_viewerId];
+		delta.notificationThread = m_ownerThread;
+		return [delta autorelease];
+	}
+	return mcached;
+}
+
+- (void)endLocalEdit:(PyGoWaveOpManager*)aManager ofWaveletWithId:(NSString*)aWaveletId
+{
+	PyGoWaveOpManager * mcached = [m_mcached valueForKey:aWaveletId];
+	if (aManager != mcached) {
+		[m_otLock lock];
+		for (PyGoWaveInboundItem * item in m_applyQueue) {
+			if (![item.waveletId isEqual:aWaveletId])
+				continue;
+			if (item.kind == PyGoWaveInboundItem_Bundle) {
+				NSArray * remote = [item.operations copy];
+				[item.operations removeAllObjects];
+				for (PyGoWaveOperation * op in remote)
+					[aManager transformInputOperation:op appendingTo:item.operations];
+				[remote release];
+			}
+			else if (item.kind == PyGoWaveInboundItem_Ack) {
+				NSDictionary * idDict = item.property;
+				for (NSString * aTempId in idDict)
+					[aManager updateBlipId:aTempId toBlipId:[idDict valueForKey:aTempId]];
+			}
+		}
+		[m_otLock unlock];
+		for (PyGoWaveOperation * op in [aManager operations])
+			[mcached mergeInsertOperation:op];
+	}
+	[self logOperationsOfWaveletWithId:aWaveletId];
+	[[self lockForWaveletWithId:aWaveletId] unlock];
+}
+
+/*
+ Hands the unacknowledged operations of a wavelet and the version they are
+ relative to to the operation log. Sent operations come first.
+*/
+- (void)logOperationsOfWaveletWithId:(NSString*)aWaveletId
+{
+	if (m_operationLog == nil)
+		return;
+	NSRecursiveLock * lock = [self lockForWaveletWithId:aWaveletId];
+	[lock lock];
+	PyGoWaveOpManager * mp = [m_mpending valueForKey:aWaveletId];
+	PyGoWaveOpManager * mc = [m_mcached valueForKey:aWaveletId];
+	if (mp != nil && mc != nil) {
+		NSData * record = nil;
+		if (!mp.isEmpty || !mc.isEmpty)
+			record = [m_bundleWriter bundleWithVersion:[self operationVersionForWaveletWithId:aWaveletId] operations:[[mp operations] arrayByAddingObjectsFromArray:[mc operations]]];
+		[m_operationLog setRecord:record forWaveletWithId:aWaveletId];
+	}
+	[lock unlock];
+}
+
+/*
+ Sends operations logged by an earlier run that never got acknowledged. They
+ can only be replayed onto the version they were made against; the server
+ cannot send the operations in between.
+*/
+- (void)replayLoggedOperationsOfWavelet:(PyGoWaveWavelet*)aWavelet
+{
+	NSString * aId = aWavelet.waveletId;
+	if (m_operationLog == nil)
+		return;
+	NSRecursiveLock * lock = [self lockForWaveletWithId:aId];
+	[lock lock];
+	BOOL idle = ![self waveletHasPendingOperations:aId] && [[m_mcached valueForKey:aId] isEmpty];
+	[lock unlock];
+	if (!idle) // Still held by this run
+		return;
+	
+	NSData * record = [m_operationLog lastRecordForWaveletWithId:aId];
+	if (record == nil)
+		return;
+	NSString * json = [[NSString alloc] initWithData:record encoding:NSUTF8StringEncoding];
+	NSDictionary * property = [[[self jsonParserForCurrentThread] objectWithString:json] valueForKey:@"property"];
+	[json release];
+	if (property == nil || [[property valueForKey:@"version"] intValue] != aWavelet.version) {
+		[m_operationLog clearWaveletWithId:aId];
+		[self postErrorOccurredNotification:@"UNSENT_OPERATIONS_DROPPED" description:@"The wavelet has changed since the unsent operations were made; they were dropped." waveletId:aId];
+		return;
+	}
 	
+	NSMutableArray * ops = [NSMutableArray new];
+	for (NSDictionary * op in [property valueForKey:@"operations"])
+		[ops addObject:[PyGoWaveOperation operationWithSerialized:op]];
+	NSLog(@"Controller: Replaying %lu logged operations on '%@'", (unsigned long) [ops count], aId);
+	[self collectParticipants];
+	[aWavelet applyOperations:ops timestamp:[NSDate date] contributorId:m_viewerId];
+	[self retrieveParticipants];
+	PyGoWaveOpManager * mc = [self beginLocalEditOfWaveletWithId:aId];
+	[mc putOperations:ops];
+	[self endLocalEdit:mc ofWaveletWithId:aId];
+	[ops release];
+}
+
+#pragma mark Messages
+
 - (void)processMessageWithWaveletId:(NSString*)aId type:(NSString*)aType property:(id)aProperty
 {
 	if ([aType isEqual:@"ERROR"]) {
@@ -409,24 +1464,37 @@
 	if ([aId isEqual:@"manager"]) {
 		if ([aType isEqual:@"WAVE_LIST"]) {
 			[self clearWaves]; // Clear all; this message is only received once per connection
-			[self collectParticipants];
 			NSDictionary * propertyDict = aProperty;
-			for (NSString * aWaveId in propertyDict) {
-				PyGoWaveWaveModel * aWave = [[PyGoWaveWaveModel alloc] initWithWaveId:aWaveId viewerId:m_viewerId participantProvider:self];
-				NSDictionary * sWavelets = [propertyDict valueForKey:aWaveId];
-				for (NSString * aWaveletId in sWavelets)
-					[self newWaveletWithDict:[sWavelets valueForKey:aWaveletId] waveletId:aWaveletId wave:aWave];
-				[self addWave:aWave initialMode:YES];
-				[aWave release];
+			for (NSString * aWaveId in propertyDict)
+				[self setWaveSummaryWithId:aWaveId wavelets:[propertyDict valueForKey:aWaveId] sorted:NO];
+			[m_waveSummaryOrder addObjectsFromArray:[m_waveSummaries allValues]];
+			[m_waveSummaryOrder sortUsingSelector:@selector(compareByLastModified:)];
+			if (!m_lazyWaveList) {
+				[self collectParticipants];
+				for (PyGoWaveWaveSummary * summary in m_waveSummaryOrder) {
+					PyGoWaveWaveModel * aWave = [[PyGoWaveWaveModel alloc] initWithWaveId:summary.waveId viewerId:m_viewerId participantProvider:self];
+					NSDictionary * sWavelets = summary.wavelets;
+					for (NSString * aWaveletId in sWavelets)
+						[self newWaveletWithDict:[sWavelets valueForKey:aWaveletId] waveletId:aWaveletId wave:aWave];
+					[self addWave:aWave initialMode:YES];
+					[aWave release];
+				}
+				[self retrieveParticipants];
 			}
-			[self retrieveParticipants];
+			[self postNotificationName:@"waveListReceived"
+							  userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+										[NSNumber numberWithUnsignedInteger:[m_waveSummaryOrder count]], @"count",
+										[NSNumber numberWithBool:m_lazyWaveList], @"lazy",
+										nil]
+							coalescing:NO];
 		}
 		else if ([aType isEqual:@"WAVELET_LIST"]) {
 			NSDictionary * propertyDict = aProperty;
 			NSString * aWaveId = [propertyDict valueForKey:@"waveId"];
-			if ([m_allWaves valueForKey:aWaveId] == nil) { // New wave
+			if ([self waveWithId:aWaveId] == nil) { // New wave
 				PyGoWaveWaveModel * aWave = [[PyGoWaveWaveModel alloc] initWithWaveId:aWaveId viewerId:m_viewerId participantProvider:self];
 				NSDictionary * sWavelets = [propertyDict valueForKey:@"wavelets"];
+				[self setWaveSummaryWithId:aWaveId wavelets:sWavelets sorted:YES];
 				[self collectParticipants];
 				for (NSString * aWaveletId in sWavelets)
 					[self newWaveletWithDict:[sWavelets valueForKey:aWaveletId] waveletId:aWaveletId wave:aWave];
@@ -437,6 +1505,7 @@
 			else { // Update old
 				PyGoWaveWaveModel * aWave = [m_allWaves valueForKey:aWaveId];
 				NSDictionary * sWavelets = [propertyDict valueForKey:@"wavelets"];
+				[self setWaveSummaryWithId:aWaveId wavelets:sWavelets sorted:YES];
 				for (NSString * aWaveletId in sWavelets) {
 					PyGoWaveWavelet * aWavelet = [aWave waveletById:aWaveletId];
 					[self collectParticipants];
@@ -451,8 +1520,10 @@
 		else if ([aType isEqual:@"PARTICIPANT_INFO"]) {
 			NSDictionary * propertyDict = aProperty;
 			[self collectParticipants];
-			for (NSString * aId in propertyDict)
+			for (NSString * aId in propertyDict) {
 				[[self participantById:aId] updateDataWithDict:[propertyDict valueForKey:aId] byServer:m_stompServer];
+				[m_participants participantWasFetched:aId];
+			}
 			[m_participantsTodo removeAllObjects]; // Trash
 			[self retrieveParticipants];
 		}
@@ -482,7 +1553,7 @@
 			NSDictionary * propertyDict = aProperty;
 			NSString * pid = [propertyDict valueForKey:@"id"];
 			NSString * aWaveletId = [propertyDict valueForKey:@"waveletId"];
-			PyGoWaveWavelet * aWavelet = [m_allWavelets valueForKey:aWaveletId];
+			PyGoWaveWavelet * aWavelet = [self waveletWithId:aWaveletId];
 			if (aWavelet == nil) {
 				if ([pid isEqual:m_viewerId]) // Someone added me to a new wave, joy!
 					[self sendJsonTo:@"manager" messageType:@"WAVELET_LIST" property:[NSDictionary dictionaryWithObjectsAndKeys:[propertyDict valueForKey:@"waveId"], @"waveId", nil]]; // Get the details
@@ -494,14 +1565,14 @@
 			NSDictionary * propertyDict = aProperty;
 			NSString * pid = [propertyDict valueForKey:@"id"];
 			NSString * aWaveletId = [propertyDict valueForKey:@"waveletId"];
-			PyGoWaveWavelet * aWavelet = [m_allWavelets valueForKey:aWaveletId];
+			PyGoWaveWavelet * aWavelet = [self waveletWithId:aWaveletId];
 			if (aWavelet != nil)
 				[aWavelet removeParticipantById:pid];
 		}
 		else if ([aType isEqual:@"WAVELET_CREATED"]) {
 			NSDictionary * propertyDict = aProperty;
 			NSString * aWaveId = [propertyDict valueForKey:@"waveId"];
-			if ([m_allWaves valueForKey:aWaveId] == nil) {
+			if ([m_waveSummaries valueForKey:aWaveId] == nil) {
 				[m_createdWaveId release];
 				m_createdWaveId = aWaveId;
 			}
@@ -516,45 +1587,56 @@
 		return;
 	}
 	
-	// Wavelet messages
+	// Wavelet messages; bundles and acknowledgements never get here
 	PyGoWaveWavelet * aWavelet = [m_allWavelets valueForKey:aId];
-	NSAssert(aWavelet != nil, @"Wavelet not found");
+	if (aWavelet == nil) {
+		NSLog(@"Controller: Message '%@' for unknown wavelet '%@'", aType, aId); return;
+	}
 	if ([aType isEqual:@"WAVELET_OPEN"]) {
 		NSDictionary * propertyDict = aProperty;
 		NSDictionary * blips = [propertyDict valueForKey:@"blips"];
 		NSDictionary * waveletDict = [propertyDict valueForKey:@"wavelet"];
 		NSString * aRootBlipId = [waveletDict valueForKey:@"rootBlipId"];
-		[aWavelet loadBlipsFromSnapshot:blips rootBlipId:aRootBlipId];
+		NSInteger version = [[waveletDict valueForKey:@"version"] intValue];
+		NSNumber * cachedVersion = [[m_cachedVersions valueForKey:aId] retain];
+		[m_cachedVersions removeObjectForKey:aId];
 		[m_openWavelets addObject:aWavelet.waveletId];
+		if (cachedVersion != nil && [cachedVersion intValue] == version) { // Cache was current
+			[cachedVersion release];
+			[self replayLoggedOperationsOfWavelet:aWavelet];
+			// Tells the observers that the wavelet can be edited now
+			[self postNotificationName:@"waveletOpened"
+							  userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+										aWavelet.waveletId, @"waveletId",
+										[NSNumber numberWithBool:aWavelet.isRoot], @"isRoot",
+										[NSNumber numberWithBool:NO], @"cached",
+										nil]
+							coalescing:NO];
+			return;
+		}
+		[cachedVersion release];
+		if (m_reconcileSnapshots && [[aWavelet allBlips] count] > 0)
+			[aWavelet reconcileBlipsWithSnapshot:blips rootBlipId:aRootBlipId];
+		else
+			[aWavelet loadBlipsFromSnapshot:blips rootBlipId:aRootBlipId];
+		aWavelet.version = version;
+		[self saveSnapshotOfWaveletWithId:aId];
+		[self replayLoggedOperationsOfWavelet:aWavelet];
 		[self postNotificationName:@"waveletOpened"
 						  userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
 									aWavelet.waveletId, @"waveletId",
 									[NSNumber numberWithBool:aWavelet.isRoot], @"isRoot",
+									[NSNumber numberWithBool:NO], @"cached",
 									nil]
 						coalescing:NO];
 	}
-	else if ([aType isEqual:@"OPERATION_MESSAGE_BUNDLE"]) {
-		NSDictionary * propertyDict = aProperty;
-		[self queueMessageBundleForWavelet:aWavelet
-									 isAck:NO
-					   serialOpsOrNewblips:[propertyDict valueForKey:@"operations"]
-								   version:[[propertyDict valueForKey:@"version"] intValue]
-								  blipsums:[propertyDict valueForKey:@"blipsums"]
-								 timestamp:parseJsonTimestamp([propertyDict valueForKey:@"timestamp"])
-							 contributorId:[propertyDict valueForKey:@"contributor"]
-		];
-	}
-	else if ([aType isEqual:@"OPERATION_MESSAGE_BUNDLE_ACK"]) {
-		NSDictionary * propertyDict = aProperty;
-		[self queueMessageBundleForWavelet:aWavelet
-									 isAck:YES
-					   serialOpsOrNewblips:[propertyDict valueForKey:@"newblips"]
-								   version:[[propertyDict valueForKey:@"version"] intValue]
-								  blipsums:[propertyDict valueForKey:@"blipsums"]
-								 timestamp:parseJsonTimestamp([propertyDict valueForKey:@"timestamp"])
-							 contributorId:[propertyDict valueForKey:@"contributor"]
-		];
-	}
+}
+
+- (void)retrieveStaleParticipants
+{
+	if ([m_participantsStale count] > 0)
+		[self sendJsonTo:@"manager" messageType:@"PARTICIPANT_INFO" property:[m_participantsStale allObjects]];
+	[m_participantsStale removeAllObjects];
 }
 
 - (void)retrieveParticipantWithId:(NSString*)aId
@@ -567,8 +1649,22 @@
 	PyGoWaveOpManager * mcached = [notification object];
 	NSAssert(mcached != nil, @"");
 	NSString * aWaveletId = mcached.waveletId;
-	if (![self waveletHasPendingOperations:aWaveletId])
-		[self transferOperationsForWaveletWithId:aWaveletId];
+	NSRecursiveLock * lock = [self lockForWaveletWithId:aWaveletId];
+	[lock lock];
+	if (m_collectMetrics)
+		[m_metrics setValue:[[mcached operations] count] ofGauge:PyGoWaveMetric_CachedOperations forWaveletWithId:aWaveletId];
+	if (![self waveletHasPendingOperations:aWaveletId]) {
+		// Hold the first operations of a burst back for a moment, so the rest can go along
+		PyGoWaveSendState * state = [self sendStateForWaveletWithId:aWaveletId];
+		NSTimeInterval window = [self sendWindowForState:state];
+		if (window <= 0.0)
+			[self transferOperationsForWaveletWithId:aWaveletId];
+		else if (!state->flushScheduled) {
+			state->flushScheduled = YES;
+			[self performSelector:@selector(flushOperations_timeout:) withObject:aWaveletId afterDelay:window];
+		}
+	}
+	[lock unlock];
 }
 
 - (void)wavelet_participantsChanged:(NSNotification*)notification
@@ -581,6 +1677,7 @@
 		if (aWavelet == aWave.rootWavelet) // It was the root wavelet, oh no!
 			[self removeWaveWithId:aWave.waveId];
 		else { // Some other wavelet I was on, phew...
+			[self discardInboundBundlesForWaveletWithId:aWaveletId];
 			[aWave removeWaveletById:aWaveletId];
 			[m_allWavelets removeObjectForKey:aWaveletId];
 		}
@@ -617,6 +1714,34 @@
 	m_stompUsername = [aStompUsername copy];
 	[m_stompPassword release];
 	m_stompPassword = [aStompPassword copy];
+	if (m_persistentParticipants) {
+		NSArray * paths = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
+		if ([paths count] > 0)
+			m_participants.path = [[paths objectAtIndex:0] stringByAppendingPathComponent:[NSString stringWithFormat:@"PyGoWaveParticipants-%@.plist", m_stompServer]];
+	}
+	else
+		m_participants.path = nil;
+	NSString * snapshotDirectory = nil;
+	if (m_snapshotCache) {
+		NSArray * paths = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
+		if ([paths count] > 0)
+			snapshotDirectory = [[paths objectAtIndex:0] stringByAppendingPathComponent:[NSString stringWithFormat:@"PyGoWaveSnapshots-%@-%@", m_stompServer, aUsername]];
+	}
+	if (snapshotDirectory == nil || ![snapshotDirectory isEqual:m_snapshotStore.directory]) {
+		[m_snapshotStore release];
+		m_snapshotStore = snapshotDirectory != nil ? [[PyGoWaveSnapshotStore alloc] initWithDirectory:snapshotDirectory] : nil;
+	}
+	NSString * logDirectory = nil;
+	if (m_logOperations) {
+		NSArray * paths = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
+		if ([paths count] > 0)
+			logDirectory = [[paths objectAtIndex:0] stringByAppendingPathComponent:[NSString stringWithFormat:@"PyGoWaveOperations-%@-%@", m_stompServer, aUsername]];
+	}
+	if (logDirectory == nil || ![logDirectory isEqual:m_operationLog.directory]) {
+		[m_operationLog commit];
+		[m_operationLog release];
+		m_operationLog = logDirectory != nil ? [[PyGoWaveOperationLog alloc] initWithDirectory:logDirectory] : nil;
+	}
 	[self reconnectToHostWithUsername:aUsername password:aPassword];
 }
 
@@ -630,6 +1755,18 @@
 	if (m_conn != nil)
 		[self disconnectFromHost];
 	m_conn = [[CRVStompClient alloc] initWithHost:m_stompServer port:m_stompPort login:m_username passcode:m_password delegate:self autoconnect:YES];
+	if (m_captureFile != nil)
+		[m_conn startCaptureToFile:m_captureFile];
+	if (m_pipelined) {
+		// Frames are parsed on the worker; the socket stays on this thread
+		if (m_workerThread == nil) {
+			m_workerThread = [PyGoWaveWorkerThread new];
+			[m_workerThread start];
+		}
+		m_conn.frameThread = m_workerThread;
+	}
+	if (m_parallelWavelets && m_workerPool == nil)
+		m_workerPool = [[PyGoWaveWorkerPool alloc] initWithThreadCount:m_workerPoolSize];
 }
 
 - (void)disconnectFromHost
@@ -646,12 +1783,122 @@
 
 - (PyGoWaveWaveModel*)waveWithId:(NSString*)aId
 {
-	return [m_allWaves valueForKey:aId];
+	PyGoWaveWaveModel * aWave = [m_allWaves valueForKey:aId];
+	if (aWave == nil) {
+		PyGoWaveWaveSummary * summary = [m_waveSummaries valueForKey:aId];
+		if (summary != nil)
+			aWave = [self loadWaveWithSummary:summary];
+	}
+	return aWave;
 }
 
 - (PyGoWaveWavelet*)waveletWithId:(NSString*)aId
 {
-	return [m_allWavelets valueForKey:aId];
+	PyGoWaveWavelet * aWavelet = [m_allWavelets valueForKey:aId];
+	if (aWavelet == nil) {
+		NSString * aWaveId = [m_summaryWaveIds valueForKey:aId];
+		if (aWaveId != nil && [m_allWaves valueForKey:aWaveId] == nil) {
+			[self loadWaveWithSummary:[m_waveSummaries valueForKey:aWaveId]];
+			aWavelet = [m_allWavelets valueForKey:aId];
+		}
+	}
+	return aWavelet;
+}
+
+- (BOOL)isWaveLoaded:(NSString*)aId
+{
+	return [m_allWaves valueForKey:aId] != nil;
+}
+
+- (BOOL)isWaveletEditable:(NSString*)aId
+{
+	return [m_cachedVersions valueForKey:aId] == nil;
+}
+
+- (NSUInteger)waveSummaryCount
+{
+	return [m_waveSummaryOrder count];
+}
+
+- (NSArray*)waveSummariesInRange:(NSRange)aRange
+{
+	NSUInteger count = [m_waveSummaryOrder count];
+	if (aRange.location >= count)
+		return [NSArray array];
+	if (aRange.length > count - aRange.location)
+		aRange.length = count - aRange.location;
+	return [m_waveSummaryOrder subarrayWithRange:aRange];
+}
+
+- (PyGoWaveWaveSummary*)waveSummaryWithId:(NSString*)aId
+{
+	return [m_waveSummaries valueForKey:aId];
+}
+
+- (NSTimeInterval)roundTripTimeForWaveletWithId:(NSString*)aId
+{
+	PyGoWaveSendState * state = [m_sendStates objectForKey:aId];
+	return state != nil ? state->srtt : 0.0;
+}
+
+- (NSTimeInterval)sendWindowForWaveletWithId:(NSString*)aId
+{
+	return [self sendWindowForState:[m_sendStates objectForKey:aId]];
+}
+
+- (NSTimeInterval)acknowledgementTimeoutForWaveletWithId:(NSString*)aId
+{
+	return [self ackTimeoutForState:[m_sendStates objectForKey:aId]];
+}
+
+- (void)setCollectMetrics:(BOOL)bCollect
+{
+	if (bCollect && m_metrics == nil)
+		m_metrics = [PyGoWaveMetrics new]; // Kept until dealloc, other threads may still be recording
+	m_collectMetrics = bCollect;
+	[self resetMetricsTimer];
+}
+
+- (void)setMetricsInterval:(NSTimeInterval)aInterval
+{
+	m_metricsInterval = aInterval;
+	[self resetMetricsTimer];
+}
+
+- (NSDictionary*)metricsSnapshot
+{
+	return [m_metrics snapshot];
+}
+
+- (void)resetMetrics
+{
+	[m_metrics reset];
+}
+
+- (NSDictionary*)memoryReport
+{
+	NSMutableDictionary * report = [NSMutableDictionary dictionaryWithCapacity:5];
+	[self accountMemoryWithReport:report ranking:nil];
+	return report;
+}
+
+- (NSArray*)topMemoryConsumers:(NSUInteger)aCount
+{
+	PyGoWaveMemoryRanking * ranking = [[PyGoWaveMemoryRanking alloc] initWithCapacity:aCount];
+	[self accountMemoryWithReport:nil ranking:ranking];
+	NSArray * entries = [ranking entries];
+	[ranking release];
+	return entries;
+}
+
+- (NSUInteger)participantCacheSize
+{
+	return m_participants.capacity;
+}
+
+- (void)setParticipantCacheSize:(NSUInteger)aSize
+{
+	m_participants.capacity = aSize;
 }
 
 - (NSInteger)searchForParticipantWithQuery:(NSString*)aQuery
@@ -667,79 +1914,124 @@
 	return m_cachedGadgetList;
 }
 
+// Edits of a wavelet shown from the snapshot cache would be queued against a version the server's snapshot may replace
+- (BOOL)acceptLocalEditOfWaveletWithId:(NSString*)aWaveletId
+{
+	if ([self isWaveletEditable:aWaveletId])
+		return YES;
+	[self postErrorOccurredNotification:@"WAVELET_CACHED"
+							description:@"The wavelet is shown from the snapshot cache and cannot be edited until the server's snapshot has arrived"
+							  waveletId:aWaveletId];
+	return NO;
+}
+
 - (void)textInserted:(NSString*)aText atIndex:(NSInteger)aIndex inBlipId:(NSString*)aBlipId ofWaveletId:(NSString*)aWaveletId
 {
+	if (![self acceptLocalEditOfWaveletWithId:aWaveletId])
+		return;
 	PyGoWaveWavelet * w = [m_allWavelets valueForKey:aWaveletId]; NSAssert(w != nil, @"Wavelet not found");
 	PyGoWaveBlip * b = [w blipById:aBlipId]; NSAssert(b != nil, @"Blip not found");
-	[[m_mcached valueForKey:aWaveletId] documentInsert:aText atIndex:aIndex inBlipWithId:aBlipId];
+	PyGoWaveOpManager * mc = [self beginLocalEditOfWaveletWithId:aWaveletId];
+	[mc documentInsert:aText atIndex:aIndex inBlipWithId:aBlipId];
+	[self endLocalEdit:mc ofWaveletWithId:aWaveletId];
 	[b insertTextAtIndex:aIndex text:aText contributor:[self viewer]];
 	b.lastModified = [NSDate date];
 }
 
 - (void)textDeletedFromStart:(NSInteger)aStart toEnd:(NSInteger)aEnd inBlipWithId:(NSString*)aBlipId ofWaveletWithId:(NSString*)aWaveletId
 {
+	if (![self acceptLocalEditOfWaveletWithId:aWaveletId])
+		return;
 	PyGoWaveWavelet * w = [m_allWavelets valueForKey:aWaveletId]; NSAssert(w != nil, @"Wavelet not found");
 	PyGoWaveBlip * b = [w blipById:aBlipId]; NSAssert(b != nil, @"Blip not found");
-	[[m_mcached valueForKey:aWaveletId] documentDeleteFromStart:aStart toEnd:aEnd inBlipWithId:aBlipId];
+	PyGoWaveOpManager * mc = [self beginLocalEditOfWaveletWithId:aWaveletId];
+	[mc documentDeleteFromStart:aStart toEnd:aEnd inBlipWithId:aBlipId];
+	[self endLocalEdit:mc ofWaveletWithId:aWaveletId];
 	[b deleteTextAtIndex:aStart length:aEnd-aStart contributor:[self viewer]];
 	b.lastModified = [NSDate date];
 }
 
 - (void)elementInsertAtIndex:(NSInteger)aIndex type:(NSInteger)aType properties:(NSDictionary*)sProperties inBlipWithId:(NSString*)aBlipId ofWaveletWithId:(NSString*)aWaveletId
 {
+	if (![self acceptLocalEditOfWaveletWithId:aWaveletId])
+		return;
 	PyGoWaveWavelet * w = [m_allWavelets valueForKey:aWaveletId]; NSAssert(w != nil, @"Wavelet not found");
 	PyGoWaveBlip * b = [w blipById:aBlipId]; NSAssert(b != nil, @"Blip not found");
-	[[m_mcached valueForKey:aWaveletId] documentElementInsertAtIndex:aIndex type:aType properties:sProperties inBlipWithId:aBlipId];
+	PyGoWaveOpManager * mc = [self beginLocalEditOfWaveletWithId:aWaveletId];
+	[mc documentElementInsertAtIndex:aIndex type:aType properties:sProperties inBlipWithId:aBlipId];
+	[self endLocalEdit:mc ofWaveletWithId:aWaveletId];
 	[b insertElementAtIndex:aIndex type:aType properties:sProperties contributor:[self viewer]];
 	b.lastModified = [NSDate date];
 }
 
 - (void)elementDeleteAtIndex:(NSInteger)aIndex inBlipWithId:(NSString*)aBlipId ofWaveletWithId:(NSString*)aWaveletId
 {
+	if (![self acceptLocalEditOfWaveletWithId:aWaveletId])
+		return;
 	PyGoWaveWavelet * w = [m_allWavelets valueForKey:aWaveletId]; NSAssert(w != nil, @"Wavelet not found");
 	PyGoWaveBlip * b = [w blipById:aBlipId]; NSAssert(b != nil, @"Blip not found");
-	[[m_mcached valueForKey:aWaveletId] documentElementDeleteAtIndex:aIndex inBlipWithId:aBlipId];
+	PyGoWaveOpManager * mc = [self beginLocalEditOfWaveletWithId:aWaveletId];
+	[mc documentElementDeleteAtIndex:aIndex inBlipWithId:aBlipId];
+	[self endLocalEdit:mc ofWaveletWithId:aWaveletId];
 	[b deleteElementAtIndex:aIndex contributor:[self viewer]];
 	b.lastModified = [NSDate date];
 }
 
 - (void)elementDeltaSubmitted:(NSDictionary*)aDelta atIndex:(NSInteger)aIndex inBlipWithId:(NSString*)aBlipId ofWaveletWithId:(NSString*)aWaveletId
 {
+	if (![self acceptLocalEditOfWaveletWithId:aWaveletId])
+		return;
 	PyGoWaveWavelet * w = [m_allWavelets valueForKey:aWaveletId]; NSAssert(w != nil, @"Wavelet not found");
 	PyGoWaveBlip * b = [w blipById:aBlipId]; NSAssert(b != nil, @"Blip not found");
-	[[m_mcached valueForKey:aWaveletId] documentElementApplyDelta:aDelta atIndex:aIndex inBlipWithId:aBlipId];
+	PyGoWaveOpManager * mc = [self beginLocalEditOfWaveletWithId:aWaveletId];
+	[mc documentElementApplyDelta:aDelta atIndex:aIndex inBlipWithId:aBlipId];
+	[self endLocalEdit:mc ofWaveletWithId:aWaveletId];
 	[b applyElementDelta:aDelta atIndex:aIndex contributor:[self viewer]];
 	b.lastModified = [NSDate date];
 }
 
 - (void)elementSetUserPrefWithKey:(NSString*)aKey toValue:(NSString*)aValue atIndex:(NSInteger)aIndex inBlipWithId:(NSString*)aBlipId ofWaveletWithId:(NSString*)aWaveletId
 {
+	if (![self acceptLocalEditOfWaveletWithId:aWaveletId])
+		return;
 	PyGoWaveWavelet * w = [m_allWavelets valueForKey:aWaveletId]; NSAssert(w != nil, @"Wavelet not found");
 	PyGoWaveBlip * b = [w blipById:aBlipId]; NSAssert(b != nil, @"Blip not found");
-	[[m_mcached valueForKey:aWaveletId] documentElementSetUserPrefWithKey:aKey toValue:aValue atIndex:aIndex inBlipWithId:aBlipId];
+	PyGoWaveOpManager * mc = [self beginLocalEditOfWaveletWithId:aWaveletId];
+	[mc documentElementSetUserPrefWithKey:aKey toValue:aValue atIndex:aIndex inBlipWithId:aBlipId];
+	[self endLocalEdit:mc ofWaveletWithId:aWaveletId];
 	[b setElementUserPrefWithKey:aKey toValue:aValue atIndex:aIndex contributor:[self viewer]];
 	b.lastModified = [NSDate date];
 }
 
 - (void)appendBlipToWaveletWithId:(NSString*)aWaveletId
 {
+	if (![self acceptLocalEditOfWaveletWithId:aWaveletId])
+		return;
 	PyGoWaveWavelet * w = [m_allWavelets valueForKey:aWaveletId]; NSAssert(w != nil, @"Wavelet not found");
 	PyGoWaveBlip * newBlip = [w appendBlipWithCreator:[self viewer]];
-	[[m_mcached valueForKey:aWaveletId] waveletAppendBlipWithTempId:newBlip.blipId];
+	PyGoWaveOpManager * mc = [self beginLocalEditOfWaveletWithId:aWaveletId];
+	[mc waveletAppendBlipWithTempId:newBlip.blipId];
 	[[m_mcached valueForKey:aWaveletId] lockBlipOpsWithId:newBlip.blipId];
+	[self endLocalEdit:mc ofWaveletWithId:aWaveletId];
 }
 
 - (void)deleteBlipWithId:(NSString*)aId ofWaveletWithId:(NSString*)aWaveletId
 {
+	if (![self acceptLocalEditOfWaveletWithId:aWaveletId])
+		return;
 	PyGoWaveWavelet * w = [m_allWavelets valueForKey:aWaveletId]; NSAssert(w != nil, @"Wavelet not found");
-	[[m_mcached valueForKey:aWaveletId] blipDeleteWithId:aId];
+	PyGoWaveOpManager * mc = [self beginLocalEditOfWaveletWithId:aWaveletId];
+	[mc blipDeleteWithId:aId];
 	[[m_draftblips valueForKey:aWaveletId] removeObject:aId];
+	[self endLocalEdit:mc ofWaveletWithId:aWaveletId];
 	[w deleteBlipWithId:aId];
 }
 
 - (void)draftBlipWithId:(NSString*)aId ofWaveletWithId:(NSString*)aWaveletId enabled:(BOOL)bEnabled
 {
 	PyGoWaveWavelet * w = [m_allWavelets valueForKey:aWaveletId]; NSAssert(w != nil, @"Wavelet not found");
+	NSRecursiveLock * lock = [self lockForWaveletWithId:aWaveletId];
+	[lock lock];
 	NSMutableArray * draftblips = [m_draftblips valueForKey:aWaveletId];
 	if (!bEnabled && [draftblips containsObject:aId]) {
 		[draftblips removeObject:aId];
@@ -757,10 +2049,14 @@
 			[mcached lockBlipOpsWithId:aId];
 		}
 	}
+	[lock unlock];
 }
 
 - (void)openWaveletWithId:(NSString*)aId
 {
+	PyGoWaveWavelet * aWavelet = [self waveletWithId:aId]; // Load the wave if only its summary is known
+	if (aWavelet != nil)
+		[self loadCachedSnapshotOfWavelet:aWavelet];
 	[self subscribeWaveletWithId:aId open:YES];
 }
 
@@ -771,10 +2067,14 @@
 
 - (void)addParticipantWithId:(NSString*)aId toWaveletWithId:(NSString*)aWaveletId
 {
-	PyGoWaveWavelet * aWavelet = [m_allWavelets valueForKey:aWaveletId];
+	if (![self acceptLocalEditOfWaveletWithId:aWaveletId])
+		return;
+	PyGoWaveWavelet * aWavelet = [self waveletWithId:aWaveletId];
 	if (aWavelet == nil)
 		return;
-	[[m_mcached valueForKey:aWaveletId] waveletAddParticipantWithId:aId];
+	PyGoWaveOpManager * mc = [self beginLocalEditOfWaveletWithId:aWaveletId];
+	[mc waveletAddParticipantWithId:aId];
+	[self endLocalEdit:mc ofWaveletWithId:aWaveletId];
 	[aWavelet addParticipant:[self participantById:aId]];
 }
 
@@ -790,10 +2090,14 @@
 
 - (void)leaveWaveletWithId:(NSString*)aId
 {
-	PyGoWaveWavelet * aWavelet = [m_allWavelets valueForKey:aId];
+	if (![self acceptLocalEditOfWaveletWithId:aId])
+		return;
+	PyGoWaveWavelet * aWavelet = [self waveletWithId:aId];
 	if (aWavelet == nil)
 		return;
-	[[m_mcached valueForKey:aId] waveletRemoveParticipantWithId:m_viewerId];
+	PyGoWaveOpManager * mc = [self beginLocalEditOfWaveletWithId:aId];
+	[mc waveletRemoveParticipantWithId:m_viewerId];
+	[self endLocalEdit:mc ofWaveletWithId:aId];
 	[aWavelet removeParticipantById:m_viewerId];
 }
 
@@ -811,10 +2115,32 @@
 }
 
 #pragma mark CRVStompClientDelegate
+- (void)loginMessageReceived:(NSArray*)aBodyAndHeader
+{
+	[self stompClient:m_conn messageReceived:[aBodyAndHeader objectAtIndex:0] withHeader:[aBodyAndHeader objectAtIndex:1]];
+}
+
+// "<rx key>.<wavelet id>.waveop" -> wavelet id, or nil; takes a substring instead of splitting
+static NSString * waveletIdFromRoutingKey(NSString * aKey)
+{
+	NSRange first = [aKey rangeOfString:@"."];
+	NSRange last = [aKey rangeOfString:@"." options:NSBackwardsSearch];
+	if (first.location == NSNotFound || first.location == last.location || ![aKey hasSuffix:@".waveop"])
+		return nil;
+	NSRange idRange = NSMakeRange(first.location + 1, last.location - first.location - 1);
+	if ([aKey rangeOfString:@"." options:0 range:idRange].location != NSNotFound)
+		return nil;
+	return [aKey substringWithRange:idRange];
+}
+
 - (void)stompClient:(CRVStompClient *)stompService messageReceived:(NSString *)body withHeader:(NSDictionary *)messageHeader
 {
 	if (m_state == PyGoWaveController_ClientConnected) {
-		NSArray * msgs = [body JSONValue];
+		if (![self isOwnerThread]) { // Logging in changes the controller state
+			[self performSelector:@selector(loginMessageReceived:) onThread:m_ownerThread withObject:[NSArray arrayWithObjects:body, messageHeader, nil] waitUntilDone:NO];
+			return;
+		}
+		NSArray * msgs = [m_jsonParser objectWithString:body];
 		NSAssert(msgs != nil, @"Error in parsing received JSON data!");
 		NSAssert([msgs count] == 1, @"Login reply must contain a single message!");
 		
@@ -850,26 +2176,14 @@
 		[self sendJsonTo:@"manager" messageType:@"WAVE_LIST"];
 	}
 	else if (m_state == PyGoWaveController_ClientOnline) {
-		NSArray * routing_key = [[messageHeader valueForKey:@"destination"] componentsSeparatedByString:@"."];
-		
-		if ([routing_key count] != 3 || ![[routing_key objectAtIndex:2] isEqual:@"waveop"]) {
+		NSString * aWaveletId = waveletIdFromRoutingKey([messageHeader valueForKey:@"destination"]);
+		if (aWaveletId == nil) {
 			NSLog(@"Controller: Malformed routing key '%@'!", [messageHeader valueForKey:@"destination"]); return;
 		}
-		NSString * aWaveletId = [routing_key objectAtIndex:1];
-		NSArray * msgs = [body JSONValue];
-		if (msgs == nil) {
-			NSLog(@"Controller: Error in parsing received JSON data!"); return;
-		}
-		for (NSDictionary * msg in msgs) {
-			NSString * msgType = [msg valueForKey:@"type"];
-			if (msgType != nil) {
-				NSString * msgProperty = [msg valueForKey:@"property"];
-				[self processMessageWithWaveletId:aWaveletId type:msgType property:msgProperty];
-			}
-			else {
-				NSLog(@"Controller: Message lacks 'type' field!"); return;
-			}
-		}
+		if (m_workerPool != nil)
+			[[self serialContextForWaveletWithId:aWaveletId] performSelector:@selector(decodeMessage:) target:self withObject:[self generationTaggedObject:[NSArray arrayWithObjects:aWaveletId, body, nil]]];
+		else
+			[self decodeMessageBody:body forWaveletWithId:aWaveletId];
 	}
 }
 
@@ -881,9 +2195,27 @@
 		[m_pingTimer release];
 		m_pingTimer = nil;
 	}
-	[self killPendingTimer];
+	[self cancelSendTimers];
+	if (m_metricsTimer != nil) {
+		[m_metricsTimer invalidate];
+		[m_metricsTimer release];
+		m_metricsTimer = nil;
+	}
 	m_state = PyGoWaveController_ClientDisconnected;
+	for (NSString * aId in m_openWavelets)
+		[self saveSnapshotOfWaveletWithId:aId];
+	[m_cachedVersions removeAllObjects];
 	[self clearWaves];
+	[m_participants save];
+	[m_operationLog commit];
+	[m_otLock lock];
+	[m_applyQueue removeAllObjects];
+	[m_contexts removeAllObjects];
+	// Queued pool tasks and armed gap timers belong to the old connection now
+	m_generation++;
+	[m_otLock unlock];
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(applyInboundItems) object:nil];
+	m_inboundDrainScheduled = NO;
 	[self postNotificationName:@"stateChanged" userInfo:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:m_state], @"state", nil]];
 	[m_conn autorelease];
 	m_conn = nil;
@@ -893,6 +2225,7 @@
 - (void)stompClientDidConnect:(CRVStompClient *)stompService
 {
 	m_connected = YES;
+	[self resetMetricsTimer];
 	NSLog(@"Controller: Authenticating...");
 	m_state = PyGoWaveController_ClientConnected;
 	[self postNotificationName:@"stateChanged" userInfo:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:m_state], @"state", nil]];
@@ -912,7 +2245,13 @@
 	
 	[self subscribeWaveletWithId:@"login" open:NO];
 	
+	// Kept out of the capture, in its raw and its escaped form; the client forgets it right after
+	if (m_captureFile != nil && [m_password length] > 0) {
+		NSString * escaped = [m_password JSONFragment];
+		m_conn.captureRedactions = [NSArray arrayWithObjects:m_password, [escaped substringWithRange:NSMakeRange(1, [escaped length] - 2)], nil];
+	}
 	[self sendJsonTo:@"login" messageType:@"LOGIN" property:[NSDictionary dictionaryWithObjectsAndKeys:m_username, @"username", m_password, @"password", nil]];
+	m_conn.captureRedactions = nil;
 	[m_password release]; // Delete Password after use
 	m_password = nil;
 }
@@ -933,16 +2272,23 @@
 
 - (PyGoWaveParticipant *)participantById:(NSString *)aParticipntId
 {
-	PyGoWaveParticipant * p = [m_allParticipants valueForKey:aParticipntId];
+	PyGoWaveParticipant * p = [m_participants participantById:aParticipntId];
 	if (p == nil) {
 		p = [[PyGoWaveParticipant alloc] initWithParticipantId:aParticipntId];
-		[m_allParticipants setValue:p forKey:aParticipntId];
-		[p release];
+		[m_participants addParticipant:p];
+		[p autorelease];
+		[m_participants shouldRequestParticipantWithId:aParticipntId];
 		if (m_participantsTodoCollect)
 			[m_participantsTodo addObject:aParticipntId];
 		else
 			[self retrieveParticipantWithId:aParticipntId];
 	}
+	else if ([m_participants shouldRequestParticipantWithId:aParticipntId]) {
+		// Cached data is served right away and revalidated in one request
+		if ([m_participantsStale count] == 0)
+			[self performSelector:@selector(retrieveStaleParticipants) withObject:nil afterDelay:0.0];
+		[m_participantsStale addObject:aParticipntId];
+	}
 	return p;
 }
 
@@ -994,6 +2340,15 @@
 	[self removeObserver:notificationObserver name:@"participantSearchResultsInvalid"];
 }
 
+- (void)addWaveListReceivedObserver:(id)notificationObserver selector:(SEL)notificationSelector
+{
+	[self addObserver:notificationObserver selector:notificationSelector name:@"waveListReceived"];
+}
+- (void)removeWaveListReceivedObserver:(id)notificationObserver
+{
+	[self removeObserver:notificationObserver name:@"waveListReceived"];
+}
+
 - (void)addWaveAddedObserver:(id)notificationObserver selector:(SEL)notificationSelector
 {
 	[self addObserver:notificationObserver selector:notificationSelector name:@"waveAdded"];
@@ -1021,4 +2376,13 @@
 	[self removeObserver:notificationObserver name:@"updateGadgetList"];
 }
 
+- (void)addMetricsUpdatedObserver:(id)notificationObserver selector:(SEL)notificationSelector
+{
+	[self addObserver:notificationObserver selector:notificationSelector name:@"metricsUpdated"];
+}
+- (void)removeMetricsUpdatedObserver:(id)notificationObserver
+{
+	[self removeObserver:notificationObserver name:@"metricsUpdated"];
+}
+
 @end
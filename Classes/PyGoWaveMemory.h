@@ -0,0 +1,60 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ Approximate memory accounting. Sizes are estimates of the bytes an object
+ keeps alive: instance sizes from the runtime plus the payload of strings,
+ data and collections. Objects shared by several owners, such as
+ participants, are counted once, where they are cached.
+*/
+
+// Instance size plus the contents of strings, numbers, dates, data, arrays,
+// dictionaries and sets, counted recursively; other objects count their
+// instance size only
+NSUInteger PyGoWaveEstimatedBytes(id aValue);
+NSUInteger PyGoWaveInstanceBytes(id aObject);
+// An array, set or dictionary without the objects it references
+NSUInteger PyGoWaveCollectionBytes(id aCollection);
+
+struct PyGoWaveMemoryEntry;
+
+/*
+ Keeps the largest consumers added to it in a bounded min-heap, so picking
+ the top N out of M costs O(M log N) and only the N survivors are retained.
+*/
+@interface PyGoWaveMemoryRanking : NSObject
+{
+	struct PyGoWaveMemoryEntry * m_heap;
+	NSUInteger m_capacity;
+	NSUInteger m_count;
+}
+
+- (id)initWithCapacity:(NSUInteger)aCapacity;
+- (void)dealloc;
+
+// Ids may be nil where they do not apply
+- (void)addBytes:(NSUInteger)aBytes kind:(NSString*)aKind waveId:(NSString*)aWaveId waveletId:(NSString*)aWaveletId blipId:(NSString*)aBlipId;
+// {"kind", "bytes", "waveId", "waveletId", "blipId"}, largest first
+- (NSArray*)entries;
+
+@end
@@ -0,0 +1,174 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#import "PyGoWaveMemory.h"
+#import <objc/runtime.h>
+
+// Header and bookkeeping of a heap block holding an object's payload
+#define PGW_BLOCK_OVERHEAD	16
+
+struct PyGoWaveMemoryEntry {
+	NSUInteger bytes;
+	NSString * kind;
+	NSString * waveId;
+	NSString * waveletId;
+	NSString * blipId;
+};
+
+NSUInteger PyGoWaveInstanceBytes(id aObject)
+{
+	return aObject != nil ? class_getInstanceSize([aObject class]) : 0;
+}
+
+NSUInteger PyGoWaveCollectionBytes(id aCollection)
+{
+	if (aCollection == nil)
+		return 0;
+	NSUInteger bytes = PyGoWaveInstanceBytes(aCollection) + PGW_BLOCK_OVERHEAD;
+	if ([aCollection isKindOfClass:[NSDictionary class]])
+		bytes += [aCollection count] * 4 * sizeof(id); // About twice as many slots as entries, each a key and a value
+	else
+		bytes += [aCollection count] * sizeof(id);
+	return bytes;
+}
+
+NSUInteger PyGoWaveEstimatedBytes(id aValue)
+{
+	if (aValue == nil)
+		return 0;
+	if ([aValue isKindOfClass:[NSString class]])
+		return PyGoWaveInstanceBytes(aValue) + PGW_BLOCK_OVERHEAD + [aValue length] * sizeof(unichar);
+	if ([aValue isKindOfClass:[NSData class]])
+		return PyGoWaveInstanceBytes(aValue) + PGW_BLOCK_OVERHEAD + [aValue length];
+	if ([aValue isKindOfClass:[NSDictionary class]]) {
+		NSUInteger bytes = PyGoWaveCollectionBytes(aValue);
+		for (id key in aValue)
+			bytes += PyGoWaveEstimatedBytes(key) + PyGoWaveEstimatedBytes([aValue objectForKey:key]);
+		return bytes;
+	}
+	if ([aValue isKindOfClass:[NSArray class]] || [aValue isKindOfClass:[NSSet class]]) {
+		NSUInteger bytes = PyGoWaveCollectionBytes(aValue);
+		for (id value in aValue)
+			bytes += PyGoWaveEstimatedBytes(value);
+		return bytes;
+	}
+	return PyGoWaveInstanceBytes(aValue);
+}
+
+static void releaseEntry(struct PyGoWaveMemoryEntry * aEntry)
+{
+	[aEntry->waveId release];
+	[aEntry->waveletId release];
+	[aEntry->blipId release];
+}
+
+// Largest first
+static int compareEntries(const void * a, const void * b)
+{
+	NSUInteger x = ((const struct PyGoWaveMemoryEntry *) a)->bytes, y = ((const struct PyGoWaveMemoryEntry *) b)->bytes;
+	return x > y ? -1 : (x < y ? 1 : 0);
+}
+
+@implementation PyGoWaveMemoryRanking
+
+#pragma mark Initialization and Deallocation
+
+- (id)initWithCapacity:(NSUInteger)aCapacity
+{
+	if (self = [super init]) {
+		m_capacity = aCapacity;
+		m_count = 0;
+		m_heap = malloc(MAX(aCapacity, 1) * sizeof(struct PyGoWaveMemoryEntry));
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	for (NSUInteger i = 0; i < m_count; i++)
+		releaseEntry(&m_heap[i]);
+	free(m_heap);
+	[super dealloc];
+}
+
+#pragma mark Public methods
+
+- (void)addBytes:(NSUInteger)aBytes kind:(NSString*)aKind waveId:(NSString*)aWaveId waveletId:(NSString*)aWaveletId blipId:(NSString*)aBlipId
+{
+	if (m_capacity == 0)
+		return;
+	NSUInteger i;
+	if (m_count < m_capacity) {
+		// Sift up from the new leaf
+		i = m_count++;
+		while (i > 0 && m_heap[(i - 1) / 2].bytes > aBytes) {
+			m_heap[i] = m_heap[(i - 1) / 2];
+			i = (i - 1) / 2;
+		}
+	}
+	else {
+		// Replace the smallest entry at the root, then sift down
+		if (aBytes <= m_heap[0].bytes)
+			return;
+		releaseEntry(&m_heap[0]);
+		i = 0;
+		for (;;) {
+			NSUInteger child = 2 * i + 1;
+			if (child >= m_count)
+				break;
+			if (child + 1 < m_count && m_heap[child + 1].bytes < m_heap[child].bytes)
+				child++;
+			if (m_heap[child].bytes >= aBytes)
+				break;
+			m_heap[i] = m_heap[child];
+			i = child;
+		}
+	}
+	m_heap[i].bytes = aBytes;
+	m_heap[i].kind = aKind; // Constant strings
+	m_heap[i].waveId = [aWaveId copy];
+	m_heap[i].waveletId = [aWaveletId copy];
+	m_heap[i].blipId = [aBlipId copy];
+}
+
+- (NSArray*)entries
+{
+	// Sorting a copy keeps the heap intact for further additions
+	struct PyGoWaveMemoryEntry * sorted = malloc(MAX(m_count, 1) * sizeof(struct PyGoWaveMemoryEntry));
+	memcpy(sorted, m_heap, m_count * sizeof(struct PyGoWaveMemoryEntry));
+	qsort(sorted, m_count, sizeof(struct PyGoWaveMemoryEntry), compareEntries);
+	NSMutableArray * entries = [NSMutableArray arrayWithCapacity:m_count];
+	for (NSUInteger i = 0; i < m_count; i++) {
+		NSMutableDictionary * entry = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+									   sorted[i].kind, @"kind",
+									   [NSNumber numberWithUnsignedInteger:sorted[i].bytes], @"bytes",
+									   nil];
+		[entry setValue:sorted[i].waveId forKey:@"waveId"];
+		[entry setValue:sorted[i].waveletId forKey:@"waveletId"];
+		[entry setValue:sorted[i].blipId forKey:@"blipId"];
+		[entries addObject:entry];
+	}
+	free(sorted);
+	return entries;
+}
+
+@end
@@ -0,0 +1,86 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+@class PyGoWaveMetricSet;
+
+
+enum {
+	PyGoWaveMetric_AckTime = 0,		// Bundle sent until its acknowledgement arrived
+	PyGoWaveMetric_TransformTime,	// Transforming one received bundle or acknowledgement
+	PyGoWaveMetric_ApplyTime,		// Applying a run of received bundles to the model
+	PyGoWaveMetric_ParseTime,		// Decoding one received message body
+	PyGoWaveMetric_TimingCount
+};
+typedef NSInteger PyGoWaveTimingMetric;
+
+enum {
+	PyGoWaveMetric_BundlesSent = 0,
+	PyGoWaveMetric_BundlesReceived,
+	PyGoWaveMetric_AcksReceived,
+	PyGoWaveMetric_CheckSyncFailures,
+	PyGoWaveMetric_BytesIn,
+	PyGoWaveMetric_BytesOut,
+	PyGoWaveMetric_CounterCount
+};
+typedef NSInteger PyGoWaveCounterMetric;
+
+enum {
+	PyGoWaveMetric_CachedOperations = 0,	// Local operations not sent yet
+	PyGoWaveMetric_PendingOperations,		// Operations sent and not acknowledged yet
+	PyGoWaveMetric_GaugeCount
+};
+typedef NSInteger PyGoWaveGaugeMetric;
+
+/*
+ Counters, gauges and latency histograms per wavelet and in total. Safe to
+ use from any thread. Histograms have one bucket per power of two
+ microseconds, so recording is O(1) and percentiles are accurate to a
+ factor of two.
+ 
+ A snapshot looks like this; times are in seconds:
+	{"total": {<metrics>}, "wavelets": {<waveletId>: {<metrics>}, ...}}
+ with <metrics>:
+	ackTime, transformTime, applyTime, parseTime
+		{"count", "mean", "p50", "p90", "p99", "max"}
+	bundlesSent, bundlesReceived, acksReceived, checkSyncFailures, bytesIn, bytesOut
+		NSNumber
+	cachedOperations, pendingOperations
+		{"current", "max"}; in total, the sum over all wavelets
+*/
+@interface PyGoWaveMetrics : NSObject
+{
+	NSLock * m_lock;
+	PyGoWaveMetricSet * m_total;
+	NSMutableDictionary * m_wavelets;
+}
+
+- (id)init;
+- (void)dealloc;
+
+- (void)addTime:(NSTimeInterval)aSeconds toTiming:(PyGoWaveTimingMetric)aMetric forWaveletWithId:(NSString*)aWaveletId;
+- (void)addCount:(unsigned long long)aCount toCounter:(PyGoWaveCounterMetric)aMetric forWaveletWithId:(NSString*)aWaveletId;
+- (void)setValue:(NSInteger)aValue ofGauge:(PyGoWaveGaugeMetric)aMetric forWaveletWithId:(NSString*)aWaveletId;
+
+- (NSDictionary*)snapshot;
+- (void)reset;
+
+@end
@@ -0,0 +1,221 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#import "PyGoWaveMetrics.h"
+
+#define PGW_HISTOGRAM_BUCKETS	32
+
+static NSString * const kTimingNames[PyGoWaveMetric_TimingCount] = {
+	@"ackTime", @"transformTime", @"applyTime", @"parseTime"
+};
+static NSString * const kCounterNames[PyGoWaveMetric_CounterCount] = {
+	@"bundlesSent", @"bundlesReceived", @"acksReceived", @"checkSyncFailures", @"bytesIn", @"bytesOut"
+};
+static NSString * const kGaugeNames[PyGoWaveMetric_GaugeCount] = {
+	@"cachedOperations", @"pendingOperations"
+};
+
+// Bucket 0 holds times below 1 µs, bucket i times below 2^i µs
+typedef struct {
+	unsigned long long buckets[PGW_HISTOGRAM_BUCKETS];
+	unsigned long long count;
+	NSTimeInterval sum;
+	NSTimeInterval max;
+} PyGoWaveHistogram;
+
+static void addToHistogram(PyGoWaveHistogram * aHistogram, NSTimeInterval aSeconds)
+{
+	unsigned long long micro = aSeconds > 0.0 ? (unsigned long long)(aSeconds * 1e6) : 0;
+	NSUInteger bucket = micro == 0 ? 0 : 64 - __builtin_clzll(micro);
+	aHistogram->buckets[MIN(bucket, PGW_HISTOGRAM_BUCKETS - 1)]++;
+	aHistogram->count++;
+	aHistogram->sum += aSeconds;
+	if (aSeconds > aHistogram->max)
+		aHistogram->max = aSeconds;
+}
+
+// Upper bound of the bucket holding the given fraction of the samples
+static NSTimeInterval histogramPercentile(const PyGoWaveHistogram * aHistogram, double aFraction)
+{
+	unsigned long long rank = (unsigned long long) ceil(aFraction * aHistogram->count), seen = 0;
+	for (NSUInteger i = 0; i < PGW_HISTOGRAM_BUCKETS; i++) {
+		seen += aHistogram->buckets[i];
+		if (seen >= rank && seen > 0)
+			return MIN((double)(1ULL << i) / 1e6, aHistogram->max);
+	}
+	return aHistogram->max;
+}
+
+@interface PyGoWaveMetricSet : NSObject
+{
+@public
+	PyGoWaveHistogram timings[PyGoWaveMetric_TimingCount];
+	unsigned long long counters[PyGoWaveMetric_CounterCount];
+	NSInteger gauges[PyGoWaveMetric_GaugeCount];
+	NSInteger gaugeMax[PyGoWaveMetric_GaugeCount];
+}
+- (NSDictionary*)dictionary;
+@end
+
+@implementation PyGoWaveMetricSet
+
+- (NSDictionary*)dictionary
+{
+	NSMutableDictionary * dict = [NSMutableDictionary dictionary];
+	for (NSInteger m = 0; m < PyGoWaveMetric_TimingCount; m++) {
+		const PyGoWaveHistogram * h = &timings[m];
+		[dict setObject:[NSDictionary dictionaryWithObjectsAndKeys:
+						 [NSNumber numberWithUnsignedLongLong:h->count], @"count",
+						 [NSNumber numberWithDouble:h->count > 0 ? h->sum / h->count : 0.0], @"mean",
+						 [NSNumber numberWithDouble:histogramPercentile(h, 0.5)], @"p50",
+						 [NSNumber numberWithDouble:histogramPercentile(h, 0.9)], @"p90",
+						 [NSNumber numberWithDouble:histogramPercentile(h, 0.99)], @"p99",
+						 [NSNumber numberWithDouble:h->max], @"max",
+						 nil]
+				 forKey:kTimingNames[m]];
+	}
+	for (NSInteger m = 0; m < PyGoWaveMetric_CounterCount; m++)
+		[dict setObject:[NSNumber numberWithUnsignedLongLong:counters[m]] forKey:kCounterNames[m]];
+	for (NSInteger m = 0; m < PyGoWaveMetric_GaugeCount; m++) {
+		[dict setObject:[NSDictionary dictionaryWithObjectsAndKeys:
+						 [NSNumber numberWithInteger:gauges[m]], @"current",
+						 [NSNumber numberWithInteger:gaugeMax[m]], @"max",
+						 nil]
+				 forKey:kGaugeNames[m]];
+	}
+	return dict;
+}
+
+@end
+
+#pragma mark -
+
+@interface PyGoWaveMetrics ()
+- (PyGoWaveMetricSet*)setForWaveletWithId:(NSString*)aWaveletId;
+@end
+
+@implementation PyGoWaveMetrics
+
+#pragma mark Initialization and Deallocation
+
+- (id)init
+{
+	if (self = [super init]) {
+		m_lock = [NSLock new];
+		m_total = [PyGoWaveMetricSet new];
+		m_wavelets = [NSMutableDictionary new];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_lock release];
+	[m_total release];
+	[m_wavelets release];
+	[super dealloc];
+}
+
+#pragma mark Private methods
+
+// Call with the lock held
+- (PyGoWaveMetricSet*)setForWaveletWithId:(NSString*)aWaveletId
+{
+	PyGoWaveMetricSet * set = [m_wavelets objectForKey:aWaveletId];
+	if (set == nil) {
+		set = [PyGoWaveMetricSet new];
+		[m_wavelets setObject:set forKey:aWaveletId];
+		[set release];
+	}
+	return set;
+}
+
+#pragma mark Public methods
+
+- (void)addTime:(NSTimeInterval)aSeconds toTiming:(PyGoWaveTimingMetric)aMetric forWaveletWithId:(NSString*)aWaveletId
+{
+	[m_lock lock];
+	addToHistogram(&m_total->timings[aMetric], aSeconds);
+	if (aWaveletId != nil)
+		addToHistogram(&[self setForWaveletWithId:aWaveletId]->timings[aMetric], aSeconds);
+	[m_lock unlock];
+}
+
+- (void)addCount:(unsigned long long)aCount toCounter:(PyGoWaveCounterMetric)aMetric forWaveletWithId:(NSString*)aWaveletId
+{
+	[m_lock lock];
+	m_total->counters[aMetric] += aCount;
+	if (aWaveletId != nil)
+		[self setForWaveletWithId:aWaveletId]->counters[aMetric] += aCount;
+	[m_lock unlock];
+}
+
+- (void)setValue:(NSInteger)aValue ofGauge:(PyGoWaveGaugeMetric)aMetric forWaveletWithId:(NSString*)aWaveletId
+{
+	[m_lock lock];
+	PyGoWaveMetricSet * set = [self setForWaveletWithId:aWaveletId];
+	m_total->gauges[aMetric] += aValue - set->gauges[aMetric];
+	m_total->gaugeMax[aMetric] = MAX(m_total->gaugeMax[aMetric], m_total->gauges[aMetric]);
+	set->gauges[aMetric] = aValue;
+	set->gaugeMax[aMetric] = MAX(set->gaugeMax[aMetric], aValue);
+	[m_lock unlock];
+}
+
+- (NSDictionary*)snapshot
+{
+	[m_lock lock];
+	NSMutableDictionary * wavelets = [NSMutableDictionary dictionaryWithCapacity:[m_wavelets count]];
+	for (NSString * aWaveletId in m_wavelets)
+		[wavelets setObject:[[m_wavelets objectForKey:aWaveletId] dictionary] forKey:aWaveletId];
+	NSDictionary * snapshot = [NSDictionary dictionaryWithObjectsAndKeys:
+							   [m_total dictionary], @"total",
+							   wavelets, @"wavelets",
+							   nil];
+	[m_lock unlock];
+	return snapshot;
+}
+
+// Gauges keep their current values, so the totals stay consistent
+- (void)reset
+{
+	[m_lock lock];
+	PyGoWaveMetricSet * total = [PyGoWaveMetricSet new];
+	NSMutableDictionary * wavelets = [NSMutableDictionary new];
+	for (NSString * aWaveletId in m_wavelets) {
+		PyGoWaveMetricSet * old = [m_wavelets objectForKey:aWaveletId];
+		PyGoWaveMetricSet * set = [PyGoWaveMetricSet new];
+		for (NSInteger m = 0; m < PyGoWaveMetric_GaugeCount; m++) {
+			set->gauges[m] = set->gaugeMax[m] = old->gauges[m];
+			total->gauges[m] += old->gauges[m];
+			total->gaugeMax[m] = total->gauges[m];
+		}
+		[wavelets setObject:set forKey:aWaveletId];
+		[set release];
+	}
+	[m_total release];
+	m_total = total;
+	[m_wavelets release];
+	m_wavelets = wavelets;
+	[m_lock unlock];
+}
+
+@end
@@ -23,6 +23,8 @@
 
 #import "PyGoWaveBase.h"
 
+@class PyGoWaveParticipantStore;
+
 @interface PyGoWaveParticipant : PyGoWaveObject
 {
 	NSString *m_participantId;
@@ -31,6 +33,7 @@
 	NSString *m_profileUrl;
 	BOOL m_online;
 	BOOL m_bot;
+	PyGoWaveParticipantStore *m_store;
 }
 @property (nonatomic, copy, readonly) NSString *participantId;
 @property (nonatomic, copy) NSString *displayName;
@@ -38,6 +41,8 @@
 @property (nonatomic, copy) NSString *profileUrl;
 @property (nonatomic) BOOL online;
 @property (nonatomic) BOOL bot;
+// Not retained; set by a store that dropped the participant while it was still in use
+@property (nonatomic, assign) PyGoWaveParticipantStore *store;
 
 - (id)initWithParticipantId:(NSString *)participantId;
 - (void)dealloc;
@@ -45,6 +50,9 @@
 - (void)updateDataWithDict:(NSDictionary *)obj byServer:(NSString*)server;
 - (NSDictionary *)toGadgetFormat;
 
+// Approximate bytes kept alive by the participant and its data
+- (NSUInteger)retainedBytes;
+
 // Convenience methods to add/remove Observers
 
 - (void)addDataChangedObserver:(id)notificationObserver selector:(SEL)notificationSelector;
@@ -66,6 +74,15 @@
 
 @class PyGoWaveWavelet, PyGoWaveBlip, PyGoWaveOperation;
 
+// Approximate bytes kept alive by a blip, see -[PyGoWaveBlip getMemoryUsage:]
+typedef struct {
+	NSUInteger content;
+	NSUInteger elements;
+	NSUInteger annotations;
+	NSUInteger contributors;	// References only; the participants are cached elsewhere
+	NSUInteger total;			// All of the above plus the blip itself
+} PyGoWaveBlipMemoryUsage;
+
 #pragma mark -
 
 @interface PyGoWaveAnnotation : PyGoWaveObject
@@ -116,16 +133,22 @@ typedef NSInteger PyGoWaveElementType;
 @property (readonly) NSInteger elementId;
 @property (readonly) NSInteger elementType;
 @property NSInteger position;
+@property (readonly) NSDictionary * properties;
 
 - (id)initWithBlip:(PyGoWaveBlip*)aBlip elementId:(NSInteger)aId position:(NSInteger)aPosition elementType:(PyGoWaveElementType)aType properties:(NSDictionary*)someProperties;
 - (void)dealloc;
 
+// Approximate bytes kept alive by the element and its properties
+- (NSUInteger)retainedBytes;
+
 @end
 
 #pragma mark -
 
 @interface PyGoWaveGadgetElement : PyGoWaveElement
 {
+	NSMutableDictionary * m_fields;
+	BOOL m_stateChangePending;
 }
 @property (readonly, nonatomic) NSDictionary *fields;
 @property (readonly, nonatomic) NSDictionary *userPrefs;
@@ -133,7 +156,11 @@ typedef NSInteger PyGoWaveElementType;
 
 - (id)initWithBlip:(PyGoWaveBlip*)aBlip elementId:(NSInteger)aId position:(NSInteger)aPosition properties:(NSDictionary*)someProperties;
 
+// Deltas are merged into the fields right away; stateChange is posted at most
+// once per frame, however many deltas arrived in between (right away if the
+// posting thread runs no run loop)
 - (void)applyDelta:(NSDictionary*)delta;
+- (void)applyDeltas:(NSArray*)deltas;
 - (void)setUserPrefWithKey:(NSString*)key toValue:(NSString*)value;
 
 // Convenience methods to add/remove Observers
@@ -155,11 +182,14 @@ typedef NSInteger PyGoWaveElementType;
 	NSString * m_viewerId;
 	NSMutableDictionary * m_wavelets;
 	NSObject <PyGoWaveParticipantProvider> * m_pp;
+	NSThread * m_notificationThread;
 }
 @property (readonly, copy) NSString * waveId;
 @property (readonly, copy) NSString * viewerId;
 @property (retain) PyGoWaveWavelet * rootWavelet;
 @property (retain) NSObject <PyGoWaveParticipantProvider> * participantProvider;
+// Thread the notifications of the wave and everything in it are delivered on (default nil)
+@property (retain) NSThread * notificationThread;
 
 - (id)initWithWaveId:(NSString*)aWaveId viewerId:(NSString*)aViewerId participantProvider:(NSObject <PyGoWaveParticipantProvider>*)pp;
 - (void)dealloc;
@@ -183,6 +213,9 @@ typedef NSInteger PyGoWaveElementType;
 - (NSArray*)allWavelets;
 - (void)removeWaveletById:(NSString*)aId;
 
+// Approximate bytes kept alive by the wave itself, not counting its wavelets
+- (NSUInteger)retainedBytes;
+
 - (void)addWaveletAddedObserver:(id)notificationObserver selector:(SEL)notificationSelector;
 - (void)removeWaveletAddedObserver:(id)notificationObserver;
 
@@ -209,6 +242,7 @@ typedef NSInteger PyGoWaveElementType;
 	NSMutableArray * m_blips;
 	PyGoWaveBlip * m_rootBlip;
 	NSString * m_status;
+	BOOL m_changeSetEvents;
 }
 @property NSInteger version;
 @property (readonly) BOOL isRoot;
@@ -220,6 +254,9 @@ typedef NSInteger PyGoWaveElementType;
 @property (readonly, nonatomic, copy) NSDate * created;
 @property (nonatomic, copy) NSDate * lastModified;
 @property (readonly, nonatomic, copy) NSDictionary * allParticipantsForGadget;
+// Report applied bundles as one contentChanged event per blip and a single
+// status and lastModified update, instead of one event per operation (default NO)
+@property BOOL changeSetEvents;
 
 - (id)initWithWave:(PyGoWaveWaveModel*)aWave
 		 waveletId:(NSString*)aWaveletId;
@@ -290,6 +327,19 @@ typedef NSInteger PyGoWaveElementType;
 - (void)updateBlipId:(NSString*)tempId toBlipId:(NSString*)blipId;
 
 - (void)loadBlipsFromSnapshot:(NSDictionary*)blips rootBlipId:(NSString*)aRootBlipId;
+// Brings the blips up to date with a snapshot instead of replacing them all. Blips
+// are matched by id; those equal to their record keep their identity and post nothing,
+// changed text is patched with one deletion and insertion around the common prefix and
+// suffix. A blip whose elements changed is replaced, as are all blips if the snapshot
+// orders them differently. Returns the number of blips updated, inserted or deleted
+- (NSUInteger)reconcileBlipsWithSnapshot:(NSDictionary*)blips rootBlipId:(NSString*)aRootBlipId;
+// Replaces all blips at once. Observers get one waveletReloaded event
+// instead of blipDeleted and blipInserted for every blip
+- (void)reloadBlips:(NSArray*)sBlips;
+
+// Approximate bytes kept alive by the wavelet itself, not counting its blips.
+// Participants are shared and counted where they are cached
+- (NSUInteger)retainedBytes;
 
 - (void)addParticipantsChangedObserver:(id)notificationObserver selector:(SEL)notificationSelector;
 - (void)removeParticipantsChangedObserver:(id)notificationObserver;
@@ -300,6 +350,9 @@ typedef NSInteger PyGoWaveElementType;
 - (void)addBlipDeletedObserver:(id)notificationObserver selector:(SEL)notificationSelector;
 - (void)removeBlipDeletedObserver:(id)notificationObserver;
 
+- (void)addWaveletReloadedObserver:(id)notificationObserver selector:(SEL)notificationSelector;
+- (void)removeWaveletReloadedObserver:(id)notificationObserver;
+
 - (void)addStatusChangeObserver:(id)notificationObserver selector:(SEL)notificationSelector;
 - (void)removeStatusChangeObserver:(id)notificationObserver;
 
@@ -328,11 +381,14 @@ typedef NSInteger PyGoWaveElementType;
 	BOOL m_submitted;
 	BOOL m_outofsync;
 	NSMutableArray * m_annotations;
+	NSMutableData * m_changeSet;
 }
 @property (nonatomic, copy) NSString * blipId;
 @property (readonly) BOOL isRoot;
 @property (readonly, nonatomic, copy) NSString * content;
 @property (nonatomic, copy) NSDate * lastModified;
+@property (readonly) NSInteger version;
+@property (readonly) BOOL isSubmitted;
 
 - (id)initWithWavelet:(PyGoWaveWavelet*)aWavelet
 			   blipId:(NSString*)aBlipId;
@@ -383,6 +439,16 @@ typedef NSInteger PyGoWaveElementType;
 
 - (BOOL)checkSyncWithSum:(NSString*)aSum;
 
+- (void)getMemoryUsage:(PyGoWaveBlipMemoryUsage*)aUsage;
+
+// While a change set is open, content changes are collected instead of posted;
+// recordChange returns NO if none is open and the change must be posted on its own
+- (void)beginChangeSet;
+- (BOOL)isInChangeSet;
+- (BOOL)recordChange:(PyGoWaveChangeType)aType index:(NSInteger)aIndex length:(NSInteger)aLength;
+- (void)endChangeSet;
+- (void)discardChangeSet;
+
 - (void)addInsertedTextObserver:(id)notificationObserver selector:(SEL)notificationSelector;
 - (void)removeInsertedTextObserver:(id)notificationObserver;
 
@@ -407,6 +473,39 @@ typedef NSInteger PyGoWaveElementType;
 - (void)addContributorAddedObserver:(id)notificationObserver selector:(SEL)notificationSelector;
 - (void)removeContributorAddedObserver:(id)notificationObserver;
 
+- (void)addContentChangedObserver:(id)notificationObserver selector:(SEL)notificationSelector;
+- (void)removeContentChangedObserver:(id)notificationObserver;
+
+@end
+
+#pragma mark -
+
+/*
+ Lightweight entry of the wave list. Keeps the wavelet dictionaries as
+ received from the server, so the full model can be created on demand.
+*/
+@interface PyGoWaveWaveSummary : NSObject
+{
+	NSString * m_waveId;
+	NSString * m_title;
+	NSDate * m_lastModified;
+	NSUInteger m_participantCount;
+	NSDictionary * m_wavelets;
+}
+@property (readonly) NSString * waveId;
+@property (readonly) NSString * title;
+@property (readonly) NSDate * lastModified;
+@property (readonly) NSUInteger participantCount;
+@property (readonly) NSDictionary * wavelets;
+
+- (id)initWithWaveId:(NSString*)aWaveId wavelets:(NSDictionary*)sWavelets;
+- (void)dealloc;
+
+- (NSComparisonResult)compareByLastModified:(PyGoWaveWaveSummary*)aSummary;
+
+// Approximate bytes kept alive by the summary and its wavelet dictionaries
+- (NSUInteger)retainedBytes;
+
 @end
 
 #pragma mark -
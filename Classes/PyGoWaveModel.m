@@ -21,12 +21,17 @@
 
 #import "PyGoWaveModel.h"
 #import "PyGoWaveOperations.h"
+#import "PyGoWaveTrace.h"
+#import "PyGoWaveMemory.h"
+#import "PyGoWaveParticipantStore.h"
 #import <CommonCrypto/CommonDigest.h>
 
+#define PGW_GADGET_STATE_INTERVAL (1.0 / 30.0)
+
 @implementation PyGoWaveParticipant
 
 @synthesize participantId = m_participantId, displayName = m_displayName, thumbnailUrl = m_thumbnailUrl;
-@synthesize profileUrl = m_profileUrl, online = m_online, bot = m_bot;
+@synthesize profileUrl = m_profileUrl, online = m_online, bot = m_bot, store = m_store;
 
 #pragma mark Initialization and Deallocation
 
@@ -43,6 +48,7 @@
 
 - (void)dealloc
 {
+	[m_store participantWillDeallocate:self];
 	[m_participantId release];
 	[m_displayName release];
 	[m_profileUrl release];
@@ -117,6 +123,15 @@
 			nil];
 }
 
+- (NSUInteger)retainedBytes
+{
+	return PyGoWaveInstanceBytes(self)
+		+ PyGoWaveEstimatedBytes(m_participantId)
+		+ PyGoWaveEstimatedBytes(m_displayName)
+		+ PyGoWaveEstimatedBytes(m_thumbnailUrl)
+		+ PyGoWaveEstimatedBytes(m_profileUrl);
+}
+
 #pragma mark Observer add/remove methods
 
 - (void)addDataChangedObserver:(id)notificationObserver selector:(SEL)notificationSelector
@@ -166,13 +181,18 @@
 	[super dealloc];
 }
 
+- (NSThread*)notificationThread
+{
+	return [m_blip notificationThread];
+}
+
 @end
 
 #pragma mark -
 
 @implementation PyGoWaveElement
 
-@synthesize blip = m_blip, elementId = m_id, elementType = m_type, position = m_pos;
+@synthesize blip = m_blip, elementId = m_id, elementType = m_type, position = m_pos, properties = m_properties;
 
 // Hidden class method
 + (NSInteger)newTempId
@@ -205,6 +225,18 @@
 	[super dealloc];
 }
 
+- (NSThread*)notificationThread
+{
+	return [m_blip notificationThread];
+}
+
+#pragma mark Public methods
+
+- (NSUInteger)retainedBytes
+{
+	return PyGoWaveInstanceBytes(self) + PyGoWaveEstimatedBytes(m_properties);
+}
+
 @end
 
 #pragma mark -
@@ -215,7 +247,17 @@
 
 - (id)initWithBlip:(PyGoWaveBlip*)aBlip elementId:(NSInteger)aId position:(NSInteger)aPosition properties:(NSDictionary*)someProperties
 {
-	return [super initWithBlip:aBlip elementId:aId position:aPosition elementType:PyGoWaveElementType_GADGET properties:someProperties];
+	if (self = [super initWithBlip:aBlip elementId:aId position:aPosition elementType:PyGoWaveElementType_GADGET properties:someProperties]) {
+		m_fields = nil;
+		m_stateChangePending = NO;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_fields release];
+	[super dealloc];
 }
 
 #pragma mark Public methods
@@ -249,22 +291,41 @@
 
 - (void)applyDelta:(NSDictionary*)delta
 {
-	NSMutableDictionary * fields = [m_properties valueForKey:@"fields"];
-	if (fields == nil)
-		fields = [NSMutableDictionary new];
-	else
-		[fields retain];
-	for (NSString * key in delta) {
-		if (key == nil)
-			[fields removeObjectForKey:key];
-		else {
-			id value = [[[delta valueForKey:key] copy] autorelease];
-			[fields setValue:value forKey:key];
+	[self applyDeltas:[NSArray arrayWithObject:delta]];
+}
+
+- (void)applyDeltas:(NSArray*)deltas
+{
+	@synchronized (self) {
+		// The fields are copied into a dictionary of our own once and then updated in place
+		if (m_fields == nil || [m_properties objectForKey:@"fields"] != m_fields) {
+			[m_fields release];
+			m_fields = [[m_properties objectForKey:@"fields"] mutableCopy];
+			if (m_fields == nil)
+				m_fields = [NSMutableDictionary new];
+			[m_properties setObject:m_fields forKey:@"fields"];
+		}
+		for (NSDictionary * delta in deltas) {
+			for (NSString * key in delta) {
+				id value = [delta objectForKey:key];
+				if (value == [NSNull null])
+					[m_fields removeObjectForKey:key];
+				else {
+					value = [value copy];
+					[m_fields setObject:value forKey:key];
+					[value release];
+				}
+			}
 		}
+		if (m_stateChangePending)
+			return;
+		m_stateChangePending = YES;
 	}
-	[m_properties setValue:fields forKey:@"fields"];
-	[fields release];
-	[self postNotificationName:@"stateChange"];
+	NSThread * thread = [self notificationThread];
+	if (thread != nil && thread != [NSThread currentThread])
+		[self performSelector:@selector(scheduleStateChange) onThread:thread withObject:nil waitUntilDone:NO];
+	else
+		[self scheduleStateChange];
 }
 
 - (void)setUserPrefWithKey:(NSString*)key toValue:(NSString*)value
@@ -285,6 +346,25 @@
 					coalescing:NO];
 }
 
+#pragma mark Private methods
+
+- (void)scheduleStateChange
+{
+	// A delayed perform never fires without a running run loop and would leave the change pending for good
+	if ([[NSRunLoop currentRunLoop] currentMode] == nil)
+		[self postStateChange];
+	else
+		[self performSelector:@selector(postStateChange) withObject:nil afterDelay:PGW_GADGET_STATE_INTERVAL];
+}
+
+- (void)postStateChange
+{
+	@synchronized (self) {
+		m_stateChangePending = NO;
+	}
+	[self postNotificationName:@"stateChange"];
+}
+
 #pragma mark Observer add/remove methods
 
 - (void)addStateChangeObserver:(id)notificationObserver selector:(SEL)notificationSelector
@@ -312,6 +392,7 @@
 @implementation PyGoWaveWaveModel
 
 @synthesize waveId = m_waveId, viewerId = m_viewerId, rootWavelet = m_rootWavelet, participantProvider = m_pp;
+@synthesize notificationThread = m_notificationThread;
 
 #pragma mark Initialization and Deallocation
 
@@ -332,6 +413,7 @@
 	[m_viewerId release];
 	[m_wavelets release];
 	[m_pp release];
+	[m_notificationThread release];
 	[super dealloc];
 }
 
@@ -415,6 +497,14 @@
 	[wavelet autorelease];
 }
 
+- (NSUInteger)retainedBytes
+{
+	return PyGoWaveInstanceBytes(self)
+		+ PyGoWaveEstimatedBytes(m_waveId)
+		+ PyGoWaveEstimatedBytes(m_viewerId)
+		+ PyGoWaveCollectionBytes(m_wavelets);
+}
+
 #pragma mark Observer add/remove methods
 
 - (void)addWaveletAddedObserver:(id)notificationObserver selector:(SEL)notificationSelector
@@ -439,9 +529,54 @@
 
 #pragma mark -
 
+@interface PyGoWaveBlip ()
+- (id)initWithWavelet:(PyGoWaveWavelet*)aWavelet
+			   blipId:(NSString*)aBlipId
+			 snapshot:(NSDictionary*)aSnapshot
+			   isRoot:(BOOL)bRoot;
+// Updates the blip in place from a newer snapshot record of it. Returns NO and
+// leaves the blip untouched if its elements differ in more than the positions
+// the text patch moves them to; aChanged tells whether anything was updated
+- (BOOL)reconcileWithSnapshot:(NSDictionary*)aSnapshot isRoot:(BOOL)bRoot changed:(BOOL*)aChanged;
+@end
+
+typedef struct {
+	unsigned long long creationTime;
+	NSString * blipId;
+	NSDictionary * snapshot;
+} PyGoWaveSnapshotBlipKey;
+
+static int compareSnapshotBlipKeys(const void * a, const void * b)
+{
+	const PyGoWaveSnapshotBlipKey * k1 = a;
+	const PyGoWaveSnapshotBlipKey * k2 = b;
+	if (k1->creationTime != k2->creationTime)
+		return k1->creationTime < k2->creationTime ? -1 : 1;
+	return (int) [k1->blipId compare:k2->blipId];
+}
+
+// Ordered by creation time; the id breaks ties, so equal timestamps neither collide nor depend on hashing.
+// The caller frees the returned keys
+static PyGoWaveSnapshotBlipKey * sortSnapshotBlips(NSDictionary * blips, NSUInteger * aCount)
+{
+	PyGoWaveSnapshotBlipKey * keys = malloc(MAX([blips count], 1) * sizeof(PyGoWaveSnapshotBlipKey));
+	NSUInteger n = 0;
+	for (NSString * blipId in blips) {
+		NSDictionary * blip = [blips objectForKey:blipId];
+		keys[n].creationTime = [[blip valueForKey:@"creationTime"] unsignedLongLongValue];
+		keys[n].blipId = blipId;
+		keys[n].snapshot = blip;
+		n++;
+	}
+	qsort(keys, n, sizeof(PyGoWaveSnapshotBlipKey), compareSnapshotBlipKeys);
+	*aCount = n;
+	return keys;
+}
+
 @implementation PyGoWaveWavelet
 
 @synthesize version = m_version, isRoot = m_root, waveletId = m_id, title = m_title, status = m_status, created = m_created, lastModified = m_lastModified;
+@synthesize changeSetEvents = m_changeSetEvents;
 
 #pragma mark Initialization and Deallocation
 
@@ -492,6 +627,7 @@
 		m_participants = [NSMutableDictionary new];
 		m_blips = [NSMutableArray new];
 		m_status = [@"clean" copy];
+		m_changeSetEvents = NO;
 		
 		if (bRoot) {
 			if ([aWave rootWavelet] == nil)
@@ -593,6 +729,11 @@
 	return m_wave;
 }
 
+- (NSThread*)notificationThread
+{
+	return [m_wave notificationThread];
+}
+
 - (void)addParticipant:(PyGoWaveParticipant*)aParticipant
 {
 	if ([m_participants valueForKey:aParticipant.participantId] == nil) {
@@ -657,14 +798,20 @@
 						 submitted:(BOOL)bSubmitted
 {
 	PyGoWaveBlip * blip = [[PyGoWaveBlip alloc] initWithWavelet:self blipId:aId content:sContent elements:sElements parent:nil creator:aCreator contributors:sContributors isRoot:bRoot lastModified:bLastModified version:aVersion submitted:bSubmitted];
-	[m_blips insertObject:blip atIndex:index];
+	[self insertBlip:blip atIndex:index];
+	return [blip autorelease];
+}
+
+// Internal
+- (void)insertBlip:(PyGoWaveBlip*)aBlip atIndex:(NSInteger)index
+{
+	[m_blips insertObject:aBlip atIndex:index];
 	[self postNotificationName:@"blipInserted"
 					  userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
 								[NSNumber numberWithInt:index], @"index",
-								[NSString stringWithString:aId], @"blipId",
+								[NSString stringWithString:aBlip.blipId], @"blipId",
 								nil]
 					coalescing:NO];
-	return [blip autorelease];
 }
 
 - (void)deleteBlipWithId:(NSString*)aId
@@ -724,12 +871,18 @@
 {
 	NSObject <PyGoWaveParticipantProvider> * pp = [m_wave participantProvider];
 	PyGoWaveParticipant * c = [pp participantById:aContributorId];
+	NSMutableArray * changedBlips = m_changeSetEvents ? [NSMutableArray new] : nil;
+	uint64_t traceStart = PyGoWaveTraceBegin();
 	
 	for (PyGoWaveOperation * op in sOperations) {
 		if (![op.blipId isEqual:@""]) {
 			PyGoWaveBlip * blip = [self blipById:op.blipId];
 			if (blip == nil)
 				continue;
+			if (changedBlips != nil && ![blip isInChangeSet]) {
+				[blip beginChangeSet];
+				[changedBlips addObject:blip];
+			}
 			switch(op.type) {
 				case PyGoWaveOperation_DOCUMENT_NOOP:
 					break;
@@ -757,7 +910,8 @@
 				default:
 					break;
 			}
-			[blip setLastModified:aTimestamp];
+			if (changedBlips == nil)
+				[blip setLastModified:aTimestamp];
 		}
 		else {
 			switch (op.type) {
@@ -775,6 +929,23 @@
 			}
 		}
 	}
+	
+	if (changedBlips != nil) {
+		for (PyGoWaveBlip * blip in changedBlips) {
+			if ([m_blips indexOfObjectIdenticalTo:blip] == NSNotFound) { // Deleted by the bundle
+				[blip discardChangeSet];
+				continue;
+			}
+			[blip endChangeSet];
+			[blip setLastModified:aTimestamp];
+		}
+		if ([changedBlips count] > 0) {
+			self.status = @"dirty";
+			self.lastModified = aTimestamp;
+		}
+		[changedBlips release];
+	}
+	PyGoWaveTraceEnd("model.applyOperations", traceStart, [sOperations count]);
 }
 
 - (void)updateBlipId:(NSString*)tempId toBlipId:(NSString*)blipId
@@ -786,63 +957,102 @@
 
 - (void)loadBlipsFromSnapshot:(NSDictionary*)blips rootBlipId:(NSString*)aRootBlipId
 {
-	NSObject <PyGoWaveParticipantProvider> * pp = [m_wave participantProvider];
+	NSUInteger n;
+	PyGoWaveSnapshotBlipKey * keys = sortSnapshotBlips(blips, &n);
 	
-	// Remove existing
-	while ([m_blips count] > 0) {
-		PyGoWaveBlip * blip = [m_blips lastObject];
-		[self deleteBlipWithId:blip.blipId];
+	NSMutableArray * newBlips = [[NSMutableArray alloc] initWithCapacity:n];
+	for (NSUInteger k = 0; k < n; k++) {
+		PyGoWaveBlip * blip = [[PyGoWaveBlip alloc] initWithWavelet:self
+															 blipId:keys[k].blipId
+														   snapshot:keys[k].snapshot
+															 isRoot:[keys[k].blipId isEqual:aRootBlipId]];
+		[newBlips addObject:blip];
+		[blip release];
 	}
+	free(keys);
 	
-	// Ordering
-	NSMutableDictionary * created = [NSMutableDictionary new];
-	for (NSString * blipId in blips) {
-		NSDictionary * blip = [blips valueForKey:blipId];
-		[created setValue:blipId forKey:[blip valueForKey:@"creationTime"]];
+	[self reloadBlips:newBlips];
+	[newBlips release];
+}
+
+- (NSUInteger)reconcileBlipsWithSnapshot:(NSDictionary*)blips rootBlipId:(NSString*)aRootBlipId
+{
+	NSUInteger n;
+	PyGoWaveSnapshotBlipKey * keys = sortSnapshotBlips(blips, &n);
+	NSMutableDictionary * positions = [[NSMutableDictionary alloc] initWithCapacity:n];
+	for (NSUInteger k = 0; k < n; k++)
+		[positions setObject:[NSNumber numberWithUnsignedInteger:k] forKey:keys[k].blipId];
+	
+	// Blips are not moved around; if the ones both sides have are in a different order, reload them all
+	NSInteger last = -1;
+	for (PyGoWaveBlip * blip in m_blips) {
+		NSNumber * position = [positions objectForKey:blip.blipId];
+		if (position == nil)
+			continue;
+		if ([position integerValue] < last) {
+			[positions release];
+			free(keys);
+			[self loadBlipsFromSnapshot:blips rootBlipId:aRootBlipId];
+			return n;
+		}
+		last = [position integerValue];
 	}
-	NSArray * sortedKeys = [[created allKeys] sortedArrayUsingFunction:sortJsonTimestamp context:NULL];
-	NSMutableArray * sortedIds = [NSMutableArray new];
-	for (NSNumber * key in sortedKeys)
-		[sortedIds addObject:[created objectForKey:key]];
-	[created release];
 	
-	for (NSString * blipId in sortedIds) {
-		NSDictionary * blip = [blips valueForKey:blipId];
-		NSMutableArray * contributors = [NSMutableArray new];
-		for (NSString * cId in [blip valueForKey:@"contributors"])
-			[contributors addObject:[pp participantById:cId]];
-		
-		NSMutableArray * blipElements = [NSMutableArray new];
-		for (NSDictionary * element in [blip valueForKey:@"elements"]) {
-			PyGoWaveElement * elementObj;
-			if ([[element valueForKey:@"type"] intValue] == PyGoWaveElementType_GADGET)
-				elementObj = [[PyGoWaveGadgetElement alloc] initWithBlip:nil
-															   elementId:[[element valueForKey:@"id"] intValue]
-																position:[[element valueForKey:@"index"] intValue]
-															  properties:[element valueForKey:@"properties"]];
-			else
-				elementObj = [[PyGoWaveElement alloc] initWithBlip:nil
-														 elementId:[[element valueForKey:@"id"] intValue]
-														  position:[[element valueForKey:@"index"] intValue]
-													   elementType:[[element valueForKey:@"type"] intValue]
-														properties:[element valueForKey:@"properties"]];
-			[blipElements addObject:[elementObj autorelease]];
+	NSUInteger changed = 0;
+	for (PyGoWaveBlip * blip in [self allBlips]) {
+		if ([positions objectForKey:blip.blipId] == nil) {
+			[self deleteBlipWithId:blip.blipId];
+			changed++;
 		}
-		
-		[self appendBlipWithId:blipId
-					   content:[blip valueForKey:@"content"]
-					  elements:blipElements
-					   creator:[pp participantById:[blip valueForKey:@"creator"]]
-				  contributors:contributors
-						isRoot:[blipId isEqual:aRootBlipId]
-				  lastModified:parseJsonTimestamp([blip valueForKey:@"lastModifiedTime"])
-					   version:[[blip valueForKey:@"version"] intValue]
-					 submitted:[[blip valueForKey:@"submitted"] boolValue]];
-		
-		[blipElements release];
-		[contributors release];
 	}
-	[sortedIds release];
+	[positions release];
+	
+	// Every blip before k now matches the snapshot, so blip k is either keys[k] or comes after it
+	for (NSUInteger k = 0; k < n; k++) {
+		BOOL isRoot = [keys[k].blipId isEqual:aRootBlipId];
+		PyGoWaveBlip * blip = [self blipByIndex:k];
+		if (blip != nil && [blip.blipId isEqual:keys[k].blipId]) {
+			BOOL blipChanged = NO;
+			if ([blip reconcileWithSnapshot:keys[k].snapshot isRoot:isRoot changed:&blipChanged]) {
+				if (blipChanged)
+					changed++;
+				continue;
+			}
+			[self deleteBlipWithId:blip.blipId]; // Elements changed, replace the blip
+		}
+		blip = [[PyGoWaveBlip alloc] initWithWavelet:self
+											  blipId:keys[k].blipId
+											snapshot:keys[k].snapshot
+											  isRoot:isRoot];
+		[self insertBlip:blip atIndex:k];
+		[blip release];
+		changed++;
+	}
+	free(keys);
+	return changed;
+}
+
+- (void)reloadBlips:(NSArray*)sBlips
+{
+	[m_blips release];
+	m_blips = [sBlips mutableCopy];
+	[self postNotificationName:@"waveletReloaded"
+					  userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+								[NSNumber numberWithUnsignedInteger:[m_blips count]], @"count",
+								nil]
+					coalescing:NO];
+}
+
+- (NSUInteger)retainedBytes
+{
+	return PyGoWaveInstanceBytes(self)
+		+ PyGoWaveEstimatedBytes(m_id)
+		+ PyGoWaveEstimatedBytes(m_title)
+		+ PyGoWaveEstimatedBytes(m_status)
+		+ PyGoWaveEstimatedBytes(m_created)
+		+ PyGoWaveEstimatedBytes(m_lastModified)
+		+ PyGoWaveCollectionBytes(m_participants)
+		+ PyGoWaveCollectionBytes(m_blips);
 }
 
 #pragma mark Observer add/remove methods
@@ -874,6 +1084,15 @@
 	[self removeObserver:notificationObserver name:@"blipDeleted"];
 }
 
+- (void)addWaveletReloadedObserver:(id)notificationObserver selector:(SEL)notificationSelector
+{
+	[self addObserver:notificationObserver selector:notificationSelector name:@"waveletReloaded"];
+}
+- (void)removeWaveletReloadedObserver:(id)notificationObserver
+{
+	[self removeObserver:notificationObserver name:@"waveletReloaded"];
+}
+
 - (void)addStatusChangeObserver:(id)notificationObserver selector:(SEL)notificationSelector
 {
 	[self addObserver:notificationObserver selector:notificationSelector name:@"statusChange"];
@@ -908,6 +1127,7 @@
 @implementation PyGoWaveBlip
 
 @synthesize isRoot = m_root, blipId = m_id, content = m_content, lastModified = m_lastModified;
+@synthesize version = m_version, isSubmitted = m_submitted;
 
 // Hidden class method
 + (NSString*)newTempId
@@ -975,6 +1195,62 @@
 		m_version = aVersion;
 		m_submitted = bSubmitted;
 		m_outofsync = NO;
+		m_changeSet = nil;
+	}
+	return self;
+}
+
+// Builds the blip and its elements straight from a snapshot record
+- (id)initWithWavelet:(PyGoWaveWavelet*)aWavelet
+			   blipId:(NSString*)aBlipId
+			 snapshot:(NSDictionary*)aSnapshot
+			   isRoot:(BOOL)bRoot
+{
+	if (self = [super init]) {
+		NSObject <PyGoWaveParticipantProvider> * pp = [[aWavelet waveModel] participantProvider];
+		m_wavelet = aWavelet; // Not retaining parent object
+		m_id = [aBlipId copy];
+		m_parent = nil;
+		m_content = [[aSnapshot valueForKey:@"content"] mutableCopy];
+		m_annotations = [NSMutableArray new];
+		
+		NSArray * elements = [aSnapshot valueForKey:@"elements"];
+		m_elements = [[NSMutableArray alloc] initWithCapacity:[elements count]];
+		for (NSDictionary * element in elements) {
+			PyGoWaveElement * elementObj;
+			if ([[element valueForKey:@"type"] intValue] == PyGoWaveElementType_GADGET)
+				elementObj = [[PyGoWaveGadgetElement alloc] initWithBlip:self
+															   elementId:[[element valueForKey:@"id"] intValue]
+																position:[[element valueForKey:@"index"] intValue]
+															  properties:[element valueForKey:@"properties"]];
+			else
+				elementObj = [[PyGoWaveElement alloc] initWithBlip:self
+														 elementId:[[element valueForKey:@"id"] intValue]
+														  position:[[element valueForKey:@"index"] intValue]
+													   elementType:[[element valueForKey:@"type"] intValue]
+														properties:[element valueForKey:@"properties"]];
+			[m_elements addObject:elementObj];
+			[elementObj release];
+		}
+		
+		m_creator = [[pp participantById:[aSnapshot valueForKey:@"creator"]] retain];
+		NSArray * contributors = [aSnapshot valueForKey:@"contributors"];
+		NSMutableDictionary * contributorDict = [[NSMutableDictionary alloc] initWithCapacity:MAX([contributors count], 1)];
+		for (NSString * cId in contributors)
+			[contributorDict setValue:[pp participantById:cId] forKey:cId];
+		if ([contributorDict count] == 0 && m_creator != nil)
+			[contributorDict setValue:m_creator forKey:m_creator.participantId];
+		m_contributors = contributorDict;
+		
+		m_root = bRoot;
+		if ([aSnapshot valueForKey:@"lastModifiedTime"] == nil)
+			m_lastModified = [[NSDate date] retain];
+		else
+			m_lastModified = [parseJsonTimestamp([aSnapshot valueForKey:@"lastModifiedTime"]) retain];
+		m_version = [[aSnapshot valueForKey:@"version"] intValue];
+		m_submitted = [[aSnapshot valueForKey:@"submitted"] boolValue];
+		m_outofsync = NO;
+		m_changeSet = nil;
 	}
 	return self;
 }
@@ -985,6 +1261,7 @@
 	[m_parent release];
 	[m_content release];
 	[m_annotations release];
+	[m_changeSet release];
 	[m_elements release];
 	[m_creator release];
 	[m_contributors release];
@@ -1039,6 +1316,11 @@
 	return m_wavelet;
 }
 
+- (NSThread*)notificationThread
+{
+	return [m_wavelet notificationThread];
+}
+
 - (PyGoWaveElement*)elementById:(NSInteger)aId
 {
 	for (PyGoWaveElement * element in m_elements) {
@@ -1101,11 +1383,13 @@
 	[m_elements addObject:elt];
 	[elt release];
 	
+	if ([self recordChange:PyGoWaveChange_InsertedElement index:aIndex length:1])
+		return;
+	
 	m_wavelet.status = @"dirty";
 	
-	[self postNotificationName:@"insertedElement"
-					  userInfo:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:aIndex], @"index", nil]
-					coalescing:NO];
+	PyGoWaveEventInfo info = {aIndex, 0, 0, 0, nil};
+	[self postEvent:PyGoWaveEvent_InsertedElement info:&info];
 }
 
 - (void)deleteElementAtIndex:(NSInteger)aIndex
@@ -1131,9 +1415,10 @@
 					anno.end -= 1;
 				}
 			}
-			[self postNotificationName:@"deletedElement"
-							  userInfo:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:aIndex], @"index", nil]
-							coalescing:NO];
+			if (![self recordChange:PyGoWaveChange_DeletedElement index:aIndex length:1]) {
+				PyGoWaveEventInfo info = {aIndex, 0, 0, 0, nil};
+				[self postEvent:PyGoWaveEvent_DeletedElement info:&info];
+			}
 			[elt autorelease];
 			break;
 		}
@@ -1161,14 +1446,13 @@
 			anno.end += length;
 	}
 	
+	if ([self recordChange:PyGoWaveChange_InsertedText index:aIndex length:length])
+		return;
+	
 	m_wavelet.status = @"dirty";
 	
-	[self postNotificationName:@"insertedText"
-					  userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
-								[NSNumber numberWithInt:aIndex], @"index",
-								[NSString stringWithString:aText], @"text",
-								nil]
-					coalescing:NO];
+	PyGoWaveEventInfo info = {aIndex, 0, 0, 0, aText};
+	[self postEvent:PyGoWaveEvent_InsertedText info:&info];
 }
 
 - (void)deleteTextAtIndex:(NSInteger)aIndex
@@ -1190,14 +1474,13 @@
 			anno.end -= aLength;
 	}
 	
+	if ([self recordChange:PyGoWaveChange_DeletedText index:aIndex length:aLength])
+		return;
+	
 	m_wavelet.status = @"dirty";
 	
-	[self postNotificationName:@"deletedText"
-					  userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
-								[NSNumber numberWithInt:aIndex], @"index",
-								[NSNumber numberWithInt:aLength], @"length",
-								nil]
-					coalescing:NO];
+	PyGoWaveEventInfo info = {aIndex, aLength, 0, 0, nil};
+	[self postEvent:PyGoWaveEvent_DeletedText info:&info];
 }
 
 - (void)applyElementDelta:(NSDictionary*)aDelta
@@ -1211,6 +1494,7 @@
 		return;
 	PyGoWaveGadgetElement * gElt = (PyGoWaveGadgetElement*) elt;
 	[gElt applyDelta:aDelta];
+	[self recordChange:PyGoWaveChange_ElementDelta index:aIndex length:1];
 }
 
 - (void)setElementUserPrefWithKey:(NSString*)aKey
@@ -1225,6 +1509,7 @@
 		return;
 	PyGoWaveGadgetElement * gElt = (PyGoWaveGadgetElement*) elt;
 	[gElt setUserPrefWithKey:aKey toValue:aValue];
+	[self recordChange:PyGoWaveChange_ElementUserPref index:aIndex length:1];
 }
 
 - (BOOL)checkSyncWithSum:(NSString*)aSum
@@ -1259,6 +1544,198 @@
 	return YES;
 }
 
+- (void)getMemoryUsage:(PyGoWaveBlipMemoryUsage*)aUsage
+{
+	aUsage->content = PyGoWaveEstimatedBytes(m_content);
+	aUsage->elements = PyGoWaveCollectionBytes(m_elements);
+	for (PyGoWaveElement * element in m_elements)
+		aUsage->elements += [element retainedBytes];
+	aUsage->annotations = PyGoWaveCollectionBytes(m_annotations);
+	for (PyGoWaveAnnotation * annotation in m_annotations)
+		aUsage->annotations += PyGoWaveInstanceBytes(annotation) + PyGoWaveEstimatedBytes(annotation.name) + PyGoWaveEstimatedBytes(annotation.value);
+	aUsage->contributors = PyGoWaveCollectionBytes(m_contributors);
+	aUsage->total = aUsage->content + aUsage->elements + aUsage->annotations + aUsage->contributors
+		+ PyGoWaveInstanceBytes(self)
+		+ PyGoWaveEstimatedBytes(m_id)
+		+ PyGoWaveEstimatedBytes(m_lastModified)
+		+ PyGoWaveEstimatedBytes(m_changeSet);
+}
+
+// Internal; posted like an edit, but neither adds a contributor nor makes the wavelet dirty
+- (void)replaceTextInRange:(NSRange)aRange withText:(NSString*)aText
+{
+	if (aRange.length > 0) {
+		[m_content deleteCharactersInRange:aRange];
+		for (PyGoWaveElement * element in m_elements) {
+			if (element.position >= aRange.location)
+				element.position -= aRange.length;
+		}
+		for (PyGoWaveAnnotation * anno in m_annotations) {
+			if (anno.start >= aRange.location) {
+				anno.start = MAX(anno.start - (NSInteger) aRange.length, (NSInteger) aRange.location);
+				anno.end = MAX(anno.end - (NSInteger) aRange.length, anno.start);
+			}
+		}
+		if (![self recordChange:PyGoWaveChange_DeletedText index:aRange.location length:aRange.length]) {
+			PyGoWaveEventInfo info = {aRange.location, aRange.length, 0, 0, nil};
+			[self postEvent:PyGoWaveEvent_DeletedText info:&info];
+		}
+	}
+	NSInteger length = [aText length];
+	if (length > 0) {
+		[m_content insertString:aText atIndex:aRange.location];
+		for (PyGoWaveElement * element in m_elements) {
+			if (element.position >= aRange.location)
+				element.position += length;
+		}
+		for (PyGoWaveAnnotation * anno in m_annotations) {
+			if (anno.start >= aRange.location) {
+				anno.start += length;
+				anno.end += length;
+			}
+		}
+		if (![self recordChange:PyGoWaveChange_InsertedText index:aRange.location length:length]) {
+			PyGoWaveEventInfo info = {aRange.location, 0, 0, 0, aText};
+			[self postEvent:PyGoWaveEvent_InsertedText info:&info];
+		}
+	}
+}
+
+- (BOOL)reconcileWithSnapshot:(NSDictionary*)aSnapshot isRoot:(BOOL)bRoot changed:(BOOL*)aChanged
+{
+	NSString * content = [aSnapshot valueForKey:@"content"];
+	if (content == nil)
+		content = @"";
+	
+	// The text differing between the common prefix and suffix is replaced in one go
+	NSUInteger oldLength = [m_content length];
+	NSUInteger newLength = [content length];
+	NSUInteger prefix = oldLength, suffix = 0;
+	BOOL textChanged = ![m_content isEqualToString:content];
+	if (textChanged) {
+		NSUInteger limit = MIN(oldLength, newLength);
+		unichar * oldChars = malloc(MAX(oldLength, 1) * sizeof(unichar));
+		unichar * newChars = malloc(MAX(newLength, 1) * sizeof(unichar));
+		[m_content getCharacters:oldChars range:NSMakeRange(0, oldLength)];
+		[content getCharacters:newChars range:NSMakeRange(0, newLength)];
+		prefix = 0;
+		while (prefix < limit && oldChars[prefix] == newChars[prefix])
+			prefix++;
+		while (suffix < limit - prefix && oldChars[oldLength - 1 - suffix] == newChars[newLength - 1 - suffix])
+			suffix++;
+		free(oldChars);
+		free(newChars);
+	}
+	NSRange replaced = NSMakeRange(prefix, oldLength - prefix - suffix);
+	NSInteger growth = (NSInteger) (newLength - prefix - suffix) - (NSInteger) replaced.length;
+	
+	// Elements are kept if the snapshot has the same ones where the patch moves them
+	NSArray * elements = [aSnapshot valueForKey:@"elements"];
+	if ([elements count] != [m_elements count])
+		return NO;
+	for (NSDictionary * element in elements) {
+		PyGoWaveElement * elt = [self elementById:[[element valueForKey:@"id"] intValue]];
+		if (elt == nil || elt.elementType != [[element valueForKey:@"type"] intValue])
+			return NO;
+		NSInteger position = elt.position;
+		if (position >= (NSInteger) NSMaxRange(replaced))
+			position += growth;
+		else if (position >= (NSInteger) replaced.location)
+			return NO; // Within the replaced text
+		if (position != [[element valueForKey:@"index"] intValue])
+			return NO;
+		NSDictionary * properties = [element valueForKey:@"properties"];
+		if (elt.properties == nil ? [properties count] != 0 : ![elt.properties isEqual:properties])
+			return NO;
+	}
+	
+	BOOL changed = NO;
+	if (textChanged) {
+		BOOL changeSet = m_wavelet.changeSetEvents && ![self isInChangeSet];
+		if (changeSet)
+			[self beginChangeSet];
+		[self replaceTextInRange:replaced withText:[content substringWithRange:NSMakeRange(prefix, newLength - prefix - suffix)]];
+		if (changeSet)
+			[self endChangeSet];
+		changed = YES;
+	}
+	m_outofsync = NO;
+	
+	NSInteger version = [[aSnapshot valueForKey:@"version"] intValue];
+	BOOL submitted = [[aSnapshot valueForKey:@"submitted"] boolValue];
+	if (m_version != version || m_submitted != submitted || m_root != bRoot) {
+		m_version = version;
+		m_submitted = submitted;
+		m_root = bRoot;
+		changed = YES;
+	}
+	
+	NSObject <PyGoWaveParticipantProvider> * pp = [[m_wavelet waveModel] participantProvider];
+	NSString * creatorId = [aSnapshot valueForKey:@"creator"];
+	if (creatorId != nil && ![m_creator.participantId isEqual:creatorId]) {
+		[m_creator release];
+		m_creator = [[pp participantById:creatorId] retain];
+		changed = YES;
+	}
+	for (NSString * cId in [aSnapshot valueForKey:@"contributors"]) {
+		if ([m_contributors valueForKey:cId] == nil) {
+			[m_contributors setValue:[pp participantById:cId] forKey:cId];
+			[self postNotificationName:@"contributorAdded"
+							  userInfo:[NSDictionary dictionaryWithObjectsAndKeys:cId, @"id", nil]
+							coalescing:NO];
+			changed = YES;
+		}
+	}
+	
+	if ([aSnapshot valueForKey:@"lastModifiedTime"] != nil) {
+		NSDate * lastModified = parseJsonTimestamp([aSnapshot valueForKey:@"lastModifiedTime"]);
+		if (![m_lastModified isEqual:lastModified]) {
+			self.lastModified = lastModified;
+			changed = YES;
+		}
+	}
+	
+	*aChanged = changed;
+	return YES;
+}
+
+- (void)beginChangeSet
+{
+	if (m_changeSet == nil)
+		m_changeSet = [NSMutableData new];
+}
+
+- (BOOL)isInChangeSet
+{
+	return m_changeSet != nil;
+}
+
+- (BOOL)recordChange:(PyGoWaveChangeType)aType index:(NSInteger)aIndex length:(NSInteger)aLength
+{
+	if (m_changeSet == nil)
+		return NO;
+	PyGoWaveChange change = {aType, aIndex, aLength};
+	[m_changeSet appendBytes:&change length:sizeof(change)];
+	return YES;
+}
+
+- (void)endChangeSet
+{
+	NSMutableData * changes = m_changeSet;
+	m_changeSet = nil;
+	if ([changes length] > 0) {
+		PyGoWaveEventInfo info = {0, 0, 0, 0, nil, [changes bytes], [changes length] / sizeof(PyGoWaveChange)};
+		[self postEvent:PyGoWaveEvent_ContentChanged info:&info];
+	}
+	[changes release];
+}
+
+- (void)discardChangeSet
+{
+	[m_changeSet release];
+	m_changeSet = nil;
+}
+
 #pragma mark Observer add/remove methods
 
 - (void)addInsertedTextObserver:(id)notificationObserver selector:(SEL)notificationSelector
@@ -1333,6 +1810,80 @@
 	[self removeObserver:notificationObserver name:@"contributorAdded"];
 }
 
+- (void)addContentChangedObserver:(id)notificationObserver selector:(SEL)notificationSelector
+{
+	[self addObserver:notificationObserver selector:notificationSelector name:@"contentChanged"];
+}
+- (void)removeContentChangedObserver:(id)notificationObserver
+{
+	[self removeObserver:notificationObserver name:@"contentChanged"];
+}
+
+@end
+
+#pragma mark -
+
+@implementation PyGoWaveWaveSummary
+
+@synthesize waveId = m_waveId, title = m_title, lastModified = m_lastModified, participantCount = m_participantCount, wavelets = m_wavelets;
+
+#pragma mark Initialization and Deallocation
+
+- (id)initWithWaveId:(NSString*)aWaveId wavelets:(NSDictionary*)sWavelets
+{
+	if (self = [super init]) {
+		m_waveId = [aWaveId copy];
+		m_wavelets = [sWavelets retain];
+		
+		NSMutableSet * participants = [NSMutableSet new];
+		unsigned int lastModified = 0;
+		for (NSString * aWaveletId in sWavelets) {
+			NSDictionary * aDict = [sWavelets valueForKey:aWaveletId];
+			if (m_title == nil || [[aDict valueForKey:@"isRoot"] boolValue]) {
+				[m_title release];
+				m_title = [[aDict valueForKey:@"title"] copy];
+			}
+			unsigned int ts = [[aDict valueForKey:@"lastModifiedTime"] unsignedIntValue];
+			if (ts > lastModified)
+				lastModified = ts;
+			[participants addObjectsFromArray:[aDict valueForKey:@"participants"]];
+		}
+		m_participantCount = [participants count];
+		[participants release];
+		m_lastModified = [[NSDate alloc] initWithTimeIntervalSince1970:(double)lastModified];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_waveId release];
+	[m_title release];
+	[m_lastModified release];
+	[m_wavelets release];
+	[super dealloc];
+}
+
+#pragma mark Public methods
+
+// Most recently modified first
+- (NSComparisonResult)compareByLastModified:(PyGoWaveWaveSummary*)aSummary
+{
+	NSComparisonResult result = [aSummary.lastModified compare:m_lastModified];
+	if (result == NSOrderedSame)
+		result = [m_waveId compare:aSummary.waveId];
+	return result;
+}
+
+- (NSUInteger)retainedBytes
+{
+	return PyGoWaveInstanceBytes(self)
+		+ PyGoWaveEstimatedBytes(m_waveId)
+		+ PyGoWaveEstimatedBytes(m_title)
+		+ PyGoWaveEstimatedBytes(m_lastModified)
+		+ PyGoWaveEstimatedBytes(m_wavelets);
+}
+
 @end
 
 #pragma mark -
@@ -0,0 +1,63 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ Append-only, per-wavelet log of the local operations the server has not
+ acknowledged yet. Each record holds the complete outstanding state, so only
+ the last intact record of a file matters. Records are buffered and written
+ together every commitInterval with one fsync per file (group commit) on a
+ background thread; an empty state truncates the file. A torn record left
+ by a crash is cut off before the next record is appended behind it.
+
+ Record layout (host byte order): uint32 length, uint32 FNV-1a checksum,
+ payload. The payload is an OPERATION_MESSAGE_BUNDLE message.
+*/
+@class PyGoWaveWorkerThread;
+
+@interface PyGoWaveOperationLog : NSObject
+{
+	NSString * m_directory;
+	NSLock * m_lock;				// Guards m_buffered, m_active and m_commitScheduled
+	NSLock * m_fileLock;			// Serializes file access, so commits are written in order
+	NSMutableDictionary * m_buffered;
+	NSMutableSet * m_active;
+	NSMutableSet * m_checked;		// Wavelets whose file ends with an intact record; guarded by m_fileLock
+	NSTimeInterval m_commitInterval;
+	BOOL m_commitScheduled;
+	PyGoWaveWorkerThread * m_writer;
+}
+@property (readonly) NSString * directory;
+// Seconds between commits; edits made within this window can be lost (default 0.2)
+@property NSTimeInterval commitInterval;
+
+- (id)initWithDirectory:(NSString*)aDirectory;
+- (void)dealloc;
+
+- (void)setRecord:(NSData*)aRecord forWaveletWithId:(NSString*)aId;
+- (void)clearWaveletWithId:(NSString*)aId;
+- (NSData*)lastRecordForWaveletWithId:(NSString*)aId;
+
+// Writes the buffered records now, on the calling thread
+- (void)commit;
+
+@end
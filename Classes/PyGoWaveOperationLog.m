@@ -0,0 +1,259 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#import "PyGoWaveOperationLog.h"
+#import "PyGoWaveWorkerThread.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define PGW_LOG_COMPACT_SIZE	65536
+
+static uint32_t checksum(const uint8_t * aBytes, NSUInteger aLength)
+{
+	uint32_t hash = 2166136261U;
+	for (NSUInteger i = 0; i < aLength; i++) {
+		hash ^= aBytes[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+// Returns the offset just past the last intact record and its payload range in aLast;
+// anything after the offset is a torn write
+static NSUInteger intactLength(const uint8_t * aBytes, NSUInteger aLength, NSRange * aLast)
+{
+	NSUInteger pos = 0;
+	*aLast = NSMakeRange(NSNotFound, 0);
+	while (aLength - pos >= 2 * sizeof(uint32_t)) {
+		uint32_t header[2];
+		memcpy(header, aBytes + pos, sizeof(header));
+		if (aLength - pos - sizeof(header) < header[0] || checksum(aBytes + pos + sizeof(header), header[0]) != header[1])
+			break;
+		*aLast = NSMakeRange(pos + sizeof(header), header[0]);
+		pos += sizeof(header) + header[0];
+	}
+	return pos;
+}
+
+// Writes all of aBytes, retrying short writes
+static BOOL writeAll(int fd, const uint8_t * aBytes, NSUInteger aLength)
+{
+	while (aLength > 0) {
+		ssize_t n = write(fd, aBytes, aLength);
+		if (n < 0)
+			return NO;
+		aBytes += n;
+		aLength -= n;
+	}
+	return YES;
+}
+
+@interface PyGoWaveOperationLog ()
+- (NSString*)pathForWaveletWithId:(NSString*)aId;
+- (NSData*)readIntactFileForWaveletWithId:(NSString*)aId last:(NSRange*)aLast;
+- (BOOL)appendRecord:(NSData*)aRecord forWaveletWithId:(NSString*)aId;
+@end
+
+@implementation PyGoWaveOperationLog
+
+@synthesize directory = m_directory, commitInterval = m_commitInterval;
+
+#pragma mark Initialization and Deallocation
+
+- (id)initWithDirectory:(NSString*)aDirectory
+{
+	if (self = [super init]) {
+		m_directory = [aDirectory copy];
+		m_lock = [NSLock new];
+		m_fileLock = [NSLock new];
+		m_buffered = [NSMutableDictionary new];
+		m_active = [NSMutableSet new];
+		m_checked = [NSMutableSet new];
+		m_commitInterval = 0.2;
+		m_commitScheduled = NO;
+		[[NSFileManager defaultManager] createDirectoryAtPath:m_directory withIntermediateDirectories:YES attributes:nil error:NULL];
+		m_writer = [PyGoWaveWorkerThread new];
+		[m_writer setName:@"PyGoWave operation log"];
+		[m_writer start];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_writer stop]; // Scheduled commits retain the log, so none are left
+	[m_writer release];
+	[m_directory release];
+	[m_lock release];
+	[m_fileLock release];
+	[m_buffered release];
+	[m_active release];
+	[m_checked release];
+	[super dealloc];
+}
+
+#pragma mark Public methods
+
+// Replaces the buffered state of a wavelet; nil or empty data clears its log
+- (void)setRecord:(NSData*)aRecord forWaveletWithId:(NSString*)aId
+{
+	if ([aRecord length] > 0)
+		aRecord = [[aRecord copy] autorelease]; // Writers reuse their buffers
+	else
+		aRecord = [NSData data];
+	BOOL schedule = NO;
+	[m_lock lock];
+	if ([aRecord length] > 0 || [m_active containsObject:aId] || [m_buffered objectForKey:aId] != nil) {
+		[m_buffered setObject:aRecord forKey:aId];
+		schedule = !m_commitScheduled;
+		m_commitScheduled = YES;
+	}
+	[m_lock unlock];
+	if (schedule)
+		[self performSelector:@selector(scheduleCommit) onThread:m_writer withObject:nil waitUntilDone:NO];
+}
+
+- (void)clearWaveletWithId:(NSString*)aId
+{
+	[m_lock lock];
+	[m_buffered removeObjectForKey:aId];
+	[m_active removeObject:aId];
+	[m_lock unlock];
+	[m_fileLock lock];
+	[[NSFileManager defaultManager] removeItemAtPath:[self pathForWaveletWithId:aId] error:NULL];
+	[m_fileLock unlock];
+}
+
+// Returns the payload of the last intact record, or nil
+- (NSData*)lastRecordForWaveletWithId:(NSString*)aId
+{
+	[m_lock lock];
+	NSData * pending = [[[m_buffered objectForKey:aId] retain] autorelease];
+	[m_lock unlock];
+	if (pending != nil)
+		return [pending length] > 0 ? pending : nil;
+	
+	NSRange last;
+	[m_fileLock lock];
+	NSData * data = [self readIntactFileForWaveletWithId:aId last:&last];
+	[m_fileLock unlock];
+	if (last.location == NSNotFound || last.length == 0)
+		return nil;
+	[m_lock lock];
+	[m_active addObject:aId];
+	[m_lock unlock];
+	return [data subdataWithRange:last];
+}
+
+- (void)commit
+{
+	// The file lock is taken first, so batches are written in the order they were taken
+	[m_fileLock lock];
+	[m_lock lock];
+	NSDictionary * records = m_buffered;
+	m_buffered = [NSMutableDictionary new];
+	m_commitScheduled = NO;
+	[m_lock unlock];
+	
+	for (NSString * aId in records) {
+		NSData * record = [records objectForKey:aId];
+		BOOL active;
+		if ([record length] == 0) {
+			truncate([[self pathForWaveletWithId:aId] fileSystemRepresentation], 0);
+			active = NO;
+		}
+		else
+			active = [self appendRecord:record forWaveletWithId:aId];
+		[m_lock lock];
+		if (active)
+			[m_active addObject:aId];
+		else if ([record length] == 0)
+			[m_active removeObject:aId];
+		[m_lock unlock];
+	}
+	[m_fileLock unlock];
+	[records release];
+}
+
+#pragma mark Private methods
+
+// Runs on the writer thread
+- (void)scheduleCommit
+{
+	[self performSelector:@selector(commit) withObject:nil afterDelay:m_commitInterval];
+}
+
+- (NSString*)pathForWaveletWithId:(NSString*)aId
+{
+	NSString * name = [[aId componentsSeparatedByCharactersInSet:[NSCharacterSet characterSetWithCharactersInString:@"/:\\"]] componentsJoinedByString:@"_"];
+	return [m_directory stringByAppendingPathComponent:[name stringByAppendingPathExtension:@"pgwl"]];
+}
+
+// Reads the log and cuts off a torn record at its end; call with the file lock held
+- (NSData*)readIntactFileForWaveletWithId:(NSString*)aId last:(NSRange*)aLast
+{
+	NSString * path = [self pathForWaveletWithId:aId];
+	NSData * data = [NSData dataWithContentsOfFile:path];
+	NSUInteger length = intactLength([data bytes], [data length], aLast);
+	if (length < [data length]) {
+		NSLog(@"OperationLog: Cutting off a torn record at the end of '%@'", path);
+		truncate([path fileSystemRepresentation], length);
+	}
+	[m_checked addObject:aId];
+	return data;
+}
+
+// Call with the file lock held
+- (BOOL)appendRecord:(NSData*)aRecord forWaveletWithId:(NSString*)aId
+{
+	uint32_t header[2] = {[aRecord length], checksum([aRecord bytes], [aRecord length])};
+	NSString * aPath = [self pathForWaveletWithId:aId];
+	const char * path = [aPath fileSystemRepresentation];
+	
+	// Appending behind a torn record would hide every later one from recovery
+	if (![m_checked containsObject:aId]) {
+		NSRange last;
+		[self readIntactFileForWaveletWithId:aId last:&last];
+	}
+	
+	// Once the file is large, start over with just this record; the rename is atomic
+	struct stat st;
+	BOOL compact = stat(path, &st) == 0 && st.st_size > PGW_LOG_COMPACT_SIZE;
+	NSString * tempPath = compact ? [aPath stringByAppendingString:@".tmp"] : aPath;
+	int fd = open([tempPath fileSystemRepresentation], compact ? O_WRONLY | O_CREAT | O_TRUNC : O_WRONLY | O_CREAT | O_APPEND, 0600);
+	if (fd < 0) {
+		NSLog(@"OperationLog: Cannot open '%@'", tempPath);
+		return NO;
+	}
+	BOOL ok = writeAll(fd, (const uint8_t*)header, sizeof(header)) && writeAll(fd, [aRecord bytes], [aRecord length]) && fsync(fd) == 0;
+	close(fd);
+	if (ok && compact)
+		ok = rename([tempPath fileSystemRepresentation], path) == 0;
+	if (!ok) {
+		NSLog(@"OperationLog: Cannot write '%@'", aPath);
+		[m_checked removeObject:aId]; // May have left a partial record
+	}
+	return ok;
+}
+
+@end
@@ -21,6 +21,8 @@
 
 #import "PyGoWaveBase.h"
 
+@class PyGoWaveBundleWriter;
+
 
 enum {
 	PyGoWaveOperation_DOCUMENT_NOOP = 0,
@@ -34,7 +36,8 @@ enum {
 	PyGoWaveOperation_WAVELET_REMOVE_PARTICIPANT,
 	PyGoWaveOperation_WAVELET_APPEND_BLIP,
 	PyGoWaveOperation_BLIP_CREATE_CHILD,
-	PyGoWaveOperation_BLIP_DELETE
+	PyGoWaveOperation_BLIP_DELETE,
+	PyGoWaveOperation_TYPE_COUNT
 };
 typedef NSInteger PyGoWaveOperationType;
 
@@ -46,6 +49,7 @@ typedef NSInteger PyGoWaveOperationType;
 	NSString * m_blipId;
 	NSInteger m_index;
 	id m_property;
+	BOOL m_propertyMutable;
 }
 @property (readonly) PyGoWaveOperationType type;
 @property (readonly) NSString * waveId;
@@ -78,9 +82,13 @@ typedef NSInteger PyGoWaveOperationType;
 
 - (void)insertString:(NSString*)aString atIndex:(NSInteger)aIndex;
 - (void)deleteStringAtIndex:(NSInteger)aIndex withLength:(NSInteger)aLength;
+- (void)mergeDelta:(NSDictionary*)aDelta;
 
 - (NSDictionary*)serialize;
 + (id)operationWithSerialized:(NSDictionary*)aSerialized;
+- (id)initWithSerialized:(NSDictionary*)aSerialized;
+// Reinitializes the operation in place, so one object can take every operation of a bundle in turn
+- (void)loadSerialized:(NSDictionary*)aSerialized;
 
 + (NSString*)stringFromType:(PyGoWaveOperationType)aType;
 + (PyGoWaveOperationType)typeFromString:(NSString*)aType;
@@ -95,17 +103,24 @@ typedef NSInteger PyGoWaveOperationType;
 	NSString * m_contributorId;
 	NSMutableArray * m_operations;
 	NSMutableArray * m_lockedBlips;
+	NSMutableDictionary * m_deltaOps;
+	NSThread * m_notificationThread;
 }
 @property (readonly) NSString * waveId;
 @property (readonly) NSString * waveletId;
 @property (readonly) NSString * contributorId;
 @property (readonly, nonatomic) BOOL isEmpty;
 @property (readonly, nonatomic) BOOL canFetch;
+// Set by the owner when operations are transformed on other threads (default nil)
+@property (retain) NSThread * notificationThread;
 
 - (id)initWithWaveId:(NSString*)aWaveId waveletId:(NSString*)aWaveletId contributorId:(NSString*)aContributorId;
 - (void)dealloc;
 
 - (NSArray*)transformInputOperation:(PyGoWaveOperation*)aInputOperation;
+// Same, but appends the results to aResults instead of a new autoreleased array.
+// aInputOperation is copied and may be reused by the caller afterwards
+- (void)transformInputOperation:(PyGoWaveOperation*)aInputOperation appendingTo:(NSMutableArray*)aResults;
 
 - (NSArray*)fetchOperations;
 - (void)putOperations:(NSArray*)sOperations;
@@ -113,6 +128,7 @@ typedef NSInteger PyGoWaveOperationType;
 - (NSArray*)serializeOperations;
 - (NSArray*)serializeAndFetchOperations:(BOOL)bFetch;
 - (void)addSerializedOperations:(NSArray*)sSerializedOperations;
+- (NSData*)writeBundleWithVersion:(NSInteger)aVersion toWriter:(PyGoWaveBundleWriter*)aWriter;
 
 - (void)documentInsert:(NSString*)aText atIndex:(NSInteger)aIndex inBlipWithId:(NSString*)aBlipId;
 - (void)documentDeleteFromStart:(NSInteger)aStart toEnd:(NSInteger)aEnd inBlipWithId:(NSString*)aBlipId;
@@ -131,8 +147,11 @@ typedef NSInteger PyGoWaveOperationType;
 - (void)blipCreateChildWithTempId:(NSString*)aTempId forBlipWithId:(NSString*)aBlipId;
 
 - (NSArray*)operations;
+// Approximate bytes kept alive by the queued operations
+- (NSUInteger)retainedBytes;
 
 - (void)insertOperation:(PyGoWaveOperation*)aOperation atIndex:(NSInteger)aIndex;
+- (void)mergeInsertOperation:(PyGoWaveOperation*)aOperation;
 - (void)removeOperationAtIndex:(NSInteger)aIndex;
 - (void)removeOperationsFromStart:(NSInteger)aStart toEnd:(NSInteger)aEnd;
 
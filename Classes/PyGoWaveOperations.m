@@ -20,6 +20,23 @@
  */
 
 #import "PyGoWaveOperations.h"
+#import "PyGoWaveBundleWriter.h"
+#import "PyGoWaveMemory.h"
+
+static inline BOOL typeIsInsert(PyGoWaveOperationType aType)
+{
+	return aType == PyGoWaveOperation_DOCUMENT_INSERT || aType == PyGoWaveOperation_DOCUMENT_ELEMENT_INSERT;
+}
+
+static inline BOOL typeIsDelete(PyGoWaveOperationType aType)
+{
+	return aType == PyGoWaveOperation_DOCUMENT_DELETE || aType == PyGoWaveOperation_DOCUMENT_ELEMENT_DELETE;
+}
+
+static inline BOOL typeIsChange(PyGoWaveOperationType aType)
+{
+	return aType == PyGoWaveOperation_DOCUMENT_ELEMENT_DELTA || aType == PyGoWaveOperation_DOCUMENT_ELEMENT_SETPREF;
+}
 
 
 @implementation PyGoWaveOperation
@@ -48,6 +65,7 @@
 		m_blipId = [aBlipId copy];
 		m_index = aIndex;
 		m_property = [aProperty copy];
+		m_propertyMutable = NO;
 	}
 	return self;
 }
@@ -65,13 +83,27 @@
 
 - (id)copyWithZone:(NSZone *)zone
 {
+	id property = m_property;
+	if (m_propertyMutable) // Do not share the delta that is still being merged into
+		property = [[[NSDictionary alloc] initWithDictionary:m_property copyItems:YES] autorelease];
 	return [[PyGoWaveOperation allocWithZone:zone]
 			initWithType:m_type
 			waveId:m_waveId
 			waveletId:m_waveletId
 			blipId:m_blipId
 			index:m_index
-			property:m_property];
+			property:property];
+}
+
+#pragma mark Overwritten setters
+
+- (void)setProperty:(id)aProperty
+{
+	if (aProperty == m_property)
+		return;
+	[m_property release];
+	m_property = [aProperty copy];
+	m_propertyMutable = NO;
 }
 
 #pragma mark Public methods
@@ -94,15 +126,15 @@
 
 - (BOOL)isInsert
 {
-	return m_type == PyGoWaveOperation_DOCUMENT_INSERT || m_type == PyGoWaveOperation_DOCUMENT_ELEMENT_INSERT;
+	return typeIsInsert(m_type);
 }
 - (BOOL)isDelete
 {
-	return m_type == PyGoWaveOperation_DOCUMENT_DELETE || m_type == PyGoWaveOperation_DOCUMENT_ELEMENT_DELETE;
+	return typeIsDelete(m_type);
 }
 - (BOOL)isChange
 {
-	return m_type == PyGoWaveOperation_DOCUMENT_ELEMENT_DELTA || m_type == PyGoWaveOperation_DOCUMENT_ELEMENT_SETPREF;
+	return typeIsChange(m_type);
 }
 
 - (NSInteger)length
@@ -140,6 +172,25 @@
 	}
 }
 
+// Adds the fields of another element delta; the property is made mutable once, then merged into in place
+- (void)mergeDelta:(NSDictionary*)aDelta
+{
+	if (m_type != PyGoWaveOperation_DOCUMENT_ELEMENT_DELTA)
+		return;
+	if (!m_propertyMutable) {
+		NSMutableDictionary * dmap = [m_property mutableCopy];
+		NSMutableDictionary * delta = [[m_property valueForKey:@"delta"] mutableCopy];
+		if (delta == nil)
+			delta = [NSMutableDictionary new];
+		[dmap setObject:delta forKey:@"delta"];
+		[delta release];
+		[m_property release];
+		m_property = dmap;
+		m_propertyMutable = YES;
+	}
+	[[m_property objectForKey:@"delta"] addEntriesFromDictionary:aDelta];
+}
+
 - (NSDictionary*)serialize
 {
 	return [NSDictionary dictionaryWithObjectsAndKeys:
@@ -155,15 +206,38 @@
 
 + (id)operationWithSerialized:(NSDictionary*)aSerialized
 {
-	PyGoWaveOperation * op = [[self alloc]
-		initWithType:[self typeFromString:[aSerialized valueForKey:@"type"]]
-			  waveId:[aSerialized valueForKey:@"waveId"]
-		   waveletId:[aSerialized valueForKey:@"waveletId"]
-			  blipId:[aSerialized valueForKey:@"blipId"]
-			   index:[[aSerialized valueForKey:@"index"] intValue]
-			property:[aSerialized valueForKey:@"property"]
+	return [[[self alloc] initWithSerialized:aSerialized] autorelease];
+}
+
+- (id)initWithSerialized:(NSDictionary*)aSerialized
+{
+	return [self
+		initWithType:[PyGoWaveOperation typeFromString:[aSerialized objectForKey:@"type"]]
+			  waveId:[aSerialized objectForKey:@"waveId"]
+		   waveletId:[aSerialized objectForKey:@"waveletId"]
+			  blipId:[aSerialized objectForKey:@"blipId"]
+			   index:[[aSerialized objectForKey:@"index"] intValue]
+			property:[aSerialized objectForKey:@"property"]
 	];
-	return [op autorelease];
+}
+
+- (void)loadSerialized:(NSDictionary*)aSerialized
+{
+	NSString * aWaveId = [[aSerialized objectForKey:@"waveId"] copy];
+	NSString * aWaveletId = [[aSerialized objectForKey:@"waveletId"] copy];
+	NSString * aBlipId = [[aSerialized objectForKey:@"blipId"] copy];
+	id aProperty = [[aSerialized objectForKey:@"property"] copy];
+	[m_waveId release];
+	[m_waveletId release];
+	[m_blipId release];
+	[m_property release];
+	m_type = [PyGoWaveOperation typeFromString:[aSerialized objectForKey:@"type"]];
+	m_waveId = aWaveId;
+	m_waveletId = aWaveletId;
+	m_blipId = aBlipId;
+	m_index = [[aSerialized objectForKey:@"index"] intValue];
+	m_property = aProperty;
+	m_propertyMutable = NO;
 }
 
 + (NSString*)stringFromType:(PyGoWaveOperationType)aType
@@ -228,12 +302,282 @@
 
 #pragma mark -
 
+/*
+ Transform rules. The rule for a pair of operation types is looked up in a
+ table that is filled once, so the transform loop does not test the types
+ of both operations again for every pair it visits.
+ A rule transforms the input operation op (at state->j of the input list)
+ against the local operation myop (at state->i of the queue). It may split
+ or drop either of them and adjusts state->j if the input list shrinks.
+ It returns YES if myop was removed from the queue.
+*/
+
+typedef struct {
+	PyGoWaveOpManager * manager;
+	NSMutableArray * inputs;
+	NSInteger i;
+	NSInteger j;
+} PyGoWaveTransformState;
+
+typedef BOOL (*PyGoWaveTransformRule)(PyGoWaveTransformState * state, PyGoWaveOperation * op, PyGoWaveOperation * myop);
+
+@interface PyGoWaveOpManager ()
+- (void)postOperationChangedWithIndex:(NSInteger)aIndex;
+@end
+
+/*
+ A pending element delta and its position in the queue. The position is kept
+ current on insertion and removal, so merging into the delta needs no scan.
+*/
+@interface PyGoWaveDeltaEntry : NSObject
+{
+	PyGoWaveOperation * m_operation;
+	NSInteger m_index;
+}
+@property (readonly) PyGoWaveOperation * operation;
+@property (assign) NSInteger index;
+
+- (id)initWithOperation:(PyGoWaveOperation*)aOperation index:(NSInteger)aIndex;
+- (void)dealloc;
+
+@end
+
+@implementation PyGoWaveDeltaEntry
+
+@synthesize operation = m_operation, index = m_index;
+
+- (id)initWithOperation:(PyGoWaveOperation*)aOperation index:(NSInteger)aIndex
+{
+	if (self = [super init]) {
+		m_operation = [aOperation retain];
+		m_index = aIndex;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_operation release];
+	[super dealloc];
+}
+
+@end
+
+static BOOL removeLocal(PyGoWaveTransformState * state)
+{
+	[state->manager removeOperationAtIndex:state->i];
+	return YES;
+}
+
+static void localChanged(PyGoWaveTransformState * state)
+{
+	[state->manager postOperationChangedWithIndex:state->i];
+}
+
+static BOOL transformDeleteDelete(PyGoWaveTransformState * state, PyGoWaveOperation * op, PyGoWaveOperation * myop)
+{
+	NSInteger end;
+	if (op.index < myop.index) {
+		end = op.index + op.length;
+		if (end <= myop.index) {
+			myop.index -= op.length;
+			localChanged(state);
+		}
+		else if (end < (myop.index + myop.length)) {
+			[op resizeToLength:myop.index - op.index];
+			[myop resizeToLength:myop.length - (end - myop.index)];
+			myop.index = op.index;
+			localChanged(state);
+		}
+		else {
+			[op resizeToLength:op.length - myop.length];
+			return removeLocal(state);
+		}
+	}
+	else {
+		end = myop.index + myop.length;
+		if (op.index >= end)
+			op.index -= myop.length;
+		else if (op.index + op.length <= end) {
+			[myop resizeToLength:myop.length - op.length];
+			[state->inputs removeObjectAtIndex:state->j];
+			state->j--;
+			if (myop.isNull)
+				return removeLocal(state);
+			localChanged(state);
+		}
+		else {
+			[myop resizeToLength:myop.length - (end - op.index)];
+			localChanged(state);
+			[op resizeToLength:op.length - (end - op.index)];
+			op.index = myop.index;
+		}
+	}
+	return NO;
+}
+
+static BOOL transformDeleteInsert(PyGoWaveTransformState * state, PyGoWaveOperation * op, PyGoWaveOperation * myop)
+{
+	if (op.index < myop.index) {
+		if (op.index + op.length <= myop.index) {
+			myop.index -= op.length;
+			localChanged(state);
+		}
+		else {
+			PyGoWaveOperation * new_op = [op copy];
+			[op resizeToLength:myop.index - op.index];
+			[new_op resizeToLength:new_op.length - op.length];
+			[state->inputs insertObject:new_op atIndex:state->j + 1];
+			[new_op release];
+			myop.index -= op.length;
+			localChanged(state);
+		}
+	}
+	else
+		op.index += myop.length;
+	return NO;
+}
+
+static BOOL transformInsertDelete(PyGoWaveTransformState * state, PyGoWaveOperation * op, PyGoWaveOperation * myop)
+{
+	if (op.index <= myop.index) {
+		myop.index += op.length;
+		localChanged(state);
+	}
+	else if (op.index >= (myop.index + myop.length))
+		op.index -= myop.length;
+	else {
+		PyGoWaveOperation * new_op = [myop copy];
+		[myop resizeToLength:op.index - myop.index];
+		localChanged(state);
+		[new_op resizeToLength:new_op.length - myop.length];
+		[state->manager insertOperation:new_op atIndex:state->i + 1];
+		[new_op release];
+		op.index = myop.index;
+	}
+	return NO;
+}
+
+static BOOL transformInsertInsert(PyGoWaveTransformState * state, PyGoWaveOperation * op, PyGoWaveOperation * myop)
+{
+	if (op.index <= myop.index) {
+		myop.index += op.length;
+		localChanged(state);
+	}
+	else
+		op.index += myop.length;
+	return NO;
+}
+
+static BOOL transformChangeDelete(PyGoWaveTransformState * state, PyGoWaveOperation * op, PyGoWaveOperation * myop)
+{
+	if (op.index > myop.index) {
+		if (op.index <= (myop.index + myop.length))
+			op.index = myop.index;
+		else
+			op.index -= myop.length;
+	}
+	return NO;
+}
+
+static BOOL transformChangeInsert(PyGoWaveTransformState * state, PyGoWaveOperation * op, PyGoWaveOperation * myop)
+{
+	if (op.index >= myop.index)
+		op.index += myop.length;
+	return NO;
+}
+
+static BOOL transformDeleteChange(PyGoWaveTransformState * state, PyGoWaveOperation * op, PyGoWaveOperation * myop)
+{
+	if (op.index < myop.index) {
+		if (myop.index <= (op.index + op.length))
+			myop.index = op.index;
+		else
+			myop.index -= op.length;
+		localChanged(state);
+	}
+	return NO;
+}
+
+static BOOL transformInsertChange(PyGoWaveTransformState * state, PyGoWaveOperation * op, PyGoWaveOperation * myop)
+{
+	if (op.index <= myop.index) {
+		myop.index += op.length;
+		localChanged(state);
+	}
+	return NO;
+}
+
+// Adding or removing a participant twice: the local operation is redundant
+static BOOL transformParticipant(PyGoWaveTransformState * state, PyGoWaveOperation * op, PyGoWaveOperation * myop)
+{
+	if ([op.property isEqual:myop.property])
+		return removeLocal(state);
+	return NO;
+}
+
+static BOOL transformBlipDelete(PyGoWaveTransformState * state, PyGoWaveOperation * op, PyGoWaveOperation * myop)
+{
+	if ([op.blipId length] != 0 && [myop.blipId length] != 0)
+		return removeLocal(state);
+	return NO;
+}
+
+// Indexed by the type of the local operation, then by the type of the input operation
+static PyGoWaveTransformRule s_transformRules[PyGoWaveOperation_TYPE_COUNT][PyGoWaveOperation_TYPE_COUNT];
+
+static PyGoWaveTransformRule resolveTransformRule(PyGoWaveOperationType aType, PyGoWaveOperationType aMyType)
+{
+	if (typeIsDelete(aType) && typeIsDelete(aMyType))
+		return transformDeleteDelete;
+	else if (typeIsDelete(aType) && typeIsInsert(aMyType))
+		return transformDeleteInsert;
+	else if (typeIsInsert(aType) && typeIsDelete(aMyType))
+		return transformInsertDelete;
+	else if (typeIsInsert(aType) && typeIsInsert(aMyType))
+		return transformInsertInsert;
+	else if (typeIsChange(aType) && typeIsDelete(aMyType))
+		return transformChangeDelete;
+	else if (typeIsChange(aType) && typeIsInsert(aMyType))
+		return transformChangeInsert;
+	else if (typeIsDelete(aType) && typeIsChange(aMyType))
+		return transformDeleteChange;
+	else if (typeIsInsert(aType) && typeIsChange(aMyType))
+		return transformInsertChange;
+	else if ((aType == PyGoWaveOperation_WAVELET_ADD_PARTICIPANT && aMyType == PyGoWaveOperation_WAVELET_ADD_PARTICIPANT)
+			 || (aType == PyGoWaveOperation_WAVELET_REMOVE_PARTICIPANT && aMyType == PyGoWaveOperation_WAVELET_REMOVE_PARTICIPANT))
+		return transformParticipant;
+	else if (aType == PyGoWaveOperation_BLIP_DELETE)
+		return transformBlipDelete;
+	return NULL;
+}
+
+static inline PyGoWaveTransformRule transformRule(PyGoWaveOperationType aType, PyGoWaveOperationType aMyType)
+{
+	if (aType < 0 || aType >= PyGoWaveOperation_TYPE_COUNT || aMyType < 0 || aMyType >= PyGoWaveOperation_TYPE_COUNT)
+		return NULL;
+	return s_transformRules[aMyType][aType];
+}
+
+#pragma mark -
+
 @implementation PyGoWaveOpManager
 
 @synthesize waveId = m_waveId, waveletId = m_waveletId, contributorId = m_contributorId;
+@synthesize notificationThread = m_notificationThread;
 
 #pragma mark Initialization and Deallocation
 
++ (void)initialize
+{
+	if (self != [PyGoWaveOpManager class])
+		return;
+	for (PyGoWaveOperationType mytype = 0; mytype < PyGoWaveOperation_TYPE_COUNT; mytype++) {
+		for (PyGoWaveOperationType type = 0; type < PyGoWaveOperation_TYPE_COUNT; type++)
+			s_transformRules[mytype][type] = resolveTransformRule(type, mytype);
+	}
+}
+
 - (id)initWithWaveId:(NSString*)aWaveId waveletId:(NSString*)aWaveletId contributorId:(NSString*)aContributorId
 {
 	if (self = [super init]) {
@@ -242,6 +586,7 @@
 		m_contributorId = [aContributorId copy];
 		m_operations = [NSMutableArray new];
 		m_lockedBlips = [NSMutableArray new];
+		m_deltaOps = [NSMutableDictionary new];
 	}
 	return self;
 }
@@ -253,6 +598,8 @@
 	[m_contributorId release];
 	[m_operations release];
 	[m_lockedBlips release];
+	[m_deltaOps release];
+	[m_notificationThread release];
 	[super dealloc];
 }
 
@@ -275,164 +622,49 @@
 // Internal
 - (void)postOperationChangedWithIndex:(NSInteger)aIndex
 {
-	[self postNotificationName:@"operationChanged" userInfo:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:aIndex], @"index", nil]];
+	PyGoWaveEventInfo info = {aIndex, 0, 0, 0, nil};
+	[self postEvent:PyGoWaveEvent_OperationChanged info:&info];
+}
+
+- (void)postOperationsEvent:(PyGoWaveEventType)aEvent start:(NSInteger)aStart end:(NSInteger)aEnd
+{
+	PyGoWaveEventInfo info = {0, 0, aStart, aEnd, nil};
+	[self postEvent:aEvent info:&info];
 }
 
 - (NSArray*)transformInputOperation:(PyGoWaveOperation*)aInputOperation
 {
-	PyGoWaveOperation * new_op = nil;
 	NSMutableArray * op_lst = [NSMutableArray new];
-	[op_lst addObject:[[aInputOperation copy] autorelease]];
-	int i = 0;
-	while (i < [m_operations count]) {
-		PyGoWaveOperation * myop = [m_operations objectAtIndex:i];
-		int j = 0;
-		while (j < [op_lst count]) {
-			PyGoWaveOperation * op = [op_lst objectAtIndex:j];
-			if (![op isCompatibleToOperation:myop])
+	[self transformInputOperation:aInputOperation appendingTo:op_lst];
+	return [op_lst autorelease];
+}
+
+- (void)transformInputOperation:(PyGoWaveOperation*)aInputOperation appendingTo:(NSMutableArray*)op_lst
+{
+	PyGoWaveOperation * new_op = [aInputOperation copy];
+	int first = [op_lst count];
+	[op_lst addObject:new_op];
+	[new_op release];
+	PyGoWaveTransformState state = {self, op_lst, 0, 0};
+	while (state.i < [m_operations count]) {
+		PyGoWaveOperation * myop = [m_operations objectAtIndex:state.i];
+		PyGoWaveOperationType mytype = myop.type;
+		state.j = first;
+		while (state.j < [op_lst count]) {
+			PyGoWaveOperation * op = [op_lst objectAtIndex:state.j];
+			if (![op isCompatibleToOperation:myop]) {
+				state.j++;
 				continue;
-			int end = 0;
-			if (op.isDelete && myop.isDelete) {
-				if (op.index < myop.index) {
-					end = op.index + op.length;
-					if (end <= myop.index) {
-						myop.index -= op.length;
-						[self postOperationChangedWithIndex:i];
-					}
-					else if (end < (myop.index + myop.length)) {
-						[op resizeToLength:myop.index - op.index];
-						[myop resizeToLength:myop.length - (end - myop.index)];
-						myop.index = op.index;
-						[self postOperationChangedWithIndex:i];
-					}
-					else {
-						[op resizeToLength:op.length - myop.length];
-						myop = nil;
-						[self removeOperationAtIndex:i];
-						i--;
-						break;
-					}
-				}
-				else {
-					end = myop.index + myop.length;
-					if (op.index >= end)
-						op.index -= myop.length;
-					else if (op.index + op.length <= end) {
-						[myop resizeToLength:myop.length - op.length];
-						[op_lst removeObjectAtIndex:j];
-						op = nil;
-						j--;
-						if (myop.isNull) {
-							myop = nil;
-							[self removeOperationAtIndex:i];
-							i--;
-							break;
-						}
-						else
-							[self postOperationChangedWithIndex:i];
-					}
-					else {
-						[myop resizeToLength:myop.length - (end - op.index)];
-						[self postOperationChangedWithIndex:i];
-						[op resizeToLength:op.length - (end - op.index)];
-						op.index = myop.index;
-					}
-				}
-			}
-			else if (op.isDelete && myop.isInsert) {
-				if (op.index < myop.index) {
-					if (op.index + op.length <= myop.index) {
-						myop.index -= op.length;
-						[self postOperationChangedWithIndex:i];
-					}
-					else {
-						new_op = [op copy];
-						[op resizeToLength:myop.index - op.index];
-						[new_op resizeToLength:new_op.length - op.length];
-						[op_lst insertObject:new_op atIndex:j + 1];
-						[new_op release];
-						myop.index -= op.length;
-						[self postOperationChangedWithIndex:i];
-					}
-				}
-				else
-					op.index += myop.length;
-			}
-			else if (op.isInsert && myop.isDelete) {
-				if (op.index <= myop.index) {
-					myop.index += op.length;
-					[self postOperationChangedWithIndex:i];
-				}
-				else if (op.index >= (myop.index + myop.length))
-					op.index -= myop.length;
-				else {
-					new_op = [myop copy];
-					[myop resizeToLength:op.index - myop.index];
-					[self postOperationChangedWithIndex:i];
-					[new_op resizeToLength:new_op.length - myop.length];
-					[self insertOperation:new_op atIndex:i + 1];
-					[new_op release];
-					op.index = myop.index;
-				}
-			}
-			else if (op.isInsert && myop.isInsert) {
-				if (op.index <= myop.index) {
-					myop.index += op.length;
-					[self postOperationChangedWithIndex:i];
-				}
-				else
-					op.index += myop.length;
-			}
-			else if (op.isChange && myop.isDelete) {
-				if (op.index > myop.index) {
-					if (op.index <= (myop.index + myop.length))
-						op.index = myop.index;
-					else
-						op.index -= myop.length;
-				}
-			}
-			else if (op.isChange && myop.isInsert) {
-				if (op.index >= myop.index)
-					op.index += myop.length;
-			}
-			else if (op.isDelete && myop.isChange) {
-				if (op.index < myop.index) {
-					if (myop.index <= (op.index + op.length)) {
-						myop.index = op.index;
-						[self postOperationChangedWithIndex:i];
-					}
-					else {
-						myop.index -= op.length;
-						[self postOperationChangedWithIndex:i];
-					}
-				}
-			}
-			else if (op.isInsert && myop.isChange) {
-				if (op.index <= myop.index) {
-					myop.index += op.length;
-					[self postOperationChangedWithIndex:i];
-				}
-			}
-			else if ((op.type == PyGoWaveOperation_WAVELET_ADD_PARTICIPANT && myop.type == PyGoWaveOperation_WAVELET_ADD_PARTICIPANT)
-					|| (op.type == PyGoWaveOperation_WAVELET_REMOVE_PARTICIPANT && myop.type == PyGoWaveOperation_WAVELET_REMOVE_PARTICIPANT)) {
-				if ([op.property isEqual:myop.property]) {
-					myop = nil;
-					[self removeOperationAtIndex:i];
-					i--;
-					break;
-				}
 			}
-			else if (op.type == PyGoWaveOperation_BLIP_DELETE && [op.blipId length] != 0 && [myop.blipId length] != 0) {
-				myop = nil;
-				[self removeOperationAtIndex:i];
-				i--;
+			PyGoWaveTransformRule rule = transformRule(op.type, mytype);
+			if (rule != NULL && rule(&state, op, myop)) {
+				state.i--;
 				break;
 			}
-			j++;
+			state.j++;
 		}
-		i++;
+		state.i++;
 	}
-	return [op_lst autorelease];
 }
 
 - (NSArray*)fetchOperations
@@ -466,14 +698,9 @@
 		return;
 	int start = [m_operations count];
 	int end = start + [sOperations count] - 1;
-	NSDictionary * info = [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:start], @"start", [NSNumber numberWithInt:end], @"end", nil];
-	[self postNotificationName:@"beforeOperationsInserted"
-					  userInfo:info
-					coalescing:NO];
+	[self postOperationsEvent:PyGoWaveEvent_BeforeOperationsInserted start:start end:end];
 	[m_operations addObjectsFromArray:sOperations];
-	[self postNotificationName:@"afterOperationsInserted"
-					  userInfo:info
-					coalescing:NO];
+	[self postOperationsEvent:PyGoWaveEvent_AfterOperationsInserted start:start end:end];
 }
 
 - (NSArray*)serializeOperations
@@ -500,34 +727,37 @@
 
 - (void)addSerializedOperations:(NSArray*)sSerializedOperations
 {
-	NSMutableArray * ops = [NSMutableArray new];
-	for (NSDictionary * op in sSerializedOperations)
-		[ops addObject:[PyGoWaveOperation operationWithSerialized:op]];
+	NSMutableArray * ops = [[NSMutableArray alloc] initWithCapacity:[sSerializedOperations count]];
+	for (NSDictionary * op in sSerializedOperations) {
+		PyGoWaveOperation * opObj = [[PyGoWaveOperation alloc] initWithSerialized:op];
+		[ops addObject:opObj];
+		[opObj release];
+	}
 	[self putOperations:ops];
 	[ops release];
 }
 
+- (NSData*)writeBundleWithVersion:(NSInteger)aVersion toWriter:(PyGoWaveBundleWriter*)aWriter
+{
+	return [aWriter bundleWithVersion:aVersion operations:m_operations];
+}
+
 - (void)mergeInsertOperation:(PyGoWaveOperation*)newop
 {
 	PyGoWaveOperation * op = nil;
 	int i = 0;
+	id elementId = nil;
 	if (newop.type == PyGoWaveOperation_DOCUMENT_ELEMENT_DELTA) {
-		for (i = 0; i < [m_operations count]; i++) {
-			op = [m_operations objectAtIndex:i];
-			NSDictionary * ndmap = newop.property;
-			if (op.type == PyGoWaveOperation_DOCUMENT_ELEMENT_DELTA && [[ndmap valueForKey:@"id"] isEqual:[op.property valueForKey:@"id"]]) {
-				NSMutableDictionary * dmap = [op.property mutableCopy];
-				NSMutableDictionary * delta = [[dmap valueForKey:@"delta"] mutableCopy];
-				NSDictionary * newdelta = [ndmap valueForKey:@"delta"];
-				for (NSString * key in newdelta)
-					[delta setValue:[newdelta valueForKey:key] forKey:key];
-				[dmap setValue:[NSDictionary dictionaryWithDictionary:delta] forKey:@"delta"];
-				op.property = [NSDictionary dictionaryWithDictionary:dmap];
-				[self postOperationChangedWithIndex:i];
-				[delta release];
-				[dmap release];
+		// Pending deltas are indexed by element id; entries leave the index with their operation
+		elementId = [newop.property valueForKey:@"id"];
+		PyGoWaveDeltaEntry * entry = elementId != nil ? [m_deltaOps objectForKey:elementId] : nil;
+		if (entry != nil) {
+			if (entry.operation.type == PyGoWaveOperation_DOCUMENT_ELEMENT_DELTA) {
+				[entry.operation mergeDelta:[newop.property valueForKey:@"delta"]];
+				[self postOperationChangedWithIndex:entry.index];
 				return;
 			}
+			[m_deltaOps removeObjectForKey:elementId];
 		}
 	}
 	i = [m_operations count] - 1;
@@ -594,6 +824,11 @@
 		}
 	}
 	[self insertOperation:newop atIndex:i+1];
+	if (elementId != nil) {
+		PyGoWaveDeltaEntry * entry = [[PyGoWaveDeltaEntry alloc] initWithOperation:newop index:i+1];
+		[m_deltaOps setObject:entry forKey:elementId];
+		[entry release];
+	}
 	return;
 }
 
@@ -758,46 +993,69 @@
 	return [NSArray arrayWithArray:m_operations];
 }
 
+- (NSUInteger)retainedBytes
+{
+	// Ids are shared with the wavelet; only the operations' own data counts
+	NSUInteger bytes = PyGoWaveInstanceBytes(self)
+		+ PyGoWaveCollectionBytes(m_operations)
+		+ PyGoWaveCollectionBytes(m_lockedBlips)
+		+ PyGoWaveCollectionBytes(m_deltaOps);
+	for (PyGoWaveOperation * op in m_operations)
+		bytes += PyGoWaveInstanceBytes(op) + PyGoWaveEstimatedBytes(op.property);
+	return bytes;
+}
+
 - (void)insertOperation:(PyGoWaveOperation*)aOperation atIndex:(NSInteger)aIndex
 {
 	if (aIndex > [m_operations count] || aIndex < 0)
 		return;
-	NSDictionary * info = [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:aIndex], @"start", [NSNumber numberWithInt:aIndex], @"end", nil];
-	[self postNotificationName:@"beforeOperationsInserted"
-					  userInfo:info
-					coalescing:NO];
+	[self postOperationsEvent:PyGoWaveEvent_BeforeOperationsInserted start:aIndex end:aIndex];
 	[m_operations insertObject:aOperation atIndex:aIndex];
-	[self postNotificationName:@"afterOperationsInserted"
-					  userInfo:info
-					coalescing:NO];
+	// Appending moves nothing
+	if (aIndex < (NSInteger) [m_operations count] - 1) {
+		for (PyGoWaveDeltaEntry * entry in [m_deltaOps objectEnumerator]) {
+			if (entry.index >= aIndex)
+				entry.index++;
+		}
+	}
+	[self postOperationsEvent:PyGoWaveEvent_AfterOperationsInserted start:aIndex end:aIndex];
+}
+
+- (void)updateDeltaEntriesForRemovalFromStart:(NSInteger)aStart toEnd:(NSInteger)aEnd
+{
+	NSMutableArray * removed = nil;
+	for (NSString * aId in m_deltaOps) {
+		PyGoWaveDeltaEntry * entry = [m_deltaOps objectForKey:aId];
+		if (entry.index > aEnd)
+			entry.index -= aEnd - aStart + 1;
+		else if (entry.index >= aStart) {
+			if (removed == nil)
+				removed = [NSMutableArray array];
+			[removed addObject:aId];
+		}
+	}
+	if (removed != nil)
+		[m_deltaOps removeObjectsForKeys:removed];
 }
 
 - (void)removeOperationAtIndex:(NSInteger)aIndex
 {
 	if (aIndex < 0 || aIndex >= [m_operations count])
 		return;
-	NSDictionary * info = [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:aIndex], @"start", [NSNumber numberWithInt:aIndex], @"end", nil];
-	[self postNotificationName:@"beforeOperationsRemoved"
-					  userInfo:info
-					coalescing:NO];
+	[self postOperationsEvent:PyGoWaveEvent_BeforeOperationsRemoved start:aIndex end:aIndex];
 	[m_operations removeObjectAtIndex:aIndex];
-	[self postNotificationName:@"afterOperationsRemoved"
-					  userInfo:info
-					coalescing:NO];
+	[self updateDeltaEntriesForRemovalFromStart:aIndex toEnd:aIndex];
+	[self postOperationsEvent:PyGoWaveEvent_AfterOperationsRemoved start:aIndex end:aIndex];
 }
 
 - (void)removeOperationsFromStart:(NSInteger)aStart toEnd:(NSInteger)aEnd
 {
 	if (aStart < 0 || aEnd < 0 || aStart > aEnd || aStart >= [m_operations count] || aEnd >= [m_operations count])
 		return;
-	NSDictionary * info = [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:aStart], @"start", [NSNumber numberWithInt:aEnd], @"end", nil];
-	[self postNotificationName:@"beforeOperationsRemoved"
-					  userInfo:info
-					coalescing:NO];
+	[self postOperationsEvent:PyGoWaveEvent_BeforeOperationsRemoved start:aStart end:aEnd];
 	[m_operations removeObjectsInRange:NSMakeRange(aStart, aEnd-aStart+1)];
-	[self postNotificationName:@"afterOperationsRemoved"
-					  userInfo:info
-					coalescing:NO];
+	[self updateDeltaEntriesForRemovalFromStart:aStart toEnd:aEnd];
+	[self postOperationsEvent:PyGoWaveEvent_AfterOperationsRemoved start:aStart end:aEnd];
 }
 
 - (void)updateBlipId:(NSString*)aTempId toBlipId:(NSString*)aBlipId
@@ -806,7 +1064,7 @@
 		PyGoWaveOperation * op = [m_operations objectAtIndex:i];
 		if ([op.blipId isEqual:aTempId]) {
 			op.blipId = aBlipId;
-			[self postNotificationName:@"operationChanged" userInfo:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:i], @"index", nil]];
+			[self postOperationChangedWithIndex:i];
 		}
 	}
 }
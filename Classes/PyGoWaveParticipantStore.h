@@ -0,0 +1,73 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+@class PyGoWaveParticipant;
+@class PyGoWaveParticipantStoreEntry;
+
+
+/*
+ Holds participant objects by id, most recently used first. Beyond capacity
+ the least recently used participants are dropped. One that is still in use
+ elsewhere (e.g. by a wavelet) is remembered without a reference until it is
+ deallocated and handed out again if asked for, so there is never more than
+ one object for an id. With a path set, fetched participants are written to a
+ property list and served from there on the next start.
+*/
+@interface PyGoWaveParticipantStore : NSObject
+{
+	NSMutableDictionary * m_entries;
+	NSMutableDictionary * m_evicted; // Dropped entries whose participant may still be alive
+	PyGoWaveParticipantStoreEntry * m_head;
+	PyGoWaveParticipantStoreEntry * m_tail;
+	NSUInteger m_capacity;
+	NSTimeInterval m_maxAge;
+	NSString * m_path;
+	BOOL m_dirty;
+}
+// Maximum number of participants kept; 0 means no limit (default 500)
+@property (nonatomic) NSUInteger capacity;
+// Seconds after which fetched data should be requested again (default 3600)
+@property NSTimeInterval maxAge;
+// Cache file; nil keeps participants in memory only. Setting a new path
+// saves to the old one and loads the new one (default nil)
+@property (nonatomic, copy) NSString * path;
+@property (readonly) NSUInteger count;
+
+- (id)initWithCapacity:(NSUInteger)aCapacity;
+- (void)dealloc;
+
+- (PyGoWaveParticipant*)participantById:(NSString*)aId;
+- (void)addParticipant:(PyGoWaveParticipant*)aParticipant;
+- (void)removeAllParticipants;
+// Approximate bytes kept alive by the cache and the participants in it
+- (NSUInteger)retainedBytes;
+
+- (BOOL)shouldRequestParticipantWithId:(NSString*)aId;
+- (void)participantWasFetched:(NSString*)aId;
+
+- (BOOL)load;
+- (BOOL)save;
+
+// Called by an evicted participant, see -[PyGoWaveParticipant store]
+- (void)participantWillDeallocate:(PyGoWaveParticipant*)aParticipant;
+
+@end
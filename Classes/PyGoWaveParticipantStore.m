@@ -0,0 +1,328 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#import "PyGoWaveParticipantStore.h"
+#import "PyGoWaveModel.h"
+#import "PyGoWaveMemory.h"
+
+#define PGW_STORE_SAVE_DELAY 5.0
+
+@interface PyGoWaveParticipantStoreEntry : NSObject
+{
+@public
+	PyGoWaveParticipant * participant;
+	NSTimeInterval fetched; // 0 if never fetched
+	BOOL requested;
+	BOOL evicted; // The participant is not retained
+	PyGoWaveParticipantStoreEntry * prev;
+	PyGoWaveParticipantStoreEntry * next;
+}
+@end
+
+@implementation PyGoWaveParticipantStoreEntry
+
+- (void)dealloc
+{
+	if (!evicted)
+		[participant release];
+	[super dealloc];
+}
+
+@end
+
+#pragma mark -
+
+@interface PyGoWaveParticipantStore ()
+- (PyGoWaveParticipantStoreEntry*)entryForId:(NSString*)aId;
+- (void)forgetEvicted;
+- (void)unlinkEntry:(PyGoWaveParticipantStoreEntry*)aEntry;
+- (void)pushEntry:(PyGoWaveParticipantStoreEntry*)aEntry;
+- (void)trim;
+- (void)scheduleSave;
+@end
+
+@implementation PyGoWaveParticipantStore
+
+@synthesize capacity = m_capacity, maxAge = m_maxAge, path = m_path;
+
+#pragma mark Initialization and Deallocation
+
+- (id)initWithCapacity:(NSUInteger)aCapacity
+{
+	if (self = [super init]) {
+		m_entries = [NSMutableDictionary new];
+		m_evicted = [NSMutableDictionary new];
+		m_head = nil;
+		m_tail = nil;
+		m_capacity = aCapacity;
+		m_maxAge = 3600.0;
+		m_path = nil;
+		m_dirty = NO;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(save) object:nil];
+	[self forgetEvicted];
+	[m_evicted release];
+	[m_entries release];
+	[m_path release];
+	[super dealloc];
+}
+
+#pragma mark Properties
+
+- (void)setCapacity:(NSUInteger)aCapacity
+{
+	m_capacity = aCapacity;
+	[self trim];
+}
+
+- (void)setPath:(NSString*)aPath
+{
+	if (aPath == m_path || [aPath isEqual:m_path])
+		return;
+	[self save];
+	[m_path release];
+	m_path = [aPath copy];
+	[self removeAllParticipants];
+	[self load];
+}
+
+- (NSUInteger)count
+{
+	return [m_entries count];
+}
+
+#pragma mark Public methods
+
+- (PyGoWaveParticipant*)participantById:(NSString*)aId
+{
+	PyGoWaveParticipantStoreEntry * entry = [m_entries objectForKey:aId];
+	if (entry == nil) {
+		entry = [m_evicted objectForKey:aId];
+		if (entry == nil)
+			return nil;
+		// Still in use elsewhere, so take it back
+		[m_entries setObject:entry forKey:aId];
+		[m_evicted removeObjectForKey:aId];
+		entry->participant.store = nil;
+		[entry->participant retain];
+		entry->evicted = NO;
+		[self pushEntry:entry];
+		[self trim];
+	}
+	else if (entry != m_head) {
+		[self unlinkEntry:entry];
+		[self pushEntry:entry];
+	}
+	return entry->participant;
+}
+
+- (void)addParticipant:(PyGoWaveParticipant*)aParticipant
+{
+	NSAssert([self entryForId:aParticipant.participantId] == nil, @"Participant was already present");
+	PyGoWaveParticipantStoreEntry * entry = [PyGoWaveParticipantStoreEntry new];
+	entry->participant = [aParticipant retain];
+	[m_entries setObject:entry forKey:aParticipant.participantId];
+	[self pushEntry:entry];
+	[entry release];
+	[self trim];
+}
+
+- (void)removeAllParticipants
+{
+	m_head = nil;
+	m_tail = nil;
+	[m_entries removeAllObjects];
+	[self forgetEvicted];
+}
+
+- (NSUInteger)retainedBytes
+{
+	NSUInteger bytes = PyGoWaveInstanceBytes(self) + PyGoWaveCollectionBytes(m_entries);
+	for (PyGoWaveParticipantStoreEntry * entry = m_head; entry != nil; entry = entry->next)
+		bytes += PyGoWaveInstanceBytes(entry) + [entry->participant retainedBytes];
+	return bytes;
+}
+
+// Returns YES once for a participant that was never fetched or whose data is older than maxAge
+- (BOOL)shouldRequestParticipantWithId:(NSString*)aId
+{
+	PyGoWaveParticipantStoreEntry * entry = [self entryForId:aId];
+	if (entry == nil || entry->requested)
+		return NO;
+	if (entry->fetched > 0.0 && [NSDate timeIntervalSinceReferenceDate] - entry->fetched < m_maxAge)
+		return NO;
+	entry->requested = YES;
+	return YES;
+}
+
+- (void)participantWasFetched:(NSString*)aId
+{
+	PyGoWaveParticipantStoreEntry * entry = [self entryForId:aId];
+	if (entry == nil)
+		return;
+	entry->fetched = [NSDate timeIntervalSinceReferenceDate];
+	entry->requested = NO;
+	[self scheduleSave];
+}
+
+- (BOOL)load
+{
+	if (m_path == nil)
+		return NO;
+	NSData * data = [NSData dataWithContentsOfFile:m_path];
+	if (data == nil)
+		return NO;
+	NSString * error = nil;
+	id records = [NSPropertyListSerialization propertyListFromData:data mutabilityOption:NSPropertyListImmutable format:NULL errorDescription:&error];
+	if (![records isKindOfClass:[NSArray class]]) {
+		NSLog(@"ParticipantStore: Cannot read '%@': %@", m_path, error);
+		[error release];
+		return NO;
+	}
+	// Stored most recently used first
+	for (NSDictionary * record in [records reverseObjectEnumerator]) {
+		NSString * aId = [record valueForKey:@"id"];
+		if (aId == nil || [self entryForId:aId] != nil)
+			continue;
+		PyGoWaveParticipant * p = [[PyGoWaveParticipant alloc] initWithParticipantId:aId];
+		[p updateDataWithDict:record byServer:nil];
+		[self addParticipant:p];
+		[p release];
+		PyGoWaveParticipantStoreEntry * entry = [m_entries objectForKey:aId];
+		if (entry != nil)
+			entry->fetched = [[record valueForKey:@"fetched"] doubleValue];
+	}
+	return YES;
+}
+
+- (BOOL)save
+{
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(save) object:nil];
+	if (m_path == nil || !m_dirty)
+		return NO;
+	NSMutableArray * records = [[NSMutableArray alloc] initWithCapacity:[m_entries count]];
+	for (PyGoWaveParticipantStoreEntry * entry = m_head; entry != nil; entry = entry->next) {
+		if (entry->fetched <= 0.0)
+			continue;
+		PyGoWaveParticipant * p = entry->participant;
+		// setValue:forKey: skips nil values, which would end an object/key list early
+		NSMutableDictionary * record = [[NSMutableDictionary alloc] initWithCapacity:6];
+		[record setValue:p.participantId forKey:@"id"];
+		[record setValue:p.displayName forKey:@"displayName"];
+		[record setValue:p.thumbnailUrl forKey:@"thumbnailUrl"];
+		[record setValue:p.profileUrl forKey:@"profileUrl"];
+		[record setValue:[NSNumber numberWithBool:p.bot] forKey:@"isBot"];
+		[record setValue:[NSNumber numberWithDouble:entry->fetched] forKey:@"fetched"];
+		[records addObject:record];
+		[record release];
+	}
+	NSString * error = nil;
+	NSData * data = [NSPropertyListSerialization dataFromPropertyList:records format:NSPropertyListBinaryFormat_v1_0 errorDescription:&error];
+	[records release];
+	if (data == nil || ![data writeToFile:m_path atomically:YES]) {
+		NSLog(@"ParticipantStore: Cannot write '%@': %@", m_path, error);
+		[error release];
+		return NO;
+	}
+	m_dirty = NO;
+	return YES;
+}
+
+- (void)participantWillDeallocate:(PyGoWaveParticipant*)aParticipant
+{
+	[m_evicted removeObjectForKey:aParticipant.participantId];
+}
+
+#pragma mark Private methods
+
+- (PyGoWaveParticipantStoreEntry*)entryForId:(NSString*)aId
+{
+	PyGoWaveParticipantStoreEntry * entry = [m_entries objectForKey:aId];
+	return entry != nil ? entry : [m_evicted objectForKey:aId];
+}
+
+- (void)forgetEvicted
+{
+	for (NSString * aId in m_evicted)
+		((PyGoWaveParticipantStoreEntry*) [m_evicted objectForKey:aId])->participant.store = nil;
+	[m_evicted removeAllObjects];
+}
+
+- (void)unlinkEntry:(PyGoWaveParticipantStoreEntry*)aEntry
+{
+	if (aEntry->prev != nil)
+		aEntry->prev->next = aEntry->next;
+	else
+		m_head = aEntry->next;
+	if (aEntry->next != nil)
+		aEntry->next->prev = aEntry->prev;
+	else
+		m_tail = aEntry->prev;
+	aEntry->prev = nil;
+	aEntry->next = nil;
+}
+
+- (void)pushEntry:(PyGoWaveParticipantStoreEntry*)aEntry
+{
+	aEntry->prev = nil;
+	aEntry->next = m_head;
+	if (m_head != nil)
+		m_head->prev = aEntry;
+	else
+		m_tail = aEntry;
+	m_head = aEntry;
+}
+
+- (void)trim
+{
+	if (m_capacity == 0)
+		return;
+	while ([m_entries count] > m_capacity && m_tail != nil) {
+		PyGoWaveParticipantStoreEntry * entry = m_tail;
+		PyGoWaveParticipant * p = entry->participant;
+		NSString * aId = p.participantId;
+		[self unlinkEntry:entry];
+		// Remembered until the participant goes away, which may be right now
+		[m_evicted setObject:entry forKey:aId];
+		[m_entries removeObjectForKey:aId];
+		entry->evicted = YES;
+		p.store = self;
+		[p release];
+	}
+}
+
+- (void)scheduleSave
+{
+	if (m_path == nil)
+		return;
+	if (!m_dirty) {
+		m_dirty = YES;
+		[self performSelector:@selector(save) withObject:nil afterDelay:PGW_STORE_SAVE_DELAY];
+	}
+}
+
+@end
@@ -0,0 +1,80 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+@class PyGoWaveWavelet;
+@class PyGoWaveBundleWriter;
+@class SBJsonParser;
+
+
+/*
+ A wavelet as it was at one version, read from a memory-mapped cache file.
+ Only the header is checked when the snapshot is opened; blips are decoded
+ when they are loaded into a wavelet.
+*/
+@interface PyGoWaveSnapshot : NSObject
+{
+	NSData * m_data;
+	SBJsonParser * m_parser;
+	NSInteger m_version;
+	NSUInteger m_blipCount;
+	NSUInteger m_indexOffset;
+}
+@property (readonly) NSInteger version;
+@property (readonly) NSUInteger blipCount;
+
+- (id)initWithData:(NSData*)aData parser:(SBJsonParser*)aParser;
+- (void)dealloc;
+
+- (BOOL)loadIntoWavelet:(PyGoWaveWavelet*)aWavelet;
+
+@end
+
+#pragma mark -
+
+/*
+ Directory of wavelet snapshots, one file per wavelet.
+
+ File layout (host byte order; strings are a uint32 length and UTF-8 bytes):
+	header		PyGoWaveSnapshotHeader
+	wavelet		rootBlipId
+	blips		blipId, creatorId, lastModified (double), version (int32),
+				flags (uint32), content, contributor count, contributor ids,
+				element count, elements (id, position, type as int32,
+				properties as JSON string)
+	index		uint32 offset of each blip, in document order
+*/
+@interface PyGoWaveSnapshotStore : NSObject
+{
+	NSString * m_directory;
+	PyGoWaveBundleWriter * m_writer;
+	SBJsonParser * m_parser;
+}
+@property (readonly) NSString * directory;
+
+- (id)initWithDirectory:(NSString*)aDirectory;
+- (void)dealloc;
+
+- (PyGoWaveSnapshot*)snapshotForWaveletWithId:(NSString*)aId;
+- (BOOL)saveWavelet:(PyGoWaveWavelet*)aWavelet;
+- (void)removeSnapshotForWaveletWithId:(NSString*)aId;
+
+@end
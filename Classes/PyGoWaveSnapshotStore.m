@@ -0,0 +1,354 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#import "PyGoWaveSnapshotStore.h"
+#import "PyGoWaveModel.h"
+#import "PyGoWaveBundleWriter.h"
+#import "JSON/SBJsonParser.h"
+
+#define PGW_SNAPSHOT_FORMAT		2
+#define PGW_SNAPSHOT_BYTEORDER	0x01020304
+#define PGW_SNAPSHOT_SUBMITTED	0x1
+#define PGW_SNAPSHOT_ROOT		0x2
+
+typedef struct {
+	char magic[4];
+	uint32_t byteOrder;
+	uint32_t format;
+	int32_t version;
+	uint32_t blipCount;
+	uint32_t waveletOffset;
+	uint32_t indexOffset;
+} PyGoWaveSnapshotHeader;
+
+typedef struct {
+	const uint8_t * bytes;
+	NSUInteger length;
+	NSUInteger pos;
+	BOOL ok;
+} PyGoWaveSnapshotCursor;
+
+#pragma mark Reading
+
+// Reads are bounds checked; after the first failure the cursor only returns zeroes
+static BOOL readBytes(PyGoWaveSnapshotCursor * aCursor, void * aBuffer, NSUInteger aLength)
+{
+	if (!aCursor->ok || aCursor->length - aCursor->pos < aLength) {
+		aCursor->ok = NO;
+		memset(aBuffer, 0, aLength);
+		return NO;
+	}
+	memcpy(aBuffer, aCursor->bytes + aCursor->pos, aLength); // Records are not aligned
+	aCursor->pos += aLength;
+	return YES;
+}
+
+static uint32_t readUInt32(PyGoWaveSnapshotCursor * aCursor)
+{
+	uint32_t value;
+	readBytes(aCursor, &value, sizeof(value));
+	return value;
+}
+
+static int32_t readInt32(PyGoWaveSnapshotCursor * aCursor)
+{
+	int32_t value;
+	readBytes(aCursor, &value, sizeof(value));
+	return value;
+}
+
+static double readDouble(PyGoWaveSnapshotCursor * aCursor)
+{
+	double value;
+	readBytes(aCursor, &value, sizeof(value));
+	return value;
+}
+
+static NSString * readString(PyGoWaveSnapshotCursor * aCursor)
+{
+	uint32_t length = readUInt32(aCursor);
+	if (!aCursor->ok || aCursor->length - aCursor->pos < length) {
+		aCursor->ok = NO;
+		return nil;
+	}
+	NSString * str = [[NSString alloc] initWithBytes:aCursor->bytes + aCursor->pos length:length encoding:NSUTF8StringEncoding];
+	aCursor->pos += length;
+	if (str == nil)
+		aCursor->ok = NO;
+	return [str autorelease];
+}
+
+#pragma mark Writing
+
+static void writeUInt32(NSMutableData * aData, uint32_t aValue)
+{
+	[aData appendBytes:&aValue length:sizeof(aValue)];
+}
+
+static void writeInt32(NSMutableData * aData, int32_t aValue)
+{
+	[aData appendBytes:&aValue length:sizeof(aValue)];
+}
+
+static void writeDouble(NSMutableData * aData, double aValue)
+{
+	[aData appendBytes:&aValue length:sizeof(aValue)];
+}
+
+static void writeString(NSMutableData * aData, NSString * aString)
+{
+	if (aString == nil)
+		aString = @"";
+	NSUInteger start = [aData length];
+	NSUInteger maxLength = [aString maximumLengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+	NSUInteger length = 0;
+	[aData setLength:start + sizeof(uint32_t) + maxLength];
+	[aString getBytes:(uint8_t*)[aData mutableBytes] + start + sizeof(uint32_t)
+			maxLength:maxLength
+		   usedLength:&length
+			 encoding:NSUTF8StringEncoding
+			  options:0
+				range:NSMakeRange(0, [aString length])
+	   remainingRange:NULL];
+	uint32_t length32 = (uint32_t) length;
+	memcpy((uint8_t*)[aData mutableBytes] + start, &length32, sizeof(length32));
+	[aData setLength:start + sizeof(uint32_t) + length];
+}
+
+#pragma mark -
+
+@implementation PyGoWaveSnapshot
+
+@synthesize version = m_version, blipCount = m_blipCount;
+
+#pragma mark Initialization and Deallocation
+
+- (id)initWithData:(NSData*)aData parser:(SBJsonParser*)aParser
+{
+	if (self = [super init]) {
+		PyGoWaveSnapshotHeader header;
+		if ([aData length] < sizeof(header)) {
+			[self release];
+			return nil;
+		}
+		[aData getBytes:&header length:sizeof(header)];
+		if (memcmp(header.magic, "PGWS", 4) != 0 || header.byteOrder != PGW_SNAPSHOT_BYTEORDER || header.format != PGW_SNAPSHOT_FORMAT
+			|| header.waveletOffset > [aData length] || header.indexOffset > [aData length]
+			|| ([aData length] - header.indexOffset) / sizeof(uint32_t) < header.blipCount) {
+			[self release];
+			return nil;
+		}
+		m_data = [aData retain];
+		m_parser = [aParser retain];
+		m_version = header.version;
+		m_blipCount = header.blipCount;
+		m_indexOffset = header.indexOffset;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_data release];
+	[m_parser release];
+	[super dealloc];
+}
+
+#pragma mark Public methods
+
+// Replaces the blips of aWavelet; returns NO and leaves it untouched if the file is damaged
+- (BOOL)loadIntoWavelet:(PyGoWaveWavelet*)aWavelet
+{
+	NSObject <PyGoWaveParticipantProvider> * pp = [[aWavelet waveModel] participantProvider];
+	PyGoWaveSnapshotCursor cursor = {[m_data bytes], [m_data length], m_indexOffset, YES};
+	
+	NSMutableArray * blips = [[NSMutableArray alloc] initWithCapacity:m_blipCount];
+	for (NSUInteger i = 0; i < m_blipCount; i++) {
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		cursor.pos = m_indexOffset + i * sizeof(uint32_t);
+		cursor.pos = readUInt32(&cursor);
+		
+		NSString * blipId = readString(&cursor);
+		NSString * creatorId = readString(&cursor);
+		double lastModified = readDouble(&cursor);
+		int32_t version = readInt32(&cursor);
+		uint32_t flags = readUInt32(&cursor);
+		NSString * content = readString(&cursor);
+		
+		uint32_t count = readUInt32(&cursor);
+		NSMutableArray * contributors = [NSMutableArray array];
+		for (uint32_t j = 0; j < count && cursor.ok; j++)
+			[contributors addObject:[pp participantById:readString(&cursor)]];
+		
+		count = readUInt32(&cursor);
+		NSMutableArray * elements = [NSMutableArray array];
+		for (uint32_t j = 0; j < count && cursor.ok; j++) {
+			int32_t elementId = readInt32(&cursor);
+			int32_t position = readInt32(&cursor);
+			int32_t type = readInt32(&cursor);
+			NSString * json = readString(&cursor);
+			if (!cursor.ok)
+				break;
+			NSDictionary * properties = [m_parser objectWithString:json];
+			PyGoWaveElement * elementObj;
+			if (type == PyGoWaveElementType_GADGET)
+				elementObj = [[PyGoWaveGadgetElement alloc] initWithBlip:nil elementId:elementId position:position properties:properties];
+			else
+				elementObj = [[PyGoWaveElement alloc] initWithBlip:nil elementId:elementId position:position elementType:type properties:properties];
+			[elements addObject:elementObj];
+			[elementObj release];
+		}
+		
+		if (cursor.ok) {
+			PyGoWaveBlip * blip = [[PyGoWaveBlip alloc] initWithWavelet:aWavelet
+																 blipId:blipId
+																content:content
+															   elements:elements
+																 parent:nil
+																creator:[creatorId length] > 0 ? [pp participantById:creatorId] : nil
+														   contributors:contributors
+																 isRoot:(flags & PGW_SNAPSHOT_ROOT) != 0
+														   lastModified:[NSDate dateWithTimeIntervalSince1970:lastModified]
+																version:version
+															  submitted:(flags & PGW_SNAPSHOT_SUBMITTED) != 0];
+			[blips addObject:blip];
+			[blip release];
+		}
+		[pool release];
+		if (!cursor.ok) {
+			NSLog(@"Snapshot: Damaged blip record %u", (unsigned int) i);
+			[blips release];
+			return NO;
+		}
+	}
+	// The wavelet is only touched once the whole snapshot has been read
+	[aWavelet reloadBlips:blips];
+	[blips release];
+	aWavelet.version = m_version;
+	return YES;
+}
+
+@end
+
+#pragma mark -
+
+@implementation PyGoWaveSnapshotStore
+
+@synthesize directory = m_directory;
+
+#pragma mark Initialization and Deallocation
+
+- (id)initWithDirectory:(NSString*)aDirectory
+{
+	if (self = [super init]) {
+		m_directory = [aDirectory copy];
+		m_writer = [PyGoWaveBundleWriter new];
+		m_parser = [SBJsonParser new];
+		[[NSFileManager defaultManager] createDirectoryAtPath:m_directory withIntermediateDirectories:YES attributes:nil error:NULL];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_directory release];
+	[m_writer release];
+	[m_parser release];
+	[super dealloc];
+}
+
+#pragma mark Public methods
+
+- (NSString*)pathForWaveletWithId:(NSString*)aId
+{
+	NSString * name = [[aId componentsSeparatedByCharactersInSet:[NSCharacterSet characterSetWithCharactersInString:@"/:\\"]] componentsJoinedByString:@"_"];
+	return [m_directory stringByAppendingPathComponent:[name stringByAppendingPathExtension:@"pgws"]];
+}
+
+- (PyGoWaveSnapshot*)snapshotForWaveletWithId:(NSString*)aId
+{
+	NSData * data = [NSData dataWithContentsOfMappedFile:[self pathForWaveletWithId:aId]];
+	if (data == nil)
+		return nil;
+	PyGoWaveSnapshot * snapshot = [[PyGoWaveSnapshot alloc] initWithData:data parser:m_parser];
+	if (snapshot == nil)
+		NSLog(@"Snapshot: Ignoring invalid cache file for wavelet '%@'", aId);
+	return [snapshot autorelease];
+}
+
+- (BOOL)saveWavelet:(PyGoWaveWavelet*)aWavelet
+{
+	NSArray * blips = [aWavelet allBlips];
+	NSMutableData * data = [[NSMutableData alloc] initWithLength:sizeof(PyGoWaveSnapshotHeader)];
+	PyGoWaveSnapshotHeader header = {{'P', 'G', 'W', 'S'}, PGW_SNAPSHOT_BYTEORDER, PGW_SNAPSHOT_FORMAT, aWavelet.version, [blips count], 0, 0};
+	
+	header.waveletOffset = [data length];
+	NSString * rootBlipId = nil;
+	for (PyGoWaveBlip * blip in blips) {
+		if (blip.isRoot)
+			rootBlipId = blip.blipId;
+	}
+	writeString(data, rootBlipId);
+	
+	NSMutableData * index = [[NSMutableData alloc] initWithCapacity:[blips count] * sizeof(uint32_t)];
+	for (PyGoWaveBlip * blip in blips) {
+		writeUInt32(index, [data length]);
+		writeString(data, blip.blipId);
+		writeString(data, [blip creator].participantId);
+		writeDouble(data, [blip.lastModified timeIntervalSince1970]);
+		writeInt32(data, blip.version);
+		writeUInt32(data, (blip.isSubmitted ? PGW_SNAPSHOT_SUBMITTED : 0) | (blip.isRoot ? PGW_SNAPSHOT_ROOT : 0));
+		writeString(data, blip.content);
+		NSArray * contributors = [blip allContributors];
+		writeUInt32(data, [contributors count]);
+		for (PyGoWaveParticipant * p in contributors)
+			writeString(data, p.participantId);
+		NSArray * elements = [blip allElements];
+		writeUInt32(data, [elements count]);
+		for (PyGoWaveElement * element in elements) {
+			writeInt32(data, element.elementId);
+			writeInt32(data, element.position);
+			writeInt32(data, element.elementType);
+			[m_writer reset];
+			[m_writer appendValue:element.properties];
+			writeUInt32(data, [[m_writer data] length]);
+			[data appendData:[m_writer data]];
+		}
+	}
+	header.indexOffset = [data length];
+	[data appendData:index];
+	[index release];
+	[data replaceBytesInRange:NSMakeRange(0, sizeof(header)) withBytes:&header];
+	
+	BOOL ok = [data writeToFile:[self pathForWaveletWithId:aWavelet.waveletId] atomically:YES];
+	if (!ok)
+		NSLog(@"Snapshot: Cannot write cache file for wavelet '%@'", aWavelet.waveletId);
+	[data release];
+	return ok;
+}
+
+- (void)removeSnapshotForWaveletWithId:(NSString*)aId
+{
+	[[NSFileManager defaultManager] removeItemAtPath:[self pathForWaveletWithId:aId] error:NULL];
+}
+
+@end
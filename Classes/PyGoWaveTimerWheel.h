@@ -0,0 +1,61 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+@class PyGoWaveTimerWheelEntry;
+
+
+/*
+ Deadlines for any number of keys, driven by one repeating timer. Each
+ deadline hangs in the slot of the tick it falls on (modulo the number of
+ slots), so setting, moving and removing one is O(1); every tick only looks
+ at the deadlines of a single slot. When a deadline has passed, the target
+ receives the selector with the key as argument, on the thread that set the
+ deadline. The target is not retained. The timer only runs while deadlines
+ are set.
+*/
+@interface PyGoWaveTimerWheel : NSObject
+{
+	PyGoWaveTimerWheelEntry ** m_slots;
+	NSUInteger m_slotCount;
+	NSUInteger m_current;
+	NSTimeInterval m_tickInterval;
+	NSTimeInterval m_lastTick;
+	NSMutableDictionary * m_entries;
+	NSTimer * m_timer;
+	id m_target;
+	SEL m_selector;
+}
+// Resolution of the deadlines; they fire up to one tick late
+@property (readonly) NSTimeInterval tickInterval;
+@property (readonly) NSUInteger count;
+
+- (id)initWithTickInterval:(NSTimeInterval)aInterval slotCount:(NSUInteger)aCount target:(id)aTarget selector:(SEL)aSelector;
+- (void)dealloc;
+
+// Replaces an earlier deadline of the same key
+- (void)setDeadlineForKey:(id)aKey afterDelay:(NSTimeInterval)aDelay;
+- (BOOL)hasDeadlineForKey:(id)aKey;
+- (void)removeDeadlineForKey:(id)aKey;
+- (void)removeAllDeadlines;
+
+@end
@@ -0,0 +1,210 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#import "PyGoWaveTimerWheel.h"
+
+@interface PyGoWaveTimerWheelEntry : NSObject
+{
+@public
+	id key;
+	NSTimeInterval deadline;
+	NSUInteger slot;
+	PyGoWaveTimerWheelEntry * prev;
+	PyGoWaveTimerWheelEntry * next;
+}
+@end
+
+@implementation PyGoWaveTimerWheelEntry
+
+- (void)dealloc
+{
+	[key release];
+	[super dealloc];
+}
+
+@end
+
+#pragma mark -
+
+@interface PyGoWaveTimerWheel ()
+- (void)unlinkEntry:(PyGoWaveTimerWheelEntry*)aEntry;
+- (void)stopTimer;
+@end
+
+@implementation PyGoWaveTimerWheel
+
+@synthesize tickInterval = m_tickInterval;
+
+#pragma mark Initialization and Deallocation
+
+- (id)initWithTickInterval:(NSTimeInterval)aInterval slotCount:(NSUInteger)aCount target:(id)aTarget selector:(SEL)aSelector
+{
+	NSAssert(aInterval > 0.0 && aCount > 0, @"Timer wheel needs a tick interval and at least one slot");
+	if (self = [super init]) {
+		m_slotCount = aCount;
+		m_slots = calloc(aCount, sizeof(PyGoWaveTimerWheelEntry*));
+		m_current = 0;
+		m_tickInterval = aInterval;
+		m_lastTick = 0.0;
+		m_entries = [NSMutableDictionary new];
+		m_timer = nil;
+		m_target = aTarget;
+		m_selector = aSelector;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[self stopTimer];
+	free(m_slots);
+	[m_entries release];
+	[super dealloc];
+}
+
+#pragma mark Properties
+
+- (NSUInteger)count
+{
+	return [m_entries count];
+}
+
+#pragma mark Public methods
+
+- (void)setDeadlineForKey:(id)aKey afterDelay:(NSTimeInterval)aDelay
+{
+	NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+	if (m_timer == nil) {
+		m_lastTick = now;
+		// Retains the wheel until it is stopped, which happens as soon as no deadline is left
+		m_timer = [[NSTimer scheduledTimerWithTimeInterval:m_tickInterval target:self selector:@selector(timer_timeout:) userInfo:nil repeats:YES] retain];
+	}
+	
+	PyGoWaveTimerWheelEntry * entry = [m_entries objectForKey:aKey];
+	if (entry != nil)
+		[self unlinkEntry:entry];
+	else {
+		entry = [PyGoWaveTimerWheelEntry new];
+		entry->key = [aKey retain];
+		[m_entries setObject:entry forKey:aKey];
+		[entry release];
+	}
+	
+	entry->deadline = now + aDelay;
+	NSTimeInterval ticks = ceil((entry->deadline - m_lastTick) / m_tickInterval);
+	if (ticks < 1.0)
+		ticks = 1.0;
+	// Deadlines further out than one revolution are skipped until their round comes
+	entry->slot = (m_current + (NSUInteger) fmod(ticks, (double) m_slotCount)) % m_slotCount;
+	entry->prev = nil;
+	entry->next = m_slots[entry->slot];
+	if (entry->next != nil)
+		entry->next->prev = entry;
+	m_slots[entry->slot] = entry;
+}
+
+- (BOOL)hasDeadlineForKey:(id)aKey
+{
+	return [m_entries objectForKey:aKey] != nil;
+}
+
+- (void)removeDeadlineForKey:(id)aKey
+{
+	PyGoWaveTimerWheelEntry * entry = [m_entries objectForKey:aKey];
+	if (entry == nil)
+		return;
+	[self unlinkEntry:entry];
+	[m_entries removeObjectForKey:aKey];
+	if ([m_entries count] == 0)
+		[self stopTimer];
+}
+
+- (void)removeAllDeadlines
+{
+	for (NSUInteger i = 0; i < m_slotCount; i++)
+		m_slots[i] = nil;
+	[m_entries removeAllObjects];
+	[self stopTimer];
+}
+
+#pragma mark Private methods
+
+- (void)unlinkEntry:(PyGoWaveTimerWheelEntry*)aEntry
+{
+	if (aEntry->prev != nil)
+		aEntry->prev->next = aEntry->next;
+	else
+		m_slots[aEntry->slot] = aEntry->next;
+	if (aEntry->next != nil)
+		aEntry->next->prev = aEntry->prev;
+	aEntry->prev = nil;
+	aEntry->next = nil;
+}
+
+- (void)stopTimer
+{
+	if (m_timer != nil) {
+		[m_timer invalidate];
+		[m_timer release];
+		m_timer = nil;
+	}
+}
+
+- (void)timer_timeout:(NSTimer*)aTimer
+{
+	NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+	NSUInteger ticks = (NSUInteger) ((now - m_lastTick) / m_tickInterval);
+	if (ticks == 0)
+		return;
+	if (ticks > m_slotCount) {
+		// The run loop was stalled; one revolution visits every slot
+		m_lastTick = now - m_slotCount * m_tickInterval;
+		ticks = m_slotCount;
+	}
+	
+	NSMutableArray * expired = nil;
+	for (; ticks > 0; ticks--) {
+		m_lastTick += m_tickInterval;
+		m_current = (m_current + 1) % m_slotCount;
+		PyGoWaveTimerWheelEntry * entry = m_slots[m_current];
+		while (entry != nil) {
+			PyGoWaveTimerWheelEntry * next = entry->next;
+			if (entry->deadline <= now) {
+				if (expired == nil)
+					expired = [NSMutableArray array];
+				[expired addObject:entry->key];
+				[self unlinkEntry:entry];
+				[m_entries removeObjectForKey:entry->key];
+			}
+			entry = next;
+		}
+	}
+	if ([m_entries count] == 0)
+		[self stopTimer];
+	
+	// The target may set new deadlines from here
+	for (id aKey in expired)
+		[m_target performSelector:m_selector withObject:aKey];
+}
+
+@end
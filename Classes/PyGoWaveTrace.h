@@ -0,0 +1,66 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ Optional tracing of the client's processing stages. Spans go into a ring
+ buffer of the thread that records them, so recording takes no lock; when a
+ buffer is full, its oldest spans are overwritten. The export is Chrome trace
+ event JSON, which chrome://tracing and Perfetto open directly.
+ 
+ Instrumenting a stage:
+	uint64_t traceStart = PyGoWaveTraceBegin();
+	...
+	PyGoWaveTraceEnd("json.parse", traceStart, byteCount);
+ While tracing is off this is a flag test at each end. Names must be string
+ literals; the value is shown as an argument of the span, -1 for none.
+*/
+
+extern volatile BOOL PyGoWaveTraceEnabled;
+
+uint64_t PyGoWaveTraceNow(void);
+void PyGoWaveTraceRecord(const char * aName, uint64_t aStart, long long aValue);
+
+static inline uint64_t PyGoWaveTraceBegin(void)
+{
+	return PyGoWaveTraceEnabled ? PyGoWaveTraceNow() : 0;
+}
+
+// Spans begun while tracing was off are dropped
+static inline void PyGoWaveTraceEnd(const char * aName, uint64_t aStart, long long aValue)
+{
+	if (aStart != 0)
+		PyGoWaveTraceRecord(aName, aStart, aValue);
+}
+
+@interface PyGoWaveTrace : NSObject
+{
+}
+
+// Starts a new trace; threads get ring buffers of aCapacity spans when they first record one
++ (void)startWithCapacity:(NSUInteger)aCapacity;
++ (void)stop;
++ (BOOL)isTracing;
+
+// Spans recorded since the last start that are still in the buffers
++ (NSData*)exportData;
++ (BOOL)writeToFile:(NSString*)aPath;
+
+@end
@@ -0,0 +1,220 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#import "PyGoWaveTrace.h"
+#import "PyGoWaveBundleWriter.h"
+#include <pthread.h>
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+#define PGW_TRACE_DEFAULT_CAPACITY	16384
+
+#define appendLiteral(s) [writer appendBytes:s length:sizeof(s)-1]
+
+typedef struct {
+	const char * name;
+	uint64_t start;
+	uint64_t end;
+	long long value;
+} PyGoWaveTraceEvent;
+
+// Written by its thread only; head counts all spans ever recorded
+typedef struct PyGoWaveTraceBuffer {
+	PyGoWaveTraceEvent * events;
+	NSUInteger capacity;
+	volatile uint64_t head;
+	NSUInteger threadId;
+	NSString * threadName;
+	struct PyGoWaveTraceBuffer * next;
+} PyGoWaveTraceBuffer;
+
+volatile BOOL PyGoWaveTraceEnabled = NO;
+
+static pthread_key_t s_bufferKey;
+static pthread_once_t s_bufferKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t s_buffersLock = PTHREAD_MUTEX_INITIALIZER;
+static PyGoWaveTraceBuffer * s_buffers = NULL; // Kept for the export after their threads end
+static NSUInteger s_bufferCount = 0;
+static NSUInteger s_capacity = PGW_TRACE_DEFAULT_CAPACITY;
+static uint64_t s_traceStart = 0;
+
+static void createBufferKey(void)
+{
+	pthread_key_create(&s_bufferKey, NULL);
+}
+
+static PyGoWaveTraceBuffer * newBuffer(void)
+{
+	PyGoWaveTraceBuffer * buffer = calloc(1, sizeof(PyGoWaveTraceBuffer));
+	NSThread * thread = [NSThread currentThread];
+	NSString * name = [thread name];
+	
+	pthread_mutex_lock(&s_buffersLock);
+	buffer->capacity = s_capacity;
+	buffer->events = calloc(buffer->capacity, sizeof(PyGoWaveTraceEvent));
+	buffer->threadId = ++s_bufferCount;
+	if ([thread isMainThread])
+		buffer->threadName = @"main";
+	else if ([name length] > 0)
+		buffer->threadName = [name copy];
+	else
+		buffer->threadName = [[NSString alloc] initWithFormat:@"thread %u", (unsigned) buffer->threadId];
+	buffer->next = s_buffers;
+	s_buffers = buffer;
+	pthread_mutex_unlock(&s_buffersLock);
+	
+	pthread_setspecific(s_bufferKey, buffer);
+	return buffer;
+}
+
+uint64_t PyGoWaveTraceNow(void)
+{
+#ifdef __APPLE__
+	return mach_absolute_time();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+// Microseconds since the trace started
+static double traceMicroseconds(uint64_t aTime)
+{
+	uint64_t ticks = aTime > s_traceStart ? aTime - s_traceStart : 0;
+#ifdef __APPLE__
+	static mach_timebase_info_data_t timebase;
+	if (timebase.denom == 0)
+		mach_timebase_info(&timebase);
+	return (double) ticks * timebase.numer / timebase.denom / 1000.0;
+#else
+	return ticks / 1000.0;
+#endif
+}
+
+void PyGoWaveTraceRecord(const char * aName, uint64_t aStart, long long aValue)
+{
+	uint64_t end = PyGoWaveTraceNow();
+	pthread_once(&s_bufferKeyOnce, createBufferKey);
+	PyGoWaveTraceBuffer * buffer = pthread_getspecific(s_bufferKey);
+	if (buffer == NULL)
+		buffer = newBuffer();
+	
+	PyGoWaveTraceEvent * event = &buffer->events[buffer->head % buffer->capacity];
+	event->name = aName;
+	event->start = aStart;
+	event->end = end;
+	event->value = aValue;
+	__sync_synchronize(); // The span is complete before an exporting thread can see it
+	buffer->head++;
+}
+
+#pragma mark -
+
+@implementation PyGoWaveTrace
+
++ (void)startWithCapacity:(NSUInteger)aCapacity
+{
+	pthread_mutex_lock(&s_buffersLock);
+	if (aCapacity > 0)
+		s_capacity = aCapacity;
+	s_traceStart = PyGoWaveTraceNow();
+	pthread_mutex_unlock(&s_buffersLock);
+	__sync_synchronize();
+	PyGoWaveTraceEnabled = YES;
+}
+
++ (void)stop
+{
+	PyGoWaveTraceEnabled = NO;
+}
+
++ (BOOL)isTracing
+{
+	return PyGoWaveTraceEnabled;
+}
+
++ (NSData*)exportData
+{
+	PyGoWaveBundleWriter * writer = [[PyGoWaveBundleWriter alloc] init];
+	char number[64];
+	BOOL addComma = NO;
+	appendLiteral("{\"traceEvents\":[");
+	
+	pthread_mutex_lock(&s_buffersLock);
+	for (PyGoWaveTraceBuffer * buffer = s_buffers; buffer != NULL; buffer = buffer->next) {
+		if (addComma)
+			appendLiteral(",");
+		addComma = YES;
+		appendLiteral("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":");
+		[writer appendInteger:buffer->threadId];
+		appendLiteral(",\"args\":{\"name\":");
+		[writer appendString:buffer->threadName];
+		appendLiteral("}}");
+		
+		// Copy what is there, then drop whatever the thread overwrote meanwhile
+		uint64_t head = buffer->head;
+		__sync_synchronize();
+		uint64_t first = head > buffer->capacity ? head - buffer->capacity : 0;
+		NSUInteger count = (NSUInteger)(head - first);
+		PyGoWaveTraceEvent * events = malloc(MAX(count, 1) * sizeof(PyGoWaveTraceEvent));
+		for (NSUInteger i = 0; i < count; i++)
+			events[i] = buffer->events[(first + i) % buffer->capacity];
+		__sync_synchronize();
+		uint64_t after = buffer->head;
+		NSUInteger skip = after - first > buffer->capacity ? (NSUInteger) MIN(after - first - buffer->capacity, count) : 0;
+		
+		for (NSUInteger i = skip; i < count; i++) {
+			PyGoWaveTraceEvent * event = &events[i];
+			if (event->start < s_traceStart)
+				continue;
+			appendLiteral(",{\"name\":\"");
+			[writer appendBytes:event->name length:strlen(event->name)];
+			appendLiteral("\",\"cat\":\"pygowave\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+			[writer appendInteger:buffer->threadId];
+			int length = snprintf(number, sizeof(number), ",\"ts\":%.3f,\"dur\":%.3f", traceMicroseconds(event->start), traceMicroseconds(event->end) - traceMicroseconds(event->start));
+			[writer appendBytes:number length:length];
+			if (event->value >= 0) {
+				appendLiteral(",\"args\":{\"value\":");
+				[writer appendInteger:event->value];
+				appendLiteral("}");
+			}
+			appendLiteral("}");
+		}
+		free(events);
+	}
+	pthread_mutex_unlock(&s_buffersLock);
+	
+	appendLiteral("],\"displayTimeUnit\":\"ms\"}");
+	NSData * data = [NSData dataWithData:[writer data]];
+	[writer release];
+	return data;
+}
+
++ (BOOL)writeToFile:(NSString*)aPath
+{
+	return [[self exportData] writeToFile:aPath atomically:YES];
+}
+
+@end
@@ -0,0 +1,74 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#import <Foundation/Foundation.h>
+
+@class PyGoWaveWorkerPool;
+@class PyGoWavePoolThread;
+
+
+/*
+ Runs the work handed to it one item at a time, in order, on whichever pool
+ thread picks it up. Different contexts run in parallel.
+*/
+@interface PyGoWaveSerialContext : NSObject
+{
+	PyGoWaveWorkerPool * m_pool;
+	NSLock * m_lock;
+	NSMutableArray * m_tasks;
+	BOOL m_scheduled;
+}
+
+- (id)initWithPool:(PyGoWaveWorkerPool*)aPool;
+- (void)dealloc;
+
+// Queues [aTarget aSelector:aObject]; target and object are retained until it has run
+- (void)performSelector:(SEL)aSelector target:(id)aTarget withObject:(id)aObject;
+
+- (void)run;
+
+@end
+
+
+/*
+ A fixed set of threads that run serial contexts. Each thread has a deque of
+ runnable contexts; it takes the newest one from its own deque and, when that
+ is empty, steals the oldest one from another thread.
+*/
+@interface PyGoWaveWorkerPool : NSObject
+{
+	NSArray * m_threads;
+	NSCondition * m_available;
+	NSUInteger m_availableCount;
+	NSUInteger m_nextThread;
+	BOOL m_stopping;
+}
+@property (readonly) NSUInteger threadCount;
+
+// A count of 0 starts one thread per active processor
+- (id)initWithThreadCount:(NSUInteger)aCount;
+- (void)dealloc;
+
+- (void)scheduleContext:(PyGoWaveSerialContext*)aContext;
+- (void)stop;
+
+@end
@@ -0,0 +1,284 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#import "PyGoWaveWorkerPool.h"
+
+// Contexts run at most this many tasks before giving other contexts a turn
+#define PGW_CONTEXT_BATCH 32
+
+
+@interface PyGoWavePoolThread : NSThread
+{
+	PyGoWaveWorkerPool * m_pool;
+	NSLock * m_dequeLock;
+	NSMutableArray * m_deque;
+}
+
+- (id)initWithPool:(PyGoWaveWorkerPool*)aPool index:(NSUInteger)aIndex;
+- (void)dealloc;
+
+- (void)pushContext:(PyGoWaveSerialContext*)aContext;
+- (PyGoWaveSerialContext*)popContext;
+- (PyGoWaveSerialContext*)stealContext;
+
+@end
+
+
+@interface PyGoWaveWorkerPool ()
+- (PyGoWaveSerialContext*)takeContextForThread:(PyGoWavePoolThread*)aThread;
+@end
+
+
+@implementation PyGoWaveSerialContext
+
+- (id)initWithPool:(PyGoWaveWorkerPool*)aPool
+{
+	if (self = [super init]) {
+		m_pool = [aPool retain];
+		m_lock = [NSLock new];
+		m_tasks = [NSMutableArray new];
+		m_scheduled = NO;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_pool release];
+	[m_lock release];
+	[m_tasks release];
+	[super dealloc];
+}
+
+- (void)performSelector:(SEL)aSelector target:(id)aTarget withObject:(id)aObject
+{
+	NSMethodSignature * signature = [aTarget methodSignatureForSelector:aSelector];
+	NSAssert(signature != nil, @"Target does not respond to selector");
+	NSInvocation * task = [NSInvocation invocationWithMethodSignature:signature];
+	[task setTarget:aTarget];
+	[task setSelector:aSelector];
+	if ([signature numberOfArguments] > 2)
+		[task setArgument:&aObject atIndex:2];
+	[task retainArguments];
+	
+	[m_lock lock];
+	[m_tasks addObject:task];
+	BOOL schedule = !m_scheduled;
+	m_scheduled = YES;
+	[m_lock unlock];
+	
+	if (schedule)
+		[m_pool scheduleContext:self];
+}
+
+- (void)run
+{
+	[m_lock lock];
+	NSRange batch = NSMakeRange(0, MIN([m_tasks count], (NSUInteger)PGW_CONTEXT_BATCH));
+	NSArray * tasks = [m_tasks subarrayWithRange:batch];
+	[m_tasks removeObjectsInRange:batch];
+	[m_lock unlock];
+	
+	for (NSInvocation * task in tasks) {
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		[task invoke];
+		[pool release];
+	}
+	
+	[m_lock lock];
+	BOOL reschedule = [m_tasks count] > 0;
+	m_scheduled = reschedule;
+	[m_lock unlock];
+	
+	if (reschedule)
+		[m_pool scheduleContext:self];
+}
+
+@end
+
+
+@implementation PyGoWavePoolThread
+
+- (id)initWithPool:(PyGoWaveWorkerPool*)aPool index:(NSUInteger)aIndex
+{
+	if (self = [super init]) {
+		m_pool = [aPool retain]; // Released when the thread exits
+		m_dequeLock = [NSLock new];
+		m_deque = [NSMutableArray new];
+		[self setName:[NSString stringWithFormat:@"PyGoWave pool %u", (unsigned) aIndex]];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_dequeLock release];
+	[m_deque release];
+	[super dealloc];
+}
+
+- (void)main
+{
+	while (YES) {
+		NSAutoreleasePool * pool = [NSAutoreleasePool new];
+		PyGoWaveSerialContext * context = [m_pool takeContextForThread:self];
+		[context run];
+		[pool release];
+		if (context == nil)
+			break;
+	}
+	[m_pool release];
+	m_pool = nil;
+}
+
+- (void)pushContext:(PyGoWaveSerialContext*)aContext
+{
+	[m_dequeLock lock];
+	[m_deque addObject:aContext];
+	[m_dequeLock unlock];
+}
+
+- (PyGoWaveSerialContext*)popContext
+{
+	PyGoWaveSerialContext * context = nil;
+	[m_dequeLock lock];
+	if ([m_deque count] > 0) {
+		context = [[[m_deque lastObject] retain] autorelease];
+		[m_deque removeLastObject];
+	}
+	[m_dequeLock unlock];
+	return context;
+}
+
+- (PyGoWaveSerialContext*)stealContext
+{
+	PyGoWaveSerialContext * context = nil;
+	[m_dequeLock lock];
+	if ([m_deque count] > 0) {
+		context = [[[m_deque objectAtIndex:0] retain] autorelease];
+		[m_deque removeObjectAtIndex:0];
+	}
+	[m_dequeLock unlock];
+	return context;
+}
+
+@end
+
+
+@implementation PyGoWaveWorkerPool
+
+#pragma mark Initialization and Deallocation
+
+- (id)initWithThreadCount:(NSUInteger)aCount
+{
+	if (self = [super init]) {
+		if (aCount == 0)
+			aCount = [[NSProcessInfo processInfo] activeProcessorCount];
+		if (aCount == 0)
+			aCount = 1;
+		m_available = [NSCondition new];
+		m_availableCount = 0;
+		m_nextThread = 0;
+		m_stopping = NO;
+		
+		NSMutableArray * threads = [NSMutableArray arrayWithCapacity:aCount];
+		for (NSUInteger i = 0; i < aCount; i++) {
+			PyGoWavePoolThread * thread = [[PyGoWavePoolThread alloc] initWithPool:self index:i];
+			[threads addObject:thread];
+			[thread release];
+		}
+		m_threads = [threads copy];
+		for (PyGoWavePoolThread * thread in m_threads)
+			[thread start];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[m_threads release];
+	[m_available release];
+	[super dealloc];
+}
+
+#pragma mark Public methods
+
+- (NSUInteger)threadCount
+{
+	return [m_threads count];
+}
+
+- (void)scheduleContext:(PyGoWaveSerialContext*)aContext
+{
+	// Pool threads keep their own work; everyone else deals round robin
+	PyGoWavePoolThread * thread = (PyGoWavePoolThread*) [NSThread currentThread];
+	if ([m_threads indexOfObjectIdenticalTo:thread] == NSNotFound) {
+		[m_available lock];
+		thread = [m_threads objectAtIndex:m_nextThread++ % [m_threads count]];
+		[m_available unlock];
+	}
+	[thread pushContext:aContext];
+	
+	[m_available lock];
+	m_availableCount++;
+	[m_available signal];
+	[m_available unlock];
+}
+
+- (void)stop
+{
+	[m_available lock];
+	m_stopping = YES;
+	[m_available broadcast];
+	[m_available unlock];
+}
+
+#pragma mark Private methods
+
+/*
+ Blocks until a context is runnable and claims it. Every claim is backed by a
+ context in some deque, so the search below always ends. Returns nil once the
+ pool is stopped.
+*/
+- (PyGoWaveSerialContext*)takeContextForThread:(PyGoWavePoolThread*)aThread
+{
+	[m_available lock];
+	while (m_availableCount == 0 && !m_stopping)
+		[m_available wait];
+	if (m_stopping) {
+		[m_available unlock];
+		return nil;
+	}
+	m_availableCount--;
+	[m_available unlock];
+	
+	PyGoWaveSerialContext * context = [aThread popContext];
+	NSUInteger count = [m_threads count];
+	NSUInteger start = [m_threads indexOfObjectIdenticalTo:aThread];
+	while (context == nil) {
+		for (NSUInteger i = 1; i <= count && context == nil; i++)
+			context = [[m_threads objectAtIndex:(start + i) % count] stealContext];
+	}
+	return context;
+}
+
+@end
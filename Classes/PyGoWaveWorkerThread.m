@@ -0,0 +1,64 @@
+
+/*
+ * This file is part of the PyGoWave NeXT/ObjC Client API
+ *
+ * Copyright (C) 2010 Patrick Schneider <patrick.p2k.schneider@googlemail.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; see the file
+ * COPYING.LESSER.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#import "PyGoWaveWorkerThread.h"
+
+@implementation PyGoWaveWorkerThread
+
+#pragma mark Initialization and Deallocation
+
+- (id)init
+{
+	if (self = [super init])
+		[self setName:@"PyGoWave worker"];
+	return self;
+}
+
+#pragma mark Public methods
+
+- (void)main
+{
+	NSAutoreleasePool * pool = [NSAutoreleasePool new];
+	NSRunLoop * runLoop = [NSRunLoop currentRunLoop];
+	// A port keeps the run loop from returning while there is nothing to do
+	[runLoop addPort:[NSPort port] forMode:NSDefaultRunLoopMode];
+	[pool release];
+	
+	while (![self isCancelled]) {
+		pool = [NSAutoreleasePool new];
+		[runLoop runMode:NSDefaultRunLoopMode beforeDate:[NSDate distantFuture]];
+		[pool release];
+	}
+}
+
+- (void)wakeUp
+{
+}
+
+- (void)stop
+{
+	[self cancel];
+	if ([self isExecuting])
+		[self performSelector:@selector(wakeUp) onThread:self withObject:nil waitUntilDone:NO];
+}
+
+@end
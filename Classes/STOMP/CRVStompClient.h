@@ -17,6 +17,9 @@
 #import <Foundation/Foundation.h>
 #import "AsyncSocket.h"
 
+// Capture files start with these 8 bytes, see startCaptureToFile:
+#define kCRVStompCaptureMagic		"STOMPCAP"
+
 @class CRVStompClient;
 
 typedef enum {
@@ -25,6 +28,7 @@ typedef enum {
 } CRVStompAckMode;
 
 @protocol CRVStompClientDelegate <NSObject>
+// Called on the frameThread if one is set
 - (void)stompClient:(CRVStompClient *)stompService messageReceived:(NSString *)body withHeader:(NSDictionary *)messageHeader;
 
 @optional
@@ -44,9 +48,23 @@ typedef enum {
 	NSString *passcode;
 	NSString *sessionId;
 	BOOL doAutoconnect;
+	NSThread *socketThread;
+	NSThread *frameThread;
+	NSFileHandle *captureFile;
+	NSMutableData *captureBuffer;
+	NSTimeInterval captureStart;
+	NSTimeInterval captureFlushed;
+	NSArray *captureRedactions;
 }
 
 @property (nonatomic, assign) id<CRVStompClientDelegate> delegate;
+// If set, received frames are parsed on this thread and MESSAGE frames are
+// delivered to the delegate there. All other callbacks stay on the thread
+// that created the client.
+@property (nonatomic, retain) NSThread *frameThread;
+// Strings replaced by *** in captured sent frames, e.g. a password in a message
+// body. The login and passcode of CONNECT frames are always replaced.
+@property (copy) NSArray *captureRedactions;
 
 - (id)initWithHost:(NSString *)theHost 
 			  port:(NSUInteger)thePort 
@@ -64,6 +82,7 @@ typedef enum {
 - (void)connect;
 - (void)sendMessage:(NSString *)theMessage toDestination:(NSString *)destination;
 - (void)sendMessage:(NSString *)theMessage customHeader:(NSDictionary *)customHeaders;
+- (void)sendMessageData:(NSData *)theMessage customHeader:(NSDictionary *)customHeaders;
 - (void)subscribeToDestination:(NSString *)destination;
 - (void)subscribeToDestination:(NSString *)destination withAck:(CRVStompAckMode) ackMode;
 - (void)subscribeToDestination:(NSString *)destination withHeader:(NSDictionary *) header;
@@ -74,4 +93,13 @@ typedef enum {
 - (void)ack:(NSString *)messageId;
 - (void)disconnect;
 
+// Records every raw frame sent and received to a file, e.g. to replay a session
+// against a stand-in broker. After the magic, each record is a direction byte
+// ('<' received, '>' sent), the seconds since the capture started (double), the
+// frame length (uint32) and the frame bytes. Numbers are little-endian.
+// The file is only readable by the user. Records are buffered and written in
+// chunks, the rest when the capture stops.
+- (BOOL)startCaptureToFile:(NSString *)path;
+- (void)stopCapture;
+
 @end
\ No newline at end of file
@@ -13,9 +13,15 @@
 //	Stefan Saasen <stefan@coravy.com>
 //  Based on StompService.{h,m} by Scott Raymond <sco@scottraymond.net>.
 #import "CRVStompClient.h"
+#import "PyGoWaveTrace.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #define kStompDefaultPort			61613
 #define kDefaultTimeout				5	//
+#define kCaptureBufferSize			65536
+#define kCaptureFlushInterval		1.0
 
 
 // ============= http://stomp.codehaus.org/Protocol =============
@@ -56,14 +62,22 @@
 
 @interface CRVStompClient(PrivateMethods)
 - (void) sendFrame:(NSString *) command withHeader:(NSDictionary *) header andBody:(NSString *) body;
+- (void) sendFrame:(NSString *) command withHeader:(NSDictionary *) header andBodyData:(NSData *) body;
 - (void) sendFrame:(NSString *) command;
 - (void) readFrame;
+- (void) parseFrameData:(NSData *)data;
+- (void) captureFrameData:(NSData *)data direction:(char)direction;
+- (NSData *) redactedFrameData:(NSData *)data;
+- (void) flushCapture;
+- (void) writeFrameData:(NSData *)data;
 @end
 
 @implementation CRVStompClient
 
 @synthesize delegate;
 @synthesize socket, host, port, login, passcode, sessionId;
+@synthesize frameThread;
+@synthesize captureRedactions;
 
 - (id)init {
 	return [self initWithHost:@"localhost" port:kStompDefaultPort login:nil passcode:nil delegate:nil];
@@ -86,6 +100,7 @@
 	if(self = [super init]) {
 		
 		doAutoconnect = autoconnect;
+		socketThread = [[NSThread currentThread] retain];
 		
 		AsyncSocket *theSocket = [[AsyncSocket alloc] initWithDelegate:self];
 		[self setSocket: theSocket];
@@ -123,6 +138,10 @@
     [self sendFrame:kCommandSend withHeader:headers andBody:theMessage];
 }
 
+- (void)sendMessageData:(NSData *)theMessage customHeader:(NSDictionary *)customHeaders {
+    [self sendFrame:kCommandSend withHeader:customHeaders andBodyData:theMessage];
+}
+
 - (void)subscribeToDestination:(NSString *)destination {
 	[self subscribeToDestination:destination withAck: CRVStompAckModeAuto];
 }
@@ -178,6 +197,35 @@
 	[[self socket] disconnectAfterReadingAndWriting];
 }
 
+- (BOOL)startCaptureToFile:(NSString *)path {
+	[self stopCapture];
+	// Frames carry session data, so only the user may read the file; fchmod covers an existing one
+	int fd = open([path fileSystemRepresentation], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if(fd < 0 || fchmod(fd, 0600) != 0 || write(fd, kCRVStompCaptureMagic, 8) != 8) {
+		NSLog(@"StompService error: Cannot create capture file '%@'", path);
+		if(fd >= 0) {
+			close(fd);
+		}
+		return NO;
+	}
+	@synchronized(self) {
+		captureFile = [[NSFileHandle alloc] initWithFileDescriptor:fd closeOnDealloc:YES];
+		captureBuffer = [[NSMutableData alloc] initWithCapacity:kCaptureBufferSize];
+		captureStart = [NSDate timeIntervalSinceReferenceDate];
+		captureFlushed = captureStart;
+	}
+	return YES;
+}
+
+- (void)stopCapture {
+	@synchronized(self) {
+		[self flushCapture];
+		[captureFile closeFile];
+		CRV_RELEASE_SAFELY(captureFile);
+		CRV_RELEASE_SAFELY(captureBuffer);
+	}
+}
+
 
 #pragma mark -
 #pragma mark PrivateMethods
@@ -194,13 +242,97 @@
 		[frameString appendString:body];
 	}
     [frameString appendString:kControlChar];
-	[[self socket] writeData:[frameString dataUsingEncoding:NSASCIIStringEncoding] withTimeout:kDefaultTimeout tag:123];
+	[self writeFrameData:[frameString dataUsingEncoding:NSASCIIStringEncoding]];
+}
+
+- (void) sendFrame:(NSString *) command withHeader:(NSDictionary *) header andBodyData:(NSData *) body {
+	// Body bytes are written as they are; only the frame head is built as a string
+	NSMutableString *headString = [NSMutableString stringWithString: [command stringByAppendingString:@"\n"]];
+	for (id key in header) {
+		[headString appendString:key];
+		[headString appendString:@":"];
+		[headString appendString:[header objectForKey:key]];
+		[headString appendString:@"\n"];
+	}
+	[headString appendString:@"\n"];
+	NSMutableData *frameData = [NSMutableData dataWithData:[headString dataUsingEncoding:NSUTF8StringEncoding]];
+	[frameData appendData:body];
+	static const char terminator[2] = {'\n', 0};
+	[frameData appendBytes:terminator length:2];
+	[self writeFrameData:frameData];
 }
 
 - (void) sendFrame:(NSString *) command {
 	[self sendFrame:command withHeader:nil andBody:nil];
 }
 
+- (void) writeFrameData:(NSData *)data {
+	uint64_t traceStart = PyGoWaveTraceBegin();
+	if(captureFile != nil) {
+		[self captureFrameData:data direction:'>'];
+	}
+	[[self socket] writeData:data withTimeout:kDefaultTimeout tag:123];
+	PyGoWaveTraceEnd("stomp.write", traceStart, [data length]);
+}
+
+- (void) captureFrameData:(NSData *)data direction:(char)direction {
+	if(direction == '>') {
+		data = [self redactedFrameData:data];
+	}
+	NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+	uint32_t length = NSSwapHostIntToLittle((uint32_t)[data length]);
+	@synchronized(self) {
+		if(captureFile == nil) {
+			return;
+		}
+		NSSwappedDouble offset = NSSwapHostDoubleToLittle(now - captureStart);
+		[captureBuffer appendBytes:&direction length:1];
+		[captureBuffer appendBytes:&offset length:8];
+		[captureBuffer appendBytes:&length length:4];
+		[captureBuffer appendData:data];
+		// Written in large chunks instead of once per frame on the socket thread
+		if([captureBuffer length] >= kCaptureBufferSize || now - captureFlushed >= kCaptureFlushInterval) {
+			[self flushCapture];
+			captureFlushed = now;
+		}
+	}
+}
+
+// Called with the capture locked
+- (void) flushCapture {
+	if([captureBuffer length] > 0) {
+		[captureFile writeData:captureBuffer];
+		[captureBuffer setLength:0];
+	}
+}
+
+- (NSData *) redactedFrameData:(NSData *)data {
+	static const char connect[] = "CONNECT\n";
+	BOOL isConnect = [data length] >= sizeof(connect) - 1 && memcmp([data bytes], connect, sizeof(connect) - 1) == 0;
+	NSArray *redactions = [self captureRedactions];
+	if(!isConnect && [redactions count] == 0) {
+		return data;
+	}
+	NSMutableString *frame = [[[NSMutableString alloc] initWithData:data encoding:NSUTF8StringEncoding] autorelease];
+	if(frame == nil) {
+		return data;
+	}
+	if(isConnect) {
+		if([login length] > 0) {
+			[frame replaceOccurrencesOfString:[NSString stringWithFormat:@"\nlogin:%@\n", login] withString:@"\nlogin:***\n" options:0 range:NSMakeRange(0, [frame length])];
+		}
+		if([passcode length] > 0) {
+			[frame replaceOccurrencesOfString:[NSString stringWithFormat:@"\npasscode:%@\n", passcode] withString:@"\npasscode:***\n" options:0 range:NSMakeRange(0, [frame length])];
+		}
+	}
+	for(NSString *secret in redactions) {
+		if([secret length] > 0) {
+			[frame replaceOccurrencesOfString:secret withString:@"***" options:0 range:NSMakeRange(0, [frame length])];
+		}
+	}
+	return [frame dataUsingEncoding:NSUTF8StringEncoding];
+}
+
 - (void)receiveFrame:(NSString *)command headers:(NSDictionary *)headers body:(NSString *)body {
 	//NSLog(@"receiveCommand '%@' [%@], @%", command, headers, body);
 	
@@ -234,44 +366,90 @@
 	}
 }
 
+- (void)receiveFrameOnSocketThread:(NSArray *)frame {
+	[self receiveFrame:[frame objectAtIndex:0] headers:[frame objectAtIndex:1] body:[frame objectAtIndex:2]];
+}
+
 - (void)readFrame {
 	[[self socket] readDataToData:[AsyncSocket ZeroData] withTimeout:-1 tag:0];
 }
 
-#pragma mark -
-#pragma mark AsyncSocketDelegate
-
-- (void)onSocket:(AsyncSocket *)sock didReadData:(NSData*)data withTag:(long)tag {
-	NSData *strData = [data subdataWithRange:NSMakeRange(0, [data length])];
-	NSString *msg = [[NSString alloc] initWithData:strData encoding:NSUTF8StringEncoding];
-    NSMutableArray *contents = (NSMutableArray *)[msg componentsSeparatedByString:@"\n"];
-	if([[contents objectAtIndex:0] isEqual:@""]) {
-		[contents removeObjectAtIndex:0];
+- (void)parseFrameData:(NSData *)data {
+	// Frames are parsed in their own pool, so a burst does not pile up until the run loop drains
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	uint64_t traceStart = PyGoWaveTraceBegin();
+	// Scans the bytes in place; only the command, the header fields and the body become strings
+	const char *bytes = [data bytes];
+	NSUInteger length = [data length];
+	while(length > 0 && bytes[length - 1] == '\0') {
+		length--;
+	}
+	NSUInteger pos = 0;
+	if(pos < length && bytes[pos] == '\n') {
+		pos++;
 	}
-	NSString *command = [[[contents objectAtIndex:0] copy] autorelease];
-	NSMutableDictionary *headers = [[[NSMutableDictionary alloc] init] autorelease];
-	NSMutableString *body = [[[NSMutableString alloc] init] autorelease];
+	NSString *command = nil;
+	NSMutableDictionary *headers = [NSMutableDictionary dictionary];
 	BOOL hasHeaders = NO;
-    [contents removeObjectAtIndex:0];
-	for(NSString *line in contents) {
-		if(hasHeaders) {
-			[body appendString:line];
+	while(pos < length && !hasHeaders) {
+		const char *lineEnd = memchr(bytes + pos, '\n', length - pos);
+		NSUInteger end = lineEnd != NULL ? (NSUInteger)(lineEnd - bytes) : length;
+		if(command == nil) {
+			command = [[[NSString alloc] initWithBytes:bytes + pos length:end - pos encoding:NSUTF8StringEncoding] autorelease];
+		} else if(end == pos) {
+			hasHeaders = YES;
 		} else {
-			if ([line isEqual:@""]) {
-				hasHeaders = YES;
-			} else {
-				// message-id can look like this: message-id:ID:macbook-pro.local-50389-1237007652070-5:6:-1:1:1
-				NSMutableArray *parts = [NSMutableArray arrayWithArray:[line componentsSeparatedByString:@":"]];
-				// key ist the first part
-				NSString *key = [parts objectAtIndex:0];
-				[parts removeObjectAtIndex:0];
-				[headers setObject:[parts componentsJoinedByString:@":"] forKey:key];
+			// message-id can look like this: message-id:ID:macbook-pro.local-50389-1237007652070-5:6:-1:1:1
+			// so only the first colon separates key and value
+			const char *colon = memchr(bytes + pos, ':', end - pos);
+			NSUInteger keyEnd = colon != NULL ? (NSUInteger)(colon - bytes) : end;
+			NSString *key = [[NSString alloc] initWithBytes:bytes + pos length:keyEnd - pos encoding:NSUTF8StringEncoding];
+			NSString *value = colon != NULL ? [[NSString alloc] initWithBytes:colon + 1 length:end - keyEnd - 1 encoding:NSUTF8StringEncoding] : [@"" retain];
+			if(key != nil && value != nil) {
+				[headers setObject:value forKey:key];
 			}
+			[key release];
+			[value release];
 		}
+		pos = end + 1;
+	}
+	if(command == nil) {
+		command = @"";
+	}
+	NSString *body = nil;
+	if(pos < length) {
+		body = [[[NSString alloc] initWithBytes:bytes + pos length:length - pos encoding:NSUTF8StringEncoding] autorelease];
+	}
+	if(body == nil) {
+		body = @"";
+	}
+	PyGoWaveTraceEnd("stomp.parseFrame", traceStart, [data length]);
+	if([NSThread currentThread] != socketThread && ![kResponseFrameMessage isEqual:command]) {
+		[self performSelector:@selector(receiveFrameOnSocketThread:)
+					 onThread:socketThread
+				   withObject:[NSArray arrayWithObjects:command, headers, body, nil]
+				waitUntilDone:NO];
+	} else {
+		[self receiveFrame:command headers:headers body:body];
+	}
+	[pool release];
+}
+
+#pragma mark -
+#pragma mark AsyncSocketDelegate
+
+- (void)onSocket:(AsyncSocket *)sock didReadData:(NSData*)data withTag:(long)tag {
+	uint64_t traceStart = PyGoWaveTraceBegin();
+	if(captureFile != nil) {
+		[self captureFrameData:data direction:'<'];
+	}
+	if(frameThread != nil && frameThread != [NSThread currentThread]) {
+		[self performSelector:@selector(parseFrameData:) onThread:frameThread withObject:data waitUntilDone:NO];
+	} else {
+		[self parseFrameData:data];
 	}
-	[msg release];
-	[self receiveFrame:command headers:headers body:body];
 	[self readFrame];
+	PyGoWaveTraceEnd("stomp.read", traceStart, [data length]);
 }
 
 - (void)onSocket:(AsyncSocket *)sock didConnectToHost:(NSString *)host port:(UInt16)port {
@@ -297,10 +475,15 @@
 -(void) dealloc {
 	delegate = nil;
 	
+	[self stopCapture];
+	
+	CRV_RELEASE_SAFELY(captureRedactions);
 	CRV_RELEASE_SAFELY(passcode);
 	CRV_RELEASE_SAFELY(login);
 	CRV_RELEASE_SAFELY(host);
 	CRV_RELEASE_SAFELY(socket);
+	CRV_RELEASE_SAFELY(frameThread);
+	CRV_RELEASE_SAFELY(socketThread);
 
 	[super dealloc];
 }